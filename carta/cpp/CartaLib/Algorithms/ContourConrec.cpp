@@ -8,34 +8,21 @@
 #include "LineCombiner.h"
 #include <cmath>
 #include <QString>
+#include <algorithm>
 #include <QDebug>
 
 using namespace Carta::Lib::Algorithms;
 typedef std::vector < double > VD;
 
-const double kernel_gaussian3[9] =
-{ 0.02479795, 0.10787775, 0.02479795,
-  0.10787775, 0.46929721, 0.10787775,
-  0.02479795, 0.10787775, 0.02479795};
-
-const double kernel_gaussian5[25] =
-{ 0.00178843, 0.01031068, 0.01809162, 0.01031068, 0.00178843,
-  0.01031068, 0.05944323, 0.10430201, 0.05944323, 0.01031068,
-  0.01809162, 0.10430201, 0.18301345, 0.10430201, 0.01809162,
-  0.01031068, 0.05944323, 0.10430201, 0.05944323, 0.01031068,
-  0.00178843, 0.01031068, 0.01809162, 0.01031068, 0.00178843};
-
-const double kernel_box3[9] =
-{ 1.0/9.0, 1.0/9.0, 1.0/9.0,
-  1.0/9.0, 1.0/9.0, 1.0/9.0,
-  1.0/9.0, 1.0/9.0, 1.0/9.0};
-
-const double kernel_box5[25] =
-{ 1.0/25.0, 1.0/25.0, 1.0/25.0, 1.0/25.0, 1.0/25.0,
-  1.0/25.0, 1.0/25.0, 1.0/25.0, 1.0/25.0, 1.0/25.0,
-  1.0/25.0, 1.0/25.0, 1.0/25.0, 1.0/25.0, 1.0/25.0,
-  1.0/25.0, 1.0/25.0, 1.0/25.0, 1.0/25.0, 1.0/25.0,
-  1.0/25.0, 1.0/25.0, 1.0/25.0, 1.0/25.0, 1.0/25.0};
+// the smoothing kernels are separable, these are the 1D factors; the 2D kernels
+// (e.g. 0.46929721 in the middle of the 3x3 gaussian) are their outer products
+const double kernel_gaussian3[3] = { 0.15747365, 0.68505271, 0.15747365 };
+
+const double kernel_gaussian5[5] = { 0.04228983, 0.24380981, 0.42780071, 0.24380981, 0.04228983 };
+
+const double kernel_box3[3] = { 1.0/3.0, 1.0/3.0, 1.0/3.0 };
+
+const double kernel_box5[5] = { 1.0/5.0, 1.0/5.0, 1.0/5.0, 1.0/5.0, 1.0/5.0 };
 
 /*
  * The code below is modified version of Paul Bourke's algorithm:
@@ -85,19 +72,35 @@ conrecFaster( Carta::Lib::NdArray::RawViewInterface * view, int ilb, int iub, in
             break;
     }
 
-    // we will only need two rows in memory at any given time
+    // we will only need two rows in memory at any given time, and the 2*ghost+1 rows
+    // of input they are filtered from
     // int nRows = jub - jlb + 1;
     int nCols = iub - ilb - (2*ghost) + 1;
     int prepareCols = iub - ilb + 1;
     int prepareRows = 2*ghost + 1;
-    int area = prepareCols*prepareRows;
     double * rows[2] { nullptr, nullptr };
-    std::vector < double > row1( nCols ), row2( nCols ),
-                           prepareArea( area );
+    std::vector < double > row1( nCols ), row2( nCols ), inputRow( prepareCols ),
+                           prepareArea( prepareCols*prepareRows );
     rows[0] = & row1[0];
     rows[1] = & row2[0];
+
+    // input rows filtered along x, oldest first; the filter along y then only needs to
+    // rotate the pointers when a new row comes in
+    std::vector < double * > filteredRows( prepareRows );
+    for ( int r = 0; r < prepareRows; r++ ) {
+        filteredRows[r] = & prepareArea[r*prepareCols];
+    }
     int nextRowToReadIn = 0;
-    int nextFilterStart = 0;
+
+    auto filterRow = [&]( double * out ) -> void {
+        std::fill( out, out + nCols, 0.0 );
+        for ( int k = 0; k < prepareRows; k++ ) {
+            const double * in = & inputRow[k];
+            for ( int i = 0; i < nCols; i++ ) {
+                out[i] += kernel[k]*in[i];
+            }
+        }
+    };
 
     auto updateRows = [&]() -> void {
         CARTA_ASSERT( nextRowToReadIn < view-> dims()[1] );
@@ -110,34 +113,45 @@ conrecFaster( Carta::Lib::NdArray::RawViewInterface * view, int ilb, int iub, in
         // make a double view of this raw row view
         Carta::Lib::NdArray::Double dview( rawRowView, true );
 
-        // shift the row up
-        // note: we could avoid this memory copy if we swapped row[] pointers instead,
-        // and alternately read in the data into row1,row2..., for a miniscule performance
-        // gain and lot more complicated algorithm
-        row1 = row2;
-
-        // Prepare Data for possible filter
-        int t = nextRowToReadIn*prepareCols;
-        dview.forEach( [&] ( const double & val ) {
-            // To improve the performance, the prepareArea also update only one row
-            // by computing the module
-            prepareArea[(t++)%area] = val;
+        // the oldest filtered row is not needed any more
+        std::rotate( filteredRows.begin(), filteredRows.begin() + update, filteredRows.end() );
+
+        // filter along x every row as it is complete
+        int filled = 0, row = prepareRows - update;
+        bool converted = dview.forEachChunk( [&] ( const double * vals, int64_t count ) {
+            while ( count > 0 ) {
+                int n = std::min < int64_t > ( count, prepareCols - filled );
+                std::copy( vals, vals + n, & inputRow[filled] );
+                vals += n;
+                count -= n;
+                filled += n;
+                if ( filled == prepareCols ) {
+                    filterRow( filteredRows[row++] );
+                    filled = 0;
+                }
+            }
         });
 
-        // Do the filter
-        for ( int i=0; i<nCols; i++){
-            row2[i] = 0;
-            int elems = (2*ghost+1)*(2*ghost+1);
-            for ( int e=0; e<elems; e++){
-                int row = e/(2*ghost+1) + nextFilterStart;
-                int col = e%(2*ghost+1);
-                int index = (row*prepareCols + col + i) % area;
-                row2[i] += kernel[e]*prepareArea[index];
+        // rows that could not be read have no contours
+        if ( ! converted ) {
+            qWarning() << "Unsupported pixel type, no contours for rows" << nextRowToReadIn
+                       << "to" << nextRowToReadIn + update - 1;
+            for ( ; row < prepareRows; row++ ) {
+                std::fill( filteredRows[row], filteredRows[row] + nCols, NAN );
+            }
+        }
+
+        // and along y: the new row, the previous one moves up
+        std::swap( rows[0], rows[1] );
+        std::fill( rows[1], rows[1] + nCols, 0.0 );
+        for ( int k = 0; k < prepareRows; k++ ) {
+            const double * in = filteredRows[k];
+            for ( int i = 0; i < nCols; i++ ) {
+                rows[1][i] += kernel[k]*in[i];
             }
         }
 
         nextRowToReadIn += update;
-        nextFilterStart ++;
     };
     updateRows();
 
@@ -5,7 +5,7 @@
 #include "LineCombiner.h"
 #include "CartaLib/CartaLib.h"
 
-#include <QLinkedList>
+#include <algorithm>
 
 #ifdef qDebug
 #undef qDebug
@@ -25,20 +25,11 @@ LineCombiner::LineCombiner( const QRectF & rect, int rows, int cols, double thre
     m_nCols = cols;
     m_thresholdSq = threshold * threshold;
 
-    Cell * rawPtr = new Cell[m_nRows * m_nCols];
-
-    m_grid.resize( m_nRows );
-    for ( int row = 0 ; row < m_nRows ; ++row ) {
-        m_grid[row] = rawPtr + row * m_nCols;
-    }
+    m_grid.resize( m_nRows * m_nCols );
 }
 
 LineCombiner::~LineCombiner()
-{
-    if ( m_grid.size() > 0 ) {
-        delete[] m_grid[0];
-    }
-}
+{ }
 
 //void LineCombiner::setColsRows(int cols, int rows)
 //{
@@ -62,100 +53,85 @@ LineCombiner::add( QPointF p1, QPointF p2 )
 
     qDebug() << "add" << p1 << p2;
 
-    // find closest points within the threshold distance of p1 and p2
-    IndexPt * ip1 = _findClosestPt( p1 );
-    IndexPt * ip2 = _findClosestPt( p2 );
+    // find closest points within the threshold distance of p1 and p2; these are
+    // copies, the cells they come from may reorder when points are removed
+    IndexPt ip1( - 1, false ), ip2( - 1, false );
+    bool found1 = _findClosestPt( p1, ip1 );
+    bool found2 = _findClosestPt( p2, ip2 );
 
     // normalize the cases
-    if ( ! ip1 ) {
+    if ( ! found1 ) {
         std::swap( ip1, ip2 );
+        std::swap( found1, found2 );
         std::swap( p1, p2 );
     }
 
-    if ( ip1 ) {
-        CARTA_ASSERT( ip1-> poly );
-    }
-    if ( ip2 ) {
-        CARTA_ASSERT( ip2-> poly );
-    }
-
     // case1: this line segment is not near anything else
-    if ( ip1 == nullptr && ip2 == nullptr ) {
+    if ( ! found1 && ! found2 ) {
         qDebug() << "case null null";
 
         // we insert a new polyline and update spacial index
 
         // make a new polyline from p1 and p2
-        Poly * poly = new Poly;
-        poly->append( p1 );
-        poly->append( p2 );
+        int poly = newPoly();
+        m_polys[poly].append( p1 );
+        m_polys[poly].append( p2 );
 
         // insert beginning of this polyline into grid
-        findCell( p1 )-> pts.append( IndexPt( poly, false ) );
+        findCell( p1 )-> pts.push_back( IndexPt( poly, false ) );
 
         // insert end of this polyine into grid
-        findCell( p2 )-> pts.append( IndexPt( poly, true ) );
-
-        IndexPt ipt1( poly, true );
-        CARTA_ASSERT( findCell( ipt1.pt() )->pts.contains( ipt1 ) );
+        findCell( p2 )-> pts.push_back( IndexPt( poly, true ) );
 
         return;
     }
 
     // catch a super-special case.... both points point to the same polyline, same end...
     // we'll treat this as if only one of the points pointed to a polyline)
-    if( ip2 && ip1->poly == ip2->poly && ip1->flipped == ip2->flipped) {
+    if( found2 && ip1 == ip2 ) {
         qDebug() << "super special";
-        ip2 = nullptr;
+        found2 = false;
     }
 
     // only one point has a match (ip1, ip2 is null)
-    if ( ip1 != nullptr && ip2 == nullptr ) {
+    if ( ! found2 ) {
         qDebug() << "case poly null";
 
-        // make a copy of what ip1 points to, because it'll be destroyed
-        IndexPt ip1copy = * ip1;
-
-        // remove ip1 from it's corresponding cell (after this ip1 will point to
-        // a destroyed memory!)
-        ok = findCell( ip1-> pt() )-> pts.removeOne( * ip1 );
+        // remove ip1 from it's corresponding cell
+        ok = findCell( pt( ip1 ) )-> removeOne( ip1 );
         CARTA_ASSERT( ok );
 
-        // re-point ip1 to the copy
-        ip1 = & ip1copy;
-
         // we extend the polyline that ip1 points to with p2
-        if ( ip1-> flipped ) {
-            ip1-> poly-> append( p2 );
+        if ( ip1.flipped ) {
+            m_polys[ip1.poly].append( p2 );
         }
         else {
-            ip1-> poly-> prepend( p2 );
+            m_polys[ip1.poly].prepend( p2 );
         }
 
         // and add a new index point (for p2) to the respective cell
-        findCell( p2 )-> pts.append( * ip1 );
+        findCell( p2 )-> pts.push_back( ip1 );
         return;
     }
 
     // both points have a match, and it's the same polyline, but different ends...
-    if ( ip1-> poly == ip2-> poly ) {
+    if ( ip1.poly == ip2.poly ) {
         qDebug() << "case poly poly same";
 
-        CARTA_ASSERT( ip1->flipped == ! ip2->flipped );
+        CARTA_ASSERT( ip1.flipped == ! ip2.flipped );
 
         // we need to remove both points from their cells
-        Poly * poly = ip1->poly;
-        ok = findCell( ip1->pt() )->pts.removeOne( * ip1 );
+        ok = findCell( pt( ip1 ) )->removeOne( ip1 );
         CARTA_ASSERT( ok );
-        ok = findCell( ip2->pt() )->pts.removeOne( * ip2 );
+        ok = findCell( pt( ip2 ) )->removeOne( ip2 );
         CARTA_ASSERT( ok );
 
         // make it a closed polyline
-        poly->append( poly->first() );
+        Poly & poly = m_polys[ip1.poly];
+        poly.append( poly.first() );
 
-        QPolygonF polygon = poly2polygon( poly );
-        m_polygons.push_back( polygon );
-        delete poly;
+        m_polygons.push_back( poly2polygon( ip1.poly ) );
+        deletePoly( ip1.poly );
 
         return;
     }
@@ -163,66 +139,57 @@ LineCombiner::add( QPointF p1, QPointF p2 )
     // last case is: both points have a match to 2 different polylines
     qDebug() << "case poly poly diff";
 
-    // we need to merge these two polylines together
-    IndexPt ip1c = * ip1;
-    IndexPt ip2c = * ip2;
-
-    // remove first polyline from the spatial index
-    ok = findCell( ip1c.poly->front() )-> pts.removeAll( { ip1c.poly, false }
-                                                         );
+    // we need to merge these two polylines together, so both come out of the
+    // spatial index
+    ok = findCell( m_polys[ip1.poly].first() )-> removeOne( IndexPt( ip1.poly, false ) );
     CARTA_ASSERT( ok );
-    ok = findCell( ip1c.poly->back() )-> pts.removeAll( { ip1c.poly, true }
-                                                        );
+    ok = findCell( m_polys[ip1.poly].last() )-> removeOne( IndexPt( ip1.poly, true ) );
     CARTA_ASSERT( ok );
-
-    // remove second polyline from the spatial index
-    ok = findCell( ip2c.poly->front() )-> pts.removeAll( { ip2c.poly, false }
-                                                         );
+    ok = findCell( m_polys[ip2.poly].first() )-> removeOne( IndexPt( ip2.poly, false ) );
     CARTA_ASSERT( ok );
-    ok = findCell( ip2c.poly->back() )-> pts.removeAll( { ip2c.poly, true }
-                                                        );
+    ok = findCell( m_polys[ip2.poly].last() )-> removeOne( IndexPt( ip2.poly, true ) );
     CARTA_ASSERT( ok ); Q_UNUSED(ok);
 
     // we need to handle 4 cases for merging... in any case, we'll be re-using poly1 and
     // appending/prepending to it all elements from poly2
+    Poly & poly1 = m_polys[ip1.poly];
+    const Poly & poly2 = m_polys[ip2.poly];
+    // appending goes to the tail of poly1 and prepending to its head, either way
+    // one push_back per point
+    auto merge = [&] ( bool reversed, std::vector < QPointF > & dst ) {
+        if ( ! reversed ) {
+            dst.insert( dst.end(), poly2.head.rbegin(), poly2.head.rend() );
+            dst.insert( dst.end(), poly2.tail.begin(), poly2.tail.end() );
+        }
+        else {
+            dst.insert( dst.end(), poly2.tail.rbegin(), poly2.tail.rend() );
+            dst.insert( dst.end(), poly2.head.begin(), poly2.head.end() );
+        }
+    };
     // case1: append poly2 to the end of poly1, in forward order
-    if ( ip1c.flipped && ! ip2c.flipped ) {
+    if ( ip1.flipped && ! ip2.flipped ) {
         qDebug() << "subcase1 - append forward";
-        for ( auto & pt : * ip2c.poly ) {
-            ip1c.poly->append( pt );
-        }
+        merge( false, poly1.tail );
     }
-    else if ( ip1c.flipped && ip2c.flipped ) {
+    else if ( ip1.flipped && ip2.flipped ) {
         qDebug() << "subcase2 - append reverse";
-        QLinkedListIterator < QPointF > i( * ip2c.poly );
-        i.toBack();
-        while ( i.hasPrevious() ) {
-            ip1c.poly-> append( i.previous() );
-        }
+        merge( true, poly1.tail );
     }
-    else if ( ! ip1c.flipped && ! ip2c.flipped ) {
+    else if ( ! ip1.flipped && ! ip2.flipped ) {
         qDebug() << "subase3 - prepend forward";
-        for ( auto & pt : * ip2c.poly ) {
-            ip1c.poly->prepend( pt );
-        }
+        merge( false, poly1.head );
     }
     else {
         qDebug() << "subase4 - prepend reverse";
-        QLinkedListIterator < QPointF > i( * ip2c.poly );
-        i.toBack();
-        while ( i.hasPrevious() ) {
-            ip1c.poly-> prepend( i.previous() );
-        }
+        merge( true, poly1.head );
     }
 
     // get rid of poly2
-    delete ip2c.poly;
+    deletePoly( ip2.poly );
 
     // re-insert the endpoints of poly1 into spatial index
-    ip1c = IndexPt( ip1c.poly, false );
-    ip2c = IndexPt( ip1c.poly, true );
-    findCell( ip1c.poly->first() )->pts.append( ip1c );
-    findCell( ip1c.poly->last() )->pts.append( ip2c );
+    findCell( poly1.first() )->pts.push_back( IndexPt( ip1.poly, false ) );
+    findCell( poly1.last() )->pts.push_back( IndexPt( ip1.poly, true ) );
 } // add
 
 std::vector < QPolygonF >
@@ -238,16 +205,12 @@ LineCombiner::getPolygons()
                     continue;
                 }
 
-                // convert the polyline to QPolygonF
-                QPolygonF pf = poly2polygon( ipt.poly );
+                // convert the polyline to QPolygonF and add it to our list
+                m_polygons.push_back( poly2polygon( ipt.poly ) );
 
                 // delete the polyline
                 qDebug() << "Deleting poly" << ipt.poly;
-
-                delete ipt.poly;
-
-                // add the new polygon to our list
-                m_polygons.push_back( pf );
+                deletePoly( ipt.poly );
             }
             cell( row, col ).pts.clear();
         }
@@ -293,21 +256,59 @@ LineCombiner::cell( int row, int col )
     CARTA_ASSERT( row < m_nRows );
     CARTA_ASSERT( col < m_nCols );
     CARTA_ASSERT( m_grid.size() > 0 );
-    return m_grid[row][col];
+    return m_grid[row * m_nCols + col];
+}
+
+bool
+LineCombiner::Cell::removeOne( const IndexPt & ipt )
+{
+    auto it = std::find( pts.begin(), pts.end(), ipt );
+    if ( it == pts.end() ) {
+        return false;
+    }
+    * it = pts.back();
+    pts.pop_back();
+    return true;
+}
+
+int
+LineCombiner::newPoly()
+{
+    if ( m_freePolys.empty() ) {
+        m_polys.emplace_back();
+        return m_polys.size() - 1;
+    }
+    int poly = m_freePolys.back();
+    m_freePolys.pop_back();
+    return poly;
+}
+
+void
+LineCombiner::deletePoly( int poly )
+{
+    // keep the memory, the next polyline will likely need it
+    m_polys[poly].head.clear();
+    m_polys[poly].tail.clear();
+    m_freePolys.push_back( poly );
 }
 
 QPolygonF
-LineCombiner::poly2polygon( LineCombiner::Poly * poly )
+LineCombiner::poly2polygon( int poly )
 {
+    const Poly & p = m_polys[poly];
     QPolygonF pf;
-    for ( QPointF & pt : * poly ) {
+    pf.reserve( p.head.size() + p.tail.size() );
+    for ( auto it = p.head.rbegin() ; it != p.head.rend() ; ++it ) {
+        pf.append( * it );
+    }
+    for ( const QPointF & pt : p.tail ) {
         pf.append( pt );
     }
     return pf;
 }
 
-LineCombiner::IndexPt *
-LineCombiner::_findClosestPt( const QPointF & p )
+bool
+LineCombiner::_findClosestPt( const QPointF & p, IndexPt & result )
 {
     // find the row/column of the grid cell containing this point
     int row, col;
@@ -315,7 +316,6 @@ LineCombiner::_findClosestPt( const QPointF & p )
 
     // we'll be searching 3x3 cells around row/col
     double bestDist = - 1.0;
-    IndexPt * result = nullptr;
     for ( int r = row - 1 ; r <= row + 1 ; ++r ) {
         if ( r < 0 || r >= m_nRows ) {
             continue;
@@ -325,20 +325,20 @@ LineCombiner::_findClosestPt( const QPointF & p )
                 continue;
             }
             Cell & cell = this-> cell( r, c );
-            for ( auto & ipt : cell.pts ) {
-                QPointF & pt = ipt.pt();
-                double dx = pt.x() - p.x();
-                double dy = pt.y() - p.y();
+            for ( const IndexPt & ipt : cell.pts ) {
+                const QPointF & q = pt( ipt );
+                double dx = q.x() - p.x();
+                double dy = q.y() - p.y();
                 double dsq = dx * dx + dy * dy;
                 if ( dsq < m_thresholdSq && ( dsq < bestDist || bestDist < 0 ) ) {
                     bestDist = dsq;
-                    result = & ipt;
+                    result = ipt;
                 }
             }
         }
     }
 
-    return result;
+    return bestDist >= 0;
 } // _findClosestPt
 }
 }
@@ -6,7 +6,6 @@
 
 class QRectF;
 class QPointF;
-#include <QLinkedList>
 #include <QPolygonF>
 #include <vector>
 namespace Carta
@@ -48,32 +47,46 @@ public:
 
 private:
 
-    typedef QLinkedList < QPointF > Poly;
+    /// a polyline; it can grow at both ends, so the points are kept in two stacks
+    /// growing away from each other: head in reverse order, then tail
+    struct Poly {
+        std::vector < QPointF > head, tail;
 
-    struct IndexPt {
-        Poly * poly = nullptr;
-        bool flipped = false;
+        QPointF &
+        first()
+        {
+            return head.empty() ? tail.front() : head.back();
+        }
 
         QPointF &
-        pt()
+        last()
         {
-            if ( flipped ) {
-                return poly-> last();
-            }
-            else {
-                return poly-> first();
-            }
+            return tail.empty() ? head.front() : tail.back();
         }
 
-        IndexPt( Poly * p, bool f) { poly = p; flipped = f; }
-        bool operator ==( const IndexPt & pt) {
+        void append( const QPointF & pt ) { tail.push_back( pt ); }
+        void prepend( const QPointF & pt ) { head.push_back( pt ); }
+    };
+
+    /// an end of a polyline, in the spatial index
+    struct IndexPt {
+        int poly = - 1;
+        bool flipped = false;
+
+        IndexPt( int p, bool f) { poly = p; flipped = f; }
+        bool operator ==( const IndexPt & pt) const {
             return pt.poly == poly && pt.flipped == flipped;
         }
     };
 
+    QPointF &
+    pt( const IndexPt & ipt )
+    {
+        return ipt.flipped ? m_polys[ipt.poly].last() : m_polys[ipt.poly].first();
+    }
 
-    IndexPt *
-    _findClosestPt( const QPointF & p );
+    bool
+    _findClosestPt( const QPointF & p, IndexPt & result );
 
     int m_nRows, m_nCols;
 
@@ -82,18 +95,29 @@ private:
     pt2rowcol( const QPointF & p, int & row, int & col );
 
     struct Cell {
-        QLinkedList < IndexPt > pts;
+        std::vector < IndexPt > pts;
+
+        /// removes one occurrence of ipt, the order of the others does not matter
+        bool removeOne( const IndexPt & ipt );
     };
-    std::vector< Cell * > m_grid;
+    std::vector< Cell > m_grid; // row by row
     QRectF m_rect; // bounding rect
 
+    /// the polylines being built, referred to by their index; the ones that are done
+    /// are cleared and their index goes to m_freePolys, for the next new one
+    std::vector < Poly > m_polys;
+    std::vector < int > m_freePolys;
+
     std::vector<QPolygonF> m_polygons;
 
     Cell * findCell( const QPointF & pt);
 
     Cell & cell( int row, int col);
 
-    static QPolygonF poly2polygon( Poly * poly);
+    int newPoly();
+    void deletePoly( int poly );
+
+    QPolygonF poly2polygon( int poly);
 };
 }
 }
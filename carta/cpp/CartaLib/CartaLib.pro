@@ -67,6 +67,7 @@ SOURCES += \
     IPlotLabelGenerator.cpp \
     Hooks/LoadAstroImage.cpp \
     PixelPipeline/CustomizablePixelPipeline.cpp \
+    PixelPipeline/LutPipeline.cpp \
     ProfileInfo.cpp \
     PWLinear.cpp \
     StatInfo.cpp \
@@ -125,6 +126,7 @@ HEADERS += \
     TPixelPipeline/IScalar2Scalar.h \
     PixelPipeline/IPixelPipeline.h \
     PixelPipeline/CustomizablePixelPipeline.h \
+    PixelPipeline/LutPipeline.h \
     ProfileInfo.h \
     PWLinear.h \
     StatInfo.h \
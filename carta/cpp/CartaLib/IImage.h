@@ -223,6 +223,51 @@ public:
         m_rawView->forEach( wrapper, traversal );
     }
 
+    /// faster alternative to forEach(), the function gets invoked with contiguous
+    /// arrays of converted values (in the same order forEach() would visit them),
+    /// so the per-pixel std::function and converter calls are avoided
+    /// \param func function to invoke on each chunk of elements
+    /// \param chunkSize max. number of elements passed to a single invocation of func
+    /// \param traversal order of traversal
+    /// \return false if the pixel type cannot be converted to Type, in which case
+    /// func is never called
+    bool
+    forEachChunk(
+        std::function < void (const Type *, int64_t count) > func,
+        int64_t chunkSize = DefaultChunkSize,
+        RawViewInterface::Traversal traversal = RawViewInterface::Traversal::Sequential )
+    {
+        auto srcType = m_rawView->pixelType();
+
+        // no conversion necessary, hand over the raw buffers directly
+        if ( srcType == Carta::Lib::Image::CType2PixelType < Type >::type ) {
+            auto wrapper = [& func] ( const char * ptr, int64_t count )->void
+            {
+                func( reinterpret_cast < const Type * > ( ptr ), count );
+            };
+            m_rawView->forEach( chunkSize * sizeof( Type ), wrapper, nullptr, traversal );
+            return true;
+        }
+
+        // the result only depends on the type, so find out before reading anything
+        if ( ! convertArray < Type > ( srcType, nullptr, 0, nullptr ) ) {
+            return false;
+        }
+
+        std::vector < Type > converted( chunkSize );
+        auto wrapper = [& func, & converted, srcType] ( const char * ptr, int64_t count )->void
+        {
+            convertArray < Type > ( srcType, ptr, count, converted.data() );
+            func( converted.data(), count );
+        };
+        m_rawView->forEach( chunkSize * Carta::Lib::Image::pixelType2size( srcType ),
+                            wrapper, nullptr, traversal );
+        return true;
+    }
+
+    /// default number of elements per chunk for forEachChunk()
+    static constexpr int64_t DefaultChunkSize = 64 * 1024;
+
     ~TypedView()
     {
         if ( m_keepOwnership ) {
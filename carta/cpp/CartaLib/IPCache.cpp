@@ -4,3 +4,45 @@
 
 #include "IPCache.h"
 
+namespace Carta
+{
+namespace Lib
+{
+void
+IPCache::setMaxStorage( uint64_t bytes )
+{
+    Q_UNUSED( bytes );
+}
+
+void
+IPCache::compact()
+{ }
+
+uint64_t
+IPCache::nEvictions()
+{
+    return 0;
+}
+
+int
+IPCache::readEntries( std::vector < Entry > & entries )
+{
+    int found = 0;
+    for ( Entry & entry : entries ) {
+        entry.found = readEntry( entry.key, entry.val, entry.error );
+        if ( entry.found ) {
+            found++;
+        }
+    }
+    return found;
+}
+
+void
+IPCache::setEntries( const std::vector < Entry > & entries )
+{
+    for ( const Entry & entry : entries ) {
+        setEntry( entry.key, entry.val, entry.error );
+    }
+}
+}
+}
@@ -7,6 +7,7 @@
 #include <QByteArray>
 #include <QString>
 #include <memory>
+#include <vector>
 
 namespace Carta
 {
@@ -22,14 +23,29 @@ public:
     virtual uint64_t
     maxStorage() = 0;
 
-    /// return used storage in bytes
+    /// return used storage in bytes (keys and values)
     virtual uint64_t
     usedStorage() = 0;
 
+    /// change the storage budget, evicting entries if it is exceeded
+    /// the default implementation ignores the budget
+    virtual void
+    setMaxStorage( uint64_t bytes );
+
+    /// give the space of deleted entries back to the file system
+    /// the default implementation does nothing
+    virtual void
+    compact();
+
     //// return number of entries
     virtual uint64_t
     nEntries() = 0;
 
+    /// return number of entries evicted to stay within the budget since the cache was opened
+    /// the default implementation never evicts and returns 0
+    virtual uint64_t
+    nEvictions();
+
     /// remove all entries
     virtual void
     deleteAll() = 0;
@@ -47,6 +63,28 @@ public:
               const QByteArray & val,
               const QByteArray & error ) = 0;
 
+    /// one entry of a batched read or write
+    struct Entry
+    {
+        QByteArray key;
+        QByteArray val;
+        QByteArray error;
+        /// set by readEntries()
+        bool found = false;
+    };
+
+    /// read several entries in one call, much cheaper than one readEntry() per key
+    /// sets val, error and found of every entry, only the keys need to be set on input
+    /// returns the number of entries found
+    /// the default implementation calls readEntry() for each of them
+    virtual int
+    readEntries( std::vector < Entry > & entries );
+
+    /// set several entries in one call (a single write batch or transaction)
+    /// the default implementation calls setEntry() for each of them
+    virtual void
+    setEntries( const std::vector < Entry > & entries );
+
     /// Release the shared_ptr before the program quits.
     /// There may be a better way to prevent the segementation fault
     /// comes from the ~SqLitePCache when CARTA shuts down.
@@ -1,9 +1,64 @@
 #include "IntensityCacheHelper.h"
-#include "CartaLib/Algorithms/cacheUtils.h"
+
+#include <QCryptographicHash>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QStringList>
+#include <algorithm>
+#include <cstring>
 
 namespace Carta {
 namespace Lib {
 
+namespace {
+/// distinguishes the binary intensity keys from the other entries of the cache
+const char INTENSITY_KEY_TAG[4] = { 'I', 'N', 'T', '1' };
+
+/// how much of the start and of the end of each file goes into the fingerprint
+const qint64 HASH_SAMPLE_BYTES = 64 * 1024;
+
+/// the number and size of the blocks spread evenly over the rest of each file
+const int HASH_BLOCK_COUNT = 64;
+const qint64 HASH_BLOCK_BYTES = 4 * 1024;
+
+/// lock files (e.g. table.lock of CASA images) are rewritten every time an image is opened,
+/// they are not part of its content
+bool _isLockFile(const QString& name) {
+    return name.endsWith(".lock");
+}
+
+void _hashFile(QCryptographicHash& hash, const QString& path, const QString& name) {
+    QFile file(path);
+    qint64 size = file.size();
+    hash.addData(name.toUtf8());
+    hash.addData(reinterpret_cast<const char*>(&size), sizeof(size));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    hash.addData(file.read(HASH_SAMPLE_BYTES));
+    if (size <= HASH_SAMPLE_BYTES) {
+        return;
+    }
+
+    // the headers and the first and last pixels are not enough to tell apart images that
+    // were written with the same shape, so blocks from the middle go in as well
+    qint64 middle = size - 2 * HASH_SAMPLE_BYTES;
+    if (middle > HASH_BLOCK_COUNT * HASH_BLOCK_BYTES) {
+        for (int i = 0; i < HASH_BLOCK_COUNT; i++) {
+            file.seek(HASH_SAMPLE_BYTES + middle / HASH_BLOCK_COUNT * i);
+            hash.addData(file.read(HASH_BLOCK_BYTES));
+        }
+    } else if (middle > 0) {
+        file.seek(HASH_SAMPLE_BYTES);
+        hash.addData(file.read(middle));
+    }
+    file.seek(std::max(HASH_SAMPLE_BYTES, size - HASH_SAMPLE_BYTES));
+    hash.addData(file.read(HASH_SAMPLE_BYTES));
+}
+}
+
 IntensityValue::IntensityValue(double value, double error) : value(value), error(error) {
 }
 
@@ -11,24 +66,110 @@ IntensityCacheHelper::IntensityCacheHelper(std::shared_ptr<Carta::Lib::IPCache>
 }
 
 std::shared_ptr<IntensityValue> IntensityCacheHelper::get(QString fileName, int frameLow, int frameHigh, double percentile, int stokeFrame, QString transformationLabel) {
-    QString intensityKey = QString("%1/%2/%3/%4/%5/%6/intensity").arg(fileName).arg(frameLow).arg(frameHigh).arg(stokeFrame).arg(percentile).arg(transformationLabel);
-        
-    QByteArray intensityVal, intensityError;
-    bool intensityInCache = m_diskCache->readEntry(intensityKey.toUtf8(), intensityVal, intensityError);
+    return get(fileName, frameLow, frameHigh, std::vector<double>({percentile}), stokeFrame, transformationLabel)[0];
+}
+
+std::vector<std::shared_ptr<IntensityValue> > IntensityCacheHelper::get(QString fileName, int frameLow, int frameHigh, const std::vector<double>& percentiles, int stokeFrame, QString transformationLabel) {
+    std::vector<std::shared_ptr<IntensityValue> > result(percentiles.size());
+    if (percentiles.empty()) {
+        return result;
+    }
     
-    if (intensityInCache) {
-        double value = qb2d(intensityVal);
-        double error = qb2d(intensityError);
-        return std::make_shared<IntensityValue>(value, error);
+    QByteArray fileHash = _getFileHash(fileName);
+    std::vector<IPCache::Entry> entries(percentiles.size());
+    for (size_t i = 0; i < percentiles.size(); i++) {
+        entries[i].key = _getKey(fileHash, frameLow, frameHigh, stokeFrame, percentiles[i], transformationLabel);
     }
     
-    return nullptr;
+    m_diskCache->readEntries(entries);
+    
+    // the value holds both the intensity and its error
+    double pair[2];
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].found && entries[i].val.size() == sizeof(pair)) {
+            memcpy(pair, entries[i].val.constData(), sizeof(pair));
+            result[i] = std::make_shared<IntensityValue>(pair[0], pair[1]);
+        }
+    }
+    
+    return result;
 }
 
 void IntensityCacheHelper::set(QString fileName, double intensity, double error, int frameLow, int frameHigh, double percentile, int stokeFrame, QString transformationLabel) {
-    QString intensityKey = QString("%1/%2/%3/%4/%5/%6/intensity").arg(fileName).arg(frameLow).arg(frameHigh).arg(stokeFrame).arg(percentile).arg(transformationLabel);
+    set(fileName, std::map<double, double>({{percentile, intensity}}), error, frameLow, frameHigh, stokeFrame, transformationLabel);
+}
+
+void IntensityCacheHelper::set(QString fileName, const std::map<double, double>& intensities, double error, int frameLow, int frameHigh, int stokeFrame, QString transformationLabel) {
+    if (intensities.empty()) {
+        return;
+    }
+    
+    QByteArray fileHash = _getFileHash(fileName);
+    QByteArray errorBytes(reinterpret_cast<const char*>(&error), sizeof(error));
+    std::vector<IPCache::Entry> entries;
+    entries.reserve(intensities.size());
+    for (auto& intensity : intensities) {
+        double pair[2] = {intensity.second, error};
+        IPCache::Entry entry;
+        entry.key = _getKey(fileHash, frameLow, frameHigh, stokeFrame, intensity.first, transformationLabel);
+        entry.val = QByteArray(reinterpret_cast<const char*>(pair), sizeof(pair));
+        // the SQLite cache also keeps the error in its own column to pick the most accurate value
+        entry.error = errorBytes;
+        entries.push_back(entry);
+    }
     
-    m_diskCache->setEntry(intensityKey.toUtf8(), d2qb(intensity), d2qb(error));
+    m_diskCache->setEntries(entries);
+}
+
+QByteArray IntensityCacheHelper::fileHash(const QString& fileName) {
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    QFileInfo info(fileName);
+    if (info.isDir()) {
+        // e.g. CASA images: every file in the directory, in a fixed order
+        QStringList files;
+        QDirIterator iter(fileName, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+        while (iter.hasNext()) {
+            QString file = iter.next();
+            if (!_isLockFile(iter.fileName())) {
+                files.append(file);
+            }
+        }
+        files.sort();
+        QDir dir(fileName);
+        for (const QString& file : files) {
+            _hashFile(hash, file, dir.relativeFilePath(file));
+        }
+    } else {
+        _hashFile(hash, fileName, QString());
+    }
+    return hash.result();
+}
+
+QByteArray IntensityCacheHelper::_getFileHash(const QString& fileName) {
+    QFileInfo info(fileName);
+    QMutexLocker locker(&m_mutex);
+    auto iter = m_fileHashes.find(fileName);
+    if (iter != m_fileHashes.end() && iter->modified == info.lastModified() && iter->size == info.size()) {
+        return iter->hash;
+    }
+    FileHash entry;
+    entry.modified = info.lastModified();
+    entry.size = info.size();
+    entry.hash = fileHash(fileName);
+    m_fileHashes.insert(fileName, entry);
+    return entry.hash;
+}
+
+QByteArray IntensityCacheHelper::_getKey(const QByteArray& fileHash, int frameLow, int frameHigh, int stokeFrame, double percentile, const QString& transformationLabel) {
+    int32_t frames[3] = {frameLow, frameHigh, stokeFrame};
+    QByteArray key;
+    key.reserve(sizeof(INTENSITY_KEY_TAG) + fileHash.size() + sizeof(frames) + sizeof(percentile) + transformationLabel.size());
+    key.append(INTENSITY_KEY_TAG, sizeof(INTENSITY_KEY_TAG));
+    key.append(fileHash);
+    key.append(reinterpret_cast<const char*>(frames), sizeof(frames));
+    key.append(reinterpret_cast<const char*>(&percentile), sizeof(percentile));
+    key.append(transformationLabel.toUtf8());
+    return key;
 }
 
 }
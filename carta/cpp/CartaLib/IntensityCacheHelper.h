@@ -4,7 +4,12 @@
 
 #include "CartaLib/IPCache.h"
 
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
 #include <QString>
+#include <map>
+#include <vector>
 
 namespace Carta {
 namespace Lib {
@@ -23,10 +28,39 @@ public:
     /** Returns a pointer to a (value, error) pair if the value exists in the cache, or a null pointer */
     std::shared_ptr<IntensityValue> get(QString fileName, int frameLow, int frameHigh, double percentile, int stokeFrame, QString transformationLabel);
     
+    /** Looks up several percentiles in one cache call; returns a (value, error) pair or a null pointer for each of them */
+    std::vector<std::shared_ptr<IntensityValue> > get(QString fileName, int frameLow, int frameHigh, const std::vector<double>& percentiles, int stokeFrame, QString transformationLabel);
+    
     /** Sets the provided value and error for this intensity */
     void set(QString fileName, double intensity, double error, int frameLow, int frameHigh, double percentile, int stokeFrame, QString transformationLabel);
+    
+    /** Sets the intensities of several percentiles (percentile -> intensity), which share the same error, in one cache call */
+    void set(QString fileName, const std::map<double, double>& intensities, double error, int frameLow, int frameHigh, int stokeFrame, QString transformationLabel);
+    
+    /**
+     * Returns a 16 byte fingerprint of the content of an image file or directory, so that a copied
+     * or moved image keeps its cached values. Only the sizes, the first and last 64 kB and 64
+     * blocks of 4 kB spread over the rest of each file are hashed: hashing whole cubes would cost
+     * more than the values being cached. Lock files in a directory are left out.
+     */
+    static QByteArray fileHash(const QString& fileName);
+    
 private:
+    /** Returns the fingerprint of the file, hashing it only if it changed since the last call */
+    QByteArray _getFileHash(const QString& fileName);
+    
+    /** Builds the binary key of an intensity: tag, file hash, frames, stokes, percentile and label */
+    static QByteArray _getKey(const QByteArray& fileHash, int frameLow, int frameHigh, int stokeFrame, double percentile, const QString& transformationLabel);
+    
+    struct FileHash {
+        QDateTime modified;
+        qint64 size;
+        QByteArray hash;
+    };
+    
     std::shared_ptr<Carta::Lib::IPCache> m_diskCache;
+    QMutex m_mutex;
+    QHash<QString, FileHash> m_fileHashes;
 };
 
 }
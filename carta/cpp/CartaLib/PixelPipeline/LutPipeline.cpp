@@ -0,0 +1,78 @@
+/**
+ *
+ **/
+
+#include "LutPipeline.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Carta
+{
+namespace Lib
+{
+namespace PixelPipeline
+{
+constexpr int64_t LutPipeline::DefaultSize;
+
+void
+LutPipeline::cache( IPixelPipeline & funcToCache, int64_t nSegments, double min, double max,
+                    QRgb nanColor )
+{
+    CARTA_ASSERT( nSegments > 1 );
+    CARTA_ASSERT( min < max );
+    m_lut.resize( nSegments );
+    double delta = ( max - min ) / ( nSegments - 1 );
+    for ( int64_t i = 0 ; i < nSegments ; i++ ) {
+        funcToCache.convertq( min + i * delta, m_lut[i] );
+    }
+    m_nanColor = nanColor;
+    m_min = min;
+    m_scale = ( nSegments - 1 ) / ( max - min );
+    m_n1 = nSegments - 1;
+}
+
+void
+LutPipeline::convert( const float * in, int64_t count, QRgb * out ) const
+{
+    CARTA_ASSERT( ! m_lut.empty() );
+    const QRgb * lut = m_lut.data();
+    int64_t i = 0;
+#ifdef __SSE2__
+    // index = clamp( (x - min) * scale + 0.5, 0, n - 1 ), truncated; max() with the
+    // value first turns NaNs into 0, so the lookup stays in range, and the NaN
+    // color is blended in afterwards
+    const __m128 vmin = _mm_set1_ps( m_min );
+    const __m128 vscale = _mm_set1_ps( m_scale );
+    const __m128 vhalf = _mm_set1_ps( 0.5f );
+    const __m128 vzero = _mm_setzero_ps();
+    const __m128 vn1 = _mm_set1_ps( m_n1 );
+    const __m128i vnan = _mm_set1_epi32( m_nanColor );
+    alignas( 16 ) int32_t ind[4];
+    for ( ; i + 4 <= count ; i += 4 ) {
+        __m128 v = _mm_loadu_ps( in + i );
+        __m128 isNan = _mm_cmpunord_ps( v, v );
+        __m128 x = _mm_add_ps( _mm_mul_ps( _mm_sub_ps( v, vmin ), vscale ), vhalf );
+        x = _mm_min_ps( _mm_max_ps( x, vzero ), vn1 );
+        _mm_store_si128( reinterpret_cast < __m128i * > ( ind ), _mm_cvttps_epi32( x ) );
+        __m128i rgb = _mm_set_epi32( lut[ind[3]], lut[ind[2]], lut[ind[1]], lut[ind[0]] );
+        __m128i mask = _mm_castps_si128( isNan );
+        rgb = _mm_or_si128( _mm_and_si128( mask, vnan ), _mm_andnot_si128( mask, rgb ) );
+        _mm_storeu_si128( reinterpret_cast < __m128i * > ( out + i ), rgb );
+    }
+#endif
+    for ( ; i < count ; i++ ) {
+        float v = in[i];
+        if ( Q_UNLIKELY( std::isnan( v ) ) ) {
+            out[i] = m_nanColor;
+            continue;
+        }
+        float x = ( v - m_min ) * m_scale + 0.5f;
+        x = x > 0 ? ( x < m_n1 ? x : m_n1 ) : 0;
+        out[i] = lut[int32_t( x )];
+    }
+} // convert
+} // namespace PixelPipeline
+} // namespace Lib
+} // namespace Carta
@@ -0,0 +1,74 @@
+/**
+ *
+ **/
+
+#pragma once
+
+#include "IPixelPipeline.h"
+#include <vector>
+
+namespace Carta
+{
+namespace Lib
+{
+namespace PixelPipeline
+{
+/// table driven conversion of whole spans of pixels to QRgb
+///
+/// The pipeline is sampled once into a table of QRgb, so everything it does (scaling
+/// such as log or sqrt, gamma, the colormap, invert/reverse, rgb limits) is baked in.
+/// Converting a pixel is then a clamp, a scale and a lookup, with NaNs getting their
+/// own color, and there are no virtual calls or doubles in the loop.
+class LutPipeline
+{
+    CLASS_BOILERPLATE( LutPipeline );
+
+public:
+
+    /// number of entries used when no other size is asked for; with 8 bit output
+    /// this is indistinguishable from running the pipeline on every pixel
+    static constexpr int64_t DefaultSize = 64 * 1024;
+
+    LutPipeline() { }
+
+    /// \brief sample the supplied pipeline
+    /// \param funcToCache pipeline to sample, already prepped with min/max
+    /// \param nSegments number of entries of the table, at least 2
+    /// \param min value mapped to the first entry, and everything below it
+    /// \param max value mapped to the last entry, and everything above it
+    /// \param nanColor color of NaN pixels
+    void
+    cache( IPixelPipeline & funcToCache, int64_t nSegments, double min, double max,
+           QRgb nanColor );
+
+    /// converts count pixels, NaN or not
+    /// \param in the pixels
+    /// \param count number of pixels
+    /// \param out count colors, must not overlap in
+    void
+    convert( const float * in, int64_t count, QRgb * out ) const;
+
+    /// converts a single pixel, the same as convert() would
+    void
+    convertq( double x, QRgb & result ) const
+    {
+        float val = x;
+        convert( & val, 1, & result );
+    }
+
+    /// color of NaN pixels
+    QRgb
+    nanColor() const
+    {
+        return m_nanColor;
+    }
+
+private:
+
+    std::vector < QRgb > m_lut;
+    QRgb m_nanColor = 0;
+    float m_min = 0, m_scale = 1, m_n1 = 0;
+};
+} // namespace PixelPipeline
+} // namespace Lib
+} // namespace Carta
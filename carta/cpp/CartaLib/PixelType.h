@@ -176,6 +176,44 @@ typename Type2CvtFunc<DstType>::Type getConverter( Carta::Lib::Image::PixelType
     }
 }
 
+/// convert an array of pixels of one type to another type, this is the bulk
+/// version of TypedConverters::cvt, the loop gets vectorized by the compiler
+template <typename SrcType, typename DstType>
+inline void convertTypedArray( const char * src, int64_t count, DstType * dst)
+{
+    const SrcType * srcPtr = reinterpret_cast<const SrcType *>( src);
+    for( int64_t i = 0 ; i < count ; i ++ ) {
+        dst[i] = static_cast<DstType>( srcPtr[i]);
+    }
+}
+
+/// convert count pixels of type srcType stored in src to DstType
+/// \return false if srcType is not supported
+template < typename DstType>
+bool convertArray( Carta::Lib::Image::PixelType srcType, const char * src, int64_t count, DstType * dst)
+{
+    switch (srcType) {
+    case Image::PixelType::Byte:
+        convertTypedArray< uint8_t, DstType>( src, count, dst);
+        break;
+    case Image::PixelType::Int16:
+        convertTypedArray< int16_t, DstType>( src, count, dst);
+        break;
+    case Image::PixelType::Int32:
+        convertTypedArray< int32_t, DstType>( src, count, dst);
+        break;
+    case Image::PixelType::Real32:
+        convertTypedArray< float, DstType>( src, count, dst);
+        break;
+    case Image::PixelType::Real64:
+        convertTypedArray< double, DstType>( src, count, dst);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
 /// convenience function to convert a type to a string
 QString toStr( Image::PixelType t);
 
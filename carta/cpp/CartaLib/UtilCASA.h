@@ -6,7 +6,25 @@
 //class QMutex;
 //QT_END_NAMESPACE
 #include <qmutex.h>
+#include <QString>
+#include <atomic>
+#include <cstdint>
 
 extern QMutex casa_mutex;
 
+/// returns the (recursive) lock serializing pixel reads from one storage (casacore
+/// table, file, ...) identified by storageName; unlike casa_mutex, reads of
+/// different files do not block each other
+QMutex & casa_storage_mutex( const QString & storageName );
+
+/// process wide counters of how long pixel readers waited for casacore locks
+struct CasaLockStats
+{
+    std::atomic < uint64_t > acquisitions { 0 };
+    std::atomic < uint64_t > contended { 0 };
+    std::atomic < uint64_t > waitNanoSeconds { 0 };
+};
+
+extern CasaLockStats casa_lock_stats;
+
 #endif // GLOBALS_H
@@ -0,0 +1,67 @@
+#include "catch.h"
+#include "core/Algorithms/contourEncoding.h"
+#include <cmath>
+#include <random>
+
+using namespace Carta::Core::Algorithms;
+
+TEST_CASE( "Contour coordinate encoding", "[contour]" ) {
+
+    // a few random walks, like contour lines, plus a closed square
+    std::mt19937 gen( 7 );
+    std::normal_distribution < float > step( 0.0f, 0.7f );
+    std::vector < float > coordinates;
+    std::vector < int32_t > startIndices;
+    for ( int line = 0 ; line < 50 ; line++ ) {
+        startIndices.push_back( coordinates.size() );
+        float x = gen() % 4000, y = gen() % 4000;
+        for ( int i = 0 ; i < 100 + line ; i++ ) {
+            coordinates.push_back( x );
+            coordinates.push_back( y );
+            x += step( gen );
+            y += step( gen );
+        }
+    }
+    startIndices.push_back( coordinates.size() );
+    for ( float v : { 1.5f, 1.5f, 2.5f, 1.5f, 2.5f, 2.5f, 1.5f, 2.5f, 1.5f, 1.5f } ) {
+        coordinates.push_back( v );
+    }
+
+    const int decimation = 32;
+    for ( int compressionLevel : { 0, 1, 9 } ) {
+        std::vector < char > encoded = encodeContourCoordinates( coordinates, startIndices, decimation,
+                                                                 compressionLevel );
+        std::vector < float > decoded;
+        REQUIRE( decodeContourCoordinates( encoded.data(), encoded.size(), startIndices, decimation,
+                                           compressionLevel > 0, decoded ) );
+        REQUIRE( decoded.size() == coordinates.size() );
+        for ( size_t i = 0 ; i < coordinates.size() ; i++ ) {
+            REQUIRE( std::fabs( decoded[i] - coordinates[i] ) <= 0.5f / decimation );
+        }
+
+        // most steps fit into a byte
+        REQUIRE( encoded.size() < coordinates.size() * 2 );
+
+        if ( compressionLevel > 0 ) {
+            // a plain zlib stream: deflate with a 32 kB window, and a header check
+            int header = ( uint8_t( encoded[0] ) << 8 ) | uint8_t( encoded[1] );
+            REQUIRE( ( header >> 8 & 0x0f ) == 8 );
+            REQUIRE( ( header % 31 ) == 0 );
+        }
+    }
+
+    SECTION( "empty input" ) {
+        std::vector < char > encoded = encodeContourCoordinates( {}, {}, decimation );
+        std::vector < float > decoded;
+        REQUIRE( encoded.empty() );
+        REQUIRE( decodeContourCoordinates( encoded.data(), encoded.size(), {}, decimation, false, decoded ) );
+        REQUIRE( decoded.empty() );
+    }
+
+    SECTION( "truncated input" ) {
+        std::vector < char > encoded = encodeContourCoordinates( coordinates, startIndices, decimation );
+        std::vector < float > decoded;
+        REQUIRE( ! decodeContourCoordinates( encoded.data(), encoded.size() - 1, startIndices, decimation,
+                                             false, decoded ) );
+    }
+}
@@ -0,0 +1,82 @@
+#include "catch.h"
+#include "core/Algorithms/smoothing.h"
+#include <cmath>
+#include <random>
+
+using namespace Carta::Core::Algorithms;
+
+namespace {
+/// weighted mean of the finite values in [x - size / 2, x + size / 2] along both axes; for
+/// an even size the pixels on the edges of the box count half
+std::vector < float > naiveBox( const std::vector < float > & in, int width, int height, int size )
+{
+    std::vector < float > out( in.size() );
+    const int radius = size / 2;
+    auto weight = [&] ( int offset ) {
+        return size % 2 == 0 && std::abs( offset ) == radius ? 0.5 : 1.0;
+    };
+    for ( int y = 0 ; y < height ; y++ ) {
+        for ( int x = 0 ; x < width ; x++ ) {
+            double sum = 0, sumWeights = 0;
+            for ( int yy = y - radius ; yy <= y + radius ; yy++ ) {
+                for ( int xx = x - radius ; xx <= x + radius ; xx++ ) {
+                    if ( xx < 0 || yy < 0 || xx >= width || yy >= height ) {
+                        continue;
+                    }
+                    float v = in[yy * width + xx];
+                    if ( std::isfinite( v ) ) {
+                        double w = weight( xx - x ) * weight( yy - y );
+                        sum += w * v;
+                        sumWeights += w;
+                    }
+                }
+            }
+            out[y * width + x] = std::isfinite( in[y * width + x] ) && sumWeights > 0 ? sum / sumWeights : NAN;
+        }
+    }
+    return out;
+}
+}
+
+TEST_CASE( "Box smoothing", "[contour]" ) {
+
+    std::mt19937 gen( 3 );
+    std::uniform_real_distribution < float > value( - 1.0f, 1.0f );
+    const int width = 37, height = 71;
+    std::vector < float > in( width * height );
+    for ( float & v : in ) {
+        v = value( gen );
+    }
+    for ( size_t i = 0 ; i < in.size() ; i += 17 ) {
+        in[i] = NAN;
+    }
+
+    for ( int size : { 1, 2, 3, 4, 5, 8 } ) {
+        INFO( "box of " << size );
+        std::vector < float > expected = naiveBox( in, width, height, size );
+        std::vector < float > out( in.size() );
+        smoothBox( in.data(), width, height, size, out.data(), 2 );
+        for ( size_t i = 0 ; i < in.size() ; i++ ) {
+            REQUIRE( std::isnan( out[i] ) == std::isnan( expected[i] ) );
+            if ( ! std::isnan( expected[i] ) ) {
+                REQUIRE( std::fabs( out[i] - expected[i] ) < 1e-5 );
+            }
+        }
+    }
+
+    SECTION( "even sizes stay centred" ) {
+        // a single bright pixel spreads evenly to both sides, as it does with an odd size
+        std::vector < float > spike( 5 * 5, 0.0f );
+        spike[2 * 5 + 2] = 4.0f;
+        std::vector < float > out( spike.size() );
+        smoothBox( spike.data(), 5, 5, 2, out.data(), 1 );
+        REQUIRE( out[2 * 5 + 2] == Approx( 1.0f ) );
+        REQUIRE( out[2 * 5 + 1] == Approx( 0.5f ) );
+        REQUIRE( out[2 * 5 + 3] == Approx( 0.5f ) );
+        REQUIRE( out[1 * 5 + 2] == Approx( 0.5f ) );
+        REQUIRE( out[3 * 5 + 2] == Approx( 0.5f ) );
+        REQUIRE( out[1 * 5 + 1] == Approx( 0.25f ) );
+        REQUIRE( out[3 * 5 + 3] == Approx( 0.25f ) );
+        REQUIRE( out[0 * 5 + 2] == Approx( 0.0f ) );
+    }
+}
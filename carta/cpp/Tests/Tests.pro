@@ -14,6 +14,8 @@ SOURCES += \
     StateTester.cpp \
     pixelPipelineTest.cpp \
     LineCombinerTest.cpp \
+    ContourEncodingTest.cpp \
+    SmoothingTest.cpp \
     quantileTest.cpp
 
 #CONFIG += precompile_header
@@ -1,5 +1,6 @@
 #include "catch.h"
 #include "CartaLib/PixelPipeline/CustomizablePixelPipeline.h"
+#include "CartaLib/PixelPipeline/LutPipeline.h"
 #include "core/GrayColormap.h"
 #include <QColor>
 
@@ -31,4 +32,41 @@ TEST_CASE( "Cached Pixel Pipeline testing", "[pp]" ) {
         REQUIRE( ok);
     }
 
+    SECTION( "Table of colors") {
+        Core::GrayColormap::SharedPtr grayCmap = std::make_shared<Core::GrayColormap>();
+        Lib::PixelPipeline::CustomizablePixelPipeline pp;
+        pp.setColormap( grayCmap);
+        pp.setScale( Lib::PixelPipeline::ScaleType::Log);
+        pp.setMinMax( -2, 2);
+        QRgb nanColor = qRgb( 255, 0, 0);
+        Lib::PixelPipeline::LutPipeline lut;
+        lut.cache( pp, Lib::PixelPipeline::LutPipeline::DefaultSize, -2, 2, nanColor);
+
+        std::vector<float> values;
+        for( double x = -3 ; x < 3 ; x += 0.001) {
+            values.push_back( x);
+        }
+        values.push_back( NAN);
+        values.push_back( INFINITY);
+        values.push_back( - INFINITY);
+        std::vector<QRgb> colors( values.size());
+        lut.convert( values.data(), values.size(), colors.data());
+
+        for( size_t i = 0 ; i < values.size() ; i ++) {
+            QRgb expected = nanColor;
+            if( ! std::isnan( values[i])) {
+                pp.convertq( values[i], expected);
+            }
+            INFO( std::to_string( values[i]));
+            REQUIRE( std::abs( qRed( colors[i]) - qRed( expected)) <= 1);
+            REQUIRE( std::abs( qGreen( colors[i]) - qGreen( expected)) <= 1);
+            REQUIRE( std::abs( qBlue( colors[i]) - qBlue( expected)) <= 1);
+
+            // single pixels go the same way
+            QRgb single;
+            lut.convertq( values[i], single);
+            REQUIRE( single == colors[i]);
+        }
+    }
+
 }
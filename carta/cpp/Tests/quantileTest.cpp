@@ -23,6 +23,30 @@ TEST_CASE( "Exact quantile algorithm test", "[quantile]" ) {
     }
 }
 
+TEST_CASE( "Streaming exact quantile algorithm test", "[quantile]" ) {
+
+    std::vector<QuantileTestData> testCases = commonTestCases();
+
+    auto calculator = std::make_shared<Carta::Core::Algorithms::PercentilesToPixels<double> >();
+
+    for (auto& testCase : testCases) {
+
+        SECTION( testCase.name ) {
+            // never copy the whole view, and collect so few values that the buckets have to be split
+            for (int64_t maxCollect : {int64_t(0), int64_t(100), int64_t(1000000)}) {
+                calculator->setMemoryLimits(0, maxCollect);
+                std::map<double, double> intensities = calculator->percentile2pixels(testCase.view, testCase.percentiles, testCase.spectralIndex, testCase.converter, testCase.hzValues);
+
+                REQUIRE(intensities.size() == testCase.percentiles.size());
+
+                for (auto& p : testCase.percentiles) {
+                    REQUIRE(fabs(testCase.expected[p] - intensities[p]) < 1e-10);
+                }
+            }
+        }
+    }
+}
+
 TEST_CASE( "View stub test", "[quantile]" ){
 
     SECTION("TestRawViewSliceStub implementation") {
@@ -97,11 +97,17 @@ public:
         char * buff = nullptr,
         Traversal traversal = Traversal::Sequential ) override
     {
-        Q_UNUSED( buffSize );
-        Q_UNUSED( func );
         Q_UNUSED( buff );
-        Q_UNUSED( traversal );
-        qFatal( "not implemented" );
+        if ( traversal != Carta::Lib::NdArray::RawViewInterface::Traversal::Sequential ) {
+            qFatal( "sorry, not implemented yet" );
+        }
+
+        // our data is contiguous, so we can hand it over directly
+        int64_t capacity = buffSize / sizeof( PType );
+        int64_t size = data.size();
+        for ( int64_t offset = 0; offset < size; offset += capacity ) {
+            func( reinterpret_cast < const char * > ( data.data() + offset ), std::min( capacity, size - offset ) );
+        }
     }
 
     std::vector<PType> data;
@@ -0,0 +1,135 @@
+/**
+ *
+ **/
+
+#include "contourEncoding.h"
+
+#include <QByteArray>
+#include <algorithm>
+#include <cmath>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+namespace
+{
+/// size of the length qCompress() writes in front of the zlib stream
+const int QT_SIZE_HEADER = 4;
+
+/// appends v as a zigzag varint: 7 bits per byte, small magnitudes of either sign first
+inline void
+putVarint( std::vector < char > & out, int64_t v )
+{
+    uint64_t u = ( uint64_t( v ) << 1 ) ^ uint64_t( v >> 63 );
+    while ( u >= 0x80 ) {
+        out.push_back( char( ( u & 0x7f ) | 0x80 ) );
+        u >>= 7;
+    }
+    out.push_back( char( u ) );
+}
+
+/// reads a zigzag varint at pos, advancing it
+inline bool
+getVarint( const unsigned char * data, int64_t size, int64_t & pos, int64_t & v )
+{
+    uint64_t u = 0;
+    for ( int shift = 0 ; shift < 64 ; shift += 7 ) {
+        if ( pos >= size ) {
+            return false;
+        }
+        unsigned char byte = data[pos++];
+        u |= uint64_t( byte & 0x7f ) << shift;
+        if ( ! ( byte & 0x80 ) ) {
+            v = int64_t( u >> 1 ) ^ - int64_t( u & 1 );
+            return true;
+        }
+    }
+    return false;
+}
+}
+
+std::vector < char >
+encodeContourCoordinates( const std::vector < float > & coordinates,
+                          const std::vector < int32_t > & startIndices,
+                          int decimation, int compressionLevel )
+{
+    std::vector < char > encoded;
+    encoded.reserve( coordinates.size() + coordinates.size() / 4 );
+    size_t nextStart = 0;
+    int64_t last[2] = { 0, 0 };
+    for ( size_t i = 0 ; i < coordinates.size() ; i++ ) {
+        // every polyline starts from 0
+        if ( nextStart < startIndices.size() && size_t( startIndices[nextStart] ) == i ) {
+            last[0] = last[1] = 0;
+            nextStart++;
+        }
+        int64_t q = std::llround( double( coordinates[i] ) * decimation );
+        putVarint( encoded, q - last[i % 2] );
+        last[i % 2] = q;
+    }
+
+    if ( compressionLevel <= 0 ) {
+        return encoded;
+    }
+    // qCompress() puts the size in front of the zlib stream, as four big endian bytes
+    // only qUncompress() knows about, so they are left out
+    QByteArray deflated = qCompress( reinterpret_cast < const uchar * > ( encoded.data() ),
+                                     encoded.size(), std::min( compressionLevel, 9 ) );
+    if ( deflated.size() <= QT_SIZE_HEADER ) {
+        return std::vector < char > ();
+    }
+    return std::vector < char > ( deflated.begin() + QT_SIZE_HEADER, deflated.end() );
+}
+
+bool
+decodeContourCoordinates( const char * data, int64_t size,
+                          const std::vector < int32_t > & startIndices,
+                          int decimation, bool compressed,
+                          std::vector < float > & coordinates )
+{
+    coordinates.clear();
+    QByteArray inflated;
+    if ( compressed && size > 0 ) {
+        // qUncompress() wants the size in front; it is only a hint, a buffer that turns
+        // out too small is grown
+        quint32 hint = size * 4;
+        QByteArray qtData( QT_SIZE_HEADER, 0 );
+        for ( int i = 0 ; i < QT_SIZE_HEADER ; i++ ) {
+            qtData[i] = char( hint >> ( 8 * ( QT_SIZE_HEADER - 1 - i ) ) );
+        }
+        qtData.append( data, size );
+        inflated = qUncompress( qtData );
+        if ( inflated.isEmpty() ) {
+            return false;
+        }
+        data = inflated.constData();
+        size = inflated.size();
+    }
+
+    const unsigned char * bytes = reinterpret_cast < const unsigned char * > ( data );
+    size_t nextStart = 0;
+    int64_t last[2] = { 0, 0 };
+    int64_t pos = 0;
+    while ( pos < size ) {
+        size_t i = coordinates.size();
+        if ( nextStart < startIndices.size() && size_t( startIndices[nextStart] ) == i ) {
+            last[0] = last[1] = 0;
+            nextStart++;
+        }
+        int64_t delta;
+        if ( ! getVarint( bytes, size, pos, delta ) ) {
+            return false;
+        }
+        last[i % 2] += delta;
+        coordinates.push_back( float( double( last[i % 2] ) / decimation ) );
+    }
+    return coordinates.size() % 2 == 0 && nextStart == startIndices.size();
+}
+
+}
+}
+}
@@ -0,0 +1,51 @@
+/**
+ * Compact encoding of contour lines for sending them to the client
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+/// encodes the vertices of contour lines, as in ContourLines::coordinates
+/// \param coordinates x and y of every vertex, one polyline after the other
+/// \param startIndices index into coordinates of the first x of every polyline
+/// \param decimation coordinates are rounded to 1 / decimation of a pixel
+/// \param compressionLevel 0 to leave the result as it is, 1 (fastest) to 9 (smallest)
+///        to deflate it as well
+/// \return the encoded coordinates
+///
+/// The first vertex of every polyline is stored as it is and the others as the
+/// difference to the vertex before, and these integers are written as zigzag varints,
+/// so the small steps along a line mostly take one byte per coordinate. The start
+/// indices are not part of the result, they are needed to decode it. Deflated results
+/// are plain zlib streams (RFC 1950), which any inflate implementation reads.
+std::vector < char >
+encodeContourCoordinates( const std::vector < float > & coordinates,
+                          const std::vector < int32_t > & startIndices,
+                          int decimation, int compressionLevel = 0 );
+
+/// decodes what encodeContourCoordinates() made
+/// \param data the encoded coordinates
+/// \param size number of bytes of data
+/// \param startIndices the start indices that were passed to encodeContourCoordinates()
+/// \param decimation the decimation that was passed to encodeContourCoordinates()
+/// \param compressed whether the data was deflated
+/// \param coordinates set to the vertices, rounded as they were encoded
+/// \return false if the data is malformed
+bool
+decodeContourCoordinates( const char * data, int64_t size,
+                          const std::vector < int32_t > & startIndices,
+                          int decimation, bool compressed,
+                          std::vector < float > & coordinates );
+
+}
+}
+}
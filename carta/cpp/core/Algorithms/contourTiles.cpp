@@ -0,0 +1,510 @@
+/**
+ *
+ **/
+
+#include "contourTiles.h"
+#include "parallel.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+namespace
+{
+/// a line ending on the border between two tiles, to be joined with the lines of the
+/// neighbouring tile; an edge is -1 if the line does not continue past that end
+struct OpenLine
+{
+    std::vector < float > coordinates;
+    int64_t startEdge;
+    int64_t endEdge;
+};
+
+/// scratch space of one worker, kept across the tiles it computes
+struct Workspace
+{
+    /// up to two segments crossing each edge of the tile, -1 for none
+    std::vector < int32_t > edgeSegments;
+
+    /// the two edges of each segment
+    std::vector < int32_t > segments;
+
+    /// whether a segment is part of a line already
+    std::vector < char > used;
+
+    /// two rows of pixels compared to the level
+    std::vector < uint8_t > above;
+
+    /// range of the finite values of each row of cells
+    std::vector < float > rowMin, rowMax;
+};
+
+/// marching squares within one tile
+///
+/// The edges of the tile are numbered locally, the horizontal ones first (row by row,
+/// ny + 1 rows of nx edges), then the vertical ones (ny rows of nx + 1 edges). Across
+/// tiles an edge is known by its global id, 2 * pixel for the horizontal edge to the
+/// right of the pixel and 2 * pixel + 1 for the vertical edge below it.
+class TileContours
+{
+public:
+
+    TileContours( const float * data, int width, int height, int x0, int y0, int nx, int ny, Workspace & ws )
+        : m_data( data )
+          , m_width( width )
+          , m_height( height )
+          , m_x0( x0 )
+          , m_y0( y0 )
+          , m_nx( nx )
+          , m_ny( ny )
+          , m_vBase( nx * ( ny + 1 ) )
+          , m_ws( ws )
+    {
+        m_ws.edgeSegments.assign( 2 * ( m_vBase + ny * ( nx + 1 ) ), - 1 );
+
+        // most levels do not cross most rows of a smooth image
+        m_ws.rowMin.assign( ny, std::numeric_limits < float >::infinity() );
+        m_ws.rowMax.assign( ny, - std::numeric_limits < float >::infinity() );
+        for ( int y = 0 ; y <= ny ; y++ ) {
+            const float * row = data + int64_t( y0 + y ) * width + x0;
+            float lo = std::numeric_limits < float >::infinity();
+            float hi = - lo;
+            for ( int x = 0 ; x <= nx ; x++ ) {
+                if ( std::isfinite( row[x] ) ) {
+                    lo = std::min( lo, row[x] );
+                    hi = std::max( hi, row[x] );
+                }
+            }
+            for ( int ly = std::max( 0, y - 1 ) ; ly <= std::min( ny - 1, y ) ; ly++ ) {
+                m_ws.rowMin[ly] = std::min( m_ws.rowMin[ly], lo );
+                m_ws.rowMax[ly] = std::max( m_ws.rowMax[ly], hi );
+            }
+        }
+    }
+
+    /// the lines of one level; lines within the tile go to lines, the ones that end on
+    /// the border to another tile go to open
+    void
+    compute( double level, ContourLines & lines, std::vector < OpenLine > & open )
+    {
+        m_level = level;
+        findSegments();
+        traceLines( lines, open );
+
+        // leave the edge table clean for the next level
+        for ( int32_t edge : m_ws.segments ) {
+            m_ws.edgeSegments[2 * edge] = - 1;
+            m_ws.edgeSegments[2 * edge + 1] = - 1;
+        }
+    }
+
+private:
+
+    void
+    addSegment( int32_t a, int32_t b )
+    {
+        int32_t segment = m_ws.segments.size() / 2;
+        m_ws.segments.push_back( a );
+        m_ws.segments.push_back( b );
+        for ( int32_t edge : { a, b } ) {
+            int32_t * slots = & m_ws.edgeSegments[2 * edge];
+            slots[slots[0] < 0 ? 0 : 1] = segment;
+        }
+    }
+
+    void
+    findSegments()
+    {
+        m_ws.segments.clear();
+        const float level = m_level;
+
+        // whether each pixel of the current and the next row is above the level; the
+        // comparisons of a whole row vectorize, the cells then mostly see index 0 or 15
+        m_ws.above.resize( 2 * ( m_nx + 1 ) );
+        uint8_t * above = m_ws.above.data();
+        uint8_t * aboveNext = above + m_nx + 1;
+        int nextRow = - 1;
+        for ( int ly = 0 ; ly < m_ny ; ly++ ) {
+            if ( ! ( level >= m_ws.rowMin[ly] && level < m_ws.rowMax[ly] ) ) {
+                continue;
+            }
+            const float * row = m_data + int64_t( m_y0 + ly ) * m_width + m_x0;
+            const float * next = row + m_width;
+            if ( nextRow == ly ) {
+                std::swap( above, aboveNext );
+            }
+            else {
+                for ( int lx = 0 ; lx <= m_nx ; lx++ ) {
+                    above[lx] = row[lx] > level;
+                }
+            }
+            for ( int lx = 0 ; lx <= m_nx ; lx++ ) {
+                aboveNext[lx] = next[lx] > level;
+            }
+            nextRow = ly + 1;
+
+            for ( int lx = 0 ; lx < m_nx ; lx++ ) {
+                int index = above[lx] | ( above[lx + 1] << 1 ) | ( aboveNext[lx + 1] << 2 ) |
+                            ( aboveNext[lx] << 3 );
+                if ( index == 0 || index == 15 ) {
+                    // a NaN compares as below, so a cell with one is only looked at if
+                    // some other corner is above
+                    continue;
+                }
+                float v0 = row[lx], v1 = row[lx + 1], v2 = next[lx + 1], v3 = next[lx];
+                if ( ! std::isfinite( v0 ) || ! std::isfinite( v1 ) || ! std::isfinite( v2 ) ||
+                     ! std::isfinite( v3 ) ) {
+                    continue;
+                }
+
+                // bottom, right, top and left edge
+                int32_t e0 = ly * m_nx + lx;
+                int32_t e2 = e0 + m_nx;
+                int32_t e3 = m_vBase + ly * ( m_nx + 1 ) + lx;
+                int32_t e1 = e3 + 1;
+                switch ( index ) {
+                case 1:
+                case 14:
+                    addSegment( e3, e0 );
+                    break;
+                case 2:
+                case 13:
+                    addSegment( e0, e1 );
+                    break;
+                case 3:
+                case 12:
+                    addSegment( e3, e1 );
+                    break;
+                case 4:
+                case 11:
+                    addSegment( e1, e2 );
+                    break;
+                case 6:
+                case 9:
+                    addSegment( e0, e2 );
+                    break;
+                case 7:
+                case 8:
+                    addSegment( e2, e3 );
+                    break;
+                case 5:
+                case 10: {
+                    // saddle: the mean of the corners decides which of the diagonal
+                    // corners are connected
+                    bool centreAbove = ( double( v0 ) + v1 + v2 + v3 ) / 4 > level;
+                    if ( centreAbove == ( index == 5 ) ) {
+                        addSegment( e0, e1 );
+                        addSegment( e2, e3 );
+                    }
+                    else {
+                        addSegment( e3, e0 );
+                        addSegment( e1, e2 );
+                    }
+                    break;
+                }
+                }
+            }
+        }
+    } // findSegments
+
+    int32_t
+    unusedSegment( int32_t edge ) const
+    {
+        const int32_t * slots = & m_ws.edgeSegments[2 * edge];
+        for ( int i = 0 ; i < 2 ; i++ ) {
+            if ( slots[i] >= 0 && ! m_ws.used[slots[i]] ) {
+                return slots[i];
+            }
+        }
+        return - 1;
+    }
+
+    /// follows the segments from edge, starting with segment, until there is none left
+    /// \return the edge the line ends on
+    int32_t
+    walk( int32_t edge, int32_t segment, std::vector < float > & coordinates )
+    {
+        addPoint( edge, coordinates );
+        while ( segment >= 0 ) {
+            m_ws.used[segment] = 1;
+            const int32_t * ends = & m_ws.segments[2 * segment];
+            edge = ends[0] == edge ? ends[1] : ends[0];
+            addPoint( edge, coordinates );
+            segment = unusedSegment( edge );
+        }
+        return edge;
+    }
+
+    void
+    traceLines( ContourLines & lines, std::vector < OpenLine > & open )
+    {
+        const int32_t count = m_ws.segments.size() / 2;
+        m_ws.used.assign( count, 0 );
+        std::vector < float > coordinates;
+
+        // lines that end somewhere start from one of their ends, what is left after that
+        // are closed lines
+        for ( int pass = 0 ; pass < 2 ; pass++ ) {
+            for ( int32_t segment = 0 ; segment < count ; segment++ ) {
+                if ( m_ws.used[segment] ) {
+                    continue;
+                }
+                int32_t start = m_ws.segments[2 * segment];
+                if ( pass == 0 ) {
+                    if ( m_ws.edgeSegments[2 * start + 1] >= 0 ) {
+                        start = m_ws.segments[2 * segment + 1];
+                        if ( m_ws.edgeSegments[2 * start + 1] >= 0 ) {
+                            continue;
+                        }
+                    }
+                }
+                coordinates.clear();
+                int32_t end = walk( start, segment, coordinates );
+
+                bool joinStart = pass == 0 && isTileBorder( start );
+                bool joinEnd = pass == 0 && isTileBorder( end );
+                if ( joinStart || joinEnd ) {
+                    open.push_back( OpenLine {
+                                        coordinates,
+                                        joinStart ? globalEdge( start ) : - 1,
+                                        joinEnd ? globalEdge( end ) : - 1
+                                    } );
+                }
+                else {
+                    lines.startIndices.push_back( lines.coordinates.size() );
+                    lines.coordinates.insert( lines.coordinates.end(), coordinates.begin(), coordinates.end() );
+                }
+            }
+        }
+    } // traceLines
+
+    /// whether the edge is shared with another tile
+    bool
+    isTileBorder( int32_t edge ) const
+    {
+        if ( edge < m_vBase ) {
+            int ly = edge / m_nx;
+            return ( ly == 0 && m_y0 > 0 ) || ( ly == m_ny && m_y0 + m_ny < m_height - 1 );
+        }
+        int lx = ( edge - m_vBase ) % ( m_nx + 1 );
+        return ( lx == 0 && m_x0 > 0 ) || ( lx == m_nx && m_x0 + m_nx < m_width - 1 );
+    }
+
+    int64_t
+    globalEdge( int32_t edge ) const
+    {
+        int lx, ly, vertical = edge >= m_vBase;
+        if ( vertical ) {
+            lx = ( edge - m_vBase ) % ( m_nx + 1 );
+            ly = ( edge - m_vBase ) / ( m_nx + 1 );
+        }
+        else {
+            lx = edge % m_nx;
+            ly = edge / m_nx;
+        }
+        return 2 * ( int64_t( m_y0 + ly ) * m_width + m_x0 + lx ) + vertical;
+    }
+
+    /// where the level crosses the edge; the neighbouring tile finds the very same point
+    /// for a shared edge, which is what the lines are joined by
+    void
+    addPoint( int32_t edge, std::vector < float > & coordinates ) const
+    {
+        int64_t id = globalEdge( edge );
+        int64_t pixel = id / 2;
+        float a = m_data[pixel];
+        float b = m_data[pixel + ( id & 1 ? m_width : 1 )];
+        double t = ( m_level - a ) / ( double( b ) - a );
+        double x = pixel % m_width;
+        double y = pixel / m_width;
+        if ( id & 1 ) {
+            y += t;
+        }
+        else {
+            x += t;
+        }
+        coordinates.push_back( x );
+        coordinates.push_back( y );
+    }
+
+    const float * m_data;
+    const int m_width;
+    const int m_height;
+    const int m_x0;
+    const int m_y0;
+    const int m_nx;
+    const int m_ny;
+    const int32_t m_vBase;
+    Workspace & m_ws;
+    double m_level = 0;
+};
+
+/// joins the lines of one level that were cut by the tile borders
+void
+joinLines( const std::vector < OpenLine > & open, ContourLines & lines )
+{
+    // every shared edge is the end of at most one line from either tile; an end is
+    // 2 * line for the start and 2 * line + 1 for the end of a line
+    std::unordered_map < int64_t, std::pair < int, int > > edges;
+    edges.reserve( open.size() * 2 );
+    auto addEnd = [&edges] ( int64_t edge, int end ) {
+        if ( edge < 0 ) {
+            return;
+        }
+        auto result = edges.emplace( edge, std::make_pair( end, - 1 ) );
+        if ( ! result.second ) {
+            result.first-> second.second = end;
+        }
+    };
+    for ( size_t i = 0 ; i < open.size() ; i++ ) {
+        addEnd( open[i].startEdge, int( 2 * i ) );
+        addEnd( open[i].endEdge, int( 2 * i + 1 ) );
+    }
+    auto partner = [&] ( int end ) {
+        const OpenLine & line = open[end / 2];
+        int64_t edge = end & 1 ? line.endEdge : line.startEdge;
+        if ( edge < 0 ) {
+            return - 1;
+        }
+        const std::pair < int, int > & ends = edges.at( edge );
+        return ends.first == end ? ends.second : ends.first;
+    };
+
+    std::vector < char > used( open.size(), 0 );
+    auto follow = [&] ( int end ) {
+        lines.startIndices.push_back( lines.coordinates.size() );
+        bool first = true;
+        while ( end >= 0 && ! used[end / 2] ) {
+            used[end / 2] = 1;
+            const std::vector < float > & coordinates = open[end / 2].coordinates;
+            int points = coordinates.size() / 2;
+
+            // the point on the shared edge is in both lines
+            int skip = first ? 0 : 1;
+            if ( end & 1 ) {
+                for ( int p = points - 1 - skip ; p >= 0 ; p-- ) {
+                    lines.coordinates.push_back( coordinates[2 * p] );
+                    lines.coordinates.push_back( coordinates[2 * p + 1] );
+                }
+            }
+            else {
+                lines.coordinates.insert( lines.coordinates.end(), coordinates.begin() + 2 * skip, coordinates.end() );
+            }
+            first = false;
+            end = partner( end ^ 1 );
+        }
+    };
+
+    // lines that end somewhere first, then the closed ones
+    for ( size_t i = 0 ; i < open.size() ; i++ ) {
+        if ( used[i] ) {
+            continue;
+        }
+        if ( partner( 2 * i ) < 0 ) {
+            follow( 2 * i );
+        }
+        else if ( partner( 2 * i + 1 ) < 0 ) {
+            follow( 2 * i + 1 );
+        }
+    }
+    for ( size_t i = 0 ; i < open.size() ; i++ ) {
+        if ( ! used[i] ) {
+            follow( 2 * i );
+        }
+    }
+} // joinLines
+}
+
+int
+contourTileCount( int width, int height, int tileSize )
+{
+    if ( width < 2 || height < 2 || tileSize < 1 ) {
+        return 0;
+    }
+    int tilesX = ( width - 1 + tileSize - 1 ) / tileSize;
+    int tilesY = ( height - 1 + tileSize - 1 ) / tileSize;
+    return tilesX * tilesY;
+}
+
+void
+contourTileBounds( int width, int height, int tileSize, int tile, int & x0, int & y0, int & nx, int & ny )
+{
+    int tilesX = ( width - 1 + tileSize - 1 ) / tileSize;
+    x0 = ( tile % tilesX ) * tileSize;
+    y0 = ( tile / tilesX ) * tileSize;
+    nx = std::min( tileSize, width - 1 - x0 );
+    ny = std::min( tileSize, height - 1 - y0 );
+}
+
+bool
+tiledContours( const float * data, int width, int height, const std::vector < double > & levels,
+               const ContourSink & sink, int tileSize, int nThreads )
+{
+    const int nLevels = levels.size();
+    const int nTiles = contourTileCount( width, height, tileSize );
+    if ( nTiles == 0 ) {
+        return sink( - 1, std::vector < ContourLines > ( nLevels ), 1.0 );
+    }
+
+    std::vector < Workspace > workspaces( parallelWorkers( nTiles, nThreads ) );
+
+    // the open lines of every tile and level
+    std::vector < std::vector < std::vector < OpenLine > > > open( nTiles );
+
+    QMutex mutex;
+    int done = 0;
+    std::atomic < bool > stopped( false );
+    parallelFor( nTiles, [&] ( int tile, int worker ) {
+                     if ( stopped ) {
+                         return;
+                     }
+                     int x0, y0, nx, ny;
+                     contourTileBounds( width, height, tileSize, tile, x0, y0, nx, ny );
+                     TileContours contours( data, width, height, x0, y0, nx, ny, workspaces[worker] );
+                     std::vector < ContourLines > lines( nLevels );
+                     open[tile].resize( nLevels );
+                     for ( int level = 0 ; level < nLevels ; level++ ) {
+                         contours.compute( levels[level], lines[level], open[tile][level] );
+                     }
+
+                     QMutexLocker locker( & mutex );
+                     if ( stopped ) {
+                         return;
+                     }
+                     done++;
+                     // the joined lines are the last piece
+                     if ( ! sink( tile, lines, double( done ) / ( nTiles + 1 ) ) ) {
+                         stopped = true;
+                     }
+                 }, nThreads );
+    if ( stopped ) {
+        return false;
+    }
+
+    std::vector < ContourLines > joined( nLevels );
+    parallelFor( nLevels, [&] ( int level, int ) {
+                     std::vector < OpenLine > lines;
+                     for ( auto & tileLines : open ) {
+                         for ( auto & line : tileLines[level] ) {
+                             lines.push_back( std::move( line ) );
+                         }
+                     }
+                     joinLines( lines, joined[level] );
+                 }, nThreads );
+    return sink( - 1, joined, 1.0 );
+} // tiledContours
+
+}
+}
+}
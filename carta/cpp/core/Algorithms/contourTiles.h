@@ -0,0 +1,73 @@
+/**
+ * Contour lines of an image plane, computed tile by tile with marching squares
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+/// the contour lines of one level, as polylines in pixel coordinates (x is the column
+/// and y the row of the plane); closed lines end with their first vertex
+struct ContourLines
+{
+    /// x and y of every vertex, one polyline after the other
+    std::vector < float > coordinates;
+
+    /// index into coordinates of the first x of every polyline
+    std::vector < int32_t > startIndices;
+};
+
+/// receives the lines of every level found in one piece of the plane, see tiledContours()
+/// \param tile index of the tile the lines are from, or -1 for the lines crossing tile borders
+/// \param lines the lines of every level, in the order of the levels
+/// \param progress fraction of the work that is done
+/// \return false to stop, the tiles that are left are not computed
+typedef std::function < bool (int tile, const std::vector < ContourLines > & lines, double progress) > ContourSink;
+
+/// the tile of the given index, in cells (a cell being the square between four pixels)
+/// \param width width of the plane
+/// \param height height of the plane
+/// \param tileSize number of cells along each side of a tile
+/// \param tile index of the tile, row by row
+/// \param x0 set to the first column of the tile
+/// \param y0 set to the first row of the tile
+/// \param nx set to the number of cells along x
+/// \param ny set to the number of cells along y
+void
+contourTileBounds( int width, int height, int tileSize, int tile, int & x0, int & y0, int & nx, int & ny );
+
+/// number of tiles tiledContours() splits a plane into
+int
+contourTileCount( int width, int height, int tileSize );
+
+/// contour lines of a plane with marching squares; the plane is split into tiles which
+/// are computed in parallel, every one for all the levels
+/// \param data the plane, row-major
+/// \param width width of the plane
+/// \param height height of the plane
+/// \param levels the levels
+/// \param sink gets the lines that lie within a tile as soon as the tile is done, and the
+///        lines that cross tile borders, stitched together, once all the tiles are done;
+///        it is called from the worker threads, one call at a time
+/// \param tileSize number of cells along each side of a tile
+/// \param nThreads number of threads to use, 0 means QThread::idealThreadCount()
+/// \return false if the sink stopped the computation
+///
+/// Cells with a NaN (or infinite) corner have no lines, lines end at their border.
+/// Saddle cells are resolved with the mean of their corners.
+bool
+tiledContours( const float * data, int width, int height, const std::vector < double > & levels,
+               const ContourSink & sink, int tileSize = 256, int nThreads = 0 );
+
+}
+}
+}
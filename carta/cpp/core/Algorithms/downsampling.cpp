@@ -0,0 +1,127 @@
+/**
+ *
+ **/
+
+#include "downsampling.h"
+#include "parallel.h"
+
+#include <QThread>
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+namespace
+{
+/// add one input row into the per-column sums and counts of finite values
+inline void
+accumulateRow( const float * row, int64_t n, float * sums, float * counts )
+{
+    int64_t i = 0;
+#ifdef __SSE2__
+    // x - x is 0 for finite x and NaN otherwise, so comparing it to 0 gives
+    // the mask of finite values without any branches
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps( 1.0f );
+    for ( ; i + 4 <= n ; i += 4 ) {
+        __m128 v = _mm_loadu_ps( row + i );
+        __m128 finite = _mm_cmpeq_ps( _mm_sub_ps( v, v ), zero );
+        __m128 s = _mm_loadu_ps( sums + i );
+        __m128 c = _mm_loadu_ps( counts + i );
+        _mm_storeu_ps( sums + i, _mm_add_ps( s, _mm_and_ps( finite, v ) ) );
+        _mm_storeu_ps( counts + i, _mm_add_ps( c, _mm_and_ps( finite, one ) ) );
+    }
+#endif
+    for ( ; i < n ; i++ ) {
+        if ( std::isfinite( row[i] ) ) {
+            sums[i] += row[i];
+            counts[i] += 1.0f;
+        }
+    }
+}
+}
+
+void
+blockAverage( const float * in, int64_t inStride, int nx, int rows, int mip, float * out )
+{
+    if ( mip == 1 ) {
+        for ( int y = 0 ; y < rows ; y++ ) {
+            const float * row = in + y * inStride;
+            float * dst = out + int64_t( y ) * nx;
+            for ( int x = 0 ; x < nx ; x++ ) {
+                dst[x] = std::isfinite( row[x] ) ? row[x] : NAN;
+            }
+        }
+        return;
+    }
+
+    // first sum up the mip rows of each block column by column (this is where the
+    // time is spent, and it vectorizes), then reduce every mip columns to one value
+    const int64_t width = int64_t( nx ) * mip;
+    std::vector < float > sums( width ), counts( width );
+    for ( int y = 0 ; y < rows ; y++ ) {
+        std::fill( sums.begin(), sums.end(), 0.0f );
+        std::fill( counts.begin(), counts.end(), 0.0f );
+        const float * blockRow = in + int64_t( y ) * mip * inStride;
+        for ( int r = 0 ; r < mip ; r++ ) {
+            accumulateRow( blockRow + r * inStride, width, sums.data(), counts.data() );
+        }
+
+        float * dst = out + int64_t( y ) * nx;
+        const float * s = sums.data();
+        const float * c = counts.data();
+        for ( int x = 0 ; x < nx ; x++ ) {
+            float sum = 0, count = 0;
+            for ( int k = 0 ; k < mip ; k++ ) {
+                sum += s[k];
+                count += c[k];
+            }
+            dst[x] = count < 1 ? NAN : sum / count;
+            s += mip;
+            c += mip;
+        }
+    }
+} // blockAverage
+
+void
+downsample( const RowBandReader & readRows, int nx, int ny, int mip, float * out, int nThreads )
+{
+    if ( nx <= 0 || ny <= 0 ) {
+        return;
+    }
+    if ( nThreads <= 0 ) {
+        nThreads = QThread::idealThreadCount();
+    }
+
+    // a few bands per thread so that uneven read times even out, but each band
+    // still covers enough rows to make the reads efficient
+    int nBands = std::max( 1, std::min( ny, nThreads * 4 ) );
+    int bandRows = ( ny + nBands - 1 ) / nBands;
+    nBands = ( ny + bandRows - 1 ) / bandRows;
+    const int64_t inWidth = int64_t( nx ) * mip;
+
+    auto processBand = [&] ( int band ) {
+        int y0 = band * bandRows;
+        int rows = std::min( bandRows, ny - y0 );
+        std::vector < float > input( inWidth * rows * mip );
+        readRows( y0 * mip, rows * mip, input.data() );
+        blockAverage( input.data(), inWidth, nx, rows, mip, out + int64_t( y0 ) * nx );
+    };
+
+    parallelFor( nBands, [&] ( int band, int ) {
+                     processBand( band );
+                 }, nThreads );
+} // downsample
+
+}
+}
+}
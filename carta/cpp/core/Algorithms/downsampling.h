@@ -0,0 +1,48 @@
+/**
+ * Downsampling (mip) kernels used to prepare raster image data
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+/// callback that fills dst with rows [yStart, yStart + nRows) of the area being
+/// downsampled, i.e. nRows * (nx * mip) floats in row-major order
+typedef std::function < void (int yStart, int nRows, float * dst) > RowBandReader;
+
+/// NaN-aware mean of mip x mip blocks
+/// \param in first row of the input, must have rows * mip rows and nx * mip columns
+/// \param inStride number of floats between consecutive input rows
+/// \param nx number of output columns
+/// \param rows number of output rows
+/// \param mip downsampling factor
+/// \param out output, rows * nx floats
+///
+/// Non-finite input values are ignored, blocks without finite values become NaN.
+/// For mip == 1 this is a copy with non-finite values replaced by NaN.
+void
+blockAverage( const float * in, int64_t inStride, int nx, int rows, int mip, float * out );
+
+/// downsample a whole area: the output rows are split into bands which are read
+/// and averaged in parallel
+/// \param readRows supplies the input rows, it gets called from multiple threads
+/// \param nx number of output columns
+/// \param ny number of output rows
+/// \param mip downsampling factor
+/// \param out output, ny * nx floats
+/// \param nThreads number of threads to use, 0 means QThread::idealThreadCount()
+void
+downsample( const RowBandReader & readRows, int nx, int ny, int mip, float * out, int nThreads = 0 );
+
+}
+}
+}
@@ -0,0 +1,548 @@
+/**
+ *
+ **/
+
+#include "minMaxHistogram.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+// the AVX2 code is compiled for its own functions only and taken if the CPU has it,
+// so that the binaries still run on older machines
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define CARTA_RUNTIME_AVX2 1
+#include <immintrin.h>
+#define CARTA_TARGET_AVX2 __attribute__( ( target( "avx2" ) ) )
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+namespace
+{
+/// blocks with fewer values are not worth splitting between threads
+const int64_t PARALLEL_MIN_VALUES = 1 << 20;
+
+enum class Isa {
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+Isa
+detectIsa()
+{
+#ifdef CARTA_RUNTIME_AVX2
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) ) {
+        return Isa::AVX2;
+    }
+#endif
+#ifdef __SSE2__
+    return Isa::SSE2;
+#else
+    return Isa::SCALAR;
+#endif
+}
+
+Isa
+isa()
+{
+    static const Isa value = detectIsa();
+    return value;
+}
+
+/// number of bits set in the 4 bit masks of the SSE compares
+const int MASK_BITS[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+template < typename Scalar >
+inline void
+minMaxScalar( const Scalar * values, int64_t n, MinMaxCount & result )
+{
+    double lowest = result.min;
+    double highest = result.max;
+    int64_t finite = 0;
+    for ( int64_t i = 0 ; i < n ; i++ ) {
+        const Scalar val = values[i];
+        if ( std::isfinite( val ) ) {
+            finite++;
+            lowest = std::min < double > ( lowest, val );
+            highest = std::max < double > ( highest, val );
+        }
+    }
+    result.finiteCount += finite;
+    result.nonFiniteCount += n - finite;
+    result.min = lowest;
+    result.max = highest;
+}
+
+/// the values are binned in double precision in the same order of operations as
+/// MinMaxPercentiles::pixels2histogram(), so the bins are the same; round() of the
+/// non-negative bin positions is truncation plus one for a fraction of at least 0.5
+template < typename Scalar >
+inline void
+histogramScalar( const Scalar * values, int64_t n, double minIntensity, double intensityRange,
+                 int numberOfBins, uint32_t * bins )
+{
+    for ( int64_t i = 0 ; i < n ; i++ ) {
+        if ( std::isfinite( values[i] ) ) {
+            double position = numberOfBins * ( double ( values[i] ) - minIntensity ) / intensityRange;
+            position = std::min < double > ( std::max( position, 0.0 ), numberOfBins );
+            bins[static_cast < unsigned int > ( std::round( position ) )]++;
+        }
+    }
+}
+
+#ifdef __SSE2__
+void
+minMaxSse2( const float * values, int64_t n, MinMaxCount & result )
+{
+    int64_t i = 0;
+    if ( n >= 8 ) {
+        // x - x is 0 only for finite x, the others become +-inf for the extremes
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 inf = _mm_set1_ps( std::numeric_limits < float >::infinity() );
+        const __m128 negInf = _mm_set1_ps( -std::numeric_limits < float >::infinity() );
+        __m128 lowest = inf;
+        __m128 highest = negInf;
+        int64_t finite = 0;
+        for ( ; i + 4 <= n ; i += 4 ) {
+            __m128 v = _mm_loadu_ps( values + i );
+            __m128 mask = _mm_cmpeq_ps( _mm_sub_ps( v, v ), zero );
+            __m128 fv = _mm_and_ps( mask, v );
+            lowest = _mm_min_ps( lowest, _mm_or_ps( fv, _mm_andnot_ps( mask, inf ) ) );
+            highest = _mm_max_ps( highest, _mm_or_ps( fv, _mm_andnot_ps( mask, negInf ) ) );
+            finite += MASK_BITS[_mm_movemask_ps( mask )];
+        }
+        float lows[4], highs[4];
+        _mm_storeu_ps( lows, lowest );
+        _mm_storeu_ps( highs, highest );
+        for ( int k = 0 ; k < 4 ; k++ ) {
+            result.min = std::min < double > ( result.min, lows[k] );
+            result.max = std::max < double > ( result.max, highs[k] );
+        }
+        result.finiteCount += finite;
+        result.nonFiniteCount += i - finite;
+    }
+    minMaxScalar( values + i, n - i, result );
+}
+
+void
+minMaxSse2( const double * values, int64_t n, MinMaxCount & result )
+{
+    int64_t i = 0;
+    if ( n >= 8 ) {
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d inf = _mm_set1_pd( std::numeric_limits < double >::infinity() );
+        const __m128d negInf = _mm_set1_pd( -std::numeric_limits < double >::infinity() );
+        __m128d lowest = inf;
+        __m128d highest = negInf;
+        int64_t finite = 0;
+        for ( ; i + 2 <= n ; i += 2 ) {
+            __m128d v = _mm_loadu_pd( values + i );
+            __m128d mask = _mm_cmpeq_pd( _mm_sub_pd( v, v ), zero );
+            __m128d fv = _mm_and_pd( mask, v );
+            lowest = _mm_min_pd( lowest, _mm_or_pd( fv, _mm_andnot_pd( mask, inf ) ) );
+            highest = _mm_max_pd( highest, _mm_or_pd( fv, _mm_andnot_pd( mask, negInf ) ) );
+            finite += MASK_BITS[_mm_movemask_pd( mask )];
+        }
+        double lows[2], highs[2];
+        _mm_storeu_pd( lows, lowest );
+        _mm_storeu_pd( highs, highest );
+        for ( int k = 0 ; k < 2 ; k++ ) {
+            result.min = std::min( result.min, lows[k] );
+            result.max = std::max( result.max, highs[k] );
+        }
+        result.finiteCount += finite;
+        result.nonFiniteCount += i - finite;
+    }
+    minMaxScalar( values + i, n - i, result );
+}
+
+/// bins of two positions, see histogramScalar()
+inline __m128i
+binsSse2( __m128d values, __m128d minIntensity, __m128d numberOfBins, __m128d intensityRange )
+{
+    __m128d position = _mm_div_pd( _mm_mul_pd( numberOfBins, _mm_sub_pd( values, minIntensity ) ), intensityRange );
+    position = _mm_min_pd( _mm_max_pd( position, _mm_setzero_pd() ), numberOfBins );
+    __m128d whole = _mm_cvtepi32_pd( _mm_cvttpd_epi32( position ) );
+    __m128d up = _mm_and_pd( _mm_cmpge_pd( _mm_sub_pd( position, whole ), _mm_set1_pd( 0.5 ) ), _mm_set1_pd( 1.0 ) );
+    return _mm_cvttpd_epi32( _mm_add_pd( whole, up ) );
+}
+
+void
+histogramSse2( const float * values, int64_t n, double minIntensity, double intensityRange,
+               int numberOfBins, uint32_t * bins )
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128d lowest = _mm_set1_pd( minIntensity );
+    const __m128d bins2 = _mm_set1_pd( numberOfBins );
+    const __m128d range = _mm_set1_pd( intensityRange );
+    int32_t index[4];
+    int64_t i = 0;
+    for ( ; i + 4 <= n ; i += 4 ) {
+        __m128 v = _mm_loadu_ps( values + i );
+        int mask = _mm_movemask_ps( _mm_cmpeq_ps( _mm_sub_ps( v, v ), zero ) );
+        if ( mask == 0 ) {
+            continue;
+        }
+        _mm_storel_epi64( reinterpret_cast < __m128i * > ( index ), binsSse2( _mm_cvtps_pd( v ), lowest, bins2, range ) );
+        _mm_storel_epi64( reinterpret_cast < __m128i * > ( index + 2 ),
+                          binsSse2( _mm_cvtps_pd( _mm_movehl_ps( v, v ) ), lowest, bins2, range ) );
+        for ( int k = 0 ; k < 4 ; k++ ) {
+            if ( mask & ( 1 << k ) ) {
+                bins[index[k]]++;
+            }
+        }
+    }
+    histogramScalar( values + i, n - i, minIntensity, intensityRange, numberOfBins, bins );
+}
+
+void
+histogramSse2( const double * values, int64_t n, double minIntensity, double intensityRange,
+               int numberOfBins, uint32_t * bins )
+{
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d lowest = _mm_set1_pd( minIntensity );
+    const __m128d bins2 = _mm_set1_pd( numberOfBins );
+    const __m128d range = _mm_set1_pd( intensityRange );
+    int32_t index[2];
+    int64_t i = 0;
+    for ( ; i + 2 <= n ; i += 2 ) {
+        __m128d v = _mm_loadu_pd( values + i );
+        int mask = _mm_movemask_pd( _mm_cmpeq_pd( _mm_sub_pd( v, v ), zero ) );
+        if ( mask == 0 ) {
+            continue;
+        }
+        _mm_storel_epi64( reinterpret_cast < __m128i * > ( index ), binsSse2( v, lowest, bins2, range ) );
+        for ( int k = 0 ; k < 2 ; k++ ) {
+            if ( mask & ( 1 << k ) ) {
+                bins[index[k]]++;
+            }
+        }
+    }
+    histogramScalar( values + i, n - i, minIntensity, intensityRange, numberOfBins, bins );
+}
+#endif
+
+#ifdef CARTA_RUNTIME_AVX2
+CARTA_TARGET_AVX2 void
+minMaxAvx2( const float * values, int64_t n, MinMaxCount & result )
+{
+    int64_t i = 0;
+    if ( n >= 16 ) {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 inf = _mm256_set1_ps( std::numeric_limits < float >::infinity() );
+        const __m256 negInf = _mm256_set1_ps( -std::numeric_limits < float >::infinity() );
+        // two sets of accumulators, so that the loop is not bound by the latency of min/max
+        __m256 lowest0 = inf, lowest1 = inf;
+        __m256 highest0 = negInf, highest1 = negInf;
+        int64_t finite = 0;
+        for ( ; i + 16 <= n ; i += 16 ) {
+            __m256 a = _mm256_loadu_ps( values + i );
+            __m256 b = _mm256_loadu_ps( values + i + 8 );
+            __m256 maskA = _mm256_cmp_ps( _mm256_sub_ps( a, a ), zero, _CMP_EQ_OQ );
+            __m256 maskB = _mm256_cmp_ps( _mm256_sub_ps( b, b ), zero, _CMP_EQ_OQ );
+            lowest0 = _mm256_min_ps( lowest0, _mm256_blendv_ps( inf, a, maskA ) );
+            lowest1 = _mm256_min_ps( lowest1, _mm256_blendv_ps( inf, b, maskB ) );
+            highest0 = _mm256_max_ps( highest0, _mm256_blendv_ps( negInf, a, maskA ) );
+            highest1 = _mm256_max_ps( highest1, _mm256_blendv_ps( negInf, b, maskB ) );
+            finite += __builtin_popcount( _mm256_movemask_ps( maskA ) ) +
+                      __builtin_popcount( _mm256_movemask_ps( maskB ) );
+        }
+        float lows[8], highs[8];
+        _mm256_storeu_ps( lows, _mm256_min_ps( lowest0, lowest1 ) );
+        _mm256_storeu_ps( highs, _mm256_max_ps( highest0, highest1 ) );
+        for ( int k = 0 ; k < 8 ; k++ ) {
+            result.min = std::min < double > ( result.min, lows[k] );
+            result.max = std::max < double > ( result.max, highs[k] );
+        }
+        result.finiteCount += finite;
+        result.nonFiniteCount += i - finite;
+    }
+    minMaxScalar( values + i, n - i, result );
+}
+
+CARTA_TARGET_AVX2 void
+minMaxAvx2( const double * values, int64_t n, MinMaxCount & result )
+{
+    int64_t i = 0;
+    if ( n >= 8 ) {
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d inf = _mm256_set1_pd( std::numeric_limits < double >::infinity() );
+        const __m256d negInf = _mm256_set1_pd( -std::numeric_limits < double >::infinity() );
+        __m256d lowest0 = inf, lowest1 = inf;
+        __m256d highest0 = negInf, highest1 = negInf;
+        int64_t finite = 0;
+        for ( ; i + 8 <= n ; i += 8 ) {
+            __m256d a = _mm256_loadu_pd( values + i );
+            __m256d b = _mm256_loadu_pd( values + i + 4 );
+            __m256d maskA = _mm256_cmp_pd( _mm256_sub_pd( a, a ), zero, _CMP_EQ_OQ );
+            __m256d maskB = _mm256_cmp_pd( _mm256_sub_pd( b, b ), zero, _CMP_EQ_OQ );
+            lowest0 = _mm256_min_pd( lowest0, _mm256_blendv_pd( inf, a, maskA ) );
+            lowest1 = _mm256_min_pd( lowest1, _mm256_blendv_pd( inf, b, maskB ) );
+            highest0 = _mm256_max_pd( highest0, _mm256_blendv_pd( negInf, a, maskA ) );
+            highest1 = _mm256_max_pd( highest1, _mm256_blendv_pd( negInf, b, maskB ) );
+            finite += MASK_BITS[_mm256_movemask_pd( maskA )] + MASK_BITS[_mm256_movemask_pd( maskB )];
+        }
+        double lows[4], highs[4];
+        _mm256_storeu_pd( lows, _mm256_min_pd( lowest0, lowest1 ) );
+        _mm256_storeu_pd( highs, _mm256_max_pd( highest0, highest1 ) );
+        for ( int k = 0 ; k < 4 ; k++ ) {
+            result.min = std::min( result.min, lows[k] );
+            result.max = std::max( result.max, highs[k] );
+        }
+        result.finiteCount += finite;
+        result.nonFiniteCount += i - finite;
+    }
+    minMaxScalar( values + i, n - i, result );
+}
+
+/// bins of four positions, see histogramScalar()
+CARTA_TARGET_AVX2 inline __m128i
+binsAvx2( __m256d values, __m256d minIntensity, __m256d numberOfBins, __m256d intensityRange )
+{
+    __m256d position = _mm256_div_pd( _mm256_mul_pd( numberOfBins, _mm256_sub_pd( values, minIntensity ) ),
+                                      intensityRange );
+    position = _mm256_min_pd( _mm256_max_pd( position, _mm256_setzero_pd() ), numberOfBins );
+    __m256d whole = _mm256_round_pd( position, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC );
+    __m256d up = _mm256_and_pd( _mm256_cmp_pd( _mm256_sub_pd( position, whole ), _mm256_set1_pd( 0.5 ), _CMP_GE_OQ ),
+                                _mm256_set1_pd( 1.0 ) );
+    return _mm256_cvttpd_epi32( _mm256_add_pd( whole, up ) );
+}
+
+CARTA_TARGET_AVX2 void
+histogramAvx2( const float * values, int64_t n, double minIntensity, double intensityRange,
+               int numberOfBins, uint32_t * bins )
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256d lowest = _mm256_set1_pd( minIntensity );
+    const __m256d bins4 = _mm256_set1_pd( numberOfBins );
+    const __m256d range = _mm256_set1_pd( intensityRange );
+    int32_t index[8];
+    int64_t i = 0;
+    for ( ; i + 8 <= n ; i += 8 ) {
+        __m256 v = _mm256_loadu_ps( values + i );
+        int mask = _mm256_movemask_ps( _mm256_cmp_ps( _mm256_sub_ps( v, v ), zero, _CMP_EQ_OQ ) );
+        if ( mask == 0 ) {
+            continue;
+        }
+        _mm_storeu_si128( reinterpret_cast < __m128i * > ( index ),
+                          binsAvx2( _mm256_cvtps_pd( _mm256_castps256_ps128( v ) ), lowest, bins4, range ) );
+        _mm_storeu_si128( reinterpret_cast < __m128i * > ( index + 4 ),
+                          binsAvx2( _mm256_cvtps_pd( _mm256_extractf128_ps( v, 1 ) ), lowest, bins4, range ) );
+        for ( int k = 0 ; k < 8 ; k++ ) {
+            if ( mask & ( 1 << k ) ) {
+                bins[index[k]]++;
+            }
+        }
+    }
+    histogramScalar( values + i, n - i, minIntensity, intensityRange, numberOfBins, bins );
+}
+
+CARTA_TARGET_AVX2 void
+histogramAvx2( const double * values, int64_t n, double minIntensity, double intensityRange,
+               int numberOfBins, uint32_t * bins )
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d lowest = _mm256_set1_pd( minIntensity );
+    const __m256d bins4 = _mm256_set1_pd( numberOfBins );
+    const __m256d range = _mm256_set1_pd( intensityRange );
+    int32_t index[4];
+    int64_t i = 0;
+    for ( ; i + 4 <= n ; i += 4 ) {
+        __m256d v = _mm256_loadu_pd( values + i );
+        int mask = _mm256_movemask_pd( _mm256_cmp_pd( _mm256_sub_pd( v, v ), zero, _CMP_EQ_OQ ) );
+        if ( mask == 0 ) {
+            continue;
+        }
+        _mm_storeu_si128( reinterpret_cast < __m128i * > ( index ), binsAvx2( v, lowest, bins4, range ) );
+        for ( int k = 0 ; k < 4 ; k++ ) {
+            if ( mask & ( 1 << k ) ) {
+                bins[index[k]]++;
+            }
+        }
+    }
+    histogramScalar( values + i, n - i, minIntensity, intensityRange, numberOfBins, bins );
+}
+#endif
+
+template < typename Scalar >
+void
+minMaxBlock( const Scalar * values, int64_t n, MinMaxCount & result )
+{
+    switch ( isa() ) {
+#ifdef CARTA_RUNTIME_AVX2
+    case Isa::AVX2:
+        minMaxAvx2( values, n, result );
+        return;
+#endif
+#ifdef __SSE2__
+    case Isa::SSE2:
+        minMaxSse2( values, n, result );
+        return;
+#endif
+    default:
+        minMaxScalar( values, n, result );
+    }
+}
+
+template < typename Scalar >
+void
+histogramBlock( const Scalar * values, int64_t n, double minIntensity, double intensityRange,
+                int numberOfBins, uint32_t * bins )
+{
+    switch ( isa() ) {
+#ifdef CARTA_RUNTIME_AVX2
+    case Isa::AVX2:
+        histogramAvx2( values, n, minIntensity, intensityRange, numberOfBins, bins );
+        return;
+#endif
+#ifdef __SSE2__
+    case Isa::SSE2:
+        histogramSse2( values, n, minIntensity, intensityRange, numberOfBins, bins );
+        return;
+#endif
+    default:
+        histogramScalar( values, n, minIntensity, intensityRange, numberOfBins, bins );
+    }
+}
+
+/// number of parts a block is split into, 1 if it is done on the calling thread
+int
+blockParts( int64_t count, int nThreads )
+{
+    return int ( std::min < int64_t > ( int64_t ( parallelWorkers( 1 << 16, nThreads ) ) * 4,
+                                        count / PARALLEL_MIN_VALUES * 4 ) );
+}
+
+template < typename Scalar >
+MinMaxCount
+minMaxCountImpl( const Scalar * values, int64_t count, int nThreads )
+{
+    MinMaxCount result;
+    int nParts = blockParts( count, nThreads );
+    if ( nParts <= 1 ) {
+        minMaxBlock( values, count, result );
+        return result;
+    }
+    int64_t partSize = ( count + nParts - 1 ) / nParts;
+    std::vector < MinMaxCount > workerResults( parallelWorkers( nParts, nThreads ) );
+    parallelFor( nParts, [&] ( int part, int worker ) {
+                     int64_t start = part * partSize;
+                     minMaxBlock( values + start, std::min( partSize, count - start ), workerResults[worker] );
+                 }, nThreads );
+    for ( const MinMaxCount & partial : workerResults ) {
+        result.merge( partial );
+    }
+    return result;
+}
+
+template < typename Scalar >
+void
+histogramAddImpl( const Scalar * values, int64_t count, double minIntensity, double maxIntensity,
+                  int numberOfBins, uint32_t * bins, int nThreads )
+{
+    double intensityRange = std::fabs( maxIntensity - minIntensity );
+    if ( intensityRange == 0 || numberOfBins <= 0 ) {
+        bins[0] += minMaxCountImpl( values, count, nThreads ).finiteCount;
+        return;
+    }
+    int nParts = blockParts( count, nThreads );
+    if ( nParts <= 1 ) {
+        histogramBlock( values, count, minIntensity, intensityRange, numberOfBins, bins );
+        return;
+    }
+
+    // private bins for every thread, added up at the end
+    int64_t partSize = ( count + nParts - 1 ) / nParts;
+    std::vector < std::vector < uint32_t > > workerBins( parallelWorkers( nParts, nThreads ) );
+    parallelFor( nParts, [&] ( int part, int worker ) {
+                     std::vector < uint32_t > & own = workerBins[worker];
+                     if ( own.empty() ) {
+                         own.assign( numberOfBins + 1, 0 );
+                     }
+                     int64_t start = part * partSize;
+                     histogramBlock( values + start, std::min( partSize, count - start ), minIntensity,
+                                     intensityRange, numberOfBins, own.data() );
+                 }, nThreads );
+    for ( const std::vector < uint32_t > & own : workerBins ) {
+        for ( size_t b = 0 ; b < own.size() ; b++ ) {
+            bins[b] += own[b];
+        }
+    }
+}
+}
+
+void
+MinMaxCount::merge( const MinMaxCount & other )
+{
+    finiteCount += other.finiteCount;
+    nonFiniteCount += other.nonFiniteCount;
+    min = std::min( min, other.min );
+    max = std::max( max, other.max );
+}
+
+const char *
+minMaxHistogramIsa()
+{
+    switch ( isa() ) {
+    case Isa::AVX2:
+        return "avx2";
+    case Isa::SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+MinMaxCount
+minMaxCount( const float * values, int64_t count, int nThreads )
+{
+    return minMaxCountImpl( values, count, nThreads );
+}
+
+MinMaxCount
+minMaxCount( const double * values, int64_t count, int nThreads )
+{
+    return minMaxCountImpl( values, count, nThreads );
+}
+
+void
+histogramAdd( const float * values, int64_t count, double minIntensity, double maxIntensity,
+              int numberOfBins, uint32_t * bins, int nThreads )
+{
+    histogramAddImpl( values, count, minIntensity, maxIntensity, numberOfBins, bins, nThreads );
+}
+
+void
+histogramAdd( const double * values, int64_t count, double minIntensity, double maxIntensity,
+              int numberOfBins, uint32_t * bins, int nThreads )
+{
+    histogramAddImpl( values, count, minIntensity, maxIntensity, numberOfBins, bins, nThreads );
+}
+
+std::vector < uint32_t >
+histogram( const float * values, int64_t count, int numberOfBins, MinMaxCount & minMax, int nThreads )
+{
+    minMax = minMaxCount( values, count, nThreads );
+    if ( minMax.finiteCount == 0 ) {
+        return std::vector < uint32_t > ();
+    }
+    std::vector < uint32_t > bins( numberOfBins + 1, 0 );
+    histogramAdd( values, count, minMax.min, minMax.max, numberOfBins, bins.data(), nThreads );
+    return bins;
+}
+
+}
+}
+}
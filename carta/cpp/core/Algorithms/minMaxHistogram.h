@@ -0,0 +1,78 @@
+/**
+ * Min/max and histogram kernels over contiguous blocks of pixel values
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+/// extremes of the finite values of a block, and how many values were finite or not
+struct MinMaxCount {
+    int64_t finiteCount = 0;
+    int64_t nonFiniteCount = 0;
+    double min = std::numeric_limits < double >::infinity();
+    double max = -std::numeric_limits < double >::infinity();
+
+    /// add the values of another block
+    void
+    merge( const MinMaxCount & other );
+};
+
+/// the instruction set the kernels use on this CPU: "avx2", "sse2" or "scalar";
+/// it is picked at run time, the first time a kernel is called
+const char *
+minMaxHistogramIsa();
+
+/// min, max and the number of NaN and infinite values of a block in one pass
+/// \param values the block
+/// \param count number of values
+/// \param nThreads maximum number of threads, 0 means QThread::idealThreadCount();
+///        small blocks are done on the calling thread
+MinMaxCount
+minMaxCount( const float * values, int64_t count, int nThreads = 0 );
+
+MinMaxCount
+minMaxCount( const double * values, int64_t count, int nThreads = 0 );
+
+/// add the finite values of a block to a histogram; value v goes to bin
+/// round( numberOfBins * ( v - minIntensity ) / ( maxIntensity - minIntensity ) ),
+/// as in MinMaxPercentiles::pixels2histogram(), clamped to the bins
+/// \param values the block
+/// \param count number of values
+/// \param minIntensity the centre of the first bin
+/// \param maxIntensity the centre of the last bin; all the values go to the first bin
+///        if it is the same as minIntensity
+/// \param numberOfBins bins holds numberOfBins + 1 counts
+/// \param bins the counts to add to
+/// \param nThreads maximum number of threads, 0 means QThread::idealThreadCount();
+///        every thread counts into bins of its own, which are added up at the end
+void
+histogramAdd( const float * values, int64_t count, double minIntensity, double maxIntensity,
+              int numberOfBins, uint32_t * bins, int nThreads = 0 );
+
+void
+histogramAdd( const double * values, int64_t count, double minIntensity, double maxIntensity,
+              int numberOfBins, uint32_t * bins, int nThreads = 0 );
+
+/// histogram of a block in two passes: one for the extremes, one for the bins
+/// \param values the block
+/// \param count number of values
+/// \param numberOfBins the histogram has numberOfBins + 1 bins
+/// \param minMax set to the extremes and counts of the block
+/// \param nThreads maximum number of threads, 0 means QThread::idealThreadCount()
+/// \return the bins, empty if there are no finite values
+std::vector < uint32_t >
+histogram( const float * values, int64_t count, int numberOfBins, MinMaxCount & minMax, int nThreads = 0 );
+
+}
+}
+}
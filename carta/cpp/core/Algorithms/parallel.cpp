@@ -0,0 +1,62 @@
+/**
+ *
+ **/
+
+#include "parallel.h"
+
+#include <QThread>
+#include <QtConcurrent>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+int
+parallelWorkers( int count, int nThreads )
+{
+    if ( nThreads <= 0 ) {
+        nThreads = QThread::idealThreadCount();
+    }
+    return std::max( 1, std::min( nThreads, count ) );
+}
+
+void
+parallelFor( int count, const std::function < void (int index, int worker) > & func, int nThreads )
+{
+    if ( count <= 0 ) {
+        return;
+    }
+    int nWorkers = parallelWorkers( count, nThreads );
+    if ( nWorkers == 1 ) {
+        for ( int index = 0 ; index < count ; index++ ) {
+            func( index, 0 );
+        }
+        return;
+    }
+
+    std::atomic < int > nextIndex( 0 );
+    auto worker = [&] ( int id ) {
+        int index;
+        while ( ( index = nextIndex++ ) < count ) {
+            func( index, id );
+        }
+    };
+    std::vector < QFuture < void > > futures;
+    for ( int id = 1 ; id < nWorkers ; id++ ) {
+        futures.push_back( QtConcurrent::run( [&worker, id] () { worker( id ); } ) );
+    }
+    worker( 0 );
+    for ( auto & future : futures ) {
+        future.waitForFinished();
+    }
+} // parallelFor
+
+}
+}
+}
@@ -0,0 +1,36 @@
+/**
+ * Simple data parallel loops on top of the global thread pool
+ **/
+
+#pragma once
+
+#include <functional>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+/// number of workers parallelFor() will use for the given number of items
+/// \param count number of items
+/// \param nThreads maximum number of threads, 0 means QThread::idealThreadCount()
+int
+parallelWorkers( int count, int nThreads = 0 );
+
+/// call func(index, worker) for every index in [0, count)
+/// \param count number of items
+/// \param func the loop body, it gets called from multiple threads; worker is in
+///        [0, parallelWorkers(count, nThreads)) and no two calls with the same worker
+///        run at the same time, so it can be used to index per-thread accumulators
+/// \param nThreads maximum number of threads, 0 means QThread::idealThreadCount()
+///
+/// Items are handed out one at a time, so uneven item costs even out. The calling
+/// thread works as well, so we cannot starve if the pool is busy.
+void
+parallelFor( int count, const std::function < void (int index, int worker) > & func, int nThreads = 0 );
+
+}
+}
+}
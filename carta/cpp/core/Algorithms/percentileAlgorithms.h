@@ -8,6 +8,9 @@
 #include "CartaLib/IImage.h"
 #include "CartaLib/IntensityUnitConverter.h"
 #include "CartaLib/IPercentileCalculator.h"
+#include "percentileSelect.h"
+#include "parallel.h"
+#include "minMaxHistogram.h"
 
 #include <QDebug>
 #include <limits>
@@ -15,6 +18,7 @@
 #include <vector>
 #include <cmath>
 #include <numeric>
+#include <memory>
 #include <QElapsedTimer>
 
 typedef Carta::Lib::RegionHistogramData RegionHistogramData;
@@ -37,6 +41,23 @@ public:
         Carta::Lib::IntensityUnitConverter::SharedPtr converter,
         std::vector<double> hertzValues
     ) override;
+
+    /// set how much memory the algorithm may use, mostly for tests
+    /// \param inMemoryLimit views with at most this many values are copied to memory as a whole
+    /// \param maxCollect the largest number of values the streaming algorithm copies to memory at once
+    void setMemoryLimits(int64_t inMemoryLimit, int64_t maxCollect);
+
+private:
+    std::map<double, Scalar> streamingPercentile2pixels(
+        Carta::Lib::NdArray::TypedView < Scalar > & view,
+        const std::vector <double> & percentiles,
+        int spectralIndex,
+        Carta::Lib::IntensityUnitConverter::SharedPtr converter,
+        const std::vector<double> & hertzValues
+    );
+
+    int64_t m_inMemoryLimit = 16 * 1024 * 1024;
+    int64_t m_maxCollect = 4 * 1024 * 1024;
 };
 
 template <typename Scalar>
@@ -98,9 +119,8 @@ MinMaxPercentiles<Scalar>::MinMaxPercentiles() : Carta::Lib::IPercentilesToPixel
 /// Example: [0.1] will compute a value such that 10% of all values are smaller than the returned
 /// value.
 ///
-/// \note this is a dumb algorithm using quickselect. It really only works on datasets that
-/// are small enough to store in memory. For really big datasets we need a lot more sophisticated
-/// algorithm.
+/// \note small views are copied to memory and done with quickselect, views with more than
+/// m_inMemoryLimit values go through streamingPercentile2pixels() instead.
 ///
 /// \note NANs are treated as if they did not exist
 ///
@@ -129,6 +149,15 @@ PercentilesToPixels<Scalar>::percentile2pixels(
         qFatal("Cannot find intensities in these units: the conversion is frame-dependent and there is no spectral axis.");
     }
 
+    // big views are done in a couple of passes instead of copying them to memory
+    int64_t viewSize = 1;
+    for ( int dim : view.dims() ) {
+        viewSize *= dim;
+    }
+    if ( viewSize > m_inMemoryLimit ) {
+        return streamingPercentile2pixels( view, percentiles, spectralIndex, converter, hertzValues );
+    }
+
     // read in all values from the view into memory so that we can do quickselect on it
     std::vector < Scalar > allValues;
     double hertzVal;
@@ -147,18 +176,22 @@ PercentilesToPixels<Scalar>::percentile2pixels(
             Carta::Lib::NdArray::Double viewSlice = Carta::Lib::viewSliceForFrame(view, spectralIndex, f);
 
             // iterate over the frame
-            viewSlice.forEach([&allValues, &converter, &hertzVal](const Scalar & val) {
-                if ( std::isfinite( val ) ) {
-                    allValues.push_back( converter->_frameDependentConvert(val, hertzVal) );
+            viewSlice.forEachChunk([&allValues, &converter, &hertzVal](const double * values, int64_t count) {
+                for (int64_t i = 0; i < count; i++) {
+                    if ( std::isfinite( values[i] ) ) {
+                        allValues.push_back( converter->_frameDependentConvert(values[i], hertzVal) );
+                    }
                 }
             });
         }
     } else {
         // we don't have to do any conversions in the loop
         // and we can loop over the flat image
-        view.forEach([& allValues] ( const Scalar & val ) {
-            if ( std::isfinite( val ) ) {
-                allValues.push_back( val );
+        view.forEachChunk([& allValues] ( const Scalar * values, int64_t count ) {
+            for (int64_t i = 0; i < count; i++) {
+                if ( std::isfinite( values[i] ) ) {
+                    allValues.push_back( values[i] );
+                }
             }
         });
     }
@@ -191,6 +224,107 @@ PercentilesToPixels<Scalar>::percentile2pixels(
     return result;
 } // percentile2pixels
 
+template < typename Scalar >
+void
+PercentilesToPixels<Scalar>::setMemoryLimits( int64_t inMemoryLimit, int64_t maxCollect )
+{
+    m_inMemoryLimit = inMemoryLimit;
+    m_maxCollect = maxCollect;
+}
+
+/// same as percentile2pixels, but in bounded memory, see selectPercentiles()
+///
+/// \note the planes along the spectral axis are read in parallel, so the raw view needs
+/// to support reading different slices from different threads
+template < typename Scalar >
+std::map < double, Scalar >
+PercentilesToPixels<Scalar>::streamingPercentile2pixels(
+    Carta::Lib::NdArray::TypedView < Scalar > & view,
+    const std::vector < double > & percentiles,
+    int spectralIndex,
+    Carta::Lib::IntensityUnitConverter::SharedPtr converter,
+    const std::vector<double> & hertzValues
+)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool frameDependent = converter && converter->frameDependent;
+
+    // one view per plane, so that the planes can be scanned in parallel; the frame-dependent
+    // conversion needs the planes anyway
+    std::vector < std::unique_ptr < Carta::Lib::NdArray::TypedView < Scalar > > > planes;
+    int nFrames = 0;
+    if ( spectralIndex >= 0 && spectralIndex < int ( view.dims().size() ) ) {
+        nFrames = frameDependent ? hertzValues.size() : view.dims()[spectralIndex];
+    }
+    if ( nFrames > 1 || frameDependent ) {
+        for ( int f = 0 ; f < nFrames ; f++ ) {
+            SliceND frame;
+            for ( size_t d = 0 ; d < view.dims().size() ; d++ ) {
+                if ( int ( d ) == spectralIndex ) {
+                    frame.index( f );
+                }
+                else {
+                    frame.next();
+                }
+            }
+            planes.emplace_back( new Carta::Lib::NdArray::TypedView < Scalar > (
+                                     view.rawView()->getView( frame ), true ) );
+        }
+    }
+
+    const int nWorkers = planes.empty() ? 1 : parallelWorkers( planes.size() );
+    std::vector < std::vector < Scalar > > convertBuffers( nWorkers );
+    ChunkScanner < Scalar > scan = [&] ( const std::function < void (const Scalar *, int64_t, int) > & visit ) {
+        if ( planes.empty() ) {
+            if ( ! frameDependent ) {
+                view.forEachChunk( [&visit] ( const Scalar * values, int64_t count ) {
+                    visit( values, count, 0 );
+                } );
+            }
+            return;
+        }
+        parallelFor( planes.size(), [&] ( int f, int worker ) {
+            planes[f]->forEachChunk( [&] ( const Scalar * values, int64_t count ) {
+                if ( ! frameDependent ) {
+                    visit( values, count, worker );
+                    return;
+                }
+                std::vector < Scalar > & converted = convertBuffers[worker];
+                converted.resize( count );
+                for ( int64_t i = 0 ; i < count ; i++ ) {
+                    converted[i] = std::isfinite( values[i] )
+                                   ? converter->_frameDependentConvert( values[i], hertzValues[f] )
+                                   : values[i];
+                }
+                visit( converted.data(), count, worker );
+            } );
+        }, nWorkers );
+    };
+
+    uint64_t count = 0;
+    std::vector < Scalar > values = selectPercentiles < Scalar > ( scan, nWorkers, percentiles, m_maxCollect, count );
+
+    // indicate bad clip if no finite numbers were found
+    if ( count == 0 ) {
+        qFatal( "The size of raw data is zero !!" );
+    }
+
+    std::map < double, Scalar > result;
+    for ( size_t i = 0 ; i < percentiles.size() ; i++ ) {
+        result[percentiles[i]] = values[i];
+    }
+
+    int elapsedTime = timer.elapsed();
+    if (CARTA_RUNTIME_CHECKS) {
+        qCritical() << "<> Time to calculate the precise percentile in" << planes.size() << "planes:"
+                    << elapsedTime << "ms";
+    }
+
+    return result;
+} // streamingPercentile2pixels
+
 
 template < typename Scalar >
 std::vector<double>
@@ -231,6 +365,11 @@ PixelsToPercentiles<Scalar>::pixels2percentiles(
         
         return;
     };
+    auto chunk_lambda = [&view_lambda](const double * values, int64_t count) {
+        for (int64_t i = 0; i < count; i++) {
+            view_lambda(values[i]);
+        }
+    };
 
     if (converter) {
         // Divide the target intensities by the multiplier
@@ -248,16 +387,16 @@ PixelsToPercentiles<Scalar>::pixels2percentiles(
 
                 Carta::Lib::NdArray::Double viewSlice = Carta::Lib::viewSliceForFrame(view, spectralIndex, f);
                 
-                viewSlice.forEach(view_lambda);
+                viewSlice.forEachChunk(chunk_lambda);
             }
 
         } else { // not frame-dependent; calculate the target intensities once; iterate over flat image
             target_intensities = divided_intensities;
-            view.forEach(view_lambda);
+            view.forEachChunk(chunk_lambda);
         }
     } else { // no conversion; iterate over flat image
         target_intensities = intensities;
-        view.forEach(view_lambda);
+        view.forEachChunk(chunk_lambda);
     } 
 
     for (size_t i = 0; i < intensities.size(); i++) { // calculate the percentages
@@ -324,21 +463,24 @@ MinMaxPercentiles<Scalar>::percentile2pixels(
             Carta::Lib::NdArray::Double viewSlice = Carta::Lib::viewSliceForFrame(view, spectralIndex, f);
 
             // iterate over the frame
-            viewSlice.forEach([&minPixel, &maxPixel, &converter, &hertzVal, &convertedVal] ( const Scalar &val ) {
-                if ( std::isfinite( val ) ) {
-                    convertedVal = converter->_frameDependentConvert(val, hertzVal);
-                    minPixel = std::min(minPixel, convertedVal);
-                    maxPixel = std::max(maxPixel, convertedVal);
+            viewSlice.forEachChunk([&minPixel, &maxPixel, &converter, &hertzVal, &convertedVal] ( const double * values, int64_t count ) {
+                for (int64_t i = 0; i < count; i++) {
+                    if ( std::isfinite( values[i] ) ) {
+                        convertedVal = converter->_frameDependentConvert(values[i], hertzVal);
+                        minPixel = std::min(minPixel, convertedVal);
+                        maxPixel = std::max(maxPixel, convertedVal);
+                    }
                 }
             });
         }
     } else {
         // we don't have to do any conversions in the loop
         // and we can loop over the flat image
-        view.forEach([&minPixel, &maxPixel] ( const Scalar &val ) {
-            if ( std::isfinite( val ) ) {
-                minPixel = std::min(minPixel, val);
-                maxPixel = std::max(maxPixel, val);
+        view.forEachChunk([&minPixel, &maxPixel] ( const Scalar * values, int64_t count ) {
+            MinMaxCount chunk = minMaxCount( values, count );
+            if ( chunk.finiteCount > 0 ) {
+                minPixel = std::min<Scalar>(minPixel, chunk.min);
+                maxPixel = std::max<Scalar>(maxPixel, chunk.max);
             }
         });
     }
@@ -407,21 +549,20 @@ RegionHistogramData MinMaxPercentiles<Scalar>::pixels2histogram(
             Carta::Lib::NdArray::Double viewSlice = Carta::Lib::viewSliceForFrame(view, spectralIndex, f);
 
             // iterate over the frame
-            viewSlice.forEach([&bins, &pixelIndex, &minIntensity, &numberOfBins, &intensityRange, &converter, &hertzVal] (const Scalar &val) {
-                if (std::isfinite(val)) {
-                    pixelIndex = static_cast<unsigned int>(round(numberOfBins * (converter->_frameDependentConvert(val, hertzVal) - minIntensity) / intensityRange));
-                    bins[pixelIndex]++;
+            viewSlice.forEachChunk([&bins, &pixelIndex, &minIntensity, &numberOfBins, &intensityRange, &converter, &hertzVal] (const double * values, int64_t count) {
+                for (int64_t i = 0; i < count; i++) {
+                    if (std::isfinite(values[i])) {
+                        pixelIndex = static_cast<unsigned int>(round(numberOfBins * (converter->_frameDependentConvert(values[i], hertzVal) - minIntensity) / intensityRange));
+                        bins[pixelIndex]++;
+                    }
                 }
             });
         }
     } else {
         // we don't have to do any conversions in the loop
         // and we can loop over the flat image
-        view.forEach([&bins, &pixelIndex, &minIntensity, &numberOfBins, &intensityRange] (const Scalar &val) {
-            if (std::isfinite(val)) {
-                pixelIndex = static_cast<unsigned int>(round(numberOfBins * (val - minIntensity) / intensityRange));
-                bins[pixelIndex]++;
-            }
+        view.forEachChunk([&bins, &minIntensity, &maxIntensity, &numberOfBins] (const Scalar * values, int64_t count) {
+            histogramAdd(values, count, minIntensity, maxIntensity, numberOfBins, bins.data());
         });
     }
 
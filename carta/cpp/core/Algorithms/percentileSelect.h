@@ -0,0 +1,246 @@
+/**
+ * Exact percentiles of datasets that do not fit in memory
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+/// function that calls its argument with every value of a dataset, in chunks; it may call
+/// it from several threads at once, worker identifies the calling thread and is smaller
+/// than the number of workers given to selectPercentiles()
+template < typename Scalar >
+using ChunkScanner = std::function < void (
+                                         const std::function < void (const Scalar * values, int64_t count,
+                                                                     int worker) > & visit ) >;
+
+/// exact percentiles using a bounded amount of memory
+/// \param scan supplies the values, non-finite values are ignored
+/// \param nWorkers number of distinct workers scan uses
+/// \param percentiles which percentiles to compute, in [0, 1]
+/// \param maxCollect the largest number of values that are copied to memory at once
+/// \param count set to the number of finite values
+/// \return the value for each of the percentiles, same rank convention as PercentilesToPixels
+///
+/// This is a radix select on the bit patterns of the values: the bit pattern of a float
+/// can be turned into an unsigned integer that sorts like the float, so a histogram over
+/// the top 16 bits of that integer tells us which bucket holds each requested rank without
+/// knowing the range of the data. Buckets that are small enough are then collected in one
+/// more pass and the rank is selected exactly among them; large buckets (lots of identical
+/// or very close values) are split again by the next 16 bits instead. Floats need at most
+/// three passes, doubles at most five, and the memory used does not depend on the size of
+/// the dataset.
+template < typename Scalar >
+std::vector < Scalar >
+selectPercentiles( const ChunkScanner < Scalar > & scan,
+                   int nWorkers,
+                   const std::vector < double > & percentiles,
+                   int64_t maxCollect,
+                   uint64_t & count )
+{
+    static_assert( std::is_floating_point < Scalar >::value, "selectPercentiles needs floating point values" );
+    typedef typename std::conditional < sizeof( Scalar ) == 8, uint64_t, uint32_t >::type Key;
+    const int keyBits = 8 * sizeof( Key );
+    const Key signBit = Key( 1 ) << ( keyBits - 1 );
+    const int digitBits = 16;
+
+    // order preserving map between values and keys
+    auto toKey = [signBit] ( Scalar value ) {
+        Key bits;
+        std::memcpy( & bits, & value, sizeof( bits ) );
+        return ( bits & signBit ) ? Key( ~bits ) : Key( bits | signBit );
+    };
+    auto fromKey = [signBit] ( Key key ) {
+        Key bits = ( key & signBit ) ? Key( key & ~signBit ) : Key( ~key );
+        Scalar value;
+        std::memcpy( & value, & bits, sizeof( value ) );
+        return value;
+    };
+
+    /// values sharing the top 'bits' bits of their key with 'prefix'; we either take a
+    /// histogram of their next digit or collect them
+    struct Group {
+        Key prefix = 0;
+        int bits = 0;
+        int digit = 0;
+        bool collect = false;
+        std::vector < std::vector < uint64_t > > histograms; // per worker
+        std::vector < std::vector < Scalar > > values;       // per worker
+    };
+
+    /// a requested rank and the bucket it is known to be in
+    struct Target {
+        uint64_t rank = 0;
+        Key prefix = 0;
+        int bits = 0;
+        uint64_t bucketCount = 0;
+        bool done = false;
+        Scalar value = 0;
+    };
+
+    std::vector < Target > targets( percentiles.size() );
+    std::vector < Scalar > result( percentiles.size(), Scalar( 0 ) );
+    nWorkers = std::max( 1, nWorkers );
+    count = 0;
+
+    auto runPass = [&] ( std::vector < Group > & groups ) {
+        for ( auto & group : groups ) {
+            if ( group.collect ) {
+                group.values.resize( nWorkers );
+            }
+            else {
+                group.histograms.assign( nWorkers, std::vector < uint64_t > ( size_t( 1 ) << group.digit, 0 ) );
+            }
+        }
+        scan( [&] ( const Scalar * values, int64_t n, int worker ) {
+                  for ( auto & group : groups ) {
+                      const int shift = keyBits - group.bits;
+                      const int digitShift = shift - group.digit;
+                      const Key digitMask = ( Key( 1 ) << group.digit ) - 1;
+                      uint64_t * histogram = group.collect ? nullptr : group.histograms[worker].data();
+                      std::vector < Scalar > * collected = group.collect ? & group.values[worker] : nullptr;
+                      for ( int64_t i = 0 ; i < n ; i++ ) {
+                          const Scalar v = values[i];
+                          // v - v is NaN for infinities and NaNs
+                          if ( ! ( v - v == 0 ) ) {
+                              continue;
+                          }
+                          const Key key = toKey( v );
+                          if ( group.bits > 0 && Key( key >> shift ) != group.prefix ) {
+                              continue;
+                          }
+                          if ( histogram ) {
+                              histogram[( key >> digitShift ) & digitMask]++;
+                          }
+                          else {
+                              collected-> push_back( v );
+                          }
+                      }
+                  }
+              } );
+    };
+
+    // first pass: histogram of the top digit of everything
+    std::vector < Group > groups( 1 );
+    groups[0].digit = digitBits;
+    bool first = true;
+
+    while ( true ) {
+        runPass( groups );
+
+        for ( auto & group : groups ) {
+            if ( group.collect ) {
+                // select exactly among the collected values
+                std::vector < Scalar > all;
+                for ( auto & values : group.values ) {
+                    all.insert( all.end(), values.begin(), values.end() );
+                    std::vector < Scalar > ().swap( values );
+                }
+                for ( auto & target : targets ) {
+                    if ( target.done || target.bits != group.bits || target.prefix != group.prefix ) {
+                        continue;
+                    }
+                    std::nth_element( all.begin(), all.begin() + target.rank, all.end() );
+                    target.value = all[target.rank];
+                    target.done = true;
+                }
+                continue;
+            }
+
+            std::vector < uint64_t > histogram( group.histograms[0] );
+            for ( int w = 1 ; w < nWorkers ; w++ ) {
+                for ( size_t b = 0 ; b < histogram.size() ; b++ ) {
+                    histogram[b] += group.histograms[w][b];
+                }
+            }
+            group.histograms.clear();
+
+            if ( first ) {
+                // now we know how many values there are, so we can work out the ranks
+                first = false;
+                for ( auto h : histogram ) {
+                    count += h;
+                }
+                if ( count == 0 ) {
+                    return result;
+                }
+                for ( size_t i = 0 ; i < percentiles.size() ; i++ ) {
+                    // same rounding as the in-memory algorithm
+                    uint64_t x1 = std::min < uint64_t > ( std::max < uint64_t > ( uint64_t( count * percentiles[i] ), 1 ), count ) - 1;
+                    targets[i].rank = x1;
+                }
+            }
+
+            // find the bucket of every target of this group
+            for ( auto & target : targets ) {
+                if ( target.done || target.bits != group.bits || target.prefix != group.prefix ) {
+                    continue;
+                }
+                uint64_t below = 0;
+                size_t bucket = 0;
+                while ( below + histogram[bucket] <= target.rank ) {
+                    below += histogram[bucket];
+                    bucket++;
+                }
+                target.rank -= below;
+                target.prefix = Key( ( group.bits > 0 ? Key( group.prefix << group.digit ) : Key( 0 ) ) | Key( bucket ) );
+                target.bits = group.bits + group.digit;
+                target.bucketCount = histogram[bucket];
+                if ( target.bits == keyBits ) {
+                    // all the values in the bucket are the same
+                    target.value = fromKey( target.prefix );
+                    target.done = true;
+                }
+            }
+        }
+
+        // set up the next pass, targets in the same bucket share a group
+        std::vector < Group > next;
+        for ( auto & target : targets ) {
+            if ( target.done ) {
+                continue;
+            }
+            bool found = false;
+            for ( auto & group : next ) {
+                if ( group.bits == target.bits && group.prefix == target.prefix ) {
+                    found = true;
+                    break;
+                }
+            }
+            if ( found ) {
+                continue;
+            }
+            Group group;
+            group.prefix = target.prefix;
+            group.bits = target.bits;
+            group.digit = std::min( digitBits, keyBits - target.bits );
+            group.collect = int64_t( target.bucketCount ) <= maxCollect;
+            next.push_back( std::move( group ) );
+        }
+        if ( next.empty() ) {
+            break;
+        }
+        groups.swap( next );
+    }
+
+    for ( size_t i = 0 ; i < targets.size() ; i++ ) {
+        result[i] = targets[i].value;
+    }
+    return result;
+} // selectPercentiles
+
+}
+}
+}
@@ -0,0 +1,145 @@
+/**
+ *
+ **/
+
+#include "regionStatistics.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+namespace
+{
+/// regions with fewer pixels are not worth splitting between threads
+const int64_t PARALLEL_MIN_PIXELS = 1 << 20;
+
+/// add the values of one run to the moments
+inline void
+accumulateRun( const float * values, int64_t n, RegionMoments & moments )
+{
+    int64_t i = 0;
+#ifdef __SSE2__
+    if ( n >= 8 ) {
+        // as in the downsampling, x - x is 0 only for finite x; non-finite values
+        // become 0 for the sums and +-inf for the extremes. The sums are kept in
+        // double precision, the counts of a run are exact in float
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps( 1.0f );
+        const __m128 inf = _mm_set1_ps( std::numeric_limits < float >::infinity() );
+        const __m128 negInf = _mm_set1_ps( -std::numeric_limits < float >::infinity() );
+        __m128 count = zero;
+        __m128 lowest = inf;
+        __m128 highest = negInf;
+        __m128d sumLo = _mm_setzero_pd(), sumHi = _mm_setzero_pd();
+        __m128d sqLo = _mm_setzero_pd(), sqHi = _mm_setzero_pd();
+        for ( ; i + 4 <= n ; i += 4 ) {
+            __m128 v = _mm_loadu_ps( values + i );
+            __m128 finite = _mm_cmpeq_ps( _mm_sub_ps( v, v ), zero );
+            __m128 fv = _mm_and_ps( finite, v );
+            count = _mm_add_ps( count, _mm_and_ps( finite, one ) );
+            lowest = _mm_min_ps( lowest, _mm_or_ps( fv, _mm_andnot_ps( finite, inf ) ) );
+            highest = _mm_max_ps( highest, _mm_or_ps( fv, _mm_andnot_ps( finite, negInf ) ) );
+            __m128d lo = _mm_cvtps_pd( fv );
+            __m128d hi = _mm_cvtps_pd( _mm_movehl_ps( fv, fv ) );
+            sumLo = _mm_add_pd( sumLo, lo );
+            sumHi = _mm_add_pd( sumHi, hi );
+            sqLo = _mm_add_pd( sqLo, _mm_mul_pd( lo, lo ) );
+            sqHi = _mm_add_pd( sqHi, _mm_mul_pd( hi, hi ) );
+        }
+
+        float counts[4], lows[4], highs[4];
+        double sums[2], sqs[2];
+        _mm_storeu_ps( counts, count );
+        _mm_storeu_ps( lows, lowest );
+        _mm_storeu_ps( highs, highest );
+        _mm_storeu_pd( sums, _mm_add_pd( sumLo, sumHi ) );
+        _mm_storeu_pd( sqs, _mm_add_pd( sqLo, sqHi ) );
+        for ( int k = 0 ; k < 4 ; k++ ) {
+            moments.count += int64_t( counts[k] );
+            moments.min = std::min < double > ( moments.min, lows[k] );
+            moments.max = std::max < double > ( moments.max, highs[k] );
+        }
+        moments.sum += sums[0] + sums[1];
+        moments.sumSq += sqs[0] + sqs[1];
+    }
+#endif
+    for ( ; i < n ; i++ ) {
+        moments.add( values[i] );
+    }
+} // accumulateRun
+}
+
+void
+RegionMoments::merge( const RegionMoments & other )
+{
+    count += other.count;
+    sum += other.sum;
+    sumSq += other.sumSq;
+    min = std::min( min, other.min );
+    max = std::max( max, other.max );
+}
+
+int64_t
+runPixels( const std::vector < PixelRun > & runs )
+{
+    int64_t pixels = 0;
+    for ( const PixelRun & run : runs ) {
+        pixels += run.length;
+    }
+    return pixels;
+}
+
+RegionMoments
+regionMoments( const float * plane, const std::vector < PixelRun > & runs, int nThreads )
+{
+    int64_t pixels = runPixels( runs );
+    int nParts = std::min < int64_t > ( parallelWorkers( runs.size(), nThreads ) * 4,
+                                        pixels / PARALLEL_MIN_PIXELS * 4 );
+    if ( nParts <= 1 ) {
+        RegionMoments moments;
+        for ( const PixelRun & run : runs ) {
+            accumulateRun( plane + run.offset, run.length, moments );
+        }
+        return moments;
+    }
+
+    // split the runs into parts of about the same number of pixels
+    std::vector < size_t > starts( 1, 0 );
+    int64_t partPixels = ( pixels + nParts - 1 ) / nParts;
+    int64_t inPart = 0;
+    for ( size_t r = 0 ; r < runs.size() ; r++ ) {
+        if ( inPart >= partPixels ) {
+            starts.push_back( r );
+            inPart = 0;
+        }
+        inPart += runs[r].length;
+    }
+    starts.push_back( runs.size() );
+
+    std::vector < RegionMoments > workerMoments( parallelWorkers( starts.size() - 1, nThreads ) );
+    parallelFor( starts.size() - 1, [&] ( int part, int worker ) {
+                     for ( size_t r = starts[part] ; r < starts[part + 1] ; r++ ) {
+                         accumulateRun( plane + runs[r].offset, runs[r].length, workerMoments[worker] );
+                     }
+                 }, nThreads );
+
+    RegionMoments moments;
+    for ( const RegionMoments & partial : workerMoments ) {
+        moments.merge( partial );
+    }
+    return moments;
+} // regionMoments
+
+}
+}
+}
@@ -0,0 +1,70 @@
+/**
+ * Statistics of the pixels of a region in one plane
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+/// consecutive pixels of a row that lie inside a region
+struct PixelRun {
+    /// offset of the first pixel in the plane
+    int64_t offset;
+
+    /// number of pixels
+    int32_t length;
+};
+
+/// count, sums and extremes of the finite values of a region, which all the statistics
+/// of the region are derived from
+struct RegionMoments {
+    int64_t count = 0;
+    double sum = 0;
+    double sumSq = 0;
+    double min = std::numeric_limits < double >::infinity();
+    double max = -std::numeric_limits < double >::infinity();
+
+    /// add one value, NaN and infinite values are skipped
+    void
+    add( float value )
+    {
+        if ( std::isfinite( value ) ) {
+            count++;
+            sum += value;
+            sumSq += double ( value ) * value;
+            min = std::min < double > ( min, value );
+            max = std::max < double > ( max, value );
+        }
+    }
+
+    /// add the moments of other pixels
+    void
+    merge( const RegionMoments & other );
+};
+
+/// number of pixels covered by the runs
+int64_t
+runPixels( const std::vector < PixelRun > & runs );
+
+/// the moments of the pixels of a region in one fused pass over the plane
+/// \param plane the values, indexed by the offsets of the runs
+/// \param runs the pixels of the region
+/// \param nThreads maximum number of threads, 0 means QThread::idealThreadCount();
+///        small regions are done on the calling thread
+RegionMoments
+regionMoments( const float * plane, const std::vector < PixelRun > & runs, int nThreads = 0 );
+
+}
+}
+}
@@ -0,0 +1,303 @@
+/**
+ *
+ **/
+
+#include "smoothing.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+namespace
+{
+/// scratch space of one worker
+struct Scratch
+{
+    std::vector < float > values, weights;
+    std::vector < float > rowValues, rowWeights;
+    std::vector < double > sumValues, sumWeights;
+};
+
+/// splits the plane into bands of output rows; every band also reads radius rows above
+/// and below it, so bands get taller with the radius to keep that overhead down
+int
+bandHeight( int radius )
+{
+    return std::max( 64, 4 * radius );
+}
+
+/// finite values, with 0 for the others, and 1 or 0 for whether they are finite
+inline void
+splitRow( const float * in, int64_t n, float * values, float * weights )
+{
+    int64_t i = 0;
+#ifdef __SSE2__
+    // x - x is 0 for finite x and NaN otherwise
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps( 1.0f );
+    for ( ; i + 4 <= n ; i += 4 ) {
+        __m128 v = _mm_loadu_ps( in + i );
+        __m128 finite = _mm_cmpeq_ps( _mm_sub_ps( v, v ), zero );
+        _mm_storeu_ps( values + i, _mm_and_ps( finite, v ) );
+        _mm_storeu_ps( weights + i, _mm_and_ps( finite, one ) );
+    }
+#endif
+    for ( ; i < n ; i++ ) {
+        bool finite = std::isfinite( in[i] );
+        values[i] = finite ? in[i] : 0.0f;
+        weights[i] = finite ? 1.0f : 0.0f;
+    }
+}
+
+/// y += a * x
+inline void
+axpy( float * y, const float * x, float a, int64_t n )
+{
+    int64_t i = 0;
+#ifdef __SSE2__
+    const __m128 va = _mm_set1_ps( a );
+    for ( ; i + 4 <= n ; i += 4 ) {
+        __m128 vy = _mm_loadu_ps( y + i );
+        _mm_storeu_ps( y + i, _mm_add_ps( vy, _mm_mul_ps( va, _mm_loadu_ps( x + i ) ) ) );
+    }
+#endif
+    for ( ; i < n ; i++ ) {
+        y[i] += a * x[i];
+    }
+}
+
+/// y += a * x, summed up in double so that running sums do not drift
+inline void
+axpyDouble( double * y, const float * x, double a, int64_t n )
+{
+    int64_t i = 0;
+#ifdef __SSE2__
+    const __m128d va = _mm_set1_pd( a );
+    for ( ; i + 4 <= n ; i += 4 ) {
+        __m128 vx = _mm_loadu_ps( x + i );
+        __m128d lo = _mm_cvtps_pd( vx );
+        __m128d hi = _mm_cvtps_pd( _mm_movehl_ps( vx, vx ) );
+        _mm_storeu_pd( y + i, _mm_add_pd( _mm_loadu_pd( y + i ), _mm_mul_pd( va, lo ) ) );
+        _mm_storeu_pd( y + i + 2, _mm_add_pd( _mm_loadu_pd( y + i + 2 ), _mm_mul_pd( va, hi ) ) );
+    }
+#endif
+    for ( ; i < n ; i++ ) {
+        y[i] += a * x[i];
+    }
+}
+
+/// the weighted mean, NaN where the input is not finite
+template < typename Sum >
+inline void
+divideRow( const float * in, const Sum * values, const Sum * weights, int64_t n, float * out )
+{
+    for ( int64_t i = 0 ; i < n ; i++ ) {
+        out[i] = std::isfinite( in[i] ) && weights[i] > 0 ? float( values[i] / weights[i] ) : NAN;
+    }
+}
+
+/// smoothSeparable() for output rows [y0, y1)
+void
+separableBand( const float * in, int width, int height, const std::vector < float > & kernel,
+               float * out, int y0, int y1, Scratch & scratch )
+{
+    const int radius = kernel.size() / 2;
+    const int ya = std::max( 0, y0 - radius );
+    const int yb = std::min( height, y1 + radius );
+
+    // along the rows, all the taps of one weight at once over contiguous memory; the
+    // taps that would fall off either end of the row are left out
+    scratch.rowValues.assign( int64_t( yb - ya ) * width, 0.0f );
+    scratch.rowWeights.assign( int64_t( yb - ya ) * width, 0.0f );
+    scratch.values.resize( width );
+    scratch.weights.resize( width );
+    for ( int y = ya ; y < yb ; y++ ) {
+        splitRow( in + int64_t( y ) * width, width, scratch.values.data(), scratch.weights.data() );
+        float * rowValues = scratch.rowValues.data() + int64_t( y - ya ) * width;
+        float * rowWeights = scratch.rowWeights.data() + int64_t( y - ya ) * width;
+        for ( int k = 0 ; k < int( kernel.size() ) ; k++ ) {
+            int offset = k - radius;
+            int x0 = std::max( 0, - offset );
+            int x1 = std::min( width, width - offset );
+            if ( x1 <= x0 ) {
+                continue;
+            }
+            axpy( rowValues + x0, scratch.values.data() + x0 + offset, kernel[k], x1 - x0 );
+            axpy( rowWeights + x0, scratch.weights.data() + x0 + offset, kernel[k], x1 - x0 );
+        }
+    }
+
+    // along the columns, whole rows at a time
+    for ( int y = y0 ; y < y1 ; y++ ) {
+        std::fill( scratch.values.begin(), scratch.values.end(), 0.0f );
+        std::fill( scratch.weights.begin(), scratch.weights.end(), 0.0f );
+        for ( int k = 0 ; k < int( kernel.size() ) ; k++ ) {
+            int row = y + k - radius;
+            if ( row < 0 || row >= height ) {
+                continue;
+            }
+            axpy( scratch.values.data(), scratch.rowValues.data() + int64_t( row - ya ) * width, kernel[k], width );
+            axpy( scratch.weights.data(), scratch.rowWeights.data() + int64_t( row - ya ) * width, kernel[k], width );
+        }
+        divideRow( in + int64_t( y ) * width, scratch.values.data(), scratch.weights.data(), width,
+                   out + int64_t( y ) * width );
+    }
+} // separableBand
+
+/// smoothBox() for output rows [y0, y1), the box covers [x - radius, x + radius]; with
+/// halfEnds the pixels on its edges count half, for an even size that is centred
+void
+boxBand( const float * in, int width, int height, int radius, bool halfEnds, float * out, int y0, int y1,
+         Scratch & scratch )
+{
+    const int ya = std::max( 0, y0 - radius );
+    const int yb = std::min( height, y1 + radius );
+    const double endWeight = halfEnds ? 0.5 : 0.0;
+
+    // along the rows: a window sliding over each row
+    scratch.rowValues.resize( int64_t( yb - ya ) * width );
+    scratch.rowWeights.resize( int64_t( yb - ya ) * width );
+    scratch.values.resize( width );
+    scratch.weights.resize( width );
+    for ( int y = ya ; y < yb ; y++ ) {
+        const float * values = scratch.values.data();
+        const float * weights = scratch.weights.data();
+        splitRow( in + int64_t( y ) * width, width, scratch.values.data(), scratch.weights.data() );
+        float * rowValues = scratch.rowValues.data() + int64_t( y - ya ) * width;
+        float * rowWeights = scratch.rowWeights.data() + int64_t( y - ya ) * width;
+        double sumValues = 0, sumWeights = 0;
+        for ( int x = 0 ; x < std::min( radius, width ) ; x++ ) {
+            sumValues += values[x];
+            sumWeights += weights[x];
+        }
+        for ( int x = 0 ; x < width ; x++ ) {
+            double endValues = 0, endWeights = 0;
+            if ( x + radius < width ) {
+                sumValues += values[x + radius];
+                sumWeights += weights[x + radius];
+                endValues += values[x + radius];
+                endWeights += weights[x + radius];
+            }
+            if ( x - radius >= 0 ) {
+                endValues += values[x - radius];
+                endWeights += weights[x - radius];
+            }
+            rowValues[x] = sumValues - endWeight * endValues;
+            rowWeights[x] = sumWeights - endWeight * endWeights;
+            if ( x - radius >= 0 ) {
+                sumValues -= values[x - radius];
+                sumWeights -= weights[x - radius];
+            }
+        }
+    }
+
+    // along the columns: whole rows enter and leave the window, the rows on its edges
+    // count half while the output row is divided out
+    scratch.sumValues.assign( width, 0.0 );
+    scratch.sumWeights.assign( width, 0.0 );
+    auto addRow = [&] ( int row, double weight ) {
+        if ( row < 0 || row >= height ) {
+            return;
+        }
+        axpyDouble( scratch.sumValues.data(), scratch.rowValues.data() + int64_t( row - ya ) * width, weight, width );
+        axpyDouble( scratch.sumWeights.data(), scratch.rowWeights.data() + int64_t( row - ya ) * width, weight, width );
+    };
+    for ( int row = ya ; row < std::min( height, y0 + radius ) ; row++ ) {
+        addRow( row, 1.0 );
+    }
+    for ( int y = y0 ; y < y1 ; y++ ) {
+        addRow( y + radius, 1.0 );
+        if ( halfEnds ) {
+            addRow( y - radius, - 0.5 );
+            addRow( y + radius, - 0.5 );
+        }
+        divideRow( in + int64_t( y ) * width, scratch.sumValues.data(), scratch.sumWeights.data(), width,
+                   out + int64_t( y ) * width );
+        if ( halfEnds ) {
+            addRow( y - radius, 0.5 );
+            addRow( y + radius, 0.5 );
+        }
+        addRow( y - radius, - 1.0 );
+    }
+} // boxBand
+
+/// runs band() on every band of the plane
+void
+forEachBand( int height, int radius, int nThreads,
+             const std::function < void (int y0, int y1, Scratch & scratch) > & band )
+{
+    const int rows = bandHeight( radius );
+    const int nBands = ( height + rows - 1 ) / rows;
+    std::vector < Scratch > scratch( parallelWorkers( nBands, nThreads ) );
+    parallelFor( nBands, [&] ( int index, int worker ) {
+                     int y0 = index * rows;
+                     band( y0, std::min( height, y0 + rows ), scratch[worker] );
+                 }, nThreads );
+}
+}
+
+std::vector < float >
+gaussianKernel( double sigma, int radius )
+{
+    if ( radius < 0 ) {
+        radius = std::ceil( 3 * sigma );
+    }
+    std::vector < float > kernel( 2 * radius + 1 );
+    if ( sigma <= 0 ) {
+        kernel[radius] = 1;
+        return kernel;
+    }
+    double sum = 0;
+    std::vector < double > weights( kernel.size() );
+    for ( int k = - radius ; k <= radius ; k++ ) {
+        weights[k + radius] = std::exp( - 0.5 * k * k / ( sigma * sigma ) );
+        sum += weights[k + radius];
+    }
+    for ( size_t k = 0 ; k < kernel.size() ; k++ ) {
+        kernel[k] = weights[k] / sum;
+    }
+    return kernel;
+}
+
+void
+smoothSeparable( const float * in, int width, int height, const std::vector < float > & kernel,
+                 float * out, int nThreads )
+{
+    if ( width <= 0 || height <= 0 || kernel.empty() ) {
+        return;
+    }
+    forEachBand( height, kernel.size() / 2, nThreads, [&] ( int y0, int y1, Scratch & scratch ) {
+                     separableBand( in, width, height, kernel, out, y0, y1, scratch );
+                 } );
+}
+
+void
+smoothBox( const float * in, int width, int height, int size, float * out, int nThreads )
+{
+    if ( width <= 0 || height <= 0 ) {
+        return;
+    }
+    size = std::max( 1, size );
+    const int radius = size / 2;
+    const bool halfEnds = size % 2 == 0;
+    forEachBand( height, radius, nThreads, [&] ( int y0, int y1, Scratch & scratch ) {
+                     boxBand( in, width, height, radius, halfEnds, out, y0, y1, scratch );
+                 } );
+}
+
+}
+}
+}
@@ -0,0 +1,55 @@
+/**
+ * Smoothing of image planes, e.g. before computing contours
+ **/
+
+#pragma once
+
+#include <vector>
+
+namespace Carta
+{
+namespace Core
+{
+namespace Algorithms
+{
+
+/// normalized 1D gaussian
+/// \param sigma standard deviation in pixels
+/// \param radius number of taps on either side of the centre, -1 for ceil(3 * sigma)
+/// \return 2 * radius + 1 weights summing up to 1
+std::vector < float >
+gaussianKernel( double sigma, int radius = - 1 );
+
+/// convolution of a plane with a separable kernel, the same 1D kernel along the rows
+/// and along the columns
+/// \param in the plane, row-major
+/// \param width width of the plane
+/// \param height height of the plane
+/// \param kernel 1D kernel of odd size, centred on the middle weight
+/// \param out output, width * height floats, must not overlap in
+/// \param nThreads number of threads to use, 0 means QThread::idealThreadCount()
+///
+/// Non-finite values and pixels outside the plane are left out and the weights of the
+/// remaining ones are renormalized, so the border is not darkened and NaN holes do not
+/// grow. Pixels that are not finite in the input are NaN in the output.
+void
+smoothSeparable( const float * in, int width, int height, const std::vector < float > & kernel,
+                 float * out, int nThreads = 0 );
+
+/// mean over a size x size box, with running sums, so that the cost does not depend on
+/// the size
+/// \param in the plane, row-major
+/// \param width width of the plane
+/// \param height height of the plane
+/// \param size width and height of the box; an even box is kept centred on the pixel by
+///        covering size + 1 pixels with the ones on its edges counting half
+/// \param out output, width * height floats, must not overlap in
+/// \param nThreads number of threads to use, 0 means QThread::idealThreadCount()
+///
+/// Non-finite values and the border are handled as by smoothSeparable().
+void
+smoothBox( const float * in, int width, int height, int size, float * out, int nThreads = 0 );
+
+}
+}
+}
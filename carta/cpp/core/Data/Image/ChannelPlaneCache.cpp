@@ -0,0 +1,226 @@
+#include "ChannelPlaneCache.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <algorithm>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+/// reading ahead mostly waits for the disk, the planes of all the open files are read
+/// one at a time
+QThreadPool* _prefetchPool(){
+    static QThreadPool* pool = nullptr;
+    static QMutex mutex;
+    QMutexLocker locker( &mutex );
+    if ( !pool ){
+        pool = new QThreadPool();
+        pool->setMaxThreadCount( 1 );
+    }
+    return pool;
+}
+}
+
+ChannelPlaneCache::ChannelPlaneCache( int channelCount, qint64 maxBytes, int prefetchCount,
+        const PlaneReader& reader ) :
+    m_channelCount( std::max( 1, channelCount ) ),
+    m_prefetchCount( std::max( 0, prefetchCount ) ),
+    m_reader( reader ),
+    m_maxBytes( maxBytes ){
+}
+
+ChannelPlaneCache::~ChannelPlaneCache(){
+    m_cancelled = true;
+    {
+        QMutexLocker locker( &m_mutex );
+        m_queue.clear();
+    }
+    m_future.waitForFinished();
+    qDebug() << "[ChannelPlaneCache] hits:" << m_hits << "misses:" << m_misses
+             << "read ahead:" << m_prefetched << "wasted:" << m_wasted;
+}
+
+bool ChannelPlaneCache::get( int channel, int stokes, Plane& plane ){
+    Key key( channel, stokes );
+    QMutexLocker locker( &m_mutex );
+    while ( m_isReading && m_reading == key ){
+        m_readDone.wait( &m_mutex );
+    }
+    auto iter = m_entries.find( key );
+    if ( iter == m_entries.end() ){
+        m_misses++;
+        return false;
+    }
+    m_lru.splice( m_lru.begin(), m_lru, iter->second.lruPos );
+    iter->second.unused = false;
+    plane = iter->second.plane;
+    m_hits++;
+    return true;
+}
+
+bool ChannelPlaneCache::put( int channel, int stokes, const Plane& plane ){
+    QMutexLocker locker( &m_mutex );
+    return _store( Key( channel, stokes ), plane, false );
+}
+
+bool ChannelPlaneCache::fits( qint64 bytes ) const {
+    QMutexLocker locker( &m_mutex );
+    return bytes <= m_maxBytes / 4;
+}
+
+void ChannelPlaneCache::show( int channel, int stokes ){
+    if ( m_prefetchCount == 0 || m_channelCount == 1 ){
+        return;
+    }
+    QMutexLocker locker( &m_mutex );
+
+    // the step from the channel shown before, animations wrap around at the ends; one
+    // channel either way, or the same step twice in a row, sets the direction
+    int step = 0;
+    if ( stokes == m_lastStokes && m_lastChannel >= 0 ){
+        int forward = ( ( channel - m_lastChannel ) % m_channelCount + m_channelCount ) % m_channelCount;
+        int delta = forward <= m_channelCount / 2 ? forward : forward - m_channelCount;
+        if ( delta == 0 ){
+            return;
+        }
+        if ( delta == 1 || delta == -1 || delta == m_lastStep ){
+            step = delta;
+        }
+        m_lastStep = delta;
+    }
+    else {
+        m_lastStep = 0;
+    }
+    m_lastChannel = channel;
+    m_lastStokes = stokes;
+
+    // what was queued for an earlier position is not needed anymore
+    m_queue.clear();
+    if ( step == 0 ){
+        return;
+    }
+
+    // leave room for the plane shown and the one being read, or the planes read ahead
+    // would push each other out
+    int count = m_prefetchCount;
+    if ( m_planeBytes > 0 ){
+        count = std::min<qint64>( count, m_maxBytes / m_planeBytes - 2 );
+    }
+    for ( int i = 1; i <= count; i++ ){
+        int next = ( ( channel + i * step ) % m_channelCount + m_channelCount ) % m_channelCount;
+        if ( next == channel ){
+            break;
+        }
+        Key key( next, stokes );
+        if ( m_entries.find( key ) == m_entries.end() && !( m_isReading && m_reading == key ) ){
+            m_queue.push_back( key );
+        }
+    }
+
+    if ( !m_queue.empty() && !m_running ){
+        // the previous job has left the queue, it may just not have returned yet
+        m_future.waitForFinished();
+        m_running = true;
+        m_future = QtConcurrent::run( _prefetchPool(), [this](){ _run(); } );
+    }
+}
+
+void ChannelPlaneCache::_run(){
+    while ( true ){
+        Key key;
+        {
+            QMutexLocker locker( &m_mutex );
+            while ( !m_queue.empty() && m_entries.find( m_queue.front() ) != m_entries.end() ){
+                m_queue.pop_front();
+            }
+            if ( m_cancelled || m_queue.empty() ){
+                m_running = false;
+                return;
+            }
+            key = m_queue.front();
+            m_queue.pop_front();
+            m_reading = key;
+            m_isReading = true;
+        }
+
+        Plane plane;
+        bool success = m_reader( key.first, key.second, plane );
+
+        QMutexLocker locker( &m_mutex );
+        if ( success && _store( key, plane, true ) ){
+            m_prefetched++;
+        }
+        m_isReading = false;
+        m_readDone.wakeAll();
+    }
+}
+
+bool ChannelPlaneCache::_store( const Key& key, const Plane& plane, bool prefetched ){
+    qint64 size = _getSize( plane );
+    if ( size > m_maxBytes ){
+        return false;
+    }
+    auto iter = m_entries.find( key );
+    if ( iter != m_entries.end() ){
+        m_usedBytes -= _getSize( iter->second.plane );
+        m_lru.erase( iter->second.lruPos );
+        m_entries.erase( iter );
+    }
+    m_lru.push_front( key );
+    Entry& entry = m_entries[key];
+    entry.plane = plane;
+    entry.lruPos = m_lru.begin();
+    entry.unused = prefetched;
+    m_usedBytes += size;
+    m_planeBytes = size;
+    _evict();
+    return true;
+}
+
+quint64 ChannelPlaneCache::getHitCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_hits;
+}
+
+quint64 ChannelPlaneCache::getMissCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_misses;
+}
+
+quint64 ChannelPlaneCache::getPrefetchCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_prefetched;
+}
+
+quint64 ChannelPlaneCache::getWastedPrefetchCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_wasted;
+}
+
+qint64 ChannelPlaneCache::_getSize( const Plane& plane ){
+    if ( !plane.data ){
+        return 0;
+    }
+    return qint64( plane.data->size() ) * sizeof(float);
+}
+
+void ChannelPlaneCache::_evict(){
+    while ( m_usedBytes > m_maxBytes && !m_lru.empty() ){
+        auto iter = m_entries.find( m_lru.back() );
+        if ( iter != m_entries.end() ){
+            m_usedBytes -= _getSize( iter->second.plane );
+            if ( iter->second.unused ){
+                m_wasted++;
+            }
+            m_entries.erase( iter );
+        }
+        m_lru.pop_back();
+    }
+}
+
+}
+}
@@ -0,0 +1,146 @@
+/***
+ * Full resolution planes of one image, with read-ahead of the channels the user is
+ * stepping towards.
+ */
+
+#pragma once
+
+#include "MipmapCache.h"
+
+#include <QFuture>
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <utility>
+
+namespace Carta {
+
+namespace Data {
+
+class ChannelPlaneCache {
+
+public:
+
+    /// a whole plane, the same as level 1 of the mipmap pyramid
+    typedef MipmapCache::Level Plane;
+
+    /// reads a whole plane; it is called from the background thread
+    typedef std::function<bool (int channel, int stokes, Plane& plane)> PlaneReader;
+
+    /**
+     * Constructor.
+     * @param channelCount - the number of channels of the image.
+     * @param maxBytes - the memory budget of the planes.
+     * @param prefetchCount - the number of channels read ahead, 0 to read none.
+     * @param reader - reads the planes that are read ahead.
+     */
+    ChannelPlaneCache( int channelCount, qint64 maxBytes, int prefetchCount, const PlaneReader& reader );
+
+    /**
+     * Stops reading ahead, waiting for the plane being read.
+     */
+    ~ChannelPlaneCache();
+
+    /**
+     * Looks up a plane and marks it as the most recently used one. A plane that is just
+     * being read ahead is waited for rather than read twice.
+     * @param channel - the channel.
+     * @param stokes - the stokes plane.
+     * @param plane - set to the plane if it was found.
+     * @return - true if the plane was found; false otherwise.
+     */
+    bool get( int channel, int stokes, Plane& plane );
+
+    /**
+     * Stores a plane, evicting the least recently used planes to stay within the budget.
+     * @param channel - the channel.
+     * @param stokes - the stokes plane.
+     * @param plane - the plane.
+     * @return - false if the plane does not fit and was not stored.
+     */
+    bool put( int channel, int stokes, const Plane& plane );
+
+    /**
+     * Returns whether a plane of the given size is worth storing; planes larger than a
+     * quarter of the budget are not.
+     * @param bytes - the size of the plane.
+     */
+    bool fits( qint64 bytes ) const;
+
+    /**
+     * Tells the cache which channel is shown. Once the user steps through the channels in
+     * one direction, the next channels in that direction are read in the background;
+     * channels queued for an earlier direction are dropped.
+     * @param channel - the channel shown.
+     * @param stokes - the stokes plane shown.
+     */
+    void show( int channel, int stokes );
+
+    quint64 getHitCount() const;
+    quint64 getMissCount() const;
+
+    /// the number of planes read ahead
+    quint64 getPrefetchCount() const;
+
+    /// the number of planes read ahead that were evicted before anyone used them
+    quint64 getWastedPrefetchCount() const;
+
+private:
+
+    ChannelPlaneCache( const ChannelPlaneCache& other ) = delete;
+    ChannelPlaneCache& operator=( const ChannelPlaneCache& other ) = delete;
+
+    typedef std::pair<int, int> Key;
+
+    struct Entry {
+        Plane plane;
+        std::list<Key>::iterator lruPos;
+        //Whether the plane was read ahead and nobody asked for it yet
+        bool unused = false;
+    };
+
+    void _run();
+    bool _store( const Key& key, const Plane& plane, bool prefetched );
+    void _evict();
+    static qint64 _getSize( const Plane& plane );
+
+    const int m_channelCount;
+    const int m_prefetchCount;
+    PlaneReader m_reader;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_readDone;
+    //Most recently used keys at the front
+    std::list<Key> m_lru;
+    std::map<Key, Entry> m_entries;
+    qint64 m_usedBytes = 0;
+    qint64 m_maxBytes;
+    //Size of the planes stored so far, 0 until there is one
+    qint64 m_planeBytes = 0;
+
+    //The channels to read ahead, nearest first, and the one being read
+    std::deque<Key> m_queue;
+    Key m_reading;
+    bool m_isReading = false;
+    //Whether a background job is working through the queue
+    bool m_running = false;
+
+    //What was shown last, to tell the direction
+    int m_lastChannel = -1;
+    int m_lastStokes = -1;
+    int m_lastStep = 0;
+
+    quint64 m_hits = 0;
+    quint64 m_misses = 0;
+    quint64 m_prefetched = 0;
+    quint64 m_wasted = 0;
+
+    std::atomic<bool> m_cancelled { false };
+    QFuture<void> m_future;
+};
+}
+}
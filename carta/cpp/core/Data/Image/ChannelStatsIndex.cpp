@@ -0,0 +1,271 @@
+#include "ChannelStatsIndex.h"
+#include "CartaLib/CartaLib.h"
+#include "CartaLib/IntensityCacheHelper.h"
+#include "../../Algorithms/minMaxHistogram.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace Carta {
+
+namespace Data {
+
+const qint64 ChannelStatsIndex::MAX_BIN_BYTES = 64LL * 1024 * 1024;
+
+namespace {
+/// indexing is a long running, low priority job: the jobs of all the open files share one
+/// thread so they never take more than a single core away from the interactive requests
+QThreadPool* _indexPool(){
+    static QThreadPool* pool = nullptr;
+    static QMutex mutex;
+    QMutexLocker locker( &mutex );
+    if ( !pool ){
+        pool = new QThreadPool();
+        pool->setMaxThreadCount( 1 );
+    }
+    return pool;
+}
+
+/// two streaming passes over the view: one for the summary, one for the histogram, which
+/// needs the extremes; the chunks are binned as they come, the plane is never copied
+template <typename T>
+ChannelStatsIndex::Stats _computeStats( Carta::Lib::NdArray::RawViewInterface* rawView, int numberOfBins ){
+    ChannelStatsIndex::Stats stats;
+    Carta::Lib::NdArray::TypedView<T> view( rawView, false );
+    double minVal = std::numeric_limits<double>::max();
+    double maxVal = std::numeric_limits<double>::lowest();
+    double sum = 0;
+    bool converted = view.forEachChunk( [&]( const T* chunk, int64_t count ){
+        for ( int64_t i = 0; i < count; i++ ){
+            const double v = chunk[i];
+            if ( std::isfinite( v ) ){
+                minVal = std::min( minVal, v );
+                maxVal = std::max( maxVal, v );
+                sum += v;
+                stats.finiteCount++;
+            }
+            else {
+                stats.nanCount++;
+            }
+        }
+    });
+    if ( !converted ){
+        qWarning() << "[ChannelStatsIndex] Unsupported pixel type" << Carta::Lib::toStr( rawView->pixelType() );
+    }
+    if ( stats.finiteCount == 0 ){
+        return stats;
+    }
+    stats.min = minVal;
+    stats.max = maxVal;
+    stats.mean = sum / stats.finiteCount;
+
+    // same binning as MinMaxPercentiles::pixels2histogram() so the results are identical;
+    // one thread, the index must not compete with the interactive requests
+    stats.bins.assign( numberOfBins + 1, 0 );
+    view.forEachChunk( [&]( const T* chunk, int64_t count ){
+        Carta::Core::Algorithms::histogramAdd( chunk, count, minVal, maxVal, numberOfBins,
+                                               stats.bins.data(), 1 );
+    });
+    return stats;
+}
+}
+
+ChannelStatsIndex::ChannelStatsIndex( const QString& fileName, int channelCount, int stokesCount,
+        int numberOfBins, std::shared_ptr<Carta::Lib::IPCache> diskCache ) :
+    m_fileName( fileName ),
+    m_channelCount( std::max( 1, channelCount ) ),
+    m_stokesCount( std::max( 1, stokesCount ) ),
+    m_numberOfBins( numberOfBins ),
+    m_diskCache( diskCache ){
+    m_stats.resize( m_channelCount * m_stokesCount );
+    m_indexed.resize( m_channelCount * m_stokesCount, false );
+}
+
+ChannelStatsIndex::~ChannelStatsIndex(){
+    m_cancelled = true;
+    m_future.waitForFinished();
+}
+
+void ChannelStatsIndex::start( const PlaneReader& reader ){
+    if ( m_future.isRunning() ){
+        return;
+    }
+    m_cancelled = false;
+    m_future = QtConcurrent::run( _indexPool(), [this, reader](){ _run( reader ); } );
+}
+
+ChannelStatsIndex::Stats ChannelStatsIndex::compute( Carta::Lib::NdArray::RawViewInterface* view, int numberOfBins ){
+    Carta::Lib::Image::PixelType type = view->pixelType();
+    bool exactInFloat = type == Carta::Lib::Image::PixelType::Real32 ||
+            type == Carta::Lib::Image::PixelType::Int16 ||
+            type == Carta::Lib::Image::PixelType::Byte;
+    if ( exactInFloat ){
+        return _computeStats<float>( view, numberOfBins );
+    }
+    return _computeStats<double>( view, numberOfBins );
+}
+
+bool ChannelStatsIndex::get( int channel, int stokes, Stats& stats, bool withBins ) const {
+    int plane = _getPlaneIndex( channel, stokes );
+    if ( plane < 0 ){
+        return false;
+    }
+    {
+        QMutexLocker locker( &m_mutex );
+        if ( !m_indexed[plane] ){
+            return false;
+        }
+        stats = m_stats[plane];
+    }
+    if ( !withBins || !stats.bins.empty() || stats.finiteCount == 0 ){
+        return true;
+    }
+    // the histograms live in the disk cache
+    if ( m_diskCache ){
+        QByteArray val, error;
+        if ( m_diskCache->readEntry( _getKey( channel, stokes ), val, error ) &&
+                _qb2stats( val, m_numberOfBins, stats ) ){
+            return true;
+        }
+    }
+    return false;
+}
+
+int ChannelStatsIndex::getNumberOfBins() const {
+    return m_numberOfBins;
+}
+
+int ChannelStatsIndex::getIndexedCount() const {
+    return m_indexedCount;
+}
+
+int ChannelStatsIndex::getPlaneCount() const {
+    return m_channelCount * m_stokesCount;
+}
+
+void ChannelStatsIndex::_run( PlaneReader reader ){
+    QElapsedTimer timer;
+    timer.start();
+    int computed = 0;
+    if ( m_diskCache ){
+        // a file rewritten in place must not get the statistics of the old one
+        QByteArray fileHash = Carta::Lib::IntensityCacheHelper::fileHash( m_fileName );
+        QMutexLocker locker( &m_mutex );
+        m_fileHash = fileHash;
+    }
+    for ( int stokes = 0; stokes < m_stokesCount && !m_cancelled; stokes++ ){
+        for ( int channel = 0; channel < m_channelCount && !m_cancelled; channel++ ){
+            int plane = _getPlaneIndex( channel, stokes );
+            QByteArray key = _getKey( channel, stokes );
+            Stats stats;
+
+            // indexed by an earlier session
+            if ( m_diskCache ){
+                QByteArray val, error;
+                if ( m_diskCache->readEntry( key, val, error ) && _qb2stats( val, m_numberOfBins, stats ) ){
+                    _store( plane, stats, false );
+                    continue;
+                }
+            }
+
+            std::unique_ptr<Carta::Lib::NdArray::RawViewInterface> view( reader( channel, stokes ) );
+            if ( !view ){
+                qWarning() << "[ChannelStatsIndex] Could not read channel" << channel << "stokes" << stokes
+                           << "of" << m_fileName;
+                continue;
+            }
+            stats = compute( view.get(), m_numberOfBins );
+            if ( m_diskCache ){
+                m_diskCache->setEntry( key, _stats2qb( stats ), QByteArray() );
+            }
+            _store( plane, stats, !m_diskCache );
+            computed++;
+        }
+    }
+    if ( CARTA_RUNTIME_CHECKS ){
+        qCritical() << "<> Time to index" << computed << "of" << getPlaneCount() << "planes:"
+                    << timer.elapsed() << "ms";
+    }
+}
+
+void ChannelStatsIndex::_store( int plane, const Stats& stats, bool keepBins ){
+    QMutexLocker locker( &m_mutex );
+    m_stats[plane] = stats;
+    qint64 binBytes = stats.bins.size() * sizeof( uint32_t );
+    if ( keepBins && m_binBytes + binBytes <= MAX_BIN_BYTES ){
+        m_binBytes += binBytes;
+    }
+    else {
+        std::vector<uint32_t>().swap( m_stats[plane].bins );
+    }
+    if ( !m_indexed[plane] ){
+        m_indexed[plane] = true;
+        m_indexedCount++;
+    }
+}
+
+QByteArray ChannelStatsIndex::_getKey( int channel, int stokes ) const {
+    //Tag, file hash, then the plane and the binning
+    const char tag[4] = { 'C', 'H', 'S', '1' };
+    int32_t plane[3] = { channel, stokes, m_numberOfBins };
+    QByteArray key;
+    {
+        QMutexLocker locker( &m_mutex );
+        key.reserve( sizeof( tag ) + m_fileHash.size() + sizeof( plane ) );
+        key.append( tag, sizeof( tag ) );
+        key.append( m_fileHash );
+    }
+    key.append( reinterpret_cast<const char*>( plane ), sizeof( plane ) );
+    return key;
+}
+
+int ChannelStatsIndex::_getPlaneIndex( int channel, int stokes ) const {
+    if ( channel < 0 || channel >= m_channelCount || stokes < 0 || stokes >= m_stokesCount ){
+        return -1;
+    }
+    return stokes * m_channelCount + channel;
+}
+
+/// min, max, mean, finite count, NaN count, bin count, then the bins
+QByteArray ChannelStatsIndex::_stats2qb( const Stats& stats ){
+    QByteArray result;
+    double summary[3] = { stats.min, stats.max, stats.mean };
+    uint64_t counts[3] = { stats.finiteCount, stats.nanCount, stats.bins.size() };
+    result.append( reinterpret_cast<const char*>( summary ), sizeof( summary ) );
+    result.append( reinterpret_cast<const char*>( counts ), sizeof( counts ) );
+    result.append( reinterpret_cast<const char*>( stats.bins.data() ), stats.bins.size() * sizeof( uint32_t ) );
+    return result;
+}
+
+bool ChannelStatsIndex::_qb2stats( const QByteArray& bytes, int numberOfBins, Stats& stats ){
+    double summary[3];
+    uint64_t counts[3];
+    const int headerSize = sizeof( summary ) + sizeof( counts );
+    if ( bytes.size() < headerSize ){
+        return false;
+    }
+    memcpy( summary, bytes.constData(), sizeof( summary ) );
+    memcpy( counts, bytes.constData() + sizeof( summary ), sizeof( counts ) );
+    uint64_t binCount = counts[2];
+    if ( ( binCount != 0 && binCount != uint64_t( numberOfBins + 1 ) ) ||
+            uint64_t( bytes.size() ) != headerSize + binCount * sizeof( uint32_t ) ){
+        return false;
+    }
+    stats.min = summary[0];
+    stats.max = summary[1];
+    stats.mean = summary[2];
+    stats.finiteCount = counts[0];
+    stats.nanCount = counts[1];
+    stats.bins.resize( binCount );
+    memcpy( stats.bins.data(), bytes.constData() + headerSize, binCount * sizeof( uint32_t ) );
+    return true;
+}
+
+}
+}
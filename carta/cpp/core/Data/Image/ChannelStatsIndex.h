@@ -0,0 +1,128 @@
+/***
+ * Per channel statistics of an image, computed once in the background.
+ */
+
+#pragma once
+
+#include "CartaLib/IImage.h"
+#include "CartaLib/IPCache.h"
+
+#include <QFuture>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace Carta {
+
+namespace Data {
+
+class ChannelStatsIndex {
+
+public:
+
+    /// statistics of the finite values of one plane (channel and stokes)
+    struct Stats {
+        double min = 0;
+        double max = 0;
+        double mean = 0;
+        uint64_t finiteCount = 0;
+        uint64_t nanCount = 0;
+        /// numberOfBins + 1 bins centred on min + k * (max - min) / numberOfBins, the same
+        /// binning as MinMaxPercentiles::pixels2histogram(); may be empty if it was not kept
+        std::vector<uint32_t> bins;
+    };
+
+    /// returns a new view of the given plane, the index takes ownership of it
+    typedef std::function<Carta::Lib::NdArray::RawViewInterface* (int channel, int stokes)> PlaneReader;
+
+    /**
+     * Constructor.
+     * @param fileName - the image file; the persistent cache is keyed by a fingerprint of
+     *      its content, taken in the background.
+     * @param channelCount - the number of channels.
+     * @param stokesCount - the number of stokes planes.
+     * @param numberOfBins - the number of histogram bins (one less than the number of bin centres).
+     * @param diskCache - the persistent cache or nullptr if there is none.
+     */
+    ChannelStatsIndex( const QString& fileName, int channelCount, int stokesCount, int numberOfBins,
+            std::shared_ptr<Carta::Lib::IPCache> diskCache );
+
+    /**
+     * Stops the background job, if it is still running.
+     */
+    ~ChannelStatsIndex();
+
+    /**
+     * Starts indexing the planes in the background, stokes by stokes and channel by channel.
+     * Planes already in the persistent cache are not read again.
+     * @param reader - supplies the planes; it is called from the background thread.
+     */
+    void start( const PlaneReader& reader );
+
+    /**
+     * Returns the statistics of a plane if it has been indexed.
+     * @param channel - the channel.
+     * @param stokes - the stokes plane.
+     * @param stats - set to the statistics of the plane.
+     * @param withBins - whether the histogram is needed as well.
+     * @return - true if the plane (and the histogram, if requested) was found; false otherwise.
+     */
+    bool get( int channel, int stokes, Stats& stats, bool withBins ) const;
+
+    int getNumberOfBins() const;
+
+    /**
+     * Returns the number of planes indexed so far.
+     */
+    int getIndexedCount() const;
+
+    int getPlaneCount() const;
+
+    /**
+     * Computes the statistics of a view in one read.
+     * @param view - the values.
+     * @param numberOfBins - the number of histogram bins.
+     * @return - the statistics of the finite values of the view.
+     */
+    static Stats compute( Carta::Lib::NdArray::RawViewInterface* view, int numberOfBins );
+
+private:
+
+    ChannelStatsIndex( const ChannelStatsIndex& other ) = delete;
+    ChannelStatsIndex& operator=( const ChannelStatsIndex& other ) = delete;
+
+    void _run( PlaneReader reader );
+    QByteArray _getKey( int channel, int stokes ) const;
+    int _getPlaneIndex( int channel, int stokes ) const;
+    void _store( int plane, const Stats& stats, bool keepBins );
+
+    static QByteArray _stats2qb( const Stats& stats );
+    static bool _qb2stats( const QByteArray& bytes, int numberOfBins, Stats& stats );
+
+    QString m_fileName;
+    //Fingerprint of the file, see IntensityCacheHelper::fileHash(); set by the background job
+    //before any plane is indexed
+    QByteArray m_fileHash;
+    int m_channelCount;
+    int m_stokesCount;
+    int m_numberOfBins;
+    std::shared_ptr<Carta::Lib::IPCache> m_diskCache;
+
+    mutable QMutex m_mutex;
+    //Summary of every plane, the bins are only kept in memory when there is no disk cache
+    std::vector<Stats> m_stats;
+    std::vector<bool> m_indexed;
+    qint64 m_binBytes = 0;
+    std::atomic<int> m_indexedCount { 0 };
+
+    std::atomic<bool> m_cancelled { false };
+    QFuture<void> m_future;
+
+    //Upper bound on the memory used by histograms kept in memory
+    static const qint64 MAX_BIN_BYTES;
+};
+}
+}
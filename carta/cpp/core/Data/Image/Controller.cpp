@@ -423,6 +423,21 @@ PBMSharedPtr Controller::getSpectralProfile(int fileId, int x, int y, int stokeF
     return m_stack->_getSpectralProfile(fileId, x, y, stokeFrame);
 }
 
+bool Controller::getRegionSpectralProfile(int fileId, int regionId, const RegionShape& region, int stokeFrame,
+    const google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>& spectralProfiles,
+    const std::function<bool(PBMSharedPtr)>& sendProfile) const {
+    return m_stack->_getRegionSpectralProfile(fileId, regionId, region, stokeFrame, spectralProfiles, sendProfile);
+}
+
+PBMSharedPtr Controller::getRegionStats(int fileId, int regionId, const RegionShape& region, int channel,
+    int stokeFrame, const std::vector<int>& statsTypes) const {
+    return m_stack->_getRegionStats(fileId, regionId, region, channel, stokeFrame, statsTypes);
+}
+
+void Controller::removeRegionStats(int fileId, int regionId) {
+    m_stack->_removeRegionStats(fileId, regionId);
+}
+
 PBMSharedPtr Controller::getRasterImageData(int fileId, int x_min, int x_max, int y_min, int y_max, int mip,
     int frameLow, int frameHigh, int stokeFrame,
     bool isZFP, int precision, int numSubsets,
@@ -435,6 +450,32 @@ PBMSharedPtr Controller::getRasterImageData(int fileId, int x_min, int x_max, in
     return result;
 }
 
+int Controller::getRasterTiles(int fileId, const std::vector<QPoint>& tiles, int mip,
+    int frameLow, int frameHigh, int stokeFrame,
+    bool isZFP, int precision,
+    bool &changeFrame, int regionId, int numberOfBins,
+    Carta::Lib::IntensityUnitConverter::SharedPtr converter,
+    const std::function<bool(PBMSharedPtr)>& sendTile) const {
+    return m_stack->_getRasterTiles(fileId, tiles, mip, frameLow, frameHigh, stokeFrame,
+                                    isZFP, precision, changeFrame, regionId, numberOfBins,
+                                    converter, sendTile);
+}
+
+int Controller::getContourImageData(int fileId, int channel, int stokeFrame, const std::vector<double>& levels,
+    int smoothingMode, int smoothingFactor, int decimation, int compressionLevel,
+    const std::function<bool(PBMSharedPtr)>& sendContours) const {
+    return m_stack->_getContourImageData(fileId, channel, stokeFrame, levels, smoothingMode, smoothingFactor,
+        decimation, compressionLevel, sendContours);
+}
+
+void Controller::indexChannelStats(int numberOfBins) {
+    m_stack->_indexChannelStats(numberOfBins);
+}
+
+void Controller::transposeSpectralCube() {
+    m_stack->_transposeSpectralCube();
+}
+
 //QRectF Controller::_getInputRectangle(  ) const {
 //    return m_stack->_getInputRectangle( );
 //}
@@ -47,6 +47,7 @@ class ContourControls;
 class Settings;
 class Region;
 class RegionControls;
+class RegionShape;
 
 typedef Carta::Lib::InputEvents::JsonEvent InputEvent;
 
@@ -289,6 +290,43 @@ public:
      */
     PBMSharedPtr getSpectralProfile(int fileId, int x, int y, int stokeFrame) const;
 
+    /**
+     * Computes the spectral profiles of a region a chunk of channels at a time.
+     * @param fileId - the file id.
+     * @param regionId - the region id.
+     * @param region - the region, in pixel coordinates of the image.
+     * @param stokeFrame - the stoke frame.
+     * @param spectralProfiles - the coordinates and statistics the client asked for.
+     * @param sendProfile - called on the calling thread with the SpectralProfileData message after
+     *      every chunk, holding the fraction of the channels done as its progress; returns false
+     *      if the profile is no longer wanted, e.g. because the region or the stokes changed.
+     * @return - false if the profile could not be computed.
+     */
+    bool getRegionSpectralProfile(int fileId, int regionId, const RegionShape& region, int stokeFrame,
+        const google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>& spectralProfiles,
+        const std::function<bool(PBMSharedPtr)>& sendProfile) const;
+
+    /**
+     * Computes the statistics of a region in one channel.
+     * @param fileId - the file id.
+     * @param regionId - the region id.
+     * @param region - the region, in pixel coordinates of the image.
+     * @param channel - the channel; the statistics of channels asked for before
+     *      are not computed again while the region keeps its shape.
+     * @param stokeFrame - the stoke frame.
+     * @param statsTypes - the statistics the client asked for.
+     * @return - a RegionStatsData message, or nullptr if they could not be computed.
+     */
+    PBMSharedPtr getRegionStats(int fileId, int regionId, const RegionShape& region, int channel,
+        int stokeFrame, const std::vector<int>& statsTypes) const;
+
+    /**
+     * Forgets the statistics of a region.
+     * @param fileId - the file id.
+     * @param regionId - the region id.
+     */
+    void removeRegionStats(int fileId, int regionId);
+
     /**
      * Returns a vector of pixels.
      * @param xMin - lower bound of the x-pixel-coordinate.
@@ -308,6 +346,57 @@ public:
         bool &changeFrame, int regionId, int numberOfBins,
         Lib::IntensityUnitConverter::SharedPtr converter) const;
 
+    /**
+     * Streams the raster image data of the given tiles, see DataSource::RASTER_TILE_SIZE.
+     * @param fileId - the file id.
+     * @param tiles - the (column, row) indices of the tiles at the given mip, in the order they should be sent.
+     * @param mip - down sampling factor.
+     * @param frameLow - a lower bound for the image channels or -1 if there is no lower bound.
+     * @param frameHigh - an upper bound for the image channels or -1 if there is no upper bound.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param sendTile - called with the RasterImageData message of every tile as soon as it is ready;
+     *      returns false if no more tiles are wanted.
+     * @return - the number of tiles sent.
+     */
+    int getRasterTiles(int fileId, const std::vector<QPoint>& tiles, int mip,
+        int frameLow, int frameHigh, int stokeFrame,
+        bool isZFP, int precision,
+        bool &changeFrame, int regionId, int numberOfBins,
+        Lib::IntensityUnitConverter::SharedPtr converter,
+        const std::function<bool(PBMSharedPtr)>& sendTile) const;
+
+    /**
+     * Streams the contour lines of a channel, see DataSource::CONTOUR_TILE_SIZE.
+     * @param fileId - the file id.
+     * @param channel - the image channel.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param levels - the contour levels.
+     * @param smoothingMode - smoothing of the plane before contouring (0: none, 1: block average, 2: gaussian).
+     * @param smoothingFactor - the size of the smoothing kernel in pixels.
+     * @param decimation - vertices are sent encoded, rounded to 1/decimation pixels; 0 sends them as floats.
+     * @param compressionLevel - deflate level of the encoded vertices, 0 for none.
+     * @param sendContours - called with every ContourImageData message as soon as it is ready;
+     *      returns false if no more are wanted.
+     * @return - the number of messages sent.
+     */
+    int getContourImageData(int fileId, int channel, int stokeFrame, const std::vector<double>& levels,
+        int smoothingMode, int smoothingFactor, int decimation, int compressionLevel,
+        const std::function<bool(PBMSharedPtr)>& sendContours) const;
+
+    /**
+     * Starts computing the statistics of every channel of the loaded images in the background,
+     * so that channel switches do not have to scan the channel.
+     * @param numberOfBins - the number of histogram bins to keep for each channel.
+     */
+    void indexChannelStats(int numberOfBins);
+
+    /**
+     * Starts copying the cubes of the loaded images spectral-major in the background, if a
+     * spectral cache directory is configured, so that spectral profiles do not need one read
+     * per channel.
+     */
+    void transposeSpectralCube();
+
     /**
      * Return the layer with the given name, if a name is specified; otherwise, return the current
      * layer.
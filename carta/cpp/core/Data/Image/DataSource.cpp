@@ -16,12 +16,21 @@
 #include "CartaLib/IPCache.h"
 #include "../../ImageRenderService.h"
 #include "../../Algorithms/percentileAlgorithms.h"
+#include "../../Algorithms/downsampling.h"
+#include "../../Algorithms/regionStatistics.h"
+#include "../../Algorithms/contourEncoding.h"
+#include "../../Algorithms/contourTiles.h"
+#include "../../Algorithms/smoothing.h"
+#include "../FitsHeaderExtractor.h"
 #include "../Clips.h"
 #include <QDebug>
 #include <QElapsedTimer>
 #include "CartaLib/UtilCASA.h"
 #include <zfp.h>
 #include <cmath>
+#include <atomic>
+#include <cstring>
+#include <limits>
 #include <QFuture>
 #include <QtConcurrent>
 
@@ -44,6 +53,15 @@ const int DataSource::INDEX_FRAME_LOW = 3;
 const int DataSource::INDEX_FRAME_HIGH = 4;
 const bool DataSource::IS_MULTITHREAD_ZFP = true;
 const int DataSource::MAX_SUBSETS = 8;
+const int DataSource::RASTER_TILE_SIZE = 256;
+const int DataSource::CONTOUR_TILE_SIZE = 256;
+const int DataSource::CONTOUR_BLOCK_AVERAGE = 1;
+const int DataSource::CONTOUR_GAUSSIAN_BLUR = 2;
+const int DataSource::SPECTRAL_CACHE_SIZE_MB = 10 * 1024;
+const int DataSource::PLANE_CACHE_SIZE_MB = 512;
+const int DataSource::PLANE_PREFETCH_COUNT = 2;
+const qint64 DataSource::REGION_PROFILE_CHUNK_BYTES = 32LL * 1024 * 1024;
+const int DataSource::REGION_STATS_CACHE_ENTRIES = 256 * 1024;
 
 CoordinateSystems* DataSource::m_coords = nullptr;
 
@@ -51,6 +69,7 @@ DataSource::DataSource() :
     m_image( nullptr ),
     m_permuteImage( nullptr),
     m_coordinateFormatter( nullptr ),
+    m_beamArea( std::numeric_limits<double>::quiet_NaN() ),
     m_axisIndexX( 0 ),
     m_axisIndexY( 1 ){
         m_cmapCacheSize = 1000;
@@ -462,16 +481,16 @@ std::shared_ptr<Carta::Core::ImageRenderService::Service> DataSource::_getRender
     return m_renderService;
 }
 
-std::shared_ptr<Carta::Lib::IntensityValue> DataSource::_readIntensityCache(int frameLow, int frameHigh, double percentile, int stokeFrame, QString transformationLabel) const {
+std::vector<std::shared_ptr<Carta::Lib::IntensityValue> > DataSource::_readIntensityCache(int frameLow, int frameHigh, const std::vector<double>& percentiles, int stokeFrame, QString transformationLabel) const {
     if (m_diskCacheHelper) {
-        return m_diskCacheHelper->get(m_fileName, frameLow, frameHigh, percentile, stokeFrame, transformationLabel);
+        return m_diskCacheHelper->get(m_fileName, frameLow, frameHigh, percentiles, stokeFrame, transformationLabel);
     }
-    return nullptr;
+    return std::vector<std::shared_ptr<Carta::Lib::IntensityValue> >(percentiles.size());
 }
 
-void DataSource::_setIntensityCache(double intensity, double error, int frameLow, int frameHigh, double percentile, int stokeFrame, QString transformationLabel) const {
+void DataSource::_setIntensityCache(const std::map<double, double>& intensities, double error, int frameLow, int frameHigh, int stokeFrame, QString transformationLabel) const {
     if (m_diskCacheHelper) {
-        m_diskCacheHelper->set(m_fileName, intensity, error, frameLow, frameHigh, percentile, stokeFrame, transformationLabel);
+        m_diskCacheHelper->set(m_fileName, intensities, error, frameLow, frameHigh, stokeFrame, transformationLabel);
     }
 }
 
@@ -483,6 +502,16 @@ std::vector<double> DataSource::_getIntensity(int frameLow, int frameHigh,
 
     Carta::Lib::IPercentilesToPixels<double>::SharedPtr calculator = nullptr;
 
+    // The min and max of a single channel are known once the channel has been indexed
+    ChannelStatsIndex::Stats channelStats;
+    if (percentiles.size() == 2 && percentiles[0] == 0 && percentiles[1] == 1 &&
+            !(converter && converter->frameDependent) &&
+            _getChannelStats(frameLow, frameHigh, stokeFrame, channelStats, false) &&
+            channelStats.finiteCount > 0) {
+        double multiplier = converter ? converter->multiplier : 1;
+        return std::vector<double>({channelStats.min * multiplier, channelStats.max * multiplier});
+    }
+
     if (percentiles.size() == 2 && percentiles[0] == 0 && percentiles[1] == 1) {
         // Special case: always use the min/max algorithm for min and max
         calculator = std::make_shared<Carta::Core::Algorithms::MinMaxPercentiles<double> >();
@@ -513,10 +542,42 @@ std::vector<double> DataSource::_getIntensity(int frameLow, int frameHigh,
     QString transformationLabel = converter ? converter->label : "NONE";
 
 
+    // If the algorithm is approximate, we also compute the other clips, but only if they are not cached.
+    // They are looked up in the same batch as the requested percentiles.
+    std::vector<double> lookups(percentiles);
+
+    if (calculator->isApproximate) {
+        std::shared_ptr<Carta::Data::Clips> m_clips;
+        std::vector<double> percentilesFromClips = m_clips->getAllClips2percentiles();
+
+        for (auto& p : percentilesFromClips) {
+            // TODO check exactly why this is necessary
+            // check if extra percentiles are close to any existing percentiles, cached or uncached
+            // C.C.Chiang: For approximation method, we can calculate all clipping values which are
+            // listed on the UI panel at the same time. This "for loop" is used to fill in all clipping
+            // values (as a set) we want to calculate.
+            bool isDuplicate = false;
+            for (size_t i = 0; i < percentiles.size(); i++) {
+                if (fabs(percentiles[i] - p) < 1e-6) {
+                    isDuplicate = true;
+                    // Either this will be found in the cache
+                    // Or it will be in the list of percentiles to be calculated
+                    // Either way, ignore it
+                    break;
+                }
+            }
+            if (!isDuplicate) {
+                lookups.push_back(p);
+            }
+        }
+    }
+
     // If the disk cache exists, try to look up cached intensity values
 
+    std::vector<std::shared_ptr<Carta::Lib::IntensityValue> > cachedValues = _readIntensityCache(frameLow, frameHigh, lookups, stokeFrame, transformationLabel);
+
     for (size_t i = 0; i < percentiles.size(); i++) {
-        std::shared_ptr<Carta::Lib::IntensityValue> cachedValue = _readIntensityCache(frameLow, frameHigh, percentiles[i], stokeFrame, transformationLabel);
+        std::shared_ptr<Carta::Lib::IntensityValue> cachedValue = cachedValues[i];
 
         if (cachedValue /* this intensity cache exists */ &&
             cachedValue->error <= calculator->error /* already has an intensity error order smaller than the current choice */ ) {
@@ -562,36 +623,11 @@ std::vector<double> DataSource::_getIntensity(int frameLow, int frameHigh,
             }
         }
 
-        // if the algorithm is approximate, add extra percentiles from clips, but only if they are not cached
-
+        // Add the extra percentiles from clips which are not cached
         if (calculator->isApproximate) {
-            std::shared_ptr<Carta::Data::Clips> m_clips;
-            std::vector<double> percentilesFromClips = m_clips->getAllClips2percentiles();
-
-            for (auto& p : percentilesFromClips) {
-                // TODO check exactly why this is necessary
-                // check if extra percentiles are close to any existing percentiles, cached or uncached
-                // C.C.Chiang: For approximation method, we can calculate all clipping values which are
-                // listed on the UI panel at the same time. This "for loop" is used to fill in all clipping
-                // values (as a set) we want to calculate.
-                bool isDuplicate = false;
-                for (size_t i = 0; i < percentiles.size(); i++) {
-                    if (fabs(percentiles[i] - p) < 1e-6) {
-                        isDuplicate = true;
-                        // Either this was found in the cache already
-                        // Or it's already in the list of percentiles to be calculated
-                        // Either way, ignore it
-                        break;
-                    }
-                }
-                if (!isDuplicate) {
-                    // This is a different percentile
-                    // Look in the cache first
-                    std::shared_ptr<Carta::Lib::IntensityValue> cachedValue = _readIntensityCache(frameLow, frameHigh, p, stokeFrame, transformationLabel);
-                    // Add it to the list if it's not in the cache
-                    if (!cachedValue) {
-                        percentilesToCalculate.push_back(p);
-                    }
+            for (size_t i = percentiles.size(); i < lookups.size(); i++) {
+                if (!cachedValues[i]) {
+                    percentilesToCalculate.push_back(lookups[i]);
                 }
             }
 
@@ -620,13 +656,13 @@ std::vector<double> DataSource::_getIntensity(int frameLow, int frameHigh,
         int spectralIndex = Util::getAxisIndex( m_image, AxisInfo::KnownType::SPECTRAL );
         clips_map = calculator->percentile2pixels(doubleView, percentilesToCalculate, spectralIndex, converter, hertzValues);
 
-        // add all the calculated values to the cache
+        // add all the calculated values to the cache, in one batch
 
-        for (auto &m : clips_map) {
-            // TODO: check what happens with the close values. Do we also need to cache the value with a different key, or does the serialisation unify them?
-            // put calculated values in the disk cache if it exists
-            _setIntensityCache(m.second, calculator->error, frameLow, frameHigh, m.first, stokeFrame, transformationLabel);
+        // TODO: check what happens with the close values. Do we also need to cache the value with a different key, or does the serialisation unify them?
+        // put calculated values in the disk cache if it exists
+        _setIntensityCache(clips_map, calculator->error, frameLow, frameHigh, stokeFrame, transformationLabel);
 
+        for (auto &m : clips_map) {
             qDebug() << "++++++++ [set cache] for percentile" << m.first << ", intensity=" << m.second << "+/- (max-min)*" << calculator->error;
         }
 
@@ -689,6 +725,22 @@ RegionHistogramData DataSource::_getPixels2HistogramData(int fileId, int regionI
     qDebug() << "[DataSource] Calculating the regional histogram data...................................>";
     RegionHistogramData result; // results from the "percentileAlgorithms.h"
 
+    // the histogram of a single channel without unit conversion is computed when the file is opened
+    ChannelStatsIndex::Stats channelStats;
+    if (!converter && m_channelStats && m_channelStats->getNumberOfBins() == numberOfBins &&
+            _getChannelStats(frameLow, frameHigh, stokeFrame, channelStats, true) &&
+            !channelStats.bins.empty()) {
+        result.fileId = fileId;
+        result.regionId = regionId;
+        result.num_bins = numberOfBins + 1;
+        result.bin_width = fabs(channelStats.max - channelStats.min) / numberOfBins;
+        result.first_bin_center = channelStats.min;
+        result.bins = std::move(channelStats.bins);
+        result.frameLow = frameLow;
+        result.stokeFrame = stokeFrame;
+        return result;
+    }
+
     // get the raw data
     Carta::Lib::NdArray::RawViewInterface* rawData = _getRawDataForStoke(frameLow, frameHigh, stokeFrame);
     if (rawData == nullptr) {
@@ -697,6 +749,43 @@ RegionHistogramData DataSource::_getPixels2HistogramData(int fileId, int regionI
     }
 
     std::shared_ptr<Carta::Lib::NdArray::RawViewInterface> view(rawData);
+
+    // a single channel is binned from the plane in memory, which also gives the min/max
+    // instead of reading the channel once more for them; the bins are in raw units either
+    // way when the conversion is a plain multiplier. The planes are floats, so only pixel
+    // types that floats hold exactly get the same bins as the double view below.
+    Carta::Lib::Image::PixelType pixelType = view->pixelType();
+    bool exactInFloat = pixelType == Carta::Lib::Image::PixelType::Real32 ||
+            pixelType == Carta::Lib::Image::PixelType::Int16 ||
+            pixelType == Carta::Lib::Image::PixelType::Byte;
+    if (exactInFloat && frameLow == frameHigh && !(converter && converter->frameDependent)) {
+        MipmapCache::Level plane;
+        int64_t planeBytes = int64_t(view->dims()[0]) * view->dims()[1] * sizeof(float);
+        bool inMemory = _findMipmapLevel(frameLow, stokeFrame, 1, plane);
+        if (!inMemory && m_planeCache && m_planeCache->fits(planeBytes)) {
+            _getFullResolutionPlane(view.get(), frameLow, stokeFrame, plane);
+            inMemory = true;
+        }
+        if (inMemory) {
+            Carta::Core::Algorithms::MinMaxCount minMax;
+            std::vector<uint32_t> bins = Carta::Core::Algorithms::histogram(plane.data->data(),
+                    plane.data->size(), numberOfBins, minMax);
+            if (bins.empty()) {
+                qCritical() << "[DataSource] Error: the channel has no finite values!!";
+                return result;
+            }
+            result.fileId = fileId;
+            result.regionId = regionId;
+            result.num_bins = numberOfBins + 1;
+            result.bin_width = fabs(minMax.max - minMax.min) / numberOfBins;
+            result.first_bin_center = minMax.min;
+            result.bins = std::move(bins);
+            result.frameLow = frameLow;
+            result.stokeFrame = stokeFrame;
+            return result;
+        }
+    }
+
     Carta::Lib::NdArray::Double doubleView(view.get(), false);
 
     // get the min/max intensities
@@ -736,14 +825,183 @@ RegionHistogramData DataSource::_getPixels2HistogramData(int fileId, int regionI
     return result;
 }
 
+namespace {
+/// reads the rows of the area with the given x offset and width from a raw view
+Carta::Core::Algorithms::RowBandReader _viewRowReader(Carta::Lib::NdArray::RawViewInterface* view,
+        int xMin, int yMin, int readWidth) {
+    return [view, xMin, yMin, readWidth](int yStart, int nRows, float* dst) -> void {
+        SliceND bandSlice;
+        bandSlice.start(xMin).end(xMin + readWidth).next().start(yMin + yStart).end(yMin + yStart + nRows);
+
+        // make a float view of this band
+        Carta::Lib::NdArray::Float fview(view->getView(bandSlice), true);
+
+        int64_t t = 0;
+        fview.forEachChunk([&t, dst] (const float* values, int64_t count) {
+            std::copy(values, values + count, dst + t);
+            t += count;
+        });
+
+        if (t != int64_t(readWidth) * nRows) {
+            qDebug() << "The prepared length of the raw data array:" << int64_t(readWidth) * nRows
+                     << "=" << readWidth << "X" << nRows
+                     << ", which is not consistent with the slice cut:" << t << "!!";
+            qFatal("The prepared length of the raw data array is not consistent with the slice cut!!");
+        }
+    };
+}
+
+/// reads a whole plane from a raw view
+void _readPlane(Carta::Lib::NdArray::RawViewInterface* view, MipmapCache::Level& plane) {
+    const int width = view->dims()[0];
+    const int height = view->dims()[1];
+    auto data = std::make_shared<std::vector<float> >(int64_t(width) * height);
+    Carta::Core::Algorithms::downsample(_viewRowReader(view, 0, 0, width), width, height, 1, data->data());
+    plane.width = width;
+    plane.height = height;
+    plane.mip = 1;
+    plane.data = data;
+}
+
+/// reads the rows of the area with the given x offset and width from a level in memory
+Carta::Core::Algorithms::RowBandReader _levelRowReader(const MipmapCache::Level& level,
+        int xMin, int yMin, int readWidth) {
+    return [level, xMin, yMin, readWidth](int yStart, int nRows, float* dst) -> void {
+        for (int r = 0; r < nRows; r++) {
+            const float* src = level.data->data() + int64_t(yMin + yStart + r) * level.width + xMin;
+            std::copy(src, src + readWidth, dst + int64_t(r) * readWidth);
+        }
+    };
+}
+
+/// serializes a level for the persistent cache: width, height, then the pixels
+QByteArray _level2qb(const MipmapCache::Level& level) {
+    QByteArray result;
+    int32_t header[2] = {level.width, level.height};
+    result.append(reinterpret_cast<const char*>(header), sizeof(header));
+    result.append(reinterpret_cast<const char*>(level.data->data()), level.data->size() * sizeof(float));
+    return result;
+}
+
+bool _qb2level(const QByteArray& bytes, int mip, MipmapCache::Level& level) {
+    int32_t header[2];
+    if (bytes.size() < int(sizeof(header))) {
+        return false;
+    }
+    memcpy(header, bytes.constData(), sizeof(header));
+    int64_t count = int64_t(header[0]) * header[1];
+    if (header[0] <= 0 || header[1] <= 0 || bytes.size() != int64_t(sizeof(header)) + count * int64_t(sizeof(float))) {
+        return false;
+    }
+    auto data = std::make_shared<std::vector<float> >(count);
+    memcpy(data->data(), bytes.constData() + sizeof(header), count * sizeof(float));
+    level.width = header[0];
+    level.height = header[1];
+    level.mip = mip;
+    level.data = data;
+    return true;
+}
+}
+
+bool DataSource::_findMipmapLevel(int channel, int stokeFrame, int mip, MipmapCache::Level& level) const {
+    // the full resolution plane is never persisted, it is just a copy of the file
+    if (mip == 1) {
+        return m_planeCache && m_planeCache->get(channel, stokeFrame, level);
+    }
+    MipmapCache& cache = MipmapCache::instance();
+    QString key = MipmapCache::makeKey(m_fileName, channel, stokeFrame, mip);
+    if (cache.get(key, level)) {
+        return true;
+    }
+    if (m_diskCache && !m_fileHash.isEmpty()) {
+        QByteArray val, error;
+        QByteArray persistentKey = MipmapCache::makePersistentKey(m_fileHash, channel, stokeFrame, mip);
+        if (m_diskCache->readEntry(persistentKey, val, error) && _qb2level(val, mip, level)) {
+            cache.put(key, level);
+            return true;
+        }
+    }
+    return false;
+}
+
+void DataSource::_getDownsampledData(Carta::Lib::NdArray::RawViewInterface* view, int xMin, int yMin,
+        int nx, int ny, int mip, int frameLow, int frameHigh, int stokeFrame, float* out) const {
+    const int width = view->dims()[0];
+    const int height = view->dims()[1];
+    const int readWidth = nx * mip;
+
+    // only single planes go to the mipmap cache
+    if (frameLow != frameHigh) {
+        Carta::Core::Algorithms::downsample(_viewRowReader(view, xMin, yMin, readWidth), nx, ny, mip, out);
+        return;
+    }
+    const int channel = frameLow;
+    MipmapCache& cache = MipmapCache::instance();
+
+    // the bounds of an aligned request at a cached level are just copied
+    MipmapCache::Level level;
+    bool aligned = (xMin % mip == 0) && (yMin % mip == 0);
+    if (aligned && _findMipmapLevel(channel, stokeFrame, mip, level)) {
+        _levelRowReader(level, xMin / mip, yMin / mip, nx)(0, ny, out);
+        qDebug() << "[DataSource] Raster image data from the mipmap cache, mip=" << mip;
+        return;
+    }
+
+    // build the whole level when the request covers a good part of the plane, which
+    // is typical for zoomed out views (zoomed in views are better off reading just
+    // the bounds)
+    bool buildLevel = mip > 1 && int64_t(readWidth) * ny * mip * 4 >= int64_t(width) * height;
+
+    // only a level build needs the whole plane; other requests skip the plane cache, a
+    // request at mip 1 already missed it above
+    MipmapCache::Level fullRes;
+    if (buildLevel) {
+        // read the whole plane once, all other levels can be made from it in memory
+        _getFullResolutionPlane(view, channel, stokeFrame, fullRes);
+        int levelWidth = width / mip;
+        int levelHeight = height / mip;
+        auto data = std::make_shared<std::vector<float> >(int64_t(levelWidth) * levelHeight);
+        Carta::Core::Algorithms::downsample(_levelRowReader(fullRes, 0, 0, levelWidth * mip),
+                                            levelWidth, levelHeight, mip, data->data());
+        level.width = levelWidth;
+        level.height = levelHeight;
+        level.mip = mip;
+        level.data = data;
+        QString key = MipmapCache::makeKey(m_fileName, channel, stokeFrame, mip);
+        cache.put(key, level);
+        if (m_diskCache && !m_fileHash.isEmpty()) {
+            m_diskCache->setEntry(MipmapCache::makePersistentKey(m_fileHash, channel, stokeFrame, mip),
+                                  _level2qb(level), QByteArray());
+        }
+        if (aligned) {
+            _levelRowReader(level, xMin / mip, yMin / mip, nx)(0, ny, out);
+            return;
+        }
+    }
+
+    // compute the bounds directly, from memory if we can
+    auto reader = buildLevel ? _levelRowReader(fullRes, xMin, yMin, readWidth)
+                             : _viewRowReader(view, xMin, yMin, readWidth);
+    Carta::Core::Algorithms::downsample(reader, nx, ny, mip, out);
+}
+
+void DataSource::_getFullResolutionPlane(Carta::Lib::NdArray::RawViewInterface* view, int channel, int stokeFrame,
+        MipmapCache::Level& plane) const {
+    if (_findMipmapLevel(channel, stokeFrame, 1, plane)) {
+        return;
+    }
+    _readPlane(view, plane);
+    if (m_planeCache) {
+        m_planeCache->put(channel, stokeFrame, plane);
+    }
+}
+
 PBMSharedPtr DataSource::_getRasterImageData(int fileId, int xMin, int xMax, int yMin, int yMax, int mip,
     int frameLow, int frameHigh, int stokeFrame,
     bool isZFP, int precision, int numSubsets,
     bool &changeFrame, int regionId, int numberOfBins,
     Carta::Lib::IntensityUnitConverter::SharedPtr converter) const {
 
-    std::vector<float> imageData; // the image raw data with downsampling
-
     // start timer for computing approximate percentiles
     QElapsedTimer timer;
     timer.start();
@@ -756,6 +1014,7 @@ PBMSharedPtr DataSource::_getRasterImageData(int fileId, int xMin, int xMax, int
         qWarning() << "[DataSource] Downsampling parameter, mip=" << mip
                    << ", which is larger than the image width=" <<  view->dims()[0]
                    << "or high=" << view->dims()[1] << ". Return nullptr";
+        delete view;
         return nullptr;
         // [Try] it may be due to the frontend signal problem, reset the mip as 1 to pass, and then resend the next correct signal
         //mip = 1;
@@ -768,64 +1027,10 @@ PBMSharedPtr DataSource::_getRasterImageData(int fileId, int xMin, int xMax, int
     //qDebug() << "get the x-pixel-coordinate range: [x_min, x_max]= [" << xMin << "," << xMax << "]" << "--> W=" << nx;
     //qDebug() << "get the y-pixel-coordinate range: [y_min, y_max]= [" << yMin << "," << yMax << "]" << "--> H=" << ny;
 
-    int prepareCols = view->dims()[0]; // get the full width length
-    int prepareRows = mip;
-    int area = prepareCols * prepareRows;
-    std::vector<float> prepareArea(area);
-
-    int nRows = (yMax - yMin) / mip;
-    int nCols = (xMax - xMin) / mip;
-    int nextRowToReadIn = yMin;
-
-    auto updateRows = [&]() -> void {
-        CARTA_ASSERT(nextRowToReadIn < view->dims()[1]); // check if the row index is beyond the length of the image high
-
-        SliceND rowSlice;
-        rowSlice.next().start( nextRowToReadIn ).end( nextRowToReadIn + prepareRows );
-        auto rawRowView = view -> getView( rowSlice );
-
-        // make a float view of this raw row view
-        Carta::Lib::NdArray::Float fview( rawRowView, true );
-
-        int t = 0;
-        fview.forEach( [&] ( const float & val ) {
-            // To improve the performance, the prepareArea also update only one row by computing the module
-            prepareArea[(t++)] = val;
-        });
-
-        if (t != area) {
-            qDebug() << "The prepared length of the raw data array:" << area
-                     << "=" << prepareCols << "X" << prepareRows
-                     << ", which is not consistent with the slice cut:" << t << "!!";
-            qFatal("The prepared length of the raw data array is not consistent with the slice cut!!");
-        }
-
-        // Calculate the mean of each block (mip X mip)
-        for (int i = 0; i < nCols; i++) {
-            float rawData = 0;
-            int elems = mip * mip;
-            float denominator = elems;
-            for (int e = 0; e < elems; e++) {
-                int row = e / mip;
-                int col = e % mip;
-                int index = ((row * prepareCols) + (col + (xMin + (i * mip))));
-                if (std::isfinite(prepareArea[index])) {
-                    rawData += prepareArea[index];
-                } else {
-                    denominator -= 1;
-                }
-            }
-            // set the NaN type of the pixel as the minimum of the other finite pixel values
-            rawData = (denominator < 1 ? NAN : rawData / denominator);
-            imageData.push_back(rawData);
-        }
-        nextRowToReadIn += prepareRows;
-    };
-
-    // scan the raw data for with rows for down sampling
-    for (int j = 0; j < nRows; j++) {
-        updateRows();
-    }
+    // average each (mip X mip) block, the results go straight to imageData
+    std::vector<float> imageData(int64_t(nx) * ny); // the image raw data with downsampling
+    _getDownsampledData(view, xMin, yMin, nx, ny, mip, frameLow, frameHigh, stokeFrame, imageData.data());
+    delete view;
 
     // add the RasterImageData message
     CARTA::ImageBounds* imgBounds = new CARTA::ImageBounds();
@@ -932,56 +1137,397 @@ PBMSharedPtr DataSource::_getRasterImageData(int fileId, int xMin, int xMax, int
 
     // check if need to calculate the histogram data
     if (changeFrame) {
-        RegionHistogramData result = _getPixels2HistogramData(fileId, regionId, frameLow, frameHigh, stokeFrame,
-                                                              numberOfBins, converter);
-        // check if the calculation result is valid
-        if (result.bins.size() > 0) {
-            // add RegionHistogramData in the RasterImageData message
-            CARTA::RegionHistogramData* region_histogram_data = new CARTA::RegionHistogramData();
-            region_histogram_data->set_file_id(result.fileId);
-            region_histogram_data->set_region_id(result.regionId);
-            region_histogram_data->set_stokes(result.stokeFrame);
-
-            CARTA::Histogram* histogram = region_histogram_data->add_histograms();
-            histogram->set_channel(result.frameLow);
-            histogram->set_num_bins(result.num_bins);
-            histogram->set_bin_width(result.bin_width);
-
-            // the minimum value of pixels is the first bin center
-            histogram->set_first_bin_center(result.first_bin_center);
-
-            // fill in the vector of the histogram data
-            for (auto intensity : result.bins) {
-                histogram->add_bins(intensity);
-            }
-            raster->set_allocated_channel_histogram_data(region_histogram_data);
-        }
+        _setChannelHistogramData(raster.get(), fileId, regionId, frameLow, frameHigh, stokeFrame,
+                                 numberOfBins, converter);
         // reset the m_changeFrame[fileId] = false; in the NewServerConnector obj
         changeFrame = false;
     }
 
+    // read ahead once this channel is out of the way
+    if (m_planeCache && frameLow == frameHigh) {
+        m_planeCache->show(frameLow, stokeFrame);
+    }
+
     return raster;
 }
 
-PBMSharedPtr DataSource::_getXYProfiles(int fileId, int x, int y,
+int DataSource::_getRasterTiles(int fileId, const std::vector<QPoint>& tiles, int mip,
     int frameLow, int frameHigh, int stokeFrame,
-    Carta::Lib::IntensityUnitConverter::SharedPtr converter) const {
-
-    qDebug() << "[DataSource] Get X/Y profiles...................................>";
+    bool isZFP, int precision,
+    bool &changeFrame, int regionId, int numberOfBins,
+    Carta::Lib::IntensityUnitConverter::SharedPtr converter,
+    const std::function<bool(PBMSharedPtr)>& sendTile) const {
 
-    std::vector<float> xProfile, yProfile;
+    QElapsedTimer timer;
+    timer.start();
 
-    // get the raw data of image
     Carta::Lib::NdArray::RawViewInterface* rawData = _getRawDataForStoke(frameLow, frameHigh, stokeFrame);
     if (rawData == nullptr) {
-        qCritical() << "[DataSource] Error: could not retrieve image data to get X/Y profiles.";
-        return nullptr;
+        qCritical() << "[DataSource] Error: could not retrieve image data to get raster tiles.";
+        return 0;
     }
     std::shared_ptr<Carta::Lib::NdArray::RawViewInterface> view(rawData);
-    Carta::Lib::NdArray::Double doubleView(view.get(), false);
-    const int imgWidth = view->dims()[0];
-    const int imgHeight = view->dims()[1];
+    const int width = view->dims()[0];
+    const int height = view->dims()[1];
+    if (mip <= 0 || mip > std::min(width, height)) {
+        qWarning() << "[DataSource] Downsampling parameter, mip=" << mip
+                   << ", which is larger than the image width=" << width
+                   << "or high=" << height << ". No tiles sent";
+        return 0;
+    }
+
+    // tiles are aligned with the mip grid, so we only need the bounds of a tile in image pixels
+    const int tileExtent = RASTER_TILE_SIZE * mip;
+    auto tileBounds = [=](const QPoint& tile, int& x0, int& y0, int& nx, int& ny) {
+        x0 = tile.x() * tileExtent;
+        y0 = tile.y() * tileExtent;
+        nx = x0 >= 0 && x0 < width ? (std::min(x0 + tileExtent, width) - x0) / mip : 0;
+        ny = y0 >= 0 && y0 < height ? (std::min(y0 + tileExtent, height) - y0) / mip : 0;
+    };
+
+    // when the tiles cover a good part of the plane, make sure the whole level is in the
+    // mipmap cache before we start, then every tile is just a copy out of it (otherwise
+    // each tile would read the plane for itself)
+    int64_t coveredPixels = 0;
+    int lastTile = -1;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        int x0, y0, nx, ny;
+        tileBounds(tiles[i], x0, y0, nx, ny);
+        if (nx > 0 && ny > 0) {
+            coveredPixels += int64_t(nx) * ny * mip * mip;
+            lastTile = i;
+        }
+    }
+    MipmapCache::Level level;
+    if (frameLow == frameHigh && mip > 1 && coveredPixels * 4 >= int64_t(width) * height &&
+        !_findMipmapLevel(frameLow, stokeFrame, mip, level)) {
+        std::vector<float> plane(int64_t(width / mip) * (height / mip));
+        _getDownsampledData(view.get(), 0, 0, width / mip, height / mip, mip,
+                            frameLow, frameHigh, stokeFrame, plane.data());
+    }
+
+    // every tile is downsampled, NaN encoded and compressed on its own, they are queued
+    // in the order they should be sent, so the first ones are also the first to finish
+    std::vector<std::shared_ptr<CARTA::RasterImageData> > rasters(tiles.size());
+    std::atomic<bool> stopped(false);
+    auto makeTile = [&](size_t i) {
+        int x0, y0, nx, ny;
+        tileBounds(tiles[i], x0, y0, nx, ny);
+        if (nx <= 0 || ny <= 0 || stopped) {
+            return;
+        }
+        std::vector<float> tileData(int64_t(nx) * ny);
+        _getDownsampledData(view.get(), x0, y0, nx, ny, mip, frameLow, frameHigh, stokeFrame, tileData.data());
+
+        CARTA::ImageBounds* imgBounds = new CARTA::ImageBounds();
+        imgBounds->set_x_min(x0);
+        imgBounds->set_x_max(x0 + nx * mip);
+        imgBounds->set_y_min(y0);
+        imgBounds->set_y_max(y0 + ny * mip);
+
+        std::shared_ptr<CARTA::RasterImageData> raster(new CARTA::RasterImageData());
+        raster->set_file_id(fileId);
+        raster->set_allocated_image_bounds(imgBounds);
+        raster->set_channel(frameLow);
+        raster->set_stokes(stokeFrame);
+        raster->set_mip(mip);
+
+        if (isZFP) {
+            std::vector<char> compressionBuffer;
+            size_t compressedSize = 0;
+            std::vector<int32_t> nanEncodings = _getNanEncodingsBlock(tileData, 0, nx, ny);
+            if (_compress(tileData, 0, compressionBuffer, compressedSize, nx, ny, precision) != 0) {
+                qWarning() << "[DataSource] ZFP compression of the raster tile" << tiles[i] << "failed";
+            }
+            raster->set_compression_type(CARTA::CompressionType::ZFP);
+            raster->set_compression_quality(precision);
+            raster->add_image_data(compressionBuffer.data(), compressedSize);
+            raster->add_nan_encodings((char*) nanEncodings.data(), nanEncodings.size() * sizeof(int));
+        } else {
+            raster->set_compression_type(CARTA::CompressionType::NONE);
+            raster->set_compression_quality(0);
+            raster->add_image_data(tileData.data(), tileData.size() * sizeof(float));
+        }
+        rasters[i] = raster;
+    };
+
+    std::vector<QFuture<void> > futures;
+    futures.reserve(tiles.size());
+    for (size_t i = 0; i < tiles.size(); i++) {
+        futures.push_back(QtConcurrent::run([&makeTile, i]() { makeTile(i); }));
+    }
+
+    // send the tiles in order, each one as soon as it is done; the channel histogram
+    // goes with the last one so that it does not hold up the image
+    int sent = 0;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        futures[i].waitForFinished();
+        if (!rasters[i] || stopped) {
+            continue;
+        }
+        if (changeFrame && int(i) == lastTile) {
+            _setChannelHistogramData(rasters[i].get(), fileId, regionId, frameLow, frameHigh, stokeFrame,
+                                     numberOfBins, converter);
+            changeFrame = false;
+        }
+        if (!sendTile(rasters[i])) {
+            // the tiles that have not started yet are skipped, we still wait for the
+            // others since they write to this frame
+            stopped = true;
+            continue;
+        }
+        sent++;
+    }
+
+    // read ahead once this channel is out of the way
+    if (m_planeCache && frameLow == frameHigh && !stopped) {
+        m_planeCache->show(frameLow, stokeFrame);
+    }
+
+    if (CARTA_RUNTIME_CHECKS) {
+        qCritical() << "<> Time to get" << sent << "raster tiles:" << timer.elapsed() << "ms";
+    }
+    return sent;
+}
+
+int DataSource::_getContourImageData(int fileId, int channel, int stokeFrame,
+    const std::vector<double>& levels, int smoothingMode, int smoothingFactor,
+    int decimation, int compressionLevel,
+    const std::function<bool(PBMSharedPtr)>& sendContours) const {
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // marching squares needs the whole plane, which the raster requests have usually read already
+    MipmapCache::Level plane;
+    if (!_findMipmapLevel(channel, stokeFrame, 1, plane)) {
+        std::unique_ptr<Carta::Lib::NdArray::RawViewInterface> view(_getRawDataForStoke(channel, channel, stokeFrame));
+        if (!view) {
+            qCritical() << "[DataSource] Error: could not retrieve image data to get contours.";
+            return 0;
+        }
+        int64_t planeBytes = int64_t(view->dims()[0]) * view->dims()[1] * sizeof(float);
+        if (m_planeCache && m_planeCache->fits(planeBytes)) {
+            _getFullResolutionPlane(view.get(), channel, stokeFrame, plane);
+        } else {
+            _readPlane(view.get(), plane);
+        }
+    }
+
+    // the smoothed plane is only needed here, the cached one stays as it is
+    if (smoothingFactor > 1 && (smoothingMode == CONTOUR_BLOCK_AVERAGE || smoothingMode == CONTOUR_GAUSSIAN_BLUR)) {
+        std::shared_ptr<std::vector<float> > smoothed(new std::vector<float>(plane.data->size()));
+        if (smoothingMode == CONTOUR_BLOCK_AVERAGE) {
+            Carta::Core::Algorithms::smoothBox(plane.data->data(), plane.width, plane.height,
+                                               smoothingFactor, smoothed->data());
+        } else {
+            // the factor is the full width at half maximum
+            double sigma = smoothingFactor / 2.3548;
+            Carta::Core::Algorithms::smoothSeparable(plane.data->data(), plane.width, plane.height,
+                                                     Carta::Core::Algorithms::gaussianKernel(sigma), smoothed->data());
+        }
+        plane.data = smoothed;
+    }
+
+    int sent = 0;
+    auto sink = [&](int tile, const std::vector<Carta::Core::Algorithms::ContourLines>& lines, double progress) {
+        // the joined lines cover the whole image, and they are sent even if there are none
+        // so that the client knows the contours are complete
+        int x0 = 0, y0 = 0, nx = plane.width - 1, ny = plane.height - 1;
+        if (tile >= 0) {
+            Carta::Core::Algorithms::contourTileBounds(plane.width, plane.height, CONTOUR_TILE_SIZE, tile,
+                                                      x0, y0, nx, ny);
+        }
+        std::shared_ptr<CARTA::ContourImageData> contours(new CARTA::ContourImageData());
+        for (size_t i = 0; i < levels.size(); i++) {
+            if (lines[i].startIndices.empty()) {
+                continue;
+            }
+            CARTA::ContourSet* contourSet = contours->add_contour_sets();
+            contourSet->set_level(levels[i]);
+            if (decimation > 0) {
+                // quantized deltas, a byte or so per coordinate instead of four
+                // deflated when the client asked for a compression level, as a plain zlib stream
+                std::vector<char> encoded = Carta::Core::Algorithms::encodeContourCoordinates(
+                    lines[i].coordinates, lines[i].startIndices, decimation, compressionLevel);
+                contourSet->set_raw_coordinates(encoded.data(), encoded.size());
+                contourSet->set_decimation_factor(decimation);
+                contourSet->set_uncompressed_coordinates_size(lines[i].coordinates.size());
+            } else {
+                contourSet->mutable_coordinates()->Reserve(lines[i].coordinates.size());
+                for (float coordinate : lines[i].coordinates) {
+                    contourSet->add_coordinates(coordinate);
+                }
+            }
+            contourSet->mutable_start_indices()->Reserve(lines[i].startIndices.size());
+            for (int32_t startIndex : lines[i].startIndices) {
+                contourSet->add_start_indices(startIndex);
+            }
+        }
+        if (contours->contour_sets_size() == 0 && tile >= 0) {
+            return true;
+        }
+
+        CARTA::ImageBounds* imgBounds = new CARTA::ImageBounds();
+        imgBounds->set_x_min(x0);
+        imgBounds->set_x_max(x0 + nx + 1);
+        imgBounds->set_y_min(y0);
+        imgBounds->set_y_max(y0 + ny + 1);
+
+        contours->set_file_id(fileId);
+        contours->set_reference_file_id(fileId);
+        contours->set_allocated_image_bounds(imgBounds);
+        contours->set_channel(channel);
+        contours->set_stokes(stokeFrame);
+        contours->set_progress(progress);
+        if (!sendContours(contours)) {
+            return false;
+        }
+        sent++;
+        return true;
+    };
+    Carta::Core::Algorithms::tiledContours(plane.data->data(), plane.width, plane.height, levels, sink,
+                                           CONTOUR_TILE_SIZE);
+
+    if (CARTA_RUNTIME_CHECKS) {
+        qCritical() << "<> Time to get" << levels.size() << "contour levels in" << sent << "messages:"
+                    << timer.elapsed() << "ms";
+    }
+    return sent;
+}
+
+void DataSource::_setChannelHistogramData(CARTA::RasterImageData* raster, int fileId, int regionId,
+    int frameLow, int frameHigh, int stokeFrame, int numberOfBins,
+    Carta::Lib::IntensityUnitConverter::SharedPtr converter) const {
+    RegionHistogramData result = _getPixels2HistogramData(fileId, regionId, frameLow, frameHigh, stokeFrame,
+                                                          numberOfBins, converter);
+    // check if the calculation result is valid
+    if (result.bins.size() == 0) {
+        return;
+    }
+    // add RegionHistogramData in the RasterImageData message
+    CARTA::RegionHistogramData* region_histogram_data = new CARTA::RegionHistogramData();
+    region_histogram_data->set_file_id(result.fileId);
+    region_histogram_data->set_region_id(result.regionId);
+    region_histogram_data->set_stokes(result.stokeFrame);
+
+    CARTA::Histogram* histogram = region_histogram_data->add_histograms();
+    histogram->set_channel(result.frameLow);
+    histogram->set_num_bins(result.num_bins);
+    histogram->set_bin_width(result.bin_width);
+
+    // the minimum value of pixels is the first bin center
+    histogram->set_first_bin_center(result.first_bin_center);
+
+    // fill in the vector of the histogram data
+    for (auto intensity : result.bins) {
+        histogram->add_bins(intensity);
+    }
+    raster->set_allocated_channel_histogram_data(region_histogram_data);
+}
+
+void DataSource::_indexChannelStats(int numberOfBins) {
+    if (!m_image || (m_channelStats && m_channelStats->getNumberOfBins() == numberOfBins)) {
+        return;
+    }
+
+    std::vector<int> dims = m_image->dims();
+    int stokeIndex = Util::getAxisIndex(m_image, AxisInfo::KnownType::STOKES);
+    int channelCount = 1;
+    for (int i = 0; i < static_cast<int>(dims.size()); i++) {
+        if (i != m_axisIndexX && i != m_axisIndexY && i != stokeIndex) {
+            channelCount = dims[i];
+            break;
+        }
+    }
+    // only stokes I, Q, U and V are supported by _getRawDataForStoke()
+    int stokesCount = stokeIndex >= 0 ? std::min(dims[stokeIndex], 4) : 1;
+
+    m_channelStats = std::make_shared<ChannelStatsIndex>(m_fileName, channelCount, stokesCount,
+                                                         numberOfBins, m_diskCache);
+
+    // the reader must not use this data source, it may go away before the index does
+    std::shared_ptr<Carta::Lib::Image::ImageInterface> image = m_image;
+    int axisIndexX = m_axisIndexX;
+    int axisIndexY = m_axisIndexY;
+    bool hasStokes = stokeIndex >= 0;
+    m_channelStats->start([image, axisIndexX, axisIndexY, hasStokes] (int channel, int stokes) {
+        return _getRawDataForStoke(image, axisIndexX, axisIndexY, channel, channel, hasStokes ? stokes : -1);
+    });
+}
+
+void DataSource::_transposeSpectralCube() {
+    QString directory = Globals::instance()->mainConfig()->getSpectralCacheDirectory();
     int spectralIndex = Util::getAxisIndex(m_image, AxisInfo::KnownType::SPECTRAL);
+    // the copy keeps x and y as the first two axes
+    if (directory.isEmpty() || !m_image || m_spectralCube || spectralIndex < 0 ||
+            m_axisIndexX != 0 || m_axisIndexY != 1) {
+        return;
+    }
+    std::vector<int> dims = m_image->dims();
+    if (dims[spectralIndex] <= 1) {
+        return;
+    }
+    int stokeIndex = Util::getAxisIndex(m_image, AxisInfo::KnownType::STOKES);
+    // only stokes I, Q, U and V are supported by _getRawDataForStoke()
+    int stokesCount = stokeIndex >= 0 ? std::min(dims[stokeIndex], 4) : 1;
+    int sizeMB = Globals::instance()->mainConfig()->getSpectralCacheSizeMB();
+    qint64 maxBytes = qint64(sizeMB > 0 ? sizeMB : SPECTRAL_CACHE_SIZE_MB) * 1024 * 1024;
+
+    m_spectralCube = std::make_shared<SpectralCubeCache>(m_fileName, dims[m_axisIndexX], dims[m_axisIndexY],
+                                                         dims[spectralIndex], stokesCount, directory, maxBytes);
+
+    // the reader must not use this data source, it may go away before the copy does
+    std::shared_ptr<Carta::Lib::Image::ImageInterface> image = m_image;
+    int axisIndexX = m_axisIndexX;
+    int axisIndexY = m_axisIndexY;
+    bool hasStokes = stokeIndex >= 0;
+    m_spectralCube->start([image, axisIndexX, axisIndexY, hasStokes] (const QRect& area, int stokes) {
+        return _getRawDataForArea(image, axisIndexX, axisIndexY, area, hasStokes ? stokes : -1);
+    });
+}
+
+void DataSource::_resetPlaneCache() {
+    int sizeMB = Globals::instance()->mainConfig()->getPlaneCacheSizeMB();
+    qint64 maxBytes = qint64(sizeMB > 0 ? sizeMB : PLANE_CACHE_SIZE_MB) * 1024 * 1024;
+    int prefetchCount = Globals::instance()->mainConfig()->getPlanePrefetchCount();
+    if (prefetchCount < 0) {
+        prefetchCount = PLANE_PREFETCH_COUNT;
+    }
+
+    // the reader must not use this data source, it may go away before the cache does
+    std::shared_ptr<Carta::Lib::Image::ImageInterface> image = m_image;
+    int axisIndexX = m_axisIndexX;
+    int axisIndexY = m_axisIndexY;
+    m_planeCache = std::make_shared<ChannelPlaneCache>(_getFrameCount(AxisInfo::KnownType::SPECTRAL),
+            maxBytes, prefetchCount,
+            [image, axisIndexX, axisIndexY] (int channel, int stokes, ChannelPlaneCache::Plane& plane) {
+        std::unique_ptr<Carta::Lib::NdArray::RawViewInterface> view(
+            _getRawDataForStoke(image, axisIndexX, axisIndexY, channel, channel, stokes));
+        if (!view) {
+            return false;
+        }
+        _readPlane(view.get(), plane);
+        return true;
+    });
+}
+
+bool DataSource::_getChannelStats(int frameLow, int frameHigh, int stokeFrame,
+        ChannelStatsIndex::Stats& stats, bool withBins) const {
+    if (!m_channelStats || frameLow != frameHigh) {
+        return false;
+    }
+    int stokes = Util::getAxisIndex(m_image, AxisInfo::KnownType::STOKES) >= 0 ? stokeFrame : 0;
+    return m_channelStats->get(frameLow, stokes, stats, withBins);
+}
+
+PBMSharedPtr DataSource::_getXYProfiles(int fileId, int x, int y,
+    int frameLow, int frameHigh, int stokeFrame,
+    Carta::Lib::IntensityUnitConverter::SharedPtr converter) const {
+
+    qDebug() << "[DataSource] Get X/Y profiles...................................>";
+
+    std::vector<float> xProfile, yProfile;
 
     // start timer for computing X/Y profiles
     QElapsedTimer timer;
@@ -990,16 +1536,27 @@ PBMSharedPtr DataSource::_getXYProfiles(int fileId, int x, int y,
     // TODO: need to check the spatial profile to get the corresponding spatial data
     // now only get 'x', 'y' no matter what the spatial profiles are specified
 
-    if (converter && converter->frameDependent) {
-        // Find Hz values if they are required for the unit transformation
-        std::vector<double> hertzValues = _getHertzValues(doubleView.dims());
-        for (size_t f = 0; f < hertzValues.size(); f++) {
-            double hertzVal = hertzValues[f];
-            Carta::Lib::NdArray::Double viewSlice = Carta::Lib::viewSliceForFrame(doubleView, spectralIndex, f);
-            _getXYProfiles(doubleView, imgWidth, imgHeight, x, y, xProfile, yProfile);
+    // the profiles are taken from the first channel of the range
+    int channel = std::max(frameLow, 0);
+    if (!_getXYProfiles(x, y, channel, stokeFrame, xProfile, yProfile)) {
+        qCritical() << "[DataSource] Error: could not retrieve image data to get X/Y profiles.";
+        return nullptr;
+    }
+
+    if (converter) {
+        double hertz = 0;
+        if (converter->frameDependent) {
+            // Find Hz values if they are required for the unit transformation
+            std::vector<double> hertzValues = _getHertzValues(m_image->dims());
+            if (channel < int(hertzValues.size())) {
+                hertz = hertzValues[channel];
+            }
+        }
+        for (std::vector<float>* profile : {&xProfile, &yProfile}) {
+            for (float& val : *profile) {
+                val = converter->frameDependent ? converter->convert(val, hertz) : converter->convert(val);
+            }
         }
-    } else {
-        _getXYProfiles(doubleView, imgWidth, imgHeight, x, y, xProfile, yProfile);
     }
 
     // end of timer for computing X/Y profiles
@@ -1016,9 +1573,9 @@ PBMSharedPtr DataSource::_getXYProfiles(int fileId, int x, int y,
     spatialProfileData->set_y(y);
     spatialProfileData->set_channel(frameLow);
     spatialProfileData->set_stokes(stokeFrame);
-    if (xProfile.size() > x) {
+    if (int(xProfile.size()) > x) {
         spatialProfileData->set_value(xProfile[x]);
-    } else if (yProfile.size() > y) {
+    } else if (int(yProfile.size()) > y) {
         spatialProfileData->set_value(yProfile[y]);
     }
 
@@ -1037,20 +1594,53 @@ PBMSharedPtr DataSource::_getXYProfiles(int fileId, int x, int y,
     return spatialProfileData;
 }
 
-void DataSource::_getXYProfiles(Carta::Lib::NdArray::Double doubleView, const int imgWidth, const int imgHeight,
-    const int x, const int y, std::vector<float> & xProfile, std::vector<float> & yProfile) const {
+bool DataSource::_getXYProfiles(int x, int y, int channel, int stokeFrame,
+        std::vector<float>& xProfile, std::vector<float>& yProfile) const {
+    // the cursor usually moves within one channel, whose plane the raster requests have
+    // mostly read into memory already
+    MipmapCache::Level plane;
+    std::unique_ptr<Carta::Lib::NdArray::RawViewInterface> view;
+    if (!_findMipmapLevel(channel, stokeFrame, 1, plane)) {
+        view.reset(_getRawDataForStoke(channel, channel, stokeFrame));
+        if (!view) {
+            return false;
+        }
+        // a plane that does not fit in the cache would be read again for every position
+        int64_t planeBytes = int64_t(view->dims()[0]) * view->dims()[1] * sizeof(float);
+        if (m_planeCache && m_planeCache->fits(planeBytes)) {
+            _getFullResolutionPlane(view.get(), channel, stokeFrame, plane);
+        }
+    }
+    const int width = plane.data ? plane.width : view->dims()[0];
+    const int height = plane.data ? plane.height : view->dims()[1];
+    if (x < 0 || x >= width || y < 0 || y >= height) {
+        qWarning() << "[DataSource] The cursor (" << x << "," << y << ") is outside of the image.";
+        return false;
+    }
 
-    // get X profile
-    for (int index = 0; index < imgWidth; index++) {
-        float val = (float)doubleView.get({index,y});
-        std::isfinite(val) ? xProfile.push_back(val) : xProfile.push_back(NAN); // replace infinite with NaN
+    xProfile.resize(width);
+    yProfile.resize(height);
+    if (plane.data) {
+        const float* row = plane.data->data() + int64_t(y) * width;
+        std::copy(row, row + width, xProfile.begin());
+        for (int index = 0; index < height; index++) {
+            yProfile[index] = (*plane.data)[int64_t(index) * width + x];
+        }
+    } else {
+        // one read for the row and one for the column
+        _viewRowReader(view.get(), 0, y, width)(0, 1, xProfile.data());
+        _viewRowReader(view.get(), x, 0, 1)(0, height, yProfile.data());
     }
 
-    // get Y profile
-    for (int index = 0; index < imgHeight; index++) {
-        float val = (float)doubleView.get({x,index});
-        std::isfinite(val) ? yProfile.push_back(val) : yProfile.push_back(NAN); // replace infinite with NaN
+    // replace infinite with NaN
+    for (std::vector<float>* profile : {&xProfile, &yProfile}) {
+        for (float& val : *profile) {
+            if (!std::isfinite(val)) {
+                val = NAN;
+            }
+        }
     }
+    return true;
 }
 
 bool DataSource::_addProfile(std::shared_ptr<CARTA::SpatialProfileData> spatialProfileData,
@@ -1347,17 +1937,23 @@ int DataSource::_getSpectralIndicator() {
 }
 
 Carta::Lib::NdArray::RawViewInterface* DataSource::_getRawDataForStoke( int frameStart, int frameEnd, int stokeFrame ) const {
+    return _getRawDataForStoke( m_image, m_axisIndexX, m_axisIndexY, frameStart, frameEnd, stokeFrame );
+}
+
+Carta::Lib::NdArray::RawViewInterface* DataSource::_getRawDataForStoke(
+        std::shared_ptr<Carta::Lib::Image::ImageInterface> image, int axisIndexX, int axisIndexY,
+        int frameStart, int frameEnd, int stokeFrame ) {
 
     Carta::Lib::NdArray::RawViewInterface* rawData = nullptr;
-    int spectralIndex = Util::getAxisIndex( m_image, AxisInfo::KnownType::SPECTRAL );
-    int stokeIndex = Util::getAxisIndex( m_image, AxisInfo::KnownType::STOKES );
+    int spectralIndex = Util::getAxisIndex( image, AxisInfo::KnownType::SPECTRAL );
+    int stokeIndex = Util::getAxisIndex( image, AxisInfo::KnownType::STOKES );
 
-    if ( m_image ){
+    if ( image ){
         // get the image dimension:
         // if the image dimension=3, then dim[0]: x-axis, dim[1]: y-axis, and dim[2]: channel-axis
         // if the image dimension=4, then dim[0]: x-axis, dim[1]: y-axis, dim[2]: stoke-axis, and dim[3]: channel-axis
         //                                                            or  dim[2]: channel-axis, and dim[3]: stoke-axis
-        int imageDim =m_image->dims().size();
+        int imageDim =image->dims().size();
         //qDebug() << "++++++++ Dimension of image raw data=" << imageDim;
 
         SliceND frameSlice = SliceND().next();
@@ -1365,10 +1961,10 @@ Carta::Lib::NdArray::RawViewInterface* DataSource::_getRawDataForStoke( int fram
         for ( int i = 0; i < imageDim; i++ ){
 
             // only deal with the extra dimensions other than x-axis and y-axis
-            if ( i != m_axisIndexX && i != m_axisIndexY ){
+            if ( i != axisIndexX && i != axisIndexY ){
 
                 // get the number of slice (e.q. channel) in this dimension
-                int sliceSize = m_image->dims()[i];
+                int sliceSize = image->dims()[i];
                 SliceND& slice = frameSlice.next();
 
                 // If it is the target axis..
@@ -1419,11 +2015,45 @@ Carta::Lib::NdArray::RawViewInterface* DataSource::_getRawDataForStoke( int fram
                 slice.step( 1 );
             }
         }
-        rawData = m_image->getDataSlice( frameSlice );
+        rawData = image->getDataSlice( frameSlice );
     }
     return rawData;
 }
 
+Carta::Lib::NdArray::RawViewInterface* DataSource::_getRawDataForArea(
+        std::shared_ptr<Carta::Lib::Image::ImageInterface> image, int axisIndexX, int axisIndexY,
+        const QRect& area, int stokeFrame, int frameLow, int frameHigh ) {
+    int spectralIndex = Util::getAxisIndex( image, AxisInfo::KnownType::SPECTRAL );
+    int stokeIndex = Util::getAxisIndex( image, AxisInfo::KnownType::STOKES );
+    if ( !image || spectralIndex < 0 ){
+        return nullptr;
+    }
+    const std::vector<int> dims = image->dims();
+    SliceND areaSlice;
+    for ( int i = 0; i < int(dims.size()); i++ ){
+        if ( i > 0 ){
+            areaSlice.next();
+        }
+        if ( i == axisIndexX ){
+            areaSlice.start( area.left() ).end( area.right() + 1 );
+        }
+        else if ( i == axisIndexY ){
+            areaSlice.start( area.top() ).end( area.bottom() + 1 );
+        }
+        else if ( i == spectralIndex ){
+            int lastFrame = ( 0 <= frameHigh && frameHigh < dims[i] ) ? frameHigh : dims[i] - 1;
+            areaSlice.start( std::max( frameLow, 0 ) ).end( lastFrame + 1 );
+        }
+        else if ( i == stokeIndex && 0 <= stokeFrame && stokeFrame < dims[i] ){
+            areaSlice.start( stokeFrame ).end( stokeFrame + 1 );
+        }
+        else {
+            areaSlice.start( 0 ).end( 1 );
+        }
+    }
+    return image->getDataSlice( areaSlice );
+}
+
 std::vector<int> DataSource::_getStokeIndex( const std::vector<int>& frames ) const {
     std::vector<int> stokeIndex = {-1, -1};
     if ( m_permuteImage ) {
@@ -1657,6 +2287,11 @@ QString DataSource::_setFileName( const QString& fileName, bool* success ){
                 if (!res.isNull()){
                     m_image = res.val();
                     m_permuteImage = m_image;
+                    m_channelStats = nullptr;
+                    m_spectralCube = nullptr;
+                    m_regionStats = std::make_shared<RegionStatsCache>(REGION_STATS_CACHE_ENTRIES);
+                    _resetPlaneCache();
+                    m_beamArea = _getBeamArea(m_image);
                     std::shared_ptr<CoordinateFormatterInterface> cf(
                         m_image->metaData()->coordinateFormatter()->clone() );
                     m_coordinateFormatter = cf;
@@ -1665,6 +2300,9 @@ QString DataSource::_setFileName( const QString& fileName, bool* success ){
                     _resetPan();
 
                     m_fileName = file;
+                    // a file replaced on disk must not get the levels of the old one
+                    m_fileHash = m_diskCache && Globals::instance()->mainConfig()->isMipmapPersistent() ?
+                            Carta::Lib::IntensityCacheHelper::fileHash(m_fileName) : QByteArray();
                     //qDebug() << "[DataSource] m_fileName=" << m_fileName;
                 }
                 else {
@@ -1782,6 +2420,7 @@ void DataSource::_setDisplayAxes(std::vector<AxisInfo::KnownType> displayAxisTyp
 
     if ( axisXChanged || axisYChanged ){
         m_permuteImage = _getPermutedImage();
+        _resetPlaneCache();
         _resetPan();
     }
     std::vector<int> mFrames = _fitFramesToImage( frames );
@@ -1834,8 +2473,10 @@ std::vector<double> DataSource::_getQuantileIntensityCache(std::shared_ptr<Carta
     std::vector<double> clips;
 
     // If the disk cache exists, try to find the clips in the cache first
-    std::shared_ptr<Carta::Lib::IntensityValue> minClipInCache = _readIntensityCache(setChannelIndex, setChannelIndex, minClipPercentile, stokeIndex[1], "NONE");
-    std::shared_ptr<Carta::Lib::IntensityValue> maxClipInCache = _readIntensityCache(setChannelIndex, setChannelIndex, maxClipPercentile, stokeIndex[1], "NONE");
+    std::vector<std::shared_ptr<Carta::Lib::IntensityValue> > clipsInCache = _readIntensityCache(setChannelIndex, setChannelIndex,
+            std::vector<double>({minClipPercentile, maxClipPercentile}), stokeIndex[1], "NONE");
+    std::shared_ptr<Carta::Lib::IntensityValue> minClipInCache = clipsInCache[0];
+    std::shared_ptr<Carta::Lib::IntensityValue> maxClipInCache = clipsInCache[1];
     // if both of caches exist, we get their values
     if (minClipInCache && minClipInCache->error == 0 /* minimum intensity cache exists and has a zero error order */ &&
         maxClipInCache && maxClipInCache->error == 0 /* maximum intensity cache exists and has a zero error order */) {
@@ -1878,8 +2519,7 @@ std::vector<double> DataSource::_getQuantileIntensityCache(std::shared_ptr<Carta
         // this step is done in DataSource::_getCursorText() first !!
         // the intensity error is zero, because we use percentile2pixels() --> "std::nth_element" algorithm
         // for precise percentile calculation
-        _setIntensityCache(clips[0], 0, setChannelIndex, setChannelIndex, minClipPercentile, stokeIndex[1], "NONE");
-        _setIntensityCache(clips[1], 0, setChannelIndex, setChannelIndex, maxClipPercentile, stokeIndex[1], "NONE");
+        _setIntensityCache(clips_map, 0, setChannelIndex, setChannelIndex, stokeIndex[1], "NONE");
         qDebug() << "++++++++ [find cache] for percentile (per frame)= [" << minClipPercentile << "," << maxClipPercentile << "], intensity= [" << clips[0] << "," << clips[1] << "]";
     }
     return clips;
@@ -1936,23 +2576,39 @@ PBMSharedPtr DataSource::_getSpectralProfile(int fileId, int x, int y, int stoke
     // TODO: need to check the spectral profile to get the corresponding spectral data
     // now only get 'z' no matter what the spectral profile is specified
 
-    auto result = Globals::instance()->pluginManager()
-        -> prepare <Carta::Lib::Hooks::ProfileHook>(m_image, nullptr/*region info (nullptr is for all region)*/,
-                                                    x, y, m_profileInfo);
-    auto lam = [=] (const Carta::Lib::Hooks::ProfileResult &data) {
-        m_profileResult = data;
-    };
+    // the profile of a cursor is just the pixel in every channel, which is read directly
+    // rather than collapsing a sub image with the plugin
+    std::vector<float> profile;
+    int stokeFrame = m_profileInfo.getStokesFrame();
+    std::shared_ptr<SpectralCubeCache> spectralCube = m_spectralCube;
+    bool found = spectralCube && spectralCube->getProfile(x, y, std::max(stokeFrame, 0), profile);
+    if (!found) {
+        found = _getSpectralProfile(x, y, stokeFrame, profile);
+    }
+    if (!found) {
+        auto result = Globals::instance()->pluginManager()
+            -> prepare <Carta::Lib::Hooks::ProfileHook>(m_image, nullptr/*region info (nullptr is for all region)*/,
+                                                        x, y, m_profileInfo);
+        // the result is local so that profiles of different cursors can be computed at the same time
+        Carta::Lib::Hooks::ProfileResult profileResult;
+        auto lam = [&profileResult] (const Carta::Lib::Hooks::ProfileResult &data) {
+            profileResult = data;
+        };
 
-    try {
-        result.forEach(lam);
-    }
-    catch (char*& error) {
-        qDebug() << "[DataSource] ProfileRenderWorker::run: caught error: " << error;
-        m_profileResult.setError( QString(error) );
-    }
+        try {
+            result.forEach(lam);
+        }
+        catch (char*& error) {
+            qDebug() << "[DataSource] ProfileRenderWorker::run: caught error: " << error;
+            profileResult.setError( QString(error) );
+        }
 
-    // pair(first, second): first for channel_vals[](skipped), second for spectral profile
-    std::vector< std::pair<double,double> > profileData = m_profileResult.getData();
+        // pair(first, second): first for channel_vals[](skipped), second for spectral profile
+        std::vector< std::pair<double,double> > profileData = profileResult.getData();
+        for(auto iter = profileData.begin(); iter != profileData.end(); iter++) {
+            profile.push_back(iter->second);
+        }
+    }
 
     // create spectral profile data & generate protobuf message
     std::shared_ptr<CARTA::SpectralProfileData> spectralProfileData(new CARTA::SpectralProfileData());
@@ -1968,8 +2624,9 @@ PBMSharedPtr DataSource::_getSpectralProfile(int fileId, int x, int y, int stoke
     }
 
     spectralProfile->set_coordinate("z");
-    for(auto iter = profileData.begin(); iter != profileData.end(); iter++) {
-        spectralProfile->add_vals(iter->second);
+    spectralProfile->mutable_vals()->Reserve(profile.size());
+    for (float val : profile) {
+        spectralProfile->add_vals(val);
     }
 
     // end of timer for computing Z profile
@@ -1983,6 +2640,332 @@ PBMSharedPtr DataSource::_getSpectralProfile(int fileId, int x, int y, int stoke
     return spectralProfileData;
 }
 
+bool DataSource::_getSpectralProfile(int x, int y, int stokeFrame, std::vector<float>& profile) const {
+    int spectralIndex = Util::getAxisIndex(m_image, AxisInfo::KnownType::SPECTRAL);
+    if (!m_image || spectralIndex < 0) {
+        return false;
+    }
+    const std::vector<int> dims = m_image->dims();
+    if (x < 0 || x >= dims[m_axisIndexX] || y < 0 || y >= dims[m_axisIndexY]) {
+        return false;
+    }
+
+    // a single pixel of every channel, which the image reads with one strided access
+    std::unique_ptr<Carta::Lib::NdArray::RawViewInterface> view(
+        _getRawDataForArea(m_image, m_axisIndexX, m_axisIndexY, QRect(x, y, 1, 1), stokeFrame));
+    if (!view) {
+        return false;
+    }
+
+    profile.resize(dims[spectralIndex]);
+    int64_t t = 0;
+    Carta::Lib::NdArray::Float fview(view.release(), true);
+    fview.forEachChunk([&t, &profile] (const float* values, int64_t count) {
+        count = std::min<int64_t>(count, int64_t(profile.size()) - t);
+        std::copy(values, values + count, profile.begin() + t);
+        t += count;
+    });
+    if (t != int64_t(profile.size())) {
+        qWarning() << "[DataSource] Read" << t << "values of the spectral profile instead of" << profile.size();
+        return false;
+    }
+    return true;
+}
+
+namespace {
+/// the value of a statistic of a region from its moments, NaN if it is not defined
+double _getStatsValue(int statsType, const Carta::Core::Algorithms::RegionMoments& moments,
+        qint64 regionPixels, double beamArea) {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    double n = moments.count;
+    switch (statsType) {
+    case CARTA::StatsType::NumPixels:
+        return n;
+    case CARTA::StatsType::NanCount:
+        return double(regionPixels) - n;
+    case CARTA::StatsType::Sum:
+        return n > 0 ? moments.sum : nan;
+    case CARTA::StatsType::FluxDensity:
+        // NaN unless the image is in Jy/beam and has a beam
+        return n > 0 ? moments.sum / beamArea : nan;
+    case CARTA::StatsType::Mean:
+        return n > 0 ? moments.sum / n : nan;
+    case CARTA::StatsType::SumSq:
+        return n > 0 ? moments.sumSq : nan;
+    case CARTA::StatsType::RMS:
+        return n > 0 ? std::sqrt(moments.sumSq / n) : nan;
+    case CARTA::StatsType::Sigma:
+        return n > 1 ? std::sqrt(std::max(0.0, (moments.sumSq - moments.sum * moments.sum / n) / (n - 1))) : nan;
+    case CARTA::StatsType::Min:
+        return n > 0 ? moments.min : nan;
+    case CARTA::StatsType::Max:
+        return n > 0 ? moments.max : nan;
+    default:
+        return nan;
+    }
+}
+
+/// the profiles of a region with the first channelsDone channels computed
+PBMSharedPtr _makeRegionProfile(int fileId, int regionId, int stokeFrame,
+        const google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>& spectralProfiles,
+        const std::vector<Carta::Core::Algorithms::RegionMoments>& moments, qint64 regionPixels, double beamArea,
+        int channelsDone, float progress) {
+    std::shared_ptr<CARTA::SpectralProfileData> spectralProfileData(new CARTA::SpectralProfileData());
+    spectralProfileData->set_file_id(fileId);
+    spectralProfileData->set_region_id(regionId);
+    spectralProfileData->set_stokes(stokeFrame);
+    spectralProfileData->set_progress(progress);
+
+    int channels = moments.size();
+    auto addProfile = [&](const std::string& coordinate, int statsType) {
+        CARTA::SpectralProfile* spectralProfile = spectralProfileData->add_profiles();
+        spectralProfile->set_coordinate(coordinate);
+        spectralProfile->set_stats_type(static_cast<CARTA::StatsType>(statsType));
+        spectralProfile->mutable_vals()->Reserve(channels);
+        for (int channel = 0; channel < channels; channel++) {
+            spectralProfile->add_vals(channel < channelsDone
+                                      ? _getStatsValue(statsType, moments[channel], regionPixels, beamArea)
+                                      : std::numeric_limits<float>::quiet_NaN());
+        }
+    };
+    for (const CARTA::SetSpectralRequirements_SpectralConfig& config : spectralProfiles) {
+        if (config.stats_types_size() == 0) {
+            addProfile(config.coordinate(), CARTA::StatsType::Mean);
+        }
+        for (int statsType : config.stats_types()) {
+            addProfile(config.coordinate(), statsType);
+        }
+    }
+    if (spectralProfiles.size() == 0) {
+        addProfile("z", CARTA::StatsType::Mean);
+    }
+    return spectralProfileData;
+}
+}
+
+bool DataSource::_getRegionSpectralProfile(int fileId, int regionId, const RegionShape& region, int stokeFrame,
+    const google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>& spectralProfiles,
+    const std::function<bool(PBMSharedPtr)>& sendProfile) const {
+    int spectralIndex = Util::getAxisIndex(m_image, AxisInfo::KnownType::SPECTRAL);
+    if (!m_image || !m_regionStats || spectralIndex < 0) {
+        return false;
+    }
+    const std::vector<int> dims = m_image->dims();
+    std::shared_ptr<const RegionMask> mask =
+            m_regionStats->getMask(regionId, region, QSize(dims[m_axisIndexX], dims[m_axisIndexY]));
+    if (mask->pixels == 0) {
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const QRect& area = mask->area;
+    int channels = dims[spectralIndex];
+    std::vector<Carta::Core::Algorithms::RegionMoments> moments(channels);
+
+    // channels whose statistics were asked for before need not be read again
+    std::vector<char> cached(channels, 0);
+    int cachedCount = 0;
+    for (int channel = 0; channel < channels; channel++) {
+        if (m_regionStats->find(regionId, *mask, channel, stokeFrame, moments[channel])) {
+            cached[channel] = 1;
+            cachedCount++;
+        }
+    }
+
+    // the spectral-major copy has all the channels of a pixel together, so the whole
+    // profile takes one pass over the area
+    std::shared_ptr<SpectralCubeCache> spectralCube = m_spectralCube;
+    if (cachedCount < channels && spectralCube && spectralCube->isReady(std::max(stokeFrame, 0))) {
+        std::vector<char> inside(qint64(area.width()) * area.height(), 0);
+        for (const Carta::Core::Algorithms::PixelRun& run : mask->runs) {
+            std::fill(inside.begin() + run.offset, inside.begin() + run.offset + run.length, 1);
+        }
+        std::vector<Carta::Core::Algorithms::RegionMoments> cubeMoments(channels);
+        spectralCube->forEachPixel(area, std::max(stokeFrame, 0),
+                                   [&](int x, int y, const float* values) {
+            if (inside[qint64(y - area.top()) * area.width() + (x - area.left())]) {
+                for (int channel = 0; channel < channels; channel++) {
+                    cubeMoments[channel].add(values[channel]);
+                }
+            }
+        });
+        for (int channel = 0; channel < channels; channel++) {
+            if (!cached[channel]) {
+                moments[channel] = cubeMoments[channel];
+                m_regionStats->insert(regionId, *mask, channel, stokeFrame, moments[channel]);
+            }
+        }
+        cachedCount = channels;
+        qDebug() << "[DataSource] Region" << regionId << "spectral profile from the spectral cache in"
+                 << timer.elapsed() << "ms";
+    }
+    if (cachedCount == channels) {
+        sendProfile(_makeRegionProfile(fileId, regionId, stokeFrame, spectralProfiles, moments,
+                                       mask->pixels, m_beamArea, channels, SPECTRAL_PROGRESS_COMPLETE));
+        return true;
+    }
+
+    // otherwise the area is read a few channels at a time, and the client sees the
+    // profile grow as the chunks come in
+    qint64 areaPixels = qint64(area.width()) * area.height();
+    int chunkChannels = std::max<qint64>(1, std::min<qint64>(channels,
+            REGION_PROFILE_CHUNK_BYTES / (areaPixels * qint64(sizeof(float)))));
+    std::vector<float> buffer;
+    for (int chunkLow = 0; chunkLow < channels; chunkLow += chunkChannels) {
+        int chunkHigh = std::min(channels, chunkLow + chunkChannels) - 1;
+        // read only the channels of the chunk that are missing
+        int frameLow = chunkLow;
+        int frameHigh = chunkHigh;
+        while (frameLow <= frameHigh && cached[frameLow]) {
+            frameLow++;
+        }
+        while (frameHigh >= frameLow && cached[frameHigh]) {
+            frameHigh--;
+        }
+        if (frameLow <= frameHigh) {
+            std::unique_ptr<Carta::Lib::NdArray::RawViewInterface> view(
+                _getRawDataForArea(m_image, m_axisIndexX, m_axisIndexY, area, stokeFrame, frameLow, frameHigh));
+            if (!view) {
+                return false;
+            }
+            buffer.resize(areaPixels * (frameHigh - frameLow + 1));
+            int64_t t = 0;
+            Carta::Lib::NdArray::Float fview(view.release(), true);
+            fview.forEachChunk([&t, &buffer] (const float* values, int64_t count) {
+                count = std::min<int64_t>(count, int64_t(buffer.size()) - t);
+                std::copy(values, values + count, buffer.begin() + t);
+                t += count;
+            });
+            if (t != int64_t(buffer.size())) {
+                qWarning() << "[DataSource] Read" << t << "values of the region instead of" << buffer.size();
+                return false;
+            }
+
+            for (int channel = frameLow; channel <= frameHigh; channel++) {
+                if (!cached[channel]) {
+                    const float* plane = buffer.data() + (channel - frameLow) * areaPixels;
+                    moments[channel] = Carta::Core::Algorithms::regionMoments(plane, mask->runs);
+                    m_regionStats->insert(regionId, *mask, channel, stokeFrame, moments[channel]);
+                }
+            }
+        }
+
+        float progress = chunkHigh + 1 < channels ? float(chunkHigh + 1) / channels : SPECTRAL_PROGRESS_COMPLETE;
+        if (!sendProfile(_makeRegionProfile(fileId, regionId, stokeFrame, spectralProfiles, moments,
+                                            mask->pixels, m_beamArea, chunkHigh + 1, progress))) {
+            qDebug() << "[DataSource] Region" << regionId << "spectral profile stopped at channel" << chunkHigh + 1
+                     << "of" << channels;
+            return true;
+        }
+    }
+    qDebug() << "[DataSource] Region" << regionId << "spectral profile of" << mask->pixels << "pixels and"
+             << channels << "channels in" << timer.elapsed() << "ms," << cachedCount << "channels were cached";
+    return true;
+}
+
+PBMSharedPtr DataSource::_getRegionStats(int fileId, int regionId, const RegionShape& region, int channel,
+    int stokeFrame, const std::vector<int>& statsTypes) const {
+    if (!m_image || !m_regionStats) {
+        return nullptr;
+    }
+    const std::vector<int> dims = m_image->dims();
+    const int width = dims[m_axisIndexX];
+    const int height = dims[m_axisIndexY];
+
+    // the statistics of the whole image go by region -1
+    RegionShape shape = region;
+    if (regionId < 0) {
+        shape = RegionShape(RegionShape::Type::RECTANGLE,
+                            { QPointF((width - 1) / 2.0, (height - 1) / 2.0), QPointF(width, height) }, 0);
+    }
+
+    auto compute = [&](const RegionMask& mask, Carta::Core::Algorithms::RegionMoments& moments) {
+        // the plane of the channel is often in memory already, the runs are then moved
+        // from the area to the plane
+        MipmapCache::Level plane;
+        if (_findMipmapLevel(channel, stokeFrame, 1, plane)) {
+            std::vector<Carta::Core::Algorithms::PixelRun> runs(mask.runs);
+            for (Carta::Core::Algorithms::PixelRun& run : runs) {
+                qint64 y = run.offset / mask.area.width() + mask.area.top();
+                qint64 x = run.offset % mask.area.width() + mask.area.left();
+                run.offset = y * width + x;
+            }
+            moments = Carta::Core::Algorithms::regionMoments(plane.data->data(), runs);
+            return true;
+        }
+        std::unique_ptr<Carta::Lib::NdArray::RawViewInterface> view(
+            _getRawDataForArea(m_image, m_axisIndexX, m_axisIndexY, mask.area, stokeFrame, channel, channel));
+        if (!view) {
+            return false;
+        }
+        std::vector<float> values(qint64(mask.area.width()) * mask.area.height());
+        int64_t t = 0;
+        Carta::Lib::NdArray::Float fview(view.release(), true);
+        fview.forEachChunk([&t, &values] (const float* chunk, int64_t count) {
+            count = std::min<int64_t>(count, int64_t(values.size()) - t);
+            std::copy(chunk, chunk + count, values.begin() + t);
+            t += count;
+        });
+        if (t != int64_t(values.size())) {
+            qWarning() << "[DataSource] Read" << t << "values of the region instead of" << values.size();
+            return false;
+        }
+        moments = Carta::Core::Algorithms::regionMoments(values.data(), mask.runs);
+        return true;
+    };
+
+    Carta::Core::Algorithms::RegionMoments moments;
+    qint64 regionPixels = 0;
+    if (!m_regionStats->getMoments(regionId, shape, QSize(width, height), channel, stokeFrame,
+                                   compute, moments, regionPixels)) {
+        return nullptr;
+    }
+
+    std::shared_ptr<CARTA::RegionStatsData> regionStatsData(new CARTA::RegionStatsData());
+    regionStatsData->set_file_id(fileId);
+    regionStatsData->set_region_id(regionId);
+    regionStatsData->set_channel(channel);
+    regionStatsData->set_stokes(stokeFrame);
+    for (int statsType : statsTypes) {
+        CARTA::StatisticsValue* statisticsValue = regionStatsData->add_statistics();
+        statisticsValue->set_stats_type(static_cast<CARTA::StatsType>(statsType));
+        statisticsValue->set_value(_getStatsValue(statsType, moments, regionPixels, m_beamArea));
+    }
+    return regionStatsData;
+}
+
+void DataSource::_removeRegion(int regionId) {
+    if (m_regionStats) {
+        m_regionStats->remove(regionId);
+    }
+}
+
+double DataSource::_getBeamArea(std::shared_ptr<Carta::Lib::Image::ImageInterface> image) {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    FitsHeaderExtractor extractor;
+    extractor.setInput(image);
+    std::map<QString, QString> header = extractor.getHeaderMap();
+
+    // flux densities are only defined for images in Jy/beam
+    auto unit = header.find("BUNIT");
+    if (unit == header.end() || !unit->second.contains("jy/beam", Qt::CaseInsensitive)) {
+        return nan;
+    }
+    double values[4];
+    const char* keys[4] = { "BMAJ", "BMIN", "CDELT1", "CDELT2" };
+    for (int i = 0; i < 4; i++) {
+        auto found = header.find(keys[i]);
+        bool ok = false;
+        values[i] = found == header.end() ? 0 : found->second.toDouble(&ok);
+        if (!ok || values[i] == 0) {
+            return nan;
+        }
+    }
+    // the area of a Gaussian beam in pixels
+    return M_PI / (4 * std::log(2.0)) * values[0] * values[1] / std::fabs(values[2] * values[3]);
+}
+
 DataSource::~DataSource() {
 
 }
@@ -12,12 +12,15 @@
 #include "CartaLib/IntensityCacheHelper.h"
 #include "CartaLib/IPercentileCalculator.h"
 #include <memory>
+#include <functional>
 
 #include "CartaLib/Proto/region_histogram.pb.h"
 #include "CartaLib/Proto/raster_image.pb.h"
 #include "CartaLib/Proto/spatial_profile.pb.h"
 #include "CartaLib/Proto/spectral_profile.pb.h"
 #include "CartaLib/Proto/region_requirements.pb.h"
+#include "CartaLib/Proto/region_stats.pb.h"
+#include "CartaLib/Proto/contour_image.pb.h"
 
 //#include "CartaLib/Regions/IRegion.h"
 //#include "CartaLib/Regions/Ellipse.h"
@@ -26,6 +29,12 @@
 
 #include "CartaLib/ProfileInfo.h"
 #include "CartaLib/Hooks/ProfileHook.h"
+#include "MipmapCache.h"
+#include "ChannelPlaneCache.h"
+#include "ChannelStatsIndex.h"
+#include "SpectralCubeCache.h"
+#include "RegionShape.h"
+#include "RegionStatsCache.h"
 
 typedef Carta::Lib::RegionHistogramData RegionHistogramData;
 typedef std::shared_ptr<google::protobuf::MessageLite> PBMSharedPtr;
@@ -76,6 +85,16 @@ public:
     static const double ZOOM_DEFAULT;
     static const QString DATA_PATH;
 
+    /// width and height of a raster tile, in pixels of the downsampled image
+    static const int RASTER_TILE_SIZE;
+
+    /// width and height of the tiles the contours are computed and sent in, in image pixels
+    static const int CONTOUR_TILE_SIZE;
+
+    /// smoothing modes of the contours, as numbered by the client
+    static const int CONTOUR_BLOCK_AVERAGE;
+    static const int CONTOUR_GAUSSIAN_BLUR;
+
     virtual ~DataSource();
 
 
@@ -241,12 +260,17 @@ private:
      * @param percentiles - a list of numbers in [0,1] for which an intensity is desired.
      * @param stokeFrame - the index number of stoke slice
      * @param transformationLabel - a string identifier for the per-frame unit conversion used in the calculation
-     * @return - a pointer to an IntensityValue object,
+     * @return - a pointer to an IntensityValue object for each of the percentiles,
      * or a null pointer if the percentile is not in the cache
      */
-    std::shared_ptr<Carta::Lib::IntensityValue> _readIntensityCache(int frameLow, int frameHigh, double percentile, int stokeFrame, QString transformationLabel) const;
+    std::vector<std::shared_ptr<Carta::Lib::IntensityValue> > _readIntensityCache(int frameLow, int frameHigh, const std::vector<double>& percentiles, int stokeFrame, QString transformationLabel) const;
 
-    void _setIntensityCache(double intensity, double error, int frameLow, int frameHigh, double percentile, int stokeFrame, QString transformationLabel) const;
+    /**
+     * Stores intensities in the disk cache, in one batch.
+     * @param intensities - the intensity of each percentile.
+     * @param error - the error of the intensities.
+     */
+    void _setIntensityCache(const std::map<double, double>& intensities, double error, int frameLow, int frameHigh, int stokeFrame, QString transformationLabel) const;
 
 
     /**
@@ -301,6 +325,136 @@ private:
         bool &changeFrame, int regionId, int numberOfBins,
         Carta::Lib::IntensityUnitConverter::SharedPtr converter) const;
 
+    /**
+     * Computes raster image data tile by tile and hands each tile over as soon as it is ready.
+     * Tile (i, j) covers columns [i, i + 1) * RASTER_TILE_SIZE and rows [j, j + 1) * RASTER_TILE_SIZE
+     * of the image downsampled by mip, clipped to the image.
+     * @param fileId - the file id.
+     * @param tiles - the (column, row) indices of the tiles, in the order they should be sent.
+     * @param mip - down sampling factor.
+     * @param frameLow - a lower bound for the image channels or -1 if there is no lower bound.
+     * @param frameHigh - an upper bound for the image channels or -1 if there is no upper bound.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param isZFP - whether each tile should be compressed with ZFP.
+     * @param precision - the ZFP precision.
+     * @param changeFrame - whether the channel histogram should go along with the last tile; it is reset once sent.
+     * @param regionId - the region the histogram belongs to.
+     * @param numberOfBins - the number of histogram bins.
+     * @param converter - the intensity unit converter.
+     * @param sendTile - called on the calling thread with the RasterImageData message of every tile; once it
+     *      returns false the tiles that are left are not computed.
+     * @return - the number of tiles sent.
+     */
+    int _getRasterTiles(int fileId, const std::vector<QPoint>& tiles, int mip,
+        int frameLow, int frameHigh, int stokeFrame,
+        bool isZFP, int precision,
+        bool &changeFrame, int regionId, int numberOfBins,
+        Carta::Lib::IntensityUnitConverter::SharedPtr converter,
+        const std::function<bool(PBMSharedPtr)>& sendTile) const;
+
+    /**
+     * Computes the contour lines of a channel at full resolution and hands them over piece
+     * by piece: the lines within each tile of CONTOUR_TILE_SIZE pixels as soon as the tile
+     * is done, and the lines crossing the tile borders, joined, as the last message.
+     * @param fileId - the file id.
+     * @param channel - the image channel.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param levels - the contour levels.
+     * @param smoothingMode - smoothing of the plane before contouring (0: none, 1: block average, 2: gaussian).
+     * @param smoothingFactor - the size of the smoothing kernel in pixels.
+     * @param decimation - vertices are sent encoded, rounded to 1/decimation pixels; 0 sends them as floats.
+     * @param compressionLevel - deflate level of the encoded vertices, 0 for none.
+     * @param sendContours - called with every ContourImageData message, from the worker threads but
+     *      one call at a time; once it returns false the tiles that are left are not computed.
+     * @return - the number of messages sent.
+     */
+    int _getContourImageData(int fileId, int channel, int stokeFrame, const std::vector<double>& levels,
+        int smoothingMode, int smoothingFactor, int decimation, int compressionLevel,
+        const std::function<bool(PBMSharedPtr)>& sendContours) const;
+
+    /**
+     * Adds the histogram of the current channel to a raster message.
+     * @param raster - the message to add the histogram to.
+     * @param fileId - the file id.
+     * @param regionId - the region the histogram belongs to.
+     * @param frameLow - a lower bound for the image channels or -1 if there is no lower bound.
+     * @param frameHigh - an upper bound for the image channels or -1 if there is no upper bound.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param numberOfBins - the number of histogram bins.
+     * @param converter - the intensity unit converter.
+     */
+    void _setChannelHistogramData(CARTA::RasterImageData* raster, int fileId, int regionId,
+        int frameLow, int frameHigh, int stokeFrame, int numberOfBins,
+        Carta::Lib::IntensityUnitConverter::SharedPtr converter) const;
+
+    /**
+     * Starts computing the statistics of every channel and stokes plane in the background.
+     * @param numberOfBins - the number of histogram bins to keep for each plane.
+     */
+    void _indexChannelStats(int numberOfBins);
+
+    /**
+     * Starts copying the cube spectral-major into the spectral cache directory in the
+     * background, if the directory is configured, so that spectral profiles read the
+     * channels of a pixel in one go.
+     */
+    void _transposeSpectralCube();
+
+    /**
+     * Starts over with an empty plane cache, for a new image or new display axes.
+     */
+    void _resetPlaneCache();
+
+    /**
+     * Looks up the statistics of a single plane in the channel statistics index.
+     * @param frameLow - a lower bound for the image channels.
+     * @param frameHigh - an upper bound for the image channels.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param stats - set to the statistics of the plane.
+     * @param withBins - whether the histogram is needed as well.
+     * @return - true if the plane has been indexed; false otherwise.
+     */
+    bool _getChannelStats(int frameLow, int frameHigh, int stokeFrame,
+            ChannelStatsIndex::Stats& stats, bool withBins) const;
+
+    /**
+     * Downsamples the given bounds of a plane into out, using the mipmap cache where possible.
+     * @param view - the plane (raw data for one channel and stoke).
+     * @param xMin - lower bound of the x-pixel-coordinate.
+     * @param yMin - lower bound of the y-pixel-coordinate.
+     * @param nx - number of downsampled columns.
+     * @param ny - number of downsampled rows.
+     * @param mip - down sampling factor.
+     * @param frameLow - a lower bound for the image channels.
+     * @param frameHigh - an upper bound for the image channels.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param out - storage for nx * ny downsampled pixels.
+     */
+    void _getDownsampledData(Carta::Lib::NdArray::RawViewInterface* view, int xMin, int yMin,
+            int nx, int ny, int mip, int frameLow, int frameHigh, int stokeFrame, float* out) const;
+
+    /**
+     * Looks up a level of the mipmap pyramid in memory, then in the persistent cache.
+     * The full resolution level comes from the plane cache of the image.
+     * @param channel - the image channel.
+     * @param stokeFrame - the stoke frame.
+     * @param mip - down sampling factor of the level.
+     * @param level - set to the level if it was found.
+     * @return - true if the level was found; false otherwise.
+     */
+    bool _findMipmapLevel(int channel, int stokeFrame, int mip, MipmapCache::Level& level) const;
+
+    /**
+     * Returns a whole plane at full resolution, reading it into the plane cache if it is
+     * not there yet.
+     * @param view - the raw data of the plane.
+     * @param channel - the image channel.
+     * @param stokeFrame - the stoke frame.
+     * @param plane - set to the plane.
+     */
+    void _getFullResolutionPlane(Carta::Lib::NdArray::RawViewInterface* view, int channel, int stokeFrame,
+            MipmapCache::Level& plane) const;
+
     int _compress(std::vector<float>& array, size_t offset, std::vector<char>& compressionBuffer,
             size_t& compressedSize, uint32_t nx, uint32_t ny, uint32_t precision) const;
 
@@ -319,8 +473,19 @@ private:
         int frameLow, int frameHigh, int stokeFrame,
         Carta::Lib::IntensityUnitConverter::SharedPtr converter) const;
 
-    void _getXYProfiles(Carta::Lib::NdArray::Double doubleView, const int imgWidth, const int imgHeight,
-    const int x, const int y, std::vector<float> & xProfile, std::vector<float> & yProfile) const;
+    /**
+     * Reads the row and the column through a pixel of one channel in bulk, from the plane in
+     * memory; the plane is read into memory first if it fits in the mipmap cache.
+     * @param x - x coordinate of the pixel.
+     * @param y - y coordinate of the pixel.
+     * @param channel - the image channel.
+     * @param stokeFrame - the stoke frame.
+     * @param xProfile - set to the row, with infinite values replaced by NaN.
+     * @param yProfile - set to the column, with infinite values replaced by NaN.
+     * @return - false if there is no image data or the pixel is outside of the image.
+     */
+    bool _getXYProfiles(int x, int y, int channel, int stokeFrame,
+            std::vector<float>& xProfile, std::vector<float>& yProfile) const;
 
     bool _addProfile(std::shared_ptr<CARTA::SpatialProfileData> spatialProfileData,
         const std::vector<float> & profile, const std::string coordinate) const;
@@ -421,6 +586,31 @@ private:
      */
     Carta::Lib::NdArray::RawViewInterface* _getRawDataForStoke(int frameLow, int frameHigh, int stokeFrame) const;
 
+    /**
+     * Returns the raw data of the given frames of an image, see above.
+     * @param image - the image.
+     * @param axisIndexX - the horizontal display axis.
+     * @param axisIndexY - the vertical display axis.
+     */
+    static Carta::Lib::NdArray::RawViewInterface* _getRawDataForStoke(
+            std::shared_ptr<Carta::Lib::Image::ImageInterface> image, int axisIndexX, int axisIndexY,
+            int frameLow, int frameHigh, int stokeFrame);
+
+    /**
+     * Returns the raw data of an area of an image in a range of channels of one stoke frame.
+     * @param image - the image.
+     * @param axisIndexX - the horizontal display axis.
+     * @param axisIndexY - the vertical display axis.
+     * @param area - the area, which must lie within the image.
+     * @param stokeFrame - the stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V).
+     * @param frameLow - the first channel.
+     * @param frameHigh - the last channel or -1 for the last channel of the image.
+     * @return the raw data or nullptr if the image has no spectral axis.
+     */
+    static Carta::Lib::NdArray::RawViewInterface* _getRawDataForArea(
+            std::shared_ptr<Carta::Lib::Image::ImageInterface> image, int axisIndexX, int axisIndexY,
+            const QRect& area, int stokeFrame, int frameLow = 0, int frameHigh = -1);
+
     /**
      * Returns the raw data for the current view.
      * @param frames - a list of current image frames.
@@ -607,6 +797,60 @@ private:
     // calculate spectral profile (z-profile)
     PBMSharedPtr _getSpectralProfile(int fileId, int x, int y, int stoke);
 
+    /**
+     * Reads the values of a pixel in all the channels with one strided read.
+     * @param x - x coordinate of the pixel.
+     * @param y - y coordinate of the pixel.
+     * @param stokeFrame - the stoke frame.
+     * @param profile - set to the value in each channel.
+     * @return - false if the image has no spectral axis or the pixel is outside of the image.
+     */
+    bool _getSpectralProfile(int x, int y, int stokeFrame, std::vector<float>& profile) const;
+
+    /**
+     * Computes the spectral profiles of a region a chunk of channels at a time.
+     * @param fileId - the file id.
+     * @param regionId - the region id.
+     * @param region - the region, in pixel coordinates of the image.
+     * @param stokeFrame - the stoke frame.
+     * @param spectralProfiles - the coordinates and statistics the client asked for; the mean
+     *      is computed if no statistic is given.
+     * @param sendProfile - called after every chunk with a SpectralProfileData message holding the
+     *      channels computed so far, NaN for the others, and the fraction done as its progress;
+     *      once it returns false the channels that are left are not computed.
+     * @return - false if the image has no spectral axis or the region covers no pixel of the image.
+     */
+    bool _getRegionSpectralProfile(int fileId, int regionId, const RegionShape& region, int stokeFrame,
+        const google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>& spectralProfiles,
+        const std::function<bool(PBMSharedPtr)>& sendProfile) const;
+
+    /**
+     * Computes the statistics of a region in one channel, reusing those computed before
+     * for the same shape of the region.
+     * @param fileId - the file id.
+     * @param regionId - the region id.
+     * @param region - the region, in pixel coordinates of the image; not used for region -1,
+     *      which is the whole image.
+     * @param channel - the channel.
+     * @param stokeFrame - the stoke frame.
+     * @param statsTypes - the statistics the client asked for.
+     * @return - a RegionStatsData message, or nullptr if the region covers no pixel of the image.
+     */
+    PBMSharedPtr _getRegionStats(int fileId, int regionId, const RegionShape& region, int channel,
+        int stokeFrame, const std::vector<int>& statsTypes) const;
+
+    /**
+     * Forgets the statistics of a region.
+     * @param regionId - the region id.
+     */
+    void _removeRegion(int regionId);
+
+    /**
+     * Returns the area of the beam in pixels, NaN if the image is not in Jy/beam or has no beam.
+     * @param image - the image.
+     */
+    static double _getBeamArea(std::shared_ptr<Carta::Lib::Image::ImageInterface> image);
+
     /**
      *  Constructor.
      */
@@ -628,9 +872,6 @@ private:
     // profile info
     Carta::Lib::ProfileInfo m_profileInfo;
 
-    // profile calculation result
-    Carta::Lib::Hooks::ProfileResult m_profileResult;
-
     /// coordinate formatter
     std::shared_ptr<CoordinateFormatterInterface> m_coordinateFormatter;
 
@@ -645,6 +886,25 @@ private:
     // wrapper class
     std::shared_ptr<Carta::Lib::IntensityCacheHelper> m_diskCacheHelper;
 
+    // fingerprint of the file, keys the mipmap levels in the disk cache; empty if they are
+    // not persisted
+    QByteArray m_fileHash;
+
+    // statistics of every channel, built in the background
+    std::shared_ptr<ChannelStatsIndex> m_channelStats;
+
+    // full resolution planes of the channels shown and the ones read ahead
+    std::shared_ptr<ChannelPlaneCache> m_planeCache;
+
+    // spectral-major copy of the cube, built in the background
+    std::shared_ptr<SpectralCubeCache> m_spectralCube;
+
+    // masks and statistics of the regions, shared by the statistics and the spectral profiles
+    std::shared_ptr<RegionStatsCache> m_regionStats;
+
+    // area of the beam in pixels, for flux densities
+    double m_beamArea;
+
     //Indices of the display axes.
     int m_axisIndexX;
     int m_axisIndexY;
@@ -657,6 +917,14 @@ private:
     const static bool APPROXIMATION_GET_LOCATION;
     const static bool IS_MULTITHREAD_ZFP;
     const static int MAX_SUBSETS;
+    const static int SPECTRAL_CACHE_SIZE_MB;
+    const static int PLANE_CACHE_SIZE_MB;
+    //Number of channels read ahead in the direction the user steps through them
+    const static int PLANE_PREFETCH_COUNT;
+    //Bytes of the image a region spectral profile reads at a time
+    const static qint64 REGION_PROFILE_CHUNK_BYTES;
+    //Number of (region, channel, stokes) statistics kept
+    const static int REGION_STATS_CACHE_ENTRIES;
 
     DataSource(const DataSource& other);
     DataSource& operator=(const DataSource& other);
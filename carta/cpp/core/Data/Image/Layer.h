@@ -13,6 +13,7 @@
 #include "CartaLib/VectorGraphics/VGList.h"
 #include "Data/Image/Render/RenderRequest.h"
 #include "Data/Image/Render/RenderResponse.h"
+#include "Data/Image/RegionShape.h"
 #include <QImage>
 #include <QStack>
 #include <set>
@@ -342,6 +343,41 @@ protected:
      */
     virtual PBMSharedPtr _getSpectralProfile(int fileId, int x, int y, int stokeFrame) const = 0;
 
+    /**
+     * Computes the spectral profiles of a region a chunk of channels at a time.
+     * @param fileId - the file id.
+     * @param regionId - the region id.
+     * @param region - the region, in pixel coordinates of the image.
+     * @param stokeFrame - the stoke frame.
+     * @param spectralProfiles - the coordinates and statistics the client asked for.
+     * @param sendProfile - called with the SpectralProfileData message after every chunk;
+     *      returns false if the profile is no longer wanted.
+     * @return - false if the profile could not be computed.
+     */
+    virtual bool _getRegionSpectralProfile(int fileId, int regionId, const RegionShape& region, int stokeFrame,
+        const google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>& spectralProfiles,
+        const std::function<bool(PBMSharedPtr)>& sendProfile) const = 0;
+
+    /**
+     * Computes the statistics of a region in one channel.
+     * @param fileId - the file id.
+     * @param regionId - the region id.
+     * @param region - the region, in pixel coordinates of the image.
+     * @param channel - the channel.
+     * @param stokeFrame - the stoke frame.
+     * @param statsTypes - the statistics the client asked for.
+     * @return - a RegionStatsData message, or nullptr if they could not be computed.
+     */
+    virtual PBMSharedPtr _getRegionStats(int fileId, int regionId, const RegionShape& region, int channel,
+        int stokeFrame, const std::vector<int>& statsTypes) const = 0;
+
+    /**
+     * Forgets the statistics of a region.
+     * @param fileId - the file id.
+     * @param regionId - the region id.
+     */
+    virtual void _removeRegionStats(int fileId, int regionId) = 0;
+
     /**
      * Returns a vector of pixels.
      * @param xMin - lower bound of the x-pixel-coordinate.
@@ -361,6 +397,52 @@ protected:
         bool &changeFrame, int regionId, int numberOfBins,
         Carta::Lib::IntensityUnitConverter::SharedPtr converter) const = 0;
 
+    /**
+     * Computes raster image data tile by tile and hands each tile over as soon as it is ready.
+     * @param fileId - the file id.
+     * @param tiles - the (column, row) indices of the tiles at the given mip, in the order they should be sent.
+     * @param mip - down sampling factor.
+     * @param frameLow - a lower bound for the image channels or -1 if there is no lower bound.
+     * @param frameHigh - an upper bound for the image channels or -1 if there is no upper bound.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param sendTile - called with the RasterImageData message of every tile; returns false if no more tiles are wanted.
+     * @return - the number of tiles sent.
+     */
+    virtual int _getRasterTiles(int fileId, const std::vector<QPoint>& tiles, int mip,
+        int frameLow, int frameHigh, int stokeFrame,
+        bool isZFP, int precision,
+        bool &changeFrame, int regionId, int numberOfBins,
+        Carta::Lib::IntensityUnitConverter::SharedPtr converter,
+        const std::function<bool(PBMSharedPtr)>& sendTile) const = 0;
+
+    /**
+     * Computes the contour lines of a channel tile by tile and hands them over as they are ready.
+     * @param fileId - the file id.
+     * @param channel - the image channel.
+     * @param stokeFrame - a stoke frame (-1: no stoke, 0: stoke I, 1: stoke Q, 2: stoke U, 3: stoke V)
+     * @param levels - the contour levels.
+     * @param smoothingMode - smoothing of the plane before contouring (0: none, 1: block average, 2: gaussian).
+     * @param smoothingFactor - the size of the smoothing kernel in pixels.
+     * @param decimation - vertices are sent encoded, rounded to 1/decimation pixels; 0 sends them as floats.
+     * @param compressionLevel - deflate level of the encoded vertices, 0 for none.
+     * @param sendContours - called with every ContourImageData message; returns false if no more are wanted.
+     * @return - the number of messages sent.
+     */
+    virtual int _getContourImageData(int fileId, int channel, int stokeFrame, const std::vector<double>& levels,
+        int smoothingMode, int smoothingFactor, int decimation, int compressionLevel,
+        const std::function<bool(PBMSharedPtr)>& sendContours) const = 0;
+
+    /**
+     * Starts computing the statistics of every channel in the background.
+     * @param numberOfBins - the number of histogram bins to keep for each channel.
+     */
+    virtual void _indexChannelStats(int numberOfBins) = 0;
+
+    /**
+     * Starts copying the cube spectral-major in the background, if a spectral cache is configured.
+     */
+    virtual void _transposeSpectralCube() = 0;
+
     /**
      * Returns whether or not the layer can be loaded with the indicated frames.
      * @param frames - list of frame indices to load.
@@ -447,6 +447,31 @@ PBMSharedPtr LayerData::_getSpectralProfile(int fileId, int x, int y, int stokeF
     return m_dataSource->_getSpectralProfile(fileId, x, y, stokeFrame);
 }
 
+bool LayerData::_getRegionSpectralProfile(int fileId, int regionId, const RegionShape& region, int stokeFrame,
+    const google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>& spectralProfiles,
+    const std::function<bool(PBMSharedPtr)>& sendProfile) const {
+    if ( !m_dataSource ){
+        return false;
+    }
+
+    return m_dataSource->_getRegionSpectralProfile(fileId, regionId, region, stokeFrame, spectralProfiles, sendProfile);
+}
+
+PBMSharedPtr LayerData::_getRegionStats(int fileId, int regionId, const RegionShape& region, int channel,
+    int stokeFrame, const std::vector<int>& statsTypes) const {
+    PBMSharedPtr results;
+    if (m_dataSource) {
+        results = m_dataSource->_getRegionStats(fileId, regionId, region, channel, stokeFrame, statsTypes);
+    }
+    return results;
+}
+
+void LayerData::_removeRegionStats(int /*fileId*/, int regionId) {
+    if (m_dataSource) {
+        m_dataSource->_removeRegion(regionId);
+    }
+}
+
 PBMSharedPtr LayerData::_getRasterImageData(int fileId, int xMin, int xMax, int yMin, int yMax, int mip,
     int frameLow, int frameHigh, int stokeFrame,
     bool isZFP, int precision, int numSubsets,
@@ -462,6 +487,45 @@ PBMSharedPtr LayerData::_getRasterImageData(int fileId, int xMin, int xMax, int
     return results;
 }
 
+int LayerData::_getRasterTiles(int fileId, const std::vector<QPoint>& tiles, int mip,
+    int frameLow, int frameHigh, int stokeFrame,
+    bool isZFP, int precision,
+    bool &changeFrame, int regionId, int numberOfBins,
+    Carta::Lib::IntensityUnitConverter::SharedPtr converter,
+    const std::function<bool(PBMSharedPtr)>& sendTile) const {
+    int sent = 0;
+    if (m_dataSource) {
+        sent = m_dataSource->_getRasterTiles(fileId, tiles, mip, frameLow, frameHigh, stokeFrame,
+                                             isZFP, precision, changeFrame, regionId, numberOfBins,
+                                             converter, sendTile);
+    }
+    return sent;
+}
+
+int LayerData::_getContourImageData(int fileId, int channel, int stokeFrame, const std::vector<double>& levels,
+    int smoothingMode, int smoothingFactor, int decimation, int compressionLevel,
+    const std::function<bool(PBMSharedPtr)>& sendContours) const {
+    int sent = 0;
+    if (m_dataSource) {
+        sent = m_dataSource->_getContourImageData(fileId, channel, stokeFrame, levels, smoothingMode, smoothingFactor,
+            decimation, compressionLevel,
+            sendContours);
+    }
+    return sent;
+}
+
+void LayerData::_indexChannelStats(int numberOfBins) {
+    if (m_dataSource) {
+        m_dataSource->_indexChannelStats(numberOfBins);
+    }
+}
+
+void LayerData::_transposeSpectralCube() {
+    if (m_dataSource) {
+        m_dataSource->_transposeSpectralCube();
+    }
+}
+
 float LayerData::_getMaskAlpha() const {
     QString key = Carta::State::UtilState::getLookup( MASK, Util::ALPHA );
     float maskInt = m_state.getValue<int>( key );
@@ -517,6 +517,15 @@ int LayerGroup::_getIndexCurrent( ) const {
     return dataIndex;
 }
 
+std::shared_ptr<Layer> LayerGroup::_getFileLayer( int /*fileId*/ ) const {
+    std::shared_ptr<Layer> layer;
+    int dataIndex = _getIndexCurrent();
+    if ( dataIndex >= 0 ){
+        layer = m_children[dataIndex];
+    }
+    return layer;
+}
+
 QRectF LayerGroup::_getInputRect( const QSize& size ) const {
     QRectF rect(0,0,0,0);
     int dataIndex = _getIndexCurrent();
@@ -570,9 +579,9 @@ PBMSharedPtr LayerGroup::_getXYProfiles(int fileId, int x, int y,
     int frameLow, int frameHigh, int stokeFrame,
     Carta::Lib::IntensityUnitConverter::SharedPtr converter) const {
     PBMSharedPtr results;
-    int dataIndex = _getIndexCurrent();
-    if ( dataIndex >= 0 ){
-        results = m_children[dataIndex]->_getXYProfiles(fileId, x, y, frameLow, frameHigh, stokeFrame, converter);
+    std::shared_ptr<Layer> layer = _getFileLayer(fileId);
+    if ( layer ){
+        results = layer->_getXYProfiles(fileId, x, y, frameLow, frameHigh, stokeFrame, converter);
     }
     return results;
 }
@@ -598,12 +607,40 @@ bool LayerGroup::_setSpectralRequirements(int fileId, int regionId, int stokeFra
 }
 
 PBMSharedPtr LayerGroup::_getSpectralProfile(int fileId, int x, int y, int stokeFrame) const {
-    int dataIndex = _getIndexCurrent();
-    if ( dataIndex < 0 ){
+    std::shared_ptr<Layer> layer = _getFileLayer(fileId);
+    if ( !layer ){
         return nullptr;
     }
 
-    return m_children[dataIndex]->_getSpectralProfile(fileId, x, y, stokeFrame);
+    return layer->_getSpectralProfile(fileId, x, y, stokeFrame);
+}
+
+bool LayerGroup::_getRegionSpectralProfile(int fileId, int regionId, const RegionShape& region, int stokeFrame,
+    const google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>& spectralProfiles,
+    const std::function<bool(PBMSharedPtr)>& sendProfile) const {
+    std::shared_ptr<Layer> layer = _getFileLayer(fileId);
+    if ( !layer ){
+        return false;
+    }
+
+    return layer->_getRegionSpectralProfile(fileId, regionId, region, stokeFrame, spectralProfiles, sendProfile);
+}
+
+PBMSharedPtr LayerGroup::_getRegionStats(int fileId, int regionId, const RegionShape& region, int channel,
+    int stokeFrame, const std::vector<int>& statsTypes) const {
+    PBMSharedPtr results;
+    std::shared_ptr<Layer> layer = _getFileLayer(fileId);
+    if (layer) {
+        results = layer->_getRegionStats(fileId, regionId, region, channel, stokeFrame, statsTypes);
+    }
+    return results;
+}
+
+void LayerGroup::_removeRegionStats(int fileId, int regionId) {
+    std::shared_ptr<Layer> layer = _getFileLayer(fileId);
+    if (layer) {
+        layer->_removeRegionStats(fileId, regionId);
+    }
 }
 
 PBMSharedPtr LayerGroup::_getRasterImageData(int fileId, int xMin, int xMax, int yMin, int yMax, int mip,
@@ -612,9 +649,9 @@ PBMSharedPtr LayerGroup::_getRasterImageData(int fileId, int xMin, int xMax, int
     bool &changeFrame, int regionId, int numberOfBins,
     Carta::Lib::IntensityUnitConverter::SharedPtr converter) const {
     PBMSharedPtr results;
-    int dataIndex = _getIndexCurrent();
-    if (dataIndex >= 0) {
-        results = m_children[dataIndex]->_getRasterImageData(fileId, xMin, xMax, yMin, yMax, mip,
+    std::shared_ptr<Layer> layer = _getFileLayer(fileId);
+    if (layer) {
+        results = layer->_getRasterImageData(fileId, xMin, xMax, yMin, yMax, mip,
                                                              frameLow, frameHigh, stokeFrame,
                                                              isZFP, precision, numSubsets,
                                                              changeFrame, regionId, numberOfBins, converter);
@@ -622,6 +659,47 @@ PBMSharedPtr LayerGroup::_getRasterImageData(int fileId, int xMin, int xMax, int
     return results;
 }
 
+int LayerGroup::_getRasterTiles(int fileId, const std::vector<QPoint>& tiles, int mip,
+    int frameLow, int frameHigh, int stokeFrame,
+    bool isZFP, int precision,
+    bool &changeFrame, int regionId, int numberOfBins,
+    Carta::Lib::IntensityUnitConverter::SharedPtr converter,
+    const std::function<bool(PBMSharedPtr)>& sendTile) const {
+    int sent = 0;
+    std::shared_ptr<Layer> layer = _getFileLayer(fileId);
+    if (layer) {
+        sent = layer->_getRasterTiles(fileId, tiles, mip, frameLow, frameHigh, stokeFrame,
+                                                      isZFP, precision, changeFrame, regionId, numberOfBins,
+                                                      converter, sendTile);
+    }
+    return sent;
+}
+
+int LayerGroup::_getContourImageData(int fileId, int channel, int stokeFrame, const std::vector<double>& levels,
+    int smoothingMode, int smoothingFactor, int decimation, int compressionLevel,
+    const std::function<bool(PBMSharedPtr)>& sendContours) const {
+    int sent = 0;
+    std::shared_ptr<Layer> layer = _getFileLayer(fileId);
+    if (layer) {
+        sent = layer->_getContourImageData(fileId, channel, stokeFrame, levels, smoothingMode, smoothingFactor,
+            decimation, compressionLevel,
+            sendContours);
+    }
+    return sent;
+}
+
+void LayerGroup::_indexChannelStats(int numberOfBins) {
+    for (std::shared_ptr<Layer> layer : m_children) {
+        layer->_indexChannelStats(numberOfBins);
+    }
+}
+
+void LayerGroup::_transposeSpectralCube() {
+    for (std::shared_ptr<Layer> layer : m_children) {
+        layer->_transposeSpectralCube();
+    }
+}
+
 std::shared_ptr<Layer> LayerGroup::_getLayer( const QString& name ){
     std::shared_ptr<Layer> layer(nullptr);
     int dataIndex = -1;
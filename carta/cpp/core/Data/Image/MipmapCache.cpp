@@ -0,0 +1,122 @@
+#include "MipmapCache.h"
+#include "Globals.h"
+#include "MainConfig.h"
+#include <QDebug>
+
+namespace Carta {
+
+namespace Data {
+
+const qint64 MipmapCache::DEFAULT_MAX_BYTES = 1024LL * 1024 * 1024;
+
+MipmapCache::MipmapCache(){
+    m_maxBytes = DEFAULT_MAX_BYTES;
+    const MainConfig::ParsedInfo* config = Globals::instance()->mainConfig();
+    if ( config && config->getMipmapCacheSizeMB() > 0 ){
+        m_maxBytes = qint64( config->getMipmapCacheSizeMB() ) * 1024 * 1024;
+    }
+}
+
+MipmapCache & MipmapCache::instance(){
+    static MipmapCache cache;
+    return cache;
+}
+
+QString MipmapCache::makeKey( const QString& fileName, int channel, int stokes, int mip ){
+    return QString("%1/%2/%3/%4/mipmap").arg(fileName).arg(channel).arg(stokes).arg(mip);
+}
+
+QByteArray MipmapCache::makePersistentKey( const QByteArray& fileHash, int channel, int stokes, int mip ){
+    //Tag, file hash, then the plane and the level
+    const char tag[4] = { 'M', 'I', 'P', '1' };
+    int32_t plane[3] = { channel, stokes, mip };
+    QByteArray key;
+    key.reserve( sizeof( tag ) + fileHash.size() + sizeof( plane ) );
+    key.append( tag, sizeof( tag ) );
+    key.append( fileHash );
+    key.append( reinterpret_cast<const char*>( plane ), sizeof( plane ) );
+    return key;
+}
+
+bool MipmapCache::get( const QString& key, Level& level ){
+    QMutexLocker locker( &m_mutex );
+    auto iter = m_entries.find( key );
+    if ( iter == m_entries.end() ){
+        m_misses++;
+        return false;
+    }
+    m_lru.splice( m_lru.begin(), m_lru, iter->lruPos );
+    level = iter->level;
+    m_hits++;
+    return true;
+}
+
+bool MipmapCache::put( const QString& key, const Level& level ){
+    qint64 size = _getSize( level );
+    QMutexLocker locker( &m_mutex );
+    if ( size > m_maxBytes ){
+        return false;
+    }
+    auto iter = m_entries.find( key );
+    if ( iter != m_entries.end() ){
+        m_usedBytes -= _getSize( iter->level );
+        m_lru.erase( iter->lruPos );
+        m_entries.erase( iter );
+    }
+    m_lru.push_front( key );
+    Entry entry;
+    entry.level = level;
+    entry.lruPos = m_lru.begin();
+    m_entries.insert( key, entry );
+    m_usedBytes += size;
+    _evict();
+    return true;
+}
+
+void MipmapCache::setMaxBytes( qint64 maxBytes ){
+    QMutexLocker locker( &m_mutex );
+    m_maxBytes = maxBytes;
+    _evict();
+}
+
+qint64 MipmapCache::getMaxBytes() const {
+    QMutexLocker locker( &m_mutex );
+    return m_maxBytes;
+}
+
+qint64 MipmapCache::getUsedBytes() const {
+    QMutexLocker locker( &m_mutex );
+    return m_usedBytes;
+}
+
+quint64 MipmapCache::getHitCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_hits;
+}
+
+quint64 MipmapCache::getMissCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_misses;
+}
+
+qint64 MipmapCache::_getSize( const Level& level ){
+    if ( !level.data ){
+        return 0;
+    }
+    return qint64( level.data->size() ) * sizeof(float);
+}
+
+void MipmapCache::_evict(){
+    while ( m_usedBytes > m_maxBytes && !m_lru.empty() ){
+        const QString& key = m_lru.back();
+        auto iter = m_entries.find( key );
+        if ( iter != m_entries.end() ){
+            m_usedBytes -= _getSize( iter->level );
+            m_entries.erase( iter );
+        }
+        m_lru.pop_back();
+    }
+}
+
+}
+}
@@ -0,0 +1,109 @@
+/***
+ * Process wide, size-bounded cache of downsampled (mip) image planes.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QMutex>
+#include <QHash>
+#include <QString>
+#include <list>
+#include <memory>
+#include <vector>
+
+namespace Carta {
+
+namespace Data {
+
+class MipmapCache {
+
+public:
+
+    /// one level of the pyramid: the whole plane downsampled by mip
+    struct Level {
+        int width = 0;
+        int height = 0;
+        int mip = 0;
+        std::shared_ptr<const std::vector<float> > data;
+    };
+
+    /**
+     * Returns the cache shared by all sessions.
+     */
+    static MipmapCache & instance();
+
+    /**
+     * Builds the key identifying a pyramid level.
+     * @param fileName - the image file.
+     * @param channel - the spectral channel.
+     * @param stokes - the stokes plane.
+     * @param mip - the downsampling factor of the level.
+     * @return - the key for the level.
+     */
+    static QString makeKey( const QString& fileName, int channel, int stokes, int mip );
+
+    /**
+     * Builds the key of a pyramid level in the persistent cache. It outlives the process,
+     * so it is built from the content of the file rather than its name.
+     * @param fileHash - the fingerprint of the image file, see IntensityCacheHelper::fileHash().
+     * @param channel - the spectral channel.
+     * @param stokes - the stokes plane.
+     * @param mip - the downsampling factor of the level.
+     * @return - the key for the level.
+     */
+    static QByteArray makePersistentKey( const QByteArray& fileHash, int channel, int stokes, int mip );
+
+    /**
+     * Looks up a level and marks it as the most recently used one.
+     * @param key - the key of the level.
+     * @param level - set to the cached level if there is one.
+     * @return - true if the level was found; false otherwise.
+     */
+    bool get( const QString& key, Level& level );
+
+    /**
+     * Stores a level, evicting the least recently used levels to stay within the budget.
+     * @param key - the key of the level.
+     * @param level - the level to store.
+     * @return - false if the level is larger than the whole budget and was not stored.
+     */
+    bool put( const QString& key, const Level& level );
+
+    /**
+     * Sets the memory budget, evicting levels if necessary.
+     * @param maxBytes - the maximum number of bytes held by the cache.
+     */
+    void setMaxBytes( qint64 maxBytes );
+
+    qint64 getMaxBytes() const;
+    qint64 getUsedBytes() const;
+    quint64 getHitCount() const;
+    quint64 getMissCount() const;
+
+private:
+    MipmapCache();
+    MipmapCache( const MipmapCache& other) = delete;
+    MipmapCache& operator=( const MipmapCache& other ) = delete;
+
+    static qint64 _getSize( const Level& level );
+    void _evict();
+
+    struct Entry {
+        Level level;
+        std::list<QString>::iterator lruPos;
+    };
+
+    mutable QMutex m_mutex;
+    //Most recently used keys at the front
+    std::list<QString> m_lru;
+    QHash<QString, Entry> m_entries;
+    qint64 m_usedBytes = 0;
+    qint64 m_maxBytes;
+    quint64 m_hits = 0;
+    quint64 m_misses = 0;
+
+    static const qint64 DEFAULT_MAX_BYTES;
+};
+}
+}
@@ -0,0 +1,204 @@
+#include "RegionMaskCache.h"
+
+#include <QMutexLocker>
+#include <cmath>
+
+namespace Carta {
+
+namespace Data {
+
+const qint64 RegionMaskCache::DEFAULT_MAX_BYTES = 64LL * 1024 * 1024;
+const int RegionMaskCache::MAX_SHAPE_TO_IMAGE_RATIO = 4;
+
+RegionMaskCache::RegionMaskCache(){
+    m_maxBytes = DEFAULT_MAX_BYTES;
+}
+
+RegionMaskCache & RegionMaskCache::instance(){
+    static RegionMaskCache cache;
+    return cache;
+}
+
+std::shared_ptr<const RegionMask> RegionMaskCache::getMask( const RegionShape& region, const QSize& imageSize ){
+    QByteArray key = _makeKey( region );
+    int size[2] = { imageSize.width(), imageSize.height() };
+    key.append( reinterpret_cast<const char*>( size ), sizeof( size ) );
+    std::shared_ptr<const RegionMask> mask = _find( key );
+    if ( mask ){
+        QMutexLocker locker( &m_mutex );
+        m_hits++;
+        return mask;
+    }
+
+    // the shape moved so that its first point lies within the pixel at the origin; a
+    // region dragged by whole pixels has the same shape
+    QPoint anchor( 0, 0 );
+    if ( !region.getPoints().empty() && region.isValid() ){
+        const QPointF& first = region.getPoints()[0];
+        anchor = QPoint( int( std::floor( first.x() ) ), int( std::floor( first.y() ) ) );
+    }
+    RegionShape shape = region.translated( QPointF( -anchor.x(), -anchor.y() ) );
+    QByteArray shapeKey = _makeKey( shape );
+    std::shared_ptr<RegionMask> newMask = std::make_shared<RegionMask>();
+    std::shared_ptr<const RegionMask> shapeMask = _find( shapeKey );
+    bool translated = bool( shapeMask );
+    if ( !shapeMask ){
+        QRect bounds = shape.getBounds();
+        qint64 boundsPixels = bounds.isEmpty() ? 0 : qint64( bounds.width() ) * bounds.height();
+        qint64 imagePixels = qint64( imageSize.width() ) * imageSize.height();
+        if ( boundsPixels <= MAX_SHAPE_TO_IMAGE_RATIO * imagePixels ){
+            std::shared_ptr<RegionMask> fullMask = std::make_shared<RegionMask>();
+            fullMask->area = bounds;
+            fullMask->runs = shape.getRuns( bounds );
+            fullMask->pixels = Carta::Core::Algorithms::runPixels( fullMask->runs );
+            shapeMask = _insert( shapeKey, fullMask );
+        }
+    }
+    if ( shapeMask ){
+        _translate( *shapeMask, anchor.x(), anchor.y(), imageSize, *newMask );
+    }
+    else {
+        // mostly outside of the image, only the part inside is worth keeping
+        newMask->area = region.getBounds() & QRect( QPoint( 0, 0 ), imageSize );
+        newMask->runs = region.getRuns( newMask->area );
+        newMask->pixels = Carta::Core::Algorithms::runPixels( newMask->runs );
+    }
+
+    {
+        QMutexLocker locker( &m_mutex );
+        if ( translated ){
+            m_translated++;
+        }
+        else {
+            m_misses++;
+        }
+        newMask->id = m_nextId++;
+    }
+    return _insert( key, newMask );
+}
+
+void RegionMaskCache::setMaxBytes( qint64 maxBytes ){
+    QMutexLocker locker( &m_mutex );
+    m_maxBytes = maxBytes;
+    _evict();
+}
+
+qint64 RegionMaskCache::getMaxBytes() const {
+    QMutexLocker locker( &m_mutex );
+    return m_maxBytes;
+}
+
+qint64 RegionMaskCache::getUsedBytes() const {
+    QMutexLocker locker( &m_mutex );
+    return m_usedBytes;
+}
+
+quint64 RegionMaskCache::getHitCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_hits;
+}
+
+quint64 RegionMaskCache::getTranslatedCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_translated;
+}
+
+quint64 RegionMaskCache::getMissCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_misses;
+}
+
+QByteArray RegionMaskCache::_makeKey( const RegionShape& region ){
+    QByteArray key;
+    int type = int( region.getType() );
+    double rotation = region.getRotation();
+    key.append( reinterpret_cast<const char*>( &type ), sizeof( type ) );
+    key.append( reinterpret_cast<const char*>( &rotation ), sizeof( rotation ) );
+    for ( const QPointF& point : region.getPoints() ){
+        double coordinates[2] = { point.x(), point.y() };
+        key.append( reinterpret_cast<const char*>( coordinates ), sizeof( coordinates ) );
+    }
+    return key;
+}
+
+void RegionMaskCache::_translate( const RegionMask& shapeMask, int dx, int dy, const QSize& imageSize,
+        RegionMask& mask ){
+    const QRect& from = shapeMask.area;
+    mask.area = from.translated( dx, dy ) & QRect( QPoint( 0, 0 ), imageSize );
+    mask.runs.clear();
+    if ( mask.area.isEmpty() ){
+        mask.pixels = 0;
+        return;
+    }
+    const QRect& area = mask.area;
+    for ( const Carta::Core::Algorithms::PixelRun& run : shapeMask.runs ){
+        int y = int( run.offset / from.width() ) + from.top() + dy;
+        if ( y < area.top() ){
+            continue;
+        }
+        if ( y > area.bottom() ){
+            break;
+        }
+        int xStart = int( run.offset % from.width() ) + from.left() + dx;
+        int xEnd = std::min( xStart + run.length - 1, area.right() );
+        xStart = std::max( xStart, area.left() );
+        if ( xStart <= xEnd ){
+            qint64 offset = qint64( y - area.top() ) * area.width() + ( xStart - area.left() );
+            mask.runs.push_back( { offset, xEnd - xStart + 1 } );
+        }
+    }
+    mask.pixels = Carta::Core::Algorithms::runPixels( mask.runs );
+}
+
+std::shared_ptr<const RegionMask> RegionMaskCache::_find( const QByteArray& key ){
+    QMutexLocker locker( &m_mutex );
+    auto iter = m_entries.find( key );
+    if ( iter == m_entries.end() ){
+        return nullptr;
+    }
+    m_lru.splice( m_lru.begin(), m_lru, iter->lruPos );
+    return iter->mask;
+}
+
+std::shared_ptr<const RegionMask> RegionMaskCache::_insert( const QByteArray& key,
+        const std::shared_ptr<const RegionMask>& mask ){
+    qint64 size = _getSize( *mask );
+    QMutexLocker locker( &m_mutex );
+    if ( size > m_maxBytes ){
+        return mask;
+    }
+    auto iter = m_entries.find( key );
+    if ( iter != m_entries.end() ){
+        // another job rasterized the same region first, its mask is the one to use so
+        // that the id stays the same
+        m_lru.splice( m_lru.begin(), m_lru, iter->lruPos );
+        return iter->mask;
+    }
+    m_lru.push_front( key );
+    Entry entry;
+    entry.mask = mask;
+    entry.lruPos = m_lru.begin();
+    m_entries.insert( key, entry );
+    m_usedBytes += size;
+    _evict();
+    return mask;
+}
+
+qint64 RegionMaskCache::_getSize( const RegionMask& mask ){
+    return qint64( sizeof( RegionMask ) ) + qint64( mask.runs.size() ) * sizeof( Carta::Core::Algorithms::PixelRun );
+}
+
+void RegionMaskCache::_evict(){
+    while ( m_usedBytes > m_maxBytes && !m_lru.empty() ){
+        const QByteArray& key = m_lru.back();
+        auto iter = m_entries.find( key );
+        if ( iter != m_entries.end() ){
+            m_usedBytes -= _getSize( *iter->mask );
+            m_entries.erase( iter );
+        }
+        m_lru.pop_back();
+    }
+}
+
+}
+}
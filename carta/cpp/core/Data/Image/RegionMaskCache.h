@@ -0,0 +1,110 @@
+/***
+ * Pixel masks of regions, shared by every engine that works on regions. A mask is
+ * found by the geometry of its region, and a region that is only moved reuses the
+ * rasterization of its shape.
+ */
+
+#pragma once
+
+#include "RegionShape.h"
+#include "../../Algorithms/regionStatistics.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QRect>
+#include <QSize>
+#include <list>
+#include <memory>
+
+namespace Carta {
+
+namespace Data {
+
+/// the pixels of an image a region covers
+struct RegionMask {
+    /// the bounding box of the region, clipped to the image
+    QRect area;
+    /// the pixels, as offsets within the area
+    std::vector<Carta::Core::Algorithms::PixelRun> runs;
+    /// the number of pixels
+    qint64 pixels = 0;
+    /// different for every mask the cache builds, so that results computed for a mask
+    /// can tell whether they are stale
+    quint64 id = 0;
+};
+
+class RegionMaskCache {
+
+public:
+
+    /**
+     * Returns the cache shared by all sessions.
+     */
+    static RegionMaskCache & instance();
+
+    /**
+     * Returns the mask of a region, from the cache if the region was asked for before.
+     * A region that was only moved since is not rasterized again if it moved by whole
+     * pixels: the runs of its shape are shifted and clipped to the image.
+     * @param region - the region, in pixel coordinates of the image.
+     * @param imageSize - the width and height of the image.
+     */
+    std::shared_ptr<const RegionMask> getMask( const RegionShape& region, const QSize& imageSize );
+
+    /**
+     * Sets the memory budget, evicting masks if necessary.
+     * @param maxBytes - the maximum number of bytes held by the cache.
+     */
+    void setMaxBytes( qint64 maxBytes );
+
+    qint64 getMaxBytes() const;
+    qint64 getUsedBytes() const;
+    /// masks found in the cache
+    quint64 getHitCount() const;
+    /// masks shifted from the runs of a shape rasterized before
+    quint64 getTranslatedCount() const;
+    /// masks rasterized
+    quint64 getMissCount() const;
+
+private:
+    RegionMaskCache();
+    RegionMaskCache( const RegionMaskCache& other) = delete;
+    RegionMaskCache& operator=( const RegionMaskCache& other ) = delete;
+
+    /// the geometry of a region, exactly
+    static QByteArray _makeKey( const RegionShape& region );
+
+    /// moves the runs of a shape and clips them to the image
+    static void _translate( const RegionMask& shapeMask, int dx, int dy, const QSize& imageSize,
+            RegionMask& mask );
+
+    std::shared_ptr<const RegionMask> _find( const QByteArray& key );
+    /// returns the mask that is cached under the key, which may be an earlier one
+    std::shared_ptr<const RegionMask> _insert( const QByteArray& key, const std::shared_ptr<const RegionMask>& mask );
+    static qint64 _getSize( const RegionMask& mask );
+    void _evict();
+
+    struct Entry {
+        std::shared_ptr<const RegionMask> mask;
+        std::list<QByteArray>::iterator lruPos;
+    };
+
+    mutable QMutex m_mutex;
+    //Most recently used keys at the front; the masks of regions placed on an image and
+    //the unclipped masks of their shapes are kept together
+    std::list<QByteArray> m_lru;
+    QHash<QByteArray, Entry> m_entries;
+    qint64 m_usedBytes = 0;
+    qint64 m_maxBytes;
+    quint64 m_nextId = 1;
+    quint64 m_hits = 0;
+    quint64 m_translated = 0;
+    quint64 m_misses = 0;
+
+    static const qint64 DEFAULT_MAX_BYTES;
+    //Shapes are kept unclipped only if they are not much larger than the image
+    static const int MAX_SHAPE_TO_IMAGE_RATIO;
+};
+}
+}
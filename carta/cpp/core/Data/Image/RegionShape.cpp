@@ -0,0 +1,294 @@
+#include "RegionShape.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace Carta {
+
+namespace Data {
+
+namespace {
+const double DEGREES_TO_RADIANS = M_PI / 180.0;
+}
+
+RegionShape::RegionShape() :
+    m_type( Type::POINT ),
+    m_rotation( 0 ){
+}
+
+RegionShape::RegionShape( Type type, const std::vector<QPointF>& points, double rotation ) :
+    m_type( type ),
+    m_points( points ),
+    m_rotation( rotation ){
+}
+
+RegionShape::Type RegionShape::getType() const {
+    return m_type;
+}
+
+const std::vector<QPointF>& RegionShape::getPoints() const {
+    return m_points;
+}
+
+double RegionShape::getRotation() const {
+    return m_rotation;
+}
+
+bool RegionShape::isValid() const {
+    for ( const QPointF& point : m_points ){
+        if ( !std::isfinite( point.x() ) || !std::isfinite( point.y() ) ){
+            return false;
+        }
+    }
+    if ( !std::isfinite( m_rotation ) ){
+        return false;
+    }
+    switch ( m_type ){
+    case Type::POINT:
+        return m_points.size() == 1;
+    case Type::RECTANGLE:
+    case Type::ELLIPSE:
+        return m_points.size() == 2 && m_points[1].x() > 0 && m_points[1].y() > 0;
+    case Type::POLYGON:
+        return m_points.size() >= 3;
+    }
+    return false;
+}
+
+QRect RegionShape::getBounds() const {
+    if ( !isValid() ){
+        return QRect();
+    }
+    double xMin = 0;
+    double xMax = 0;
+    double yMin = 0;
+    double yMax = 0;
+    if ( m_type == Type::POINT ){
+        QPoint pixel( qRound( m_points[0].x() ), qRound( m_points[0].y() ) );
+        return QRect( pixel, pixel );
+    }
+    else if ( m_type == Type::POLYGON ){
+        xMin = xMax = m_points[0].x();
+        yMin = yMax = m_points[0].y();
+        for ( const QPointF& point : m_points ){
+            xMin = std::min( xMin, point.x() );
+            xMax = std::max( xMax, point.x() );
+            yMin = std::min( yMin, point.y() );
+            yMax = std::max( yMax, point.y() );
+        }
+    }
+    else {
+        double angle = m_rotation * DEGREES_TO_RADIANS;
+        double cosAngle = std::fabs( std::cos( angle ) );
+        double sinAngle = std::fabs( std::sin( angle ) );
+        double a = m_points[1].x();
+        double b = m_points[1].y();
+        double halfWidth = 0;
+        double halfHeight = 0;
+        if ( m_type == Type::RECTANGLE ){
+            halfWidth = ( a * cosAngle + b * sinAngle ) / 2;
+            halfHeight = ( a * sinAngle + b * cosAngle ) / 2;
+        }
+        else {
+            halfWidth = std::sqrt( a * a * cosAngle * cosAngle + b * b * sinAngle * sinAngle );
+            halfHeight = std::sqrt( a * a * sinAngle * sinAngle + b * b * cosAngle * cosAngle );
+        }
+        xMin = m_points[0].x() - halfWidth;
+        xMax = m_points[0].x() + halfWidth;
+        yMin = m_points[0].y() - halfHeight;
+        yMax = m_points[0].y() + halfHeight;
+    }
+    // the pixels whose centre can be inside
+    QPoint topLeft( int( std::ceil( xMin ) ), int( std::ceil( yMin ) ) );
+    QPoint bottomRight( int( std::floor( xMax ) ), int( std::floor( yMax ) ) );
+    return QRect( topLeft, bottomRight );
+}
+
+bool RegionShape::contains( double x, double y ) const {
+    if ( !isValid() ){
+        return false;
+    }
+    if ( m_type == Type::POINT ){
+        return qRound( m_points[0].x() ) == qRound( x ) && qRound( m_points[0].y() ) == qRound( y );
+    }
+    if ( m_type == Type::POLYGON ){
+        // even-odd rule
+        bool inside = false;
+        size_t count = m_points.size();
+        for ( size_t i = 0, j = count - 1; i < count; j = i++ ){
+            const QPointF& a = m_points[i];
+            const QPointF& b = m_points[j];
+            if ( ( a.y() > y ) != ( b.y() > y ) &&
+                    x < ( b.x() - a.x() ) * ( y - a.y() ) / ( b.y() - a.y() ) + a.x() ){
+                inside = !inside;
+            }
+        }
+        return inside;
+    }
+
+    // into the frame of the region, where its axes lie along x and y
+    double angle = m_rotation * DEGREES_TO_RADIANS;
+    double dx = x - m_points[0].x();
+    double dy = y - m_points[0].y();
+    double u = dx * std::cos( angle ) + dy * std::sin( angle );
+    double v = -dx * std::sin( angle ) + dy * std::cos( angle );
+    double a = m_points[1].x();
+    double b = m_points[1].y();
+    if ( m_type == Type::RECTANGLE ){
+        return std::fabs( u ) <= a / 2 && std::fabs( v ) <= b / 2;
+    }
+    return ( u * u ) / ( a * a ) + ( v * v ) / ( b * b ) <= 1;
+}
+
+RegionShape RegionShape::translated( const QPointF& offset ) const {
+    std::vector<QPointF> points( m_points );
+    if ( m_type == Type::RECTANGLE || m_type == Type::ELLIPSE ){
+        // the second point is the size
+        if ( !points.empty() ){
+            points[0] += offset;
+        }
+    }
+    else {
+        for ( QPointF& point : points ){
+            point += offset;
+        }
+    }
+    return RegionShape( m_type, points, m_rotation );
+}
+
+std::vector<Carta::Core::Algorithms::PixelRun> RegionShape::getRuns( const QRect& area ) const {
+    std::vector<Carta::Core::Algorithms::PixelRun> runs;
+    QRect inside = area & getBounds();
+    if ( inside.isEmpty() ){
+        return runs;
+    }
+    // a run never goes on to the next row, even when the rows are full
+    int lastRow = inside.top() - 1;
+    auto addSpan = [&]( int y, int xStart, int xEnd ){
+        xStart = std::max( xStart, inside.left() );
+        xEnd = std::min( xEnd, inside.right() );
+        if ( xStart > xEnd ){
+            return;
+        }
+        qint64 offset = qint64( y - area.top() ) * area.width() + ( xStart - area.left() );
+        if ( y == lastRow && runs.back().offset + runs.back().length == offset ){
+            runs.back().length += xEnd - xStart + 1;
+        }
+        else {
+            runs.push_back( { offset, xEnd - xStart + 1 } );
+        }
+        lastRow = y;
+    };
+
+    if ( m_type == Type::POINT ){
+        addSpan( inside.top(), inside.left(), inside.right() );
+        return runs;
+    }
+
+    if ( m_type == Type::POLYGON ){
+        // the crossings of each row with the edges, as contains() computes them; a pixel
+        // is inside between an odd crossing and the next one
+        std::vector<double> crossings;
+        size_t count = m_points.size();
+        for ( int y = inside.top(); y <= inside.bottom(); y++ ){
+            crossings.clear();
+            for ( size_t i = 0, j = count - 1; i < count; j = i++ ){
+                const QPointF& a = m_points[i];
+                const QPointF& b = m_points[j];
+                if ( ( a.y() > y ) != ( b.y() > y ) ){
+                    crossings.push_back( ( b.x() - a.x() ) * ( y - a.y() ) / ( b.y() - a.y() ) + a.x() );
+                }
+            }
+            std::sort( crossings.begin(), crossings.end() );
+            for ( size_t i = 0; i + 1 < crossings.size(); i += 2 ){
+                double xStart = std::max<double>( std::ceil( crossings[i] ), inside.left() );
+                double xEnd = std::min<double>( std::ceil( crossings[i + 1] ) - 1, inside.right() );
+                if ( xStart <= xEnd ){
+                    addSpan( y, int( xStart ), int( xEnd ) );
+                }
+            }
+        }
+        return runs;
+    }
+
+    // a rectangle or an ellipse is convex, so each row holds one span; it is solved for
+    // in the frame of the region and its ends are checked against contains()
+    double angle = m_rotation * DEGREES_TO_RADIANS;
+    double cosAngle = std::cos( angle );
+    double sinAngle = std::sin( angle );
+    double a = m_points[1].x();
+    double b = m_points[1].y();
+    for ( int y = inside.top(); y <= inside.bottom(); y++ ){
+        double dy = y - m_points[0].y();
+        double low = -std::numeric_limits<double>::infinity();
+        double high = std::numeric_limits<double>::infinity();
+        if ( m_type == Type::RECTANGLE ){
+            // |u| <= a / 2 and |v| <= b / 2, both linear in dx
+            auto clip = [&]( double slope, double intercept, double half ){
+                // a rotation of a multiple of 90 degrees leaves a rounding error in the slope
+                if ( std::fabs( slope ) < 1e-12 ){
+                    if ( std::fabs( intercept ) > half ){
+                        high = low - 1;
+                    }
+                    return;
+                }
+                double first = ( -half - intercept ) / slope;
+                double second = ( half - intercept ) / slope;
+                low = std::max( low, std::min( first, second ) );
+                high = std::min( high, std::max( first, second ) );
+            };
+            clip( cosAngle, dy * sinAngle, a / 2 );
+            clip( -sinAngle, dy * cosAngle, b / 2 );
+        }
+        else {
+            // u^2 / a^2 + v^2 / b^2 <= 1 is a quadratic in dx
+            double qa = cosAngle * cosAngle / ( a * a ) + sinAngle * sinAngle / ( b * b );
+            double qb = 2 * cosAngle * sinAngle * dy * ( 1 / ( a * a ) - 1 / ( b * b ) );
+            double qc = dy * dy * ( sinAngle * sinAngle / ( a * a ) + cosAngle * cosAngle / ( b * b ) ) - 1;
+            double discriminant = qb * qb - 4 * qa * qc;
+            if ( discriminant < 0 ){
+                continue;
+            }
+            double root = std::sqrt( discriminant );
+            low = ( -qb - root ) / ( 2 * qa );
+            high = ( -qb + root ) / ( 2 * qa );
+        }
+        if ( !( low <= high ) ){
+            continue;
+        }
+        int xStart = int( std::max<double>( std::ceil( m_points[0].x() + low ), inside.left() ) );
+        int xEnd = int( std::min<double>( std::floor( m_points[0].x() + high ), inside.right() ) );
+        if ( xStart > xEnd ){
+            continue;
+        }
+        // rounding can move the ends by a pixel
+        while ( xStart <= xEnd && !contains( xStart, y ) ){
+            xStart++;
+        }
+        while ( xEnd >= xStart && !contains( xEnd, y ) ){
+            xEnd--;
+        }
+        if ( xStart > xEnd ){
+            continue;
+        }
+        while ( xStart > inside.left() && contains( xStart - 1, y ) ){
+            xStart--;
+        }
+        while ( xEnd < inside.right() && contains( xEnd + 1, y ) ){
+            xEnd++;
+        }
+        addSpan( y, xStart, xEnd );
+    }
+    return runs;
+}
+
+bool RegionShape::operator==( const RegionShape& other ) const {
+    return m_type == other.m_type && m_points == other.m_points && m_rotation == other.m_rotation;
+}
+
+bool RegionShape::operator!=( const RegionShape& other ) const {
+    return !( *this == other );
+}
+}
+}
@@ -0,0 +1,91 @@
+/***
+ * Geometry of a region set by the client, in image pixel coordinates.
+ */
+
+#pragma once
+
+#include "../../Algorithms/regionStatistics.h"
+#include <QPointF>
+#include <QRect>
+#include <vector>
+
+namespace Carta {
+
+namespace Data {
+
+class RegionShape {
+
+public:
+
+    /// the kinds of regions the server computes statistics for
+    enum class Type {
+        POINT,
+        RECTANGLE,
+        ELLIPSE,
+        POLYGON
+    };
+
+    /**
+     * Constructor of an empty region, which contains no pixels.
+     */
+    RegionShape();
+
+    /**
+     * Constructor.
+     * @param type - the kind of region.
+     * @param points - the control points: the position of a point; the centre and the
+     *      (width, height) of a rectangle; the centre and the (semi-major, semi-minor) axes
+     *      of an ellipse; the vertices of a polygon.
+     * @param rotation - the counter-clockwise rotation of a rectangle or an ellipse about
+     *      its centre, in degrees; the major axis of an unrotated ellipse lies along x.
+     */
+    RegionShape( Type type, const std::vector<QPointF>& points, double rotation );
+
+    Type getType() const;
+    const std::vector<QPointF>& getPoints() const;
+    double getRotation() const;
+
+    /**
+     * Returns whether the control points describe a region of the given type.
+     */
+    bool isValid() const;
+
+    /**
+     * Returns the smallest area holding every pixel whose centre lies inside the region;
+     * it is not clipped to the image.
+     */
+    QRect getBounds() const;
+
+    /**
+     * Returns whether a point lies inside the region.
+     * @param x - x coordinate of the point; pixel centres are at integer coordinates.
+     * @param y - y coordinate of the point.
+     */
+    bool contains( double x, double y ) const;
+
+    /**
+     * Returns the same region moved by an offset.
+     * @param offset - the offset, in pixels.
+     */
+    RegionShape translated( const QPointF& offset ) const;
+
+    /**
+     * Returns the pixels of an area whose centre lies inside the region; they are found
+     * a row at a time, without testing every pixel of the area.
+     * @param area - the area.
+     * @return - the runs of pixels of each row, as offsets within the area with x varying
+     *      fastest, in increasing order.
+     */
+    std::vector<Carta::Core::Algorithms::PixelRun> getRuns( const QRect& area ) const;
+
+    bool operator==( const RegionShape& other ) const;
+    bool operator!=( const RegionShape& other ) const;
+
+private:
+
+    Type m_type;
+    std::vector<QPointF> m_points;
+    double m_rotation;
+};
+}
+}
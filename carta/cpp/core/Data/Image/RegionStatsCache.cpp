@@ -0,0 +1,117 @@
+#include "RegionStatsCache.h"
+
+#include <QMutexLocker>
+#include <algorithm>
+#include <limits>
+
+namespace Carta {
+
+namespace Data {
+
+RegionStatsCache::RegionStatsCache( int maxEntries ) :
+    m_maxEntries( std::max( 1, maxEntries ) ){
+}
+
+std::shared_ptr<const RegionMask> RegionStatsCache::getMask( int regionId, const RegionShape& region,
+        const QSize& imageSize ){
+    std::shared_ptr<const RegionMask> mask = RegionMaskCache::instance().getMask( region, imageSize );
+    QMutexLocker locker( &m_mutex );
+    std::shared_ptr<const RegionMask>& current = m_regions[regionId];
+    if ( !current || current->id != mask->id ){
+        _removeEntries( regionId );
+        current = mask;
+    }
+    return mask;
+}
+
+bool RegionStatsCache::find( int regionId, const RegionMask& mask, int channel, int stokes,
+        Carta::Core::Algorithms::RegionMoments& moments ){
+    QMutexLocker locker( &m_mutex );
+    auto found = m_entries.find( std::make_tuple( regionId, channel, stokes ) );
+    if ( found == m_entries.end() || found->second.maskId != mask.id ){
+        m_misses++;
+        return false;
+    }
+    m_hits++;
+    found->second.lastUsed = ++m_clock;
+    moments = found->second.moments;
+    return true;
+}
+
+void RegionStatsCache::insert( int regionId, const RegionMask& mask, int channel, int stokes,
+        const Carta::Core::Algorithms::RegionMoments& moments ){
+    QMutexLocker locker( &m_mutex );
+    auto region = m_regions.find( regionId );
+    if ( region == m_regions.end() || !region->second || region->second->id != mask.id ){
+        // the region changed while the moments were computed
+        return;
+    }
+    Entry& entry = m_entries[std::make_tuple( regionId, channel, stokes )];
+    entry.maskId = mask.id;
+    entry.moments = moments;
+    entry.lastUsed = ++m_clock;
+
+    if ( int( m_entries.size() ) > m_maxEntries ){
+        // drop the least recently used eighth at once, so that the scan is rare
+        std::vector<quint64> uses;
+        uses.reserve( m_entries.size() );
+        for ( const auto& cached : m_entries ){
+            uses.push_back( cached.second.lastUsed );
+        }
+        size_t dropCount = std::max<size_t>( 1, m_entries.size() / 8 );
+        std::nth_element( uses.begin(), uses.begin() + dropCount - 1, uses.end() );
+        quint64 oldest = uses[dropCount - 1];
+        for ( auto iter = m_entries.begin(); iter != m_entries.end(); ){
+            if ( iter->second.lastUsed <= oldest ){
+                iter = m_entries.erase( iter );
+            }
+            else {
+                ++iter;
+            }
+        }
+    }
+}
+
+bool RegionStatsCache::getMoments( int regionId, const RegionShape& region, const QSize& imageSize, int channel,
+        int stokes, const Compute& compute, Carta::Core::Algorithms::RegionMoments& moments, qint64& regionPixels ){
+    std::shared_ptr<const RegionMask> mask = getMask( regionId, region, imageSize );
+    regionPixels = mask->pixels;
+    if ( mask->pixels == 0 ){
+        return false;
+    }
+    if ( find( regionId, *mask, channel, stokes, moments ) ){
+        return true;
+    }
+    moments = Carta::Core::Algorithms::RegionMoments();
+    if ( !compute( *mask, moments ) ){
+        return false;
+    }
+    insert( regionId, *mask, channel, stokes, moments );
+    return true;
+}
+
+void RegionStatsCache::remove( int regionId ){
+    QMutexLocker locker( &m_mutex );
+    m_regions.erase( regionId );
+    _removeEntries( regionId );
+}
+
+quint64 RegionStatsCache::getHitCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_hits;
+}
+
+quint64 RegionStatsCache::getMissCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_misses;
+}
+
+void RegionStatsCache::_removeEntries( int regionId ){
+    auto first = m_entries.lower_bound( std::make_tuple( regionId, std::numeric_limits<int>::min(),
+                                                         std::numeric_limits<int>::min() ) );
+    auto last = m_entries.lower_bound( std::make_tuple( regionId + 1, std::numeric_limits<int>::min(),
+                                                        std::numeric_limits<int>::min() ) );
+    m_entries.erase( first, last );
+}
+}
+}
@@ -0,0 +1,113 @@
+/***
+ * Statistics of the regions of an image in every channel and stokes they were asked for,
+ * kept until the region changes.
+ */
+
+#pragma once
+
+#include "RegionMaskCache.h"
+#include "../../Algorithms/regionStatistics.h"
+
+#include <QMutex>
+#include <QSize>
+#include <functional>
+#include <map>
+#include <memory>
+#include <tuple>
+
+namespace Carta {
+
+namespace Data {
+
+class RegionStatsCache {
+
+public:
+
+    /// computes the moments of the pixels of a region in one plane
+    typedef std::function<bool ( const RegionMask& mask, Carta::Core::Algorithms::RegionMoments& moments )> Compute;
+
+    /**
+     * Constructor.
+     * @param maxEntries - the number of (region, channel, stokes) entries kept; the least
+     *      recently used go first.
+     */
+    explicit RegionStatsCache( int maxEntries );
+
+    /**
+     * Returns the pixels of a region from the mask cache; the statistics of the region
+     * are forgotten if its mask changed.
+     * @param regionId - the region id.
+     * @param region - the region.
+     * @param imageSize - the width and height of the image.
+     */
+    std::shared_ptr<const RegionMask> getMask( int regionId, const RegionShape& region, const QSize& imageSize );
+
+    /**
+     * Looks up the moments of a region in one channel.
+     * @param regionId - the region id.
+     * @param mask - the pixels of the region.
+     * @param channel - the channel.
+     * @param stokes - the stokes.
+     * @param moments - set to the moments if found.
+     * @return - true if they were found.
+     */
+    bool find( int regionId, const RegionMask& mask, int channel, int stokes,
+            Carta::Core::Algorithms::RegionMoments& moments );
+
+    /**
+     * Stores the moments of a region in one channel.
+     */
+    void insert( int regionId, const RegionMask& mask, int channel, int stokes,
+            const Carta::Core::Algorithms::RegionMoments& moments );
+
+    /**
+     * Returns the moments of a region in one channel, computing them only if they are not
+     * stored for the current shape of the region.
+     * @param regionId - the region id.
+     * @param region - the region.
+     * @param imageSize - the width and height of the image.
+     * @param channel - the channel.
+     * @param stokes - the stokes.
+     * @param compute - computes the moments if they are not stored.
+     * @param moments - set to the moments.
+     * @param regionPixels - set to the number of pixels of the image in the region.
+     * @return - false if the region covers no pixel of the image or the moments could not be computed.
+     */
+    bool getMoments( int regionId, const RegionShape& region, const QSize& imageSize, int channel, int stokes,
+            const Compute& compute, Carta::Core::Algorithms::RegionMoments& moments, qint64& regionPixels );
+
+    /**
+     * Forgets a region.
+     * @param regionId - the region id.
+     */
+    void remove( int regionId );
+
+    quint64 getHitCount() const;
+    quint64 getMissCount() const;
+
+private:
+
+    RegionStatsCache( const RegionStatsCache& other ) = delete;
+    RegionStatsCache& operator=( const RegionStatsCache& other ) = delete;
+
+    void _removeEntries( int regionId );
+
+    struct Entry {
+        // the id of the mask the moments were computed for
+        quint64 maskId;
+        Carta::Core::Algorithms::RegionMoments moments;
+        quint64 lastUsed;
+    };
+
+    int m_maxEntries;
+    mutable QMutex m_mutex;
+    // the mask each region has now
+    std::map<int, std::shared_ptr<const RegionMask> > m_regions;
+    // key = {regionId, channel, stokes}
+    std::map<std::tuple<int, int, int>, Entry> m_entries;
+    quint64 m_clock = 0;
+    quint64 m_hits = 0;
+    quint64 m_misses = 0;
+};
+}
+}
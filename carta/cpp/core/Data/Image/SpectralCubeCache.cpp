@@ -0,0 +1,343 @@
+#include "SpectralCubeCache.h"
+#include "CartaLib/CartaLib.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+
+namespace Carta {
+
+namespace Data {
+
+const int SpectralCubeCache::BLOCK_SIZE = 16;
+const qint64 SpectralCubeCache::MAX_CHUNK_BYTES = 64LL * 1024 * 1024;
+const qint64 SpectralCubeCache::HEADER_BYTES = 4096;
+
+namespace {
+const char CUBE_MAGIC[8] = { 'C', 'A', 'R', 'T', 'A', 'S', 'P', 'C' };
+
+/// copying is a long running, low priority job that mostly waits for the disk: the copies
+/// of all the open files share one thread
+QThreadPool* _copyPool(){
+    static QThreadPool* pool = nullptr;
+    static QMutex mutex;
+    QMutexLocker locker( &mutex );
+    if ( !pool ){
+        pool = new QThreadPool();
+        pool->setMaxThreadCount( 1 );
+    }
+    return pool;
+}
+}
+
+SpectralCubeCache::SpectralCubeCache( const QString& fileName, int width, int height, int channelCount,
+        int stokesCount, const QString& directory, qint64 maxBytes ) :
+    m_fileName( fileName ),
+    m_width( width ),
+    m_height( height ),
+    m_channelCount( std::max( 1, channelCount ) ),
+    m_stokesCount( std::max( 1, stokesCount ) ),
+    m_blocksX( ( width + BLOCK_SIZE - 1 ) / BLOCK_SIZE ),
+    m_blocksY( ( height + BLOCK_SIZE - 1 ) / BLOCK_SIZE ),
+    m_directory( directory ),
+    m_maxBytes( maxBytes ){
+    m_files.resize( m_stokesCount );
+    m_data.resize( m_stokesCount, nullptr );
+}
+
+SpectralCubeCache::~SpectralCubeCache(){
+    m_cancelled = true;
+    m_future.waitForFinished();
+    QMutexLocker locker( &m_mutex );
+    for ( int stokes = 0; stokes < m_stokesCount; stokes++ ){
+        if ( m_data[stokes] ){
+            m_files[stokes]->unmap( const_cast<uchar*>( m_data[stokes] ) );
+        }
+    }
+}
+
+void SpectralCubeCache::start( const AreaReader& reader ){
+    if ( m_future.isRunning() ){
+        return;
+    }
+    m_cancelled = false;
+    m_future = QtConcurrent::run( _copyPool(), [this, reader](){ _run( reader ); } );
+}
+
+bool SpectralCubeCache::isReady( int stokes ) const {
+    QMutexLocker locker( &m_mutex );
+    return 0 <= stokes && stokes < m_stokesCount && m_data[stokes] != nullptr;
+}
+
+double SpectralCubeCache::getProgress() const {
+    qint64 blockCount = qint64( m_blocksX ) * m_blocksY * m_stokesCount;
+    return std::min( 1.0, double( m_copiedBlocks ) / std::max<qint64>( 1, blockCount ) );
+}
+
+bool SpectralCubeCache::getProfile( int x, int y, int stokes, std::vector<float>& profile ) const {
+    if ( x < 0 || x >= m_width || y < 0 || y >= m_height || stokes < 0 || stokes >= m_stokesCount ){
+        return false;
+    }
+    const uchar* data = nullptr;
+    {
+        QMutexLocker locker( &m_mutex );
+        data = m_data[stokes];
+    }
+    if ( !data ){
+        return false;
+    }
+    // the channels of a pixel are next to each other, one read from the page cache
+    const float* values = _getPixel( data, x, y );
+    profile.assign( values, values + m_channelCount );
+    return true;
+}
+
+bool SpectralCubeCache::forEachPixel( const QRect& area, int stokes, const PixelVisitor& visitor ) const {
+    if ( stokes < 0 || stokes >= m_stokesCount ){
+        return false;
+    }
+    const uchar* data = nullptr;
+    {
+        QMutexLocker locker( &m_mutex );
+        data = m_data[stokes];
+    }
+    if ( !data ){
+        return false;
+    }
+    QRect clipped = area.intersected( QRect( 0, 0, m_width, m_height ) );
+    if ( clipped.isEmpty() ){
+        return true;
+    }
+    for ( int by = clipped.top() / BLOCK_SIZE; by <= clipped.bottom() / BLOCK_SIZE; by++ ){
+        int yStart = std::max( clipped.top(), by * BLOCK_SIZE );
+        int yEnd = std::min( clipped.bottom(), by * BLOCK_SIZE + BLOCK_SIZE - 1 );
+        for ( int bx = clipped.left() / BLOCK_SIZE; bx <= clipped.right() / BLOCK_SIZE; bx++ ){
+            int xStart = std::max( clipped.left(), bx * BLOCK_SIZE );
+            int xEnd = std::min( clipped.right(), bx * BLOCK_SIZE + BLOCK_SIZE - 1 );
+            for ( int y = yStart; y <= yEnd; y++ ){
+                for ( int x = xStart; x <= xEnd; x++ ){
+                    visitor( x, y, _getPixel( data, x, y ) );
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void SpectralCubeCache::_run( AreaReader reader ){
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 stokesBlocks = qint64( m_blocksX ) * m_blocksY;
+    for ( int stokes = 0; stokes < m_stokesCount && !m_cancelled; stokes++ ){
+        // copied by an earlier session
+        if ( _open( stokes ) ){
+            m_copiedBlocks += stokesBlocks;
+            continue;
+        }
+        if ( !_build( stokes, reader ) ){
+            break;
+        }
+        if ( !_open( stokes ) ){
+            qWarning() << "[SpectralCubeCache] Could not open the copy of stokes" << stokes << "of" << m_fileName;
+            break;
+        }
+    }
+    if ( CARTA_RUNTIME_CHECKS ){
+        qCritical() << "<> Time to copy" << m_fileName << "spectral-major:" << timer.elapsed() << "ms";
+    }
+}
+
+bool SpectralCubeCache::_open( int stokes ){
+    std::unique_ptr<QFile> file( new QFile( _getPath( stokes ) ) );
+    if ( !file->exists() || !file->open( QIODevice::ReadOnly ) || file->size() != _getCubeBytes() ){
+        return false;
+    }
+    // a copy of an older version of the image is replaced
+    Header header;
+    Header expected = _getHeader();
+    if ( file->read( reinterpret_cast<char*>( &header ), sizeof( header ) ) != sizeof( header ) ||
+            memcmp( &header, &expected, sizeof( header ) ) != 0 ){
+        return false;
+    }
+    uchar* data = file->map( 0, file->size() );
+    if ( !data ){
+        return false;
+    }
+    QMutexLocker locker( &m_mutex );
+    m_files[stokes] = std::move( file );
+    m_data[stokes] = data;
+    return true;
+}
+
+bool SpectralCubeCache::_build( int stokes, const AreaReader& reader ){
+    const qint64 cubeBytes = _getCubeBytes();
+    if ( !_makeRoom( cubeBytes ) ){
+        qWarning() << "[SpectralCubeCache]" << m_fileName << "needs" << cubeBytes / ( 1024 * 1024 )
+                   << "MB, which does not fit in the budget of" << m_maxBytes / ( 1024 * 1024 ) << "MB";
+        return false;
+    }
+
+    // built under another name, so that an interrupted copy is never opened
+    QString path = _getPath( stokes );
+    QFile file( path + ".part" );
+    if ( !file.open( QIODevice::ReadWrite | QIODevice::Truncate ) || !file.resize( cubeBytes ) ){
+        qWarning() << "[SpectralCubeCache] Could not create" << file.fileName() << ":" << file.errorString();
+        file.remove();
+        return false;
+    }
+    uchar* data = file.map( 0, cubeBytes );
+    if ( !data ){
+        qWarning() << "[SpectralCubeCache] Could not map" << file.fileName() << ":" << file.errorString();
+        file.remove();
+        return false;
+    }
+
+    // the image is read a band of blocks at a time, every channel of the band at once,
+    // which for channel-major files is one contiguous read per row and channel
+    const qint64 blockBytes = qint64( BLOCK_SIZE ) * BLOCK_SIZE * m_channelCount * sizeof( float );
+    const int chunkBlocks = std::max<qint64>( 1, std::min<qint64>( m_blocksX, MAX_CHUNK_BYTES / blockBytes ) );
+    std::vector<float> buffer;
+    int reported = int( getProgress() * 10 );
+    bool success = true;
+    for ( int by = 0; by < m_blocksY && success && !m_cancelled; by++ ){
+        for ( int bx = 0; bx < m_blocksX && success && !m_cancelled; bx += chunkBlocks ){
+            const int x0 = bx * BLOCK_SIZE;
+            const int y0 = by * BLOCK_SIZE;
+            const int w = std::min( chunkBlocks * BLOCK_SIZE, m_width - x0 );
+            const int h = std::min( BLOCK_SIZE, m_height - y0 );
+            std::unique_ptr<Carta::Lib::NdArray::RawViewInterface> view( reader( QRect( x0, y0, w, h ), stokes ) );
+            if ( !view ){
+                qWarning() << "[SpectralCubeCache] Could not read stokes" << stokes << "of" << m_fileName;
+                success = false;
+                break;
+            }
+            buffer.resize( int64_t( w ) * h * m_channelCount );
+            int64_t t = 0;
+            Carta::Lib::NdArray::Float fview( view.get(), false );
+            fview.forEachChunk( [&t, &buffer]( const float* values, int64_t count ){
+                count = std::min<int64_t>( count, int64_t( buffer.size() ) - t );
+                std::copy( values, values + count, buffer.begin() + t );
+                t += count;
+            });
+            if ( t != int64_t( buffer.size() ) ){
+                qWarning() << "[SpectralCubeCache] Read" << t << "values of" << m_fileName << "instead of" << buffer.size();
+                success = false;
+                break;
+            }
+
+            // x varies fastest in the buffer, then y, then the channel; in the copy the
+            // channels of a pixel are next to each other
+            const int64_t channelStride = int64_t( w ) * h;
+            for ( int y = 0; y < h; y++ ){
+                for ( int x = 0; x < w; x++ ){
+                    float* dst = const_cast<float*>( _getPixel( data, x0 + x, y0 + y ) );
+                    const float* src = buffer.data() + int64_t( y ) * w + x;
+                    for ( int c = 0; c < m_channelCount; c++ ){
+                        dst[c] = src[c * channelStride];
+                    }
+                }
+            }
+
+            m_copiedBlocks += ( w + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+            int progress = int( getProgress() * 10 );
+            if ( progress > reported ){
+                reported = progress;
+                qDebug() << "[SpectralCubeCache] Copied" << progress * 10 << "% of" << m_fileName;
+            }
+        }
+    }
+    if ( !success || m_cancelled ){
+        file.unmap( data );
+        file.remove();
+        return false;
+    }
+
+    // the header goes in last
+    Header header = _getHeader();
+    memcpy( data, &header, sizeof( header ) );
+    file.unmap( data );
+    file.close();
+    QFile::remove( path );
+    if ( !file.rename( path ) ){
+        qWarning() << "[SpectralCubeCache] Could not rename" << file.fileName() << ":" << file.errorString();
+        file.remove();
+        return false;
+    }
+    return true;
+}
+
+bool SpectralCubeCache::_makeRoom( qint64 bytes ) const {
+    if ( bytes > m_maxBytes ){
+        return false;
+    }
+    QDir dir( m_directory );
+    if ( !dir.exists() && !dir.mkpath( "." ) ){
+        qWarning() << "[SpectralCubeCache] Could not create the directory" << m_directory;
+        return false;
+    }
+    // oldest first
+    QFileInfoList entries = dir.entryInfoList( QStringList() << "*.cube" << "*.part", QDir::Files,
+            QDir::Time | QDir::Reversed );
+    qint64 usedBytes = 0;
+    for ( const QFileInfo& entry : entries ){
+        usedBytes += entry.size();
+    }
+    // copies that are being built, and the copies of this image, are left alone; copies that
+    // are removed while another image has them mapped stay readable until it unmaps them
+    QString prefix = QFileInfo( _getPath( 0 ) ).fileName().section( '_', 0, 0 );
+    for ( const QFileInfo& entry : entries ){
+        if ( usedBytes + bytes <= m_maxBytes ){
+            break;
+        }
+        if ( entry.suffix() == "part" || entry.fileName().startsWith( prefix ) ){
+            continue;
+        }
+        if ( QFile::remove( entry.absoluteFilePath() ) ){
+            qDebug() << "[SpectralCubeCache] Removed" << entry.fileName() << "to stay within the disk budget";
+            usedBytes -= entry.size();
+        }
+    }
+    return usedBytes + bytes <= m_maxBytes;
+}
+
+SpectralCubeCache::Header SpectralCubeCache::_getHeader() const {
+    Header header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, CUBE_MAGIC, sizeof( header.magic ) );
+    header.width = m_width;
+    header.height = m_height;
+    header.channelCount = m_channelCount;
+    header.blockSize = BLOCK_SIZE;
+    QFileInfo source( m_fileName );
+    header.sourceSize = source.size();
+    header.sourceModified = source.lastModified().toMSecsSinceEpoch();
+    return header;
+}
+
+QString SpectralCubeCache::_getPath( int stokes ) const {
+    QByteArray hash = QCryptographicHash::hash( QFileInfo( m_fileName ).absoluteFilePath().toUtf8(),
+            QCryptographicHash::Md5 ).toHex();
+    return QDir( m_directory ).filePath( QString( "%1_%2.cube" ).arg( QString( hash ) ).arg( stokes ) );
+}
+
+qint64 SpectralCubeCache::_getCubeBytes() const {
+    return HEADER_BYTES + qint64( m_blocksX ) * m_blocksY * BLOCK_SIZE * BLOCK_SIZE * m_channelCount * sizeof( float );
+}
+
+const float* SpectralCubeCache::_getPixel( const uchar* data, int x, int y ) const {
+    qint64 block = qint64( y / BLOCK_SIZE ) * m_blocksX + x / BLOCK_SIZE;
+    qint64 pixel = block * BLOCK_SIZE * BLOCK_SIZE + ( y % BLOCK_SIZE ) * BLOCK_SIZE + x % BLOCK_SIZE;
+    return reinterpret_cast<const float*>( data + HEADER_BYTES + pixel * m_channelCount * sizeof( float ) );
+}
+
+}
+}
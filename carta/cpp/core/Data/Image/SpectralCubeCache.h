@@ -0,0 +1,144 @@
+/***
+ * Spectral-major copy of an image cube in a cache directory, built in the background.
+ */
+
+#pragma once
+
+#include "CartaLib/IImage.h"
+
+#include <QFuture>
+#include <QMutex>
+#include <QRect>
+#include <QString>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class QFile;
+
+namespace Carta {
+
+namespace Data {
+
+class SpectralCubeCache {
+
+public:
+
+    /// returns a new view of all the channels of an area of one stokes plane, the cache
+    /// takes ownership of it
+    typedef std::function<Carta::Lib::NdArray::RawViewInterface* (const QRect& area, int stokes)> AreaReader;
+
+    /// receives the values of one pixel in every channel
+    typedef std::function<void (int x, int y, const float* values)> PixelVisitor;
+
+    /**
+     * Constructor.
+     * @param fileName - the image file, used to name the copy.
+     * @param width - the width of the image.
+     * @param height - the height of the image.
+     * @param channelCount - the number of channels.
+     * @param stokesCount - the number of stokes planes.
+     * @param directory - the directory the copies are kept in.
+     * @param maxBytes - the disk budget of the directory; the least recently built copies
+     *      of other images are removed to make room.
+     */
+    SpectralCubeCache( const QString& fileName, int width, int height, int channelCount, int stokesCount,
+            const QString& directory, qint64 maxBytes );
+
+    /**
+     * Stops the background job, if it is still running.
+     */
+    ~SpectralCubeCache();
+
+    /**
+     * Starts the copy in the background, stokes by stokes. Copies made by an earlier
+     * session are used as they are.
+     * @param reader - supplies the areas; it is called from the background thread.
+     */
+    void start( const AreaReader& reader );
+
+    /**
+     * Returns whether the copy of a stokes plane can be read.
+     * @param stokes - the stokes plane.
+     */
+    bool isReady( int stokes ) const;
+
+    /**
+     * Returns the fraction of the cube copied so far, between 0 and 1.
+     */
+    double getProgress() const;
+
+    /**
+     * Reads the values of a pixel in every channel.
+     * @param x - x coordinate of the pixel.
+     * @param y - y coordinate of the pixel.
+     * @param stokes - the stokes plane.
+     * @param profile - set to the value in each channel.
+     * @return - false if the copy is not ready or the pixel is outside of the image.
+     */
+    bool getProfile( int x, int y, int stokes, std::vector<float>& profile ) const;
+
+    /**
+     * Visits the pixels of an area block by block, which is the order they are stored in.
+     * @param area - the area, clipped to the image.
+     * @param stokes - the stokes plane.
+     * @param visitor - called with the values of every pixel in the area.
+     * @return - false if the copy is not ready.
+     */
+    bool forEachPixel( const QRect& area, int stokes, const PixelVisitor& visitor ) const;
+
+    /// the width and height of the blocks of pixels whose channels are stored together
+    static const int BLOCK_SIZE;
+
+private:
+
+    SpectralCubeCache( const SpectralCubeCache& other ) = delete;
+    SpectralCubeCache& operator=( const SpectralCubeCache& other ) = delete;
+
+    /// what the header of a copy records
+    struct Header {
+        char magic[8];
+        int32_t width;
+        int32_t height;
+        int32_t channelCount;
+        int32_t blockSize;
+        int64_t sourceSize;
+        int64_t sourceModified;
+    };
+
+    void _run( AreaReader reader );
+    bool _open( int stokes );
+    bool _build( int stokes, const AreaReader& reader );
+    bool _makeRoom( qint64 bytes ) const;
+    Header _getHeader() const;
+    QString _getPath( int stokes ) const;
+    qint64 _getCubeBytes() const;
+    const float* _getPixel( const uchar* data, int x, int y ) const;
+
+    QString m_fileName;
+    int m_width;
+    int m_height;
+    int m_channelCount;
+    int m_stokesCount;
+    int m_blocksX;
+    int m_blocksY;
+    QString m_directory;
+    qint64 m_maxBytes;
+
+    mutable QMutex m_mutex;
+    //Mapped copy of every stokes plane, nullptr until it is ready
+    std::vector<std::unique_ptr<QFile> > m_files;
+    std::vector<const uchar*> m_data;
+    std::atomic<qint64> m_copiedBlocks { 0 };
+
+    std::atomic<bool> m_cancelled { false };
+    QFuture<void> m_future;
+
+    //Bytes read from the image at a time
+    static const qint64 MAX_CHUNK_BYTES;
+    //Size of the header, the blocks start on a page boundary
+    static const qint64 HEADER_BYTES;
+};
+}
+}
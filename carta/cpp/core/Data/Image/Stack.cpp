@@ -316,6 +316,16 @@ int Stack::_getIndexCurrent( ) const {
     return dataIndex;
 }
 
+std::shared_ptr<Layer> Stack::_getFileLayer( int fileId ) const {
+    // the file id is the index of the layer, so requests for a file do not depend on
+    // which file is the current one and can run next to requests for other files
+    std::shared_ptr<Layer> layer;
+    if ( fileId >= 0 && fileId < m_children.size() ){
+        layer = m_children[fileId];
+    }
+    return layer;
+}
+
 //QRectF Stack::_getInputRectangle( ) const {
 //    QSize output = m_stackDraw->getClientSize();
 //    QRectF rect = _getInputRect( output );
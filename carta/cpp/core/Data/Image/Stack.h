@@ -65,6 +65,7 @@ protected:
     virtual bool _addGroup( ) Q_DECL_OVERRIDE;
     virtual bool _closeData( const QString& id ) Q_DECL_OVERRIDE;
     virtual int _getIndexCurrent( ) const Q_DECL_OVERRIDE;
+    virtual std::shared_ptr<Layer> _getFileLayer( int fileId ) const Q_DECL_OVERRIDE;
 
     virtual QStringList _getLayerIds( ) const Q_DECL_OVERRIDE;
 
@@ -5,7 +5,21 @@
 #include <QDebug>
 #include <cmath>
 #include "CartaLib/UtilCASA.h"
+#include <QHash>
 QMutex casa_mutex(QMutex::Recursive);
+CasaLockStats casa_lock_stats;
+
+QMutex & casa_storage_mutex( const QString & storageName ){
+    static QMutex registryMutex;
+    // the locks live for the whole process, there is one per file ever opened
+    static QHash<QString, QMutex*> registry;
+    QMutexLocker locker( &registryMutex );
+    QMutex* & storageMutex = registry[storageName];
+    if ( !storageMutex ){
+        storageMutex = new QMutex( QMutex::Recursive );
+    }
+    return *storageMutex;
+}
 
 namespace Carta {
 
@@ -0,0 +1,125 @@
+#include "FrameRenderCache.h"
+#include "Globals.h"
+#include "MainConfig.h"
+#include <QMutexLocker>
+
+namespace Carta {
+
+namespace Core {
+
+const qint64 FrameRenderCache::DEFAULT_MAX_BYTES = 1024LL * 1024 * 1024;
+
+FrameRenderCache::FrameRenderCache(){
+    m_maxBytes = DEFAULT_MAX_BYTES;
+    const MainConfig::ParsedInfo* config = Globals::instance()->mainConfig();
+    if ( config && config->getFrameCacheSizeMB() > 0 ){
+        m_maxBytes = qint64( config->getFrameCacheSizeMB() ) * 1024 * 1024;
+    }
+}
+
+FrameRenderCache & FrameRenderCache::instance(){
+    static FrameRenderCache cache;
+    return cache;
+}
+
+FrameRenderCache::Key FrameRenderCache::makeKey( const QString& id ){
+    //FNV-1a over the UTF-16 code units
+    quint64 hash = 14695981039346656037ULL;
+    const ushort* units = id.utf16();
+    for ( int i = 0; i < id.size(); i++ ){
+        hash = ( hash ^ ( units[i] & 0xff ) ) * 1099511628211ULL;
+        hash = ( hash ^ ( units[i] >> 8 ) ) * 1099511628211ULL;
+    }
+    Key key;
+    key.hash = hash;
+    key.check = qHash( id );
+    return key;
+}
+
+bool FrameRenderCache::get( const Key& key, QImage& frame ){
+    QMutexLocker locker( &m_mutex );
+    auto iter = m_entries.find( key.hash );
+    if ( iter == m_entries.end() || iter->check != key.check ){
+        m_misses++;
+        return false;
+    }
+    m_lru.splice( m_lru.begin(), m_lru, iter->lruPos );
+    frame = iter->frame;
+    m_hits++;
+    return true;
+}
+
+bool FrameRenderCache::put( const Key& key, const QImage& frame ){
+    qint64 size = frame.byteCount();
+    QMutexLocker locker( &m_mutex );
+    if ( size <= 0 || size > m_maxBytes ){
+        return false;
+    }
+    //Replaces an older rendering of the same frame, or a colliding one
+    auto iter = m_entries.find( key.hash );
+    if ( iter != m_entries.end() ){
+        m_usedBytes -= iter->frame.byteCount();
+        m_lru.erase( iter->lruPos );
+        m_entries.erase( iter );
+    }
+    m_lru.push_front( key.hash );
+    Entry entry;
+    entry.frame = frame;
+    entry.check = key.check;
+    entry.lruPos = m_lru.begin();
+    m_entries.insert( key.hash, entry );
+    m_usedBytes += size;
+    _evict();
+    return true;
+}
+
+void FrameRenderCache::setMaxBytes( qint64 maxBytes ){
+    QMutexLocker locker( &m_mutex );
+    m_maxBytes = maxBytes;
+    _evict();
+}
+
+qint64 FrameRenderCache::getMaxBytes() const {
+    QMutexLocker locker( &m_mutex );
+    return m_maxBytes;
+}
+
+qint64 FrameRenderCache::getUsedBytes() const {
+    QMutexLocker locker( &m_mutex );
+    return m_usedBytes;
+}
+
+int FrameRenderCache::getEntryCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_entries.size();
+}
+
+quint64 FrameRenderCache::getHitCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_hits;
+}
+
+quint64 FrameRenderCache::getMissCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_misses;
+}
+
+quint64 FrameRenderCache::getEvictionCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_evictions;
+}
+
+void FrameRenderCache::_evict(){
+    while ( m_usedBytes > m_maxBytes && !m_lru.empty() ){
+        auto iter = m_entries.find( m_lru.back() );
+        if ( iter != m_entries.end() ){
+            m_usedBytes -= iter->frame.byteCount();
+            m_entries.erase( iter );
+            m_evictions++;
+        }
+        m_lru.pop_back();
+    }
+}
+
+}
+}
@@ -0,0 +1,97 @@
+/***
+ * Process wide, size-bounded cache of rendered frames, shared by the render services
+ * of all sessions.
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <list>
+
+namespace Carta {
+
+namespace Core {
+
+class FrameRenderCache {
+
+public:
+
+    /// compact identity of a frame: a 64 bit hash of the full description, and an
+    /// independent 32 bit hash to tell the rare colliding descriptions apart
+    struct Key {
+        quint64 hash = 0;
+        uint check = 0;
+    };
+
+    /**
+     * Returns the cache shared by all sessions.
+     */
+    static FrameRenderCache & instance();
+
+    /**
+     * Builds the key of a frame from its description.
+     * @param id - describes everything the frame depends on (view, pixel pipeline, nan color,
+     *      ...) and nothing specific to a session, so identical frames share an entry.
+     * @return - the key for the frame.
+     */
+    static Key makeKey( const QString& id );
+
+    /**
+     * Looks up a frame and marks it as the most recently used one.
+     * @param key - the key of the frame.
+     * @param frame - set to the cached frame if there is one; the pixels are shared, not copied.
+     * @return - true if the frame was found; false otherwise.
+     */
+    bool get( const Key& key, QImage& frame );
+
+    /**
+     * Stores a frame, evicting the least recently used frames to stay within the budget.
+     * @param key - the key of the frame.
+     * @param frame - the frame to store; the pixels are shared, not copied.
+     * @return - false if the frame is empty or larger than the whole budget and was not stored.
+     */
+    bool put( const Key& key, const QImage& frame );
+
+    /**
+     * Sets the memory budget, evicting frames if necessary.
+     * @param maxBytes - the maximum number of bytes held by the cache.
+     */
+    void setMaxBytes( qint64 maxBytes );
+
+    qint64 getMaxBytes() const;
+    qint64 getUsedBytes() const;
+    int getEntryCount() const;
+    quint64 getHitCount() const;
+    quint64 getMissCount() const;
+    quint64 getEvictionCount() const;
+
+private:
+    FrameRenderCache();
+    FrameRenderCache( const FrameRenderCache& other) = delete;
+    FrameRenderCache& operator=( const FrameRenderCache& other ) = delete;
+
+    void _evict();
+
+    struct Entry {
+        QImage frame;
+        uint check = 0;
+        std::list<quint64>::iterator lruPos;
+    };
+
+    mutable QMutex m_mutex;
+    //Most recently used hashes at the front
+    std::list<quint64> m_lru;
+    QHash<quint64, Entry> m_entries;
+    qint64 m_usedBytes = 0;
+    qint64 m_maxBytes;
+    quint64 m_hits = 0;
+    quint64 m_misses = 0;
+    quint64 m_evictions = 0;
+
+    static const qint64 DEFAULT_MAX_BYTES;
+};
+}
+}
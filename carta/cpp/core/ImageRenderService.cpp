@@ -3,7 +3,9 @@
  **/
 
 #include "ImageRenderService.h"
+#include "FrameRenderCache.h"
 #include "CartaLib/LinearMap.h"
+#include "Algorithms/parallel.h"
 #include <QColor>
 #include <QPainter>
 #include <QElapsedTimer>
@@ -20,6 +22,25 @@ static constexpr QImage::Format OptimalQImageFormat = QImage::Format_ARGB32_Prem
 /// \todo check if the bug is still there in Qt5.4+, it definitely is there in Qt5.3
 static constexpr bool QtPremultipliedBugStillExists = true;
 
+/// makes sure qImage has the given size and the format we render into
+static void
+prepareFrameImage( QSize size, QImage & qImage )
+{
+    QImage::Format desiredFormat = OptimalQImageFormat;
+    if ( QtPremultipliedBugStillExists ) {
+        desiredFormat = QImage::Format_ARGB32;
+    }
+
+    // QImage::Format desiredFormat = QImage::Format_ARGB32;
+    if ( qImage.format() != desiredFormat ||
+         qImage.size() != size ) {
+        qImage = QImage( size, desiredFormat );
+    }
+    auto bytesPerLine = qImage.bytesPerLine();
+    CARTA_ASSERT( bytesPerLine == size.width() * 4 );
+    Q_UNUSED( bytesPerLine );
+}
+
 /// internal algorithm for converting an instance of image interface to qimage
 /// using the pixel pipeline
 ///
@@ -36,20 +57,7 @@ iView2qImage( NdArray::RawViewInterface * rawView, Pipeline & pipe, QImage & qIm
     typedef double Scalar;
 
     QSize size( rawView->dims()[0], rawView->dims()[1] );
-
-    QImage::Format desiredFormat = OptimalQImageFormat;
-    if ( QtPremultipliedBugStillExists ) {
-        desiredFormat = QImage::Format_ARGB32;
-    }
-
-    // QImage::Format desiredFormat = QImage::Format_ARGB32;
-    if ( qImage.format() != desiredFormat ||
-         qImage.size() != size ) {
-        qImage = QImage( size, desiredFormat );
-    }
-    auto bytesPerLine = qImage.bytesPerLine();
-    CARTA_ASSERT( bytesPerLine == size.width() * 4 );
-    Q_UNUSED( bytesPerLine );
+    prepareFrameImage( size, qImage );
 
     // start with a pointer to the beginning of last row (we are constructing image
     // bottom-up)
@@ -67,33 +75,92 @@ iView2qImage( NdArray::RawViewInterface * rawView, Pipeline & pipe, QImage & qIm
     // make a double view
     NdArray::TypedView < Scalar > typedView( rawView, false );
 
-    /// @todo for more efficiency, instead of forEach() we should switch to one of the
-    /// higher performance APIs and maybe even sprinkle it with some openmp/cilk magic :)
+    // scan the view in chunks of contiguous values, so that the inner loop is a
+    // plain loop over an array
+    /// @todo maybe sprinkle it with some openmp/cilk magic :)
     int64_t counter = 0;
+    const int width = size.width();
+    int64_t col = 0;
 
-
-    auto lambda = [&] ( const Scalar & ival )
+    auto chunkLambda = [&] ( const Scalar * values, int64_t count )
     {
-        if ( Q_LIKELY( ! std::isnan( ival ) ) ) {
-            pipe.convertq( ival, * outPtr );
-        }
-        else {
-            * outPtr = nanColor;
-        }
-        outPtr++;
-        counter++;
+        for ( int64_t i = 0 ; i < count ; i++ ) {
+            const Scalar ival = values[i];
+            if ( Q_LIKELY( ! std::isnan( ival ) ) ) {
+                pipe.convertq( ival, * outPtr );
+            }
+            else {
+                * outPtr = nanColor;
+            }
+            outPtr++;
 
-        // build the image bottom-up
-        if ( counter % size.width() == 0 ) {
-            outPtr -= size.width() * 2;
+            // build the image bottom-up
+            if ( ++col == width ) {
+                col = 0;
+                outPtr -= width * 2;
+            }
         }
+        counter += count;
     };
-    typedView.forEach( lambda );
+    if ( ! typedView.forEachChunk( chunkLambda ) ) {
+        qWarning() << "Cannot render pixel type" << Carta::Lib::toStr( rawView->pixelType() );
+        qImage.fill( nanColor );
+        return;
+    }
 
     CARTA_ASSERT( counter == size.width() * size.height());
 
 } // rawView2QImage
 
+/// the same as iView2qImage, with the pipeline sampled into a table; the view is read
+/// in large chunks and the rows of every chunk are converted in parallel
+static void
+iView2qImageLut( NdArray::RawViewInterface * rawView,
+                 const Carta::Lib::PixelPipeline::LutPipeline & lut, QImage & qImage )
+{
+    QSize size( rawView->dims()[0], rawView->dims()[1] );
+    prepareFrameImage( size, qImage );
+    const int64_t width = size.width();
+    const int64_t height = size.height();
+    if ( width == 0 || height == 0 ) {
+        return;
+    }
+
+    // bits() may detach, so get it once, before the threads write into it
+    QRgb * bits = reinterpret_cast < QRgb * > ( qImage.bits() );
+
+    NdArray::TypedView < float > typedView( rawView, false );
+    int64_t counter = 0;
+    auto chunkLambda = [&] ( const float * values, int64_t count )
+    {
+        if ( count == 0 ) {
+            return;
+        }
+
+        // a chunk does not have to start or end with a row
+        int64_t row0 = counter / width;
+        int64_t row1 = ( counter + count - 1 ) / width;
+        Carta::Core::Algorithms::parallelFor( row1 - row0 + 1, [&] ( int index, int ) {
+            int64_t row = row0 + index;
+            int64_t first = std::max( counter, row * width );
+            int64_t last = std::min( counter + count, ( row + 1 ) * width );
+
+            // build the image bottom-up
+            QRgb * out = bits + ( height - 1 - row ) * width + ( first - row * width );
+            lut.convert( values + ( first - counter ), last - first, out );
+        } );
+        counter += count;
+    };
+    int64_t chunkRows = std::max < int64_t > ( 1, ( 1024 * 1024 ) / width );
+    if ( ! typedView.forEachChunk( chunkLambda, chunkRows * width ) ) {
+        qWarning() << "Cannot render pixel type" << Carta::Lib::toStr( rawView->pixelType() );
+        qImage.fill( lut.nanColor() );
+        return;
+    }
+
+    CARTA_ASSERT( counter == width * height );
+} // iView2qImageLut
+
 namespace Carta
 {
 namespace Core
@@ -179,8 +246,7 @@ Service::setPixelPipeline( IClippedPixelPipeline::SharedPtr pixelPipeline,
     m_frameImage = QImage();
 
     // invalidate pixel pipeline cache
-    m_cachedPP = nullptr;
-    m_cachedPPinterp = nullptr;
+    m_lutPP = nullptr;
 }
 
 void
@@ -192,8 +258,7 @@ Service::setPixelPipelineCacheSettings( const PixelPipelineCacheSettings & param
     m_frameImage = QImage();
 
     // invalidate pixel pipeline cache
-    m_cachedPP = nullptr;
-    m_cachedPPinterp = nullptr;
+    m_lutPP = nullptr;
 }
 
 const Service::PixelPipelineCacheSettings &
@@ -230,8 +295,6 @@ Service::Service( QObject * parent ) : Carta::Lib::IImageRenderService( parent )
     m_renderTimer.setSingleShot( true );
     m_renderTimer.setInterval( 1 );
     connect( & m_renderTimer, & QTimer::timeout, this, & Me::internalRenderSlot );
-
-    m_frameCache.setMaxCost( 1 * 1024 * 1024 * 1024 ); // 1 gig
 }
 
 Service::~Service()
@@ -329,10 +392,12 @@ Service::internalRenderSlot()
         cacheId += "/0";
     }
 
-//    qDebug() << "internalRenderSlot... cache size: "
-//             << m_frameCache.totalCost() * 100.0 / m_frameCache.maxCost() << "% "
-//             << m_frameCache.size() << "entries";
-//    qDebug() << "id:" << cacheId;
+    // the frame cache is shared by all sessions, so without a view id there is
+    // nothing to tell this frame apart from the others
+    FrameRenderCache & frameCache = FrameRenderCache::instance();
+    const bool cacheable = ! m_inputViewCacheId.isEmpty();
+    const FrameRenderCache::Key frameKey = FrameRenderCache::makeKey( cacheId );
+
     struct Scope {
         ~Scope() { /*qDebug() << "internalRenderSlot done";*/ } }
     debugScopeGuard;
@@ -348,8 +413,8 @@ Service::internalRenderSlot()
         return;
     }
 
-    // seems it is copying, so no need to copy again for more safe usage
-    auto cachedRawImage = m_frameCache.object(cacheId);
+    // a hit shares the pixels of the cached frame
+    const bool cachedRawImage = cacheable && frameCache.get( frameKey, m_frameImage );
 
     // start the timer
     QElapsedTimer timer;
@@ -359,34 +424,33 @@ Service::internalRenderSlot()
     if (!cachedRawImage) {
         // cacheRaw miss
 
-        // disable pixelPipelineCache in case [clipMin, clipMax] = nan
-        if ( pixelPipelineCacheSettings().enabled && !std::isnan(clipMin) && !std::isnan(clipMax) ) {
-            if ( pixelPipelineCacheSettings().interpolated ) {
-                if ( ! m_cachedPPinterp ) {
-                    m_cachedPPinterp.reset( new Lib::PixelPipeline::CachedPipeline < true > () );
-                    m_cachedPPinterp-> cache( * m_pixelPipelineRaw,
-                            pixelPipelineCacheSettings().size, clipMin, clipMax );
-                }
-                ::iView2qImage( m_inputView.get(), * m_cachedPPinterp, m_frameImage, nanColor );
+        // the previous frame may be in the cache, render into new pixels rather than
+        // have the first write copy the cached ones
+        if ( ! m_frameImage.isDetached() ) {
+            m_frameImage = QImage();
+        }
+
+        // the pipeline goes into a table of colors, as long as there is a range to
+        // sample; with caching disabled or interpolated the table is large enough for
+        // the difference not to show in 8 bit colors
+        if ( clipMin < clipMax ) {
+            const PixelPipelineCacheSettings & settings = pixelPipelineCacheSettings();
+            int64_t lutSize = settings.size;
+            if ( ! settings.enabled || settings.interpolated ) {
+                lutSize = std::max < int64_t > ( lutSize, Lib::PixelPipeline::LutPipeline::DefaultSize );
             }
-            else {
-                if ( ! m_cachedPP ) {
-                    m_cachedPP.reset( new Lib::PixelPipeline::CachedPipeline < false > () );
-                    m_cachedPP-> cache( * m_pixelPipelineRaw,
-                            pixelPipelineCacheSettings().size, clipMin, clipMax );
-                }
-                ::iView2qImage( m_inputView.get(), * m_cachedPP, m_frameImage, nanColor );
+            if ( ! m_lutPP || m_lutNanColor != nanColor ) {
+                m_lutPP.reset( new Lib::PixelPipeline::LutPipeline() );
+                m_lutPP-> cache( * m_pixelPipelineRaw, std::max < int64_t > ( lutSize, 2 ),
+                        clipMin, clipMax, nanColor );
+                m_lutNanColor = nanColor;
             }
+            ::iView2qImageLut( m_inputView.get(), * m_lutPP, m_frameImage );
         }
         else {
             ::iView2qImage( m_inputView.get(), * m_pixelPipelineRaw, m_frameImage, nanColor );
         }
     }
-    else
-    {
-        // cacheRaw hit
-        m_frameImage = *cachedRawImage;
-    }
 
     // end the timer
     qDebug() << "Time for applying the colormap on the current view of image:" << timer.elapsed() << "ms";
@@ -451,12 +515,11 @@ Service::internalRenderSlot()
         }
     }
 
-    if (!cachedRawImage) {
+    if (!cachedRawImage && cacheable) {
         // insert this image into frame cache, they may be alterd by emit done, so change to insert first.
-        if (m_frameImage.byteCount() >0 && img.byteCount()>0) {
-            m_frameCache.insert( cacheId, new QImage( m_frameImage ), img.byteCount() );
-        } else {
-            qDebug() << "m_frameCache is empty, will not be inserted";
+        // the cost is the frame itself, the output image is not kept
+        if ( ! frameCache.put( frameKey, m_frameImage ) ) {
+            qDebug() << "frame is empty or over the cache budget, will not be inserted";
         }
     }
 
@@ -31,13 +31,13 @@
 
 #include "CartaLib/IImage.h"
 #include "CartaLib/PixelPipeline/IPixelPipeline.h"
+#include "CartaLib/PixelPipeline/LutPipeline.h"
 #include "CartaLib/Nullable.h"
 #include "CartaLib/IImageRenderService.h"
 #include <QImage>
 #include <QObject>
 #include <QColor>
 #include <QStringList>
-#include <QCache>
 #include <QTimer>
 
 namespace Carta
@@ -241,17 +241,17 @@ private:
     /// current pan (coordinates of the image pixel that is to be centered on the screen)
     QPointF m_pan = QPointF( 0, 0 );
 
-    // cached pipelines
-    Lib::PixelPipeline::CachedPipeline < true >::UniquePtr m_cachedPPinterp = nullptr;
-    Lib::PixelPipeline::CachedPipeline < false >::UniquePtr m_cachedPP = nullptr;
+    /// the pipeline sampled into a table of colors, and the nan color it was sampled with
+    Lib::PixelPipeline::LutPipeline::UniquePtr m_lutPP = nullptr;
+    QRgb m_lutNanColor = 0;
     PixelPipelineCacheSettings m_pixelPipelineCacheSettings;
 
     /// here we store the whole frame rendered, it is essentially a cache to make
     /// pan/zoom to work faster
     QImage m_frameImage;
 
-    /// cache for individual frames (to make movie playing little bit faster)
-    QCache < QString, QImage > m_frameCache;
+    /// frames are cached in the process wide FrameRenderCache (to make movie playing
+    /// little bit faster), so identical frames are shared between sessions
 
     /// last requested job id
     JobId m_lastSubmittedJobId = - 1;
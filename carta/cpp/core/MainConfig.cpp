@@ -108,6 +108,30 @@ ParsedInfo parse(const QString & filePath)
     _storeBool( json["developerLayout"], &info.m_developerLayout, "developer layout");
     _storePositiveInt( json["histogramBinCountMax"], &info.m_histogramBinCountMax, "histogram bin count max");
     _storePositiveInt( json["contourLevelCountMax"], &info.m_contourLevelCountMax, "contour level count max");
+    _storePositiveInt( json["mipmapCacheSizeMB"], &info.m_mipmapCacheSizeMB, "mipmap cache size");
+    _storeBool( json["mipmapPersistent"], &info.m_mipmapPersistent, "mipmap persistent");
+    _storePositiveInt( json["frameCacheSizeMB"], &info.m_frameCacheSizeMB, "frame cache size");
+    _storeBool( json["rasterTiles"], &info.m_rasterTiled, "raster tiles");
+
+    // spectral-major copies of image cubes, only made if a directory is given
+    QString spectralCacheDir = json[ "spectralCacheDir"].toString();
+    if ( !spectralCacheDir.isEmpty() ){
+        spectralCacheDir.replace( "$(HOME)", QDir::homePath());
+        spectralCacheDir.replace( "$(APPDIR)", QCoreApplication::applicationDirPath());
+        info.m_spectralCacheDirectory = QDir::cleanPath( spectralCacheDir );
+    }
+    _storePositiveInt( json["spectralCacheSizeMB"], &info.m_spectralCacheSizeMB, "spectral cache size");
+    _storePositiveInt( json["planeCacheSizeMB"], &info.m_planeCacheSizeMB, "plane cache size");
+
+    // 0 turns reading ahead off, so this one is not just a positive integer
+    QString prefetchError;
+    int prefetchCount = ParsedInfo::toInt( json["planePrefetchCount"], prefetchError );
+    if ( !prefetchError.isEmpty() || prefetchCount < -1 ){
+        qWarning() << "Error setting plane prefetch count:" << prefetchError << prefetchCount;
+    }
+    else {
+        info.m_planePrefetchCount = prefetchCount;
+    }
 
     return info;
 }
@@ -135,6 +159,38 @@ int ParsedInfo::getHistogramBinCountMax() const {
     return m_histogramBinCountMax;
 }
 
+int ParsedInfo::getMipmapCacheSizeMB() const {
+    return m_mipmapCacheSizeMB;
+}
+
+bool ParsedInfo::isMipmapPersistent() const {
+    return m_mipmapPersistent;
+}
+
+int ParsedInfo::getFrameCacheSizeMB() const {
+    return m_frameCacheSizeMB;
+}
+
+bool ParsedInfo::isRasterTiled() const {
+    return m_rasterTiled;
+}
+
+const QString & ParsedInfo::getSpectralCacheDirectory() const {
+    return m_spectralCacheDirectory;
+}
+
+int ParsedInfo::getSpectralCacheSizeMB() const {
+    return m_spectralCacheSizeMB;
+}
+
+int ParsedInfo::getPlaneCacheSizeMB() const {
+    return m_planeCacheSizeMB;
+}
+
+int ParsedInfo::getPlanePrefetchCount() const {
+    return m_planePrefetchCount;
+}
+
 const QJsonObject &ParsedInfo::json() const
 {
     return m_json;
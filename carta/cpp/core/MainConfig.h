@@ -6,8 +6,8 @@
 #pragma once
 
 #include <QJsonObject>
+#include <QString>
 #include <QStringList>
-class QString;
 
 namespace MainConfig {
 
@@ -40,6 +40,63 @@ public:
      */
     int getContourLevelCountMax() const;
 
+    /**
+     * Returns any valid user set memory budget for the cache of downsampled
+     * image planes in megabytes or -1 if no valid value has been provided.
+     * @return the size of the mipmap cache in MB or -1 if no valid value has
+     *   been specified.
+     */
+    int getMipmapCacheSizeMB() const;
+
+    /**
+     * Returns whether downsampled image planes should also be stored in the
+     * persistent cache.
+     */
+    bool isMipmapPersistent() const;
+
+    /**
+     * Returns any valid user set memory budget for the rendered frames shared
+     * by all sessions in megabytes or -1 if no valid value has been provided.
+     * @return the size of the frame render cache in MB or -1 if no valid value
+     *   has been specified.
+     */
+    int getFrameCacheSizeMB() const;
+
+    /**
+     * Returns whether raster image data should be streamed to the client as
+     * independently compressed tiles rather than as one image per view.
+     */
+    bool isRasterTiled() const;
+
+    /**
+     * Returns the directory spectral-major copies of image cubes are kept in, or an
+     * empty string if cubes should not be copied.
+     */
+    const QString & getSpectralCacheDirectory() const;
+
+    /**
+     * Returns any valid user set disk budget for the spectral-major copies of image
+     * cubes in megabytes or -1 if no valid value has been provided.
+     * @return the size of the spectral cache in MB or -1 if no valid value has
+     *   been specified.
+     */
+    int getSpectralCacheSizeMB() const;
+
+    /**
+     * Returns any valid user set memory budget for the full resolution planes kept
+     * for each open image in megabytes or -1 if no valid value has been provided.
+     * @return the size of the plane cache in MB or -1 if no valid value has
+     *   been specified.
+     */
+    int getPlaneCacheSizeMB() const;
+
+    /**
+     * Returns the number of channels to read ahead when the user steps through
+     * the channels of an image, 0 to not read ahead, or -1 if no valid value has
+     * been provided.
+     */
+    int getPlanePrefetchCount() const;
+
     /// whether hacks are enabled or not
     bool hacksEnabled() const;
 
@@ -94,6 +151,14 @@ protected:
     bool m_developerLayout = false;
     int m_histogramBinCountMax = -1;
     int m_contourLevelCountMax = -1;
+    int m_mipmapCacheSizeMB = -1;
+    bool m_mipmapPersistent = false;
+    int m_frameCacheSizeMB = -1;
+    bool m_rasterTiled = false;
+    QString m_spectralCacheDirectory;
+    int m_spectralCacheSizeMB = -1;
+    int m_planeCacheSizeMB = -1;
+    int m_planePrefetchCount = -1;
 
     QJsonObject m_json;
 
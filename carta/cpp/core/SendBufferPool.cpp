@@ -0,0 +1,130 @@
+#include "SendBufferPool.h"
+
+#include <google/protobuf/message_lite.h>
+#include <QMutexLocker>
+#include <algorithm>
+#include <cstring>
+
+namespace Carta {
+
+namespace Core {
+
+const size_t SendBufferPool::EVENT_NAME_LENGTH = 32;
+const size_t SendBufferPool::EVENT_ID_LENGTH = 4;
+const int SendBufferPool::MAX_POOLED_FRAMES = 64;
+const qint64 SendBufferPool::MAX_POOLED_BYTES = 256LL * 1024 * 1024;
+const qint64 SendBufferPool::MAX_FRAME_BYTES = 64LL * 1024 * 1024;
+
+QByteArray SendBufferPool::Frame::bytes() const {
+    return QByteArray::fromRawData( m_data.data(), m_size );
+}
+
+size_t SendBufferPool::Frame::size() const {
+    return m_size;
+}
+
+SendBufferPool::SendBufferPool(){
+}
+
+SendBufferPool & SendBufferPool::instance(){
+    // never destroyed, frames may still be released while the application exits
+    static SendBufferPool* pool = new SendBufferPool();
+    return *pool;
+}
+
+SendBufferPool::FramePtr SendBufferPool::serialize( const QString& respName, uint32_t eventId,
+        const std::shared_ptr<google::protobuf::MessageLite>& msg ){
+    if ( !msg ){
+        return nullptr;
+    }
+    const size_t headerSize = EVENT_NAME_LENGTH + EVENT_ID_LENGTH;
+    const size_t messageLength = msg->ByteSize();
+    Frame* frame = _acquire( headerSize + messageLength );
+    char* data = frame->m_data.data();
+
+    QByteArray name = respName.toLatin1();
+    memset( data, 0, EVENT_NAME_LENGTH );
+    memcpy( data, name.constData(), std::min<size_t>( name.size(), EVENT_NAME_LENGTH ) );
+    memcpy( data + EVENT_NAME_LENGTH, &eventId, EVENT_ID_LENGTH );
+    // ByteSize() cached the sizes, no need to compute them again
+    msg->SerializeWithCachedSizesToArray( reinterpret_cast<google::protobuf::uint8*>( data + headerSize ) );
+
+    return FramePtr( frame, [this]( const Frame* released ){
+        _release( const_cast<Frame*>( released ) );
+    });
+}
+
+quint64 SendBufferPool::getAllocationCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_allocations;
+}
+
+quint64 SendBufferPool::getReuseCount() const {
+    QMutexLocker locker( &m_mutex );
+    return m_reuses;
+}
+
+qint64 SendBufferPool::getPooledBytes() const {
+    QMutexLocker locker( &m_mutex );
+    return m_pooledBytes;
+}
+
+SendBufferPool::Frame* SendBufferPool::_acquire( size_t size ){
+    Frame* frame = nullptr;
+    {
+        QMutexLocker locker( &m_mutex );
+        // the smallest buffer that is large enough, otherwise the largest one
+        int best = -1;
+        for ( int i = 0; i < int(m_free.size()); i++ ){
+            size_t capacity = m_free[i]->m_data.size();
+            if ( best < 0 ){
+                best = i;
+                continue;
+            }
+            size_t bestCapacity = m_free[best]->m_data.size();
+            bool fits = capacity >= size;
+            bool bestFits = bestCapacity >= size;
+            if ( ( fits && ( !bestFits || capacity < bestCapacity ) ) ||
+                    ( !fits && !bestFits && capacity > bestCapacity ) ){
+                best = i;
+            }
+        }
+        if ( best >= 0 ){
+            frame = m_free[best];
+            m_free[best] = m_free.back();
+            m_free.pop_back();
+            m_pooledBytes -= frame->m_data.size();
+            m_reuses++;
+        }
+        else {
+            m_allocations++;
+        }
+    }
+    if ( !frame ){
+        frame = new Frame();
+    }
+    // buffers only grow, so a reused buffer is not cleared again; the old contents
+    // of one that is too small are not worth copying
+    if ( frame->m_data.size() < size ){
+        std::vector<char>( size ).swap( frame->m_data );
+    }
+    frame->m_size = size;
+    return frame;
+}
+
+void SendBufferPool::_release( Frame* frame ){
+    qint64 capacity = frame->m_data.size();
+    {
+        QMutexLocker locker( &m_mutex );
+        if ( capacity <= MAX_FRAME_BYTES && int(m_free.size()) < MAX_POOLED_FRAMES &&
+                m_pooledBytes + capacity <= MAX_POOLED_BYTES ){
+            m_free.push_back( frame );
+            m_pooledBytes += capacity;
+            return;
+        }
+    }
+    delete frame;
+}
+
+}
+}
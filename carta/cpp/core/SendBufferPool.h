@@ -0,0 +1,88 @@
+/***
+ * Process wide pool of the buffers the messages for the clients are serialized into.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <memory>
+#include <vector>
+
+namespace google {
+namespace protobuf {
+class MessageLite;
+}
+}
+
+namespace Carta {
+
+namespace Core {
+
+class SendBufferPool {
+
+public:
+
+    /// one message as it goes over the wire: the event name, the event id and the payload
+    class Frame {
+    public:
+        /**
+         * Returns the frame without copying it; the bytes are only valid while the frame is.
+         */
+        QByteArray bytes() const;
+
+        size_t size() const;
+
+    private:
+        friend class SendBufferPool;
+        std::vector<char> m_data;
+        size_t m_size = 0;
+    };
+
+    typedef std::shared_ptr<const Frame> FramePtr;
+
+    /**
+     * Returns the pool shared by all sessions.
+     */
+    static SendBufferPool & instance();
+
+    /**
+     * Serializes a message into a buffer from the pool; the buffer goes back to the pool
+     * when the last reference to the frame is released, on whichever thread that is.
+     * @param respName - the event name.
+     * @param eventId - the id of the request.
+     * @param msg - the message.
+     * @return - the frame or nullptr if there is no message.
+     */
+    FramePtr serialize( const QString& respName, uint32_t eventId,
+            const std::shared_ptr<google::protobuf::MessageLite>& msg );
+
+    quint64 getAllocationCount() const;
+    quint64 getReuseCount() const;
+    qint64 getPooledBytes() const;
+
+    static const size_t EVENT_NAME_LENGTH;
+    static const size_t EVENT_ID_LENGTH;
+
+private:
+    SendBufferPool();
+    SendBufferPool( const SendBufferPool& other) = delete;
+    SendBufferPool& operator=( const SendBufferPool& other ) = delete;
+
+    Frame* _acquire( size_t size );
+    void _release( Frame* frame );
+
+    mutable QMutex m_mutex;
+    std::vector<Frame*> m_free;
+    qint64 m_pooledBytes = 0;
+    quint64 m_allocations = 0;
+    quint64 m_reuses = 0;
+
+    //Bounds on what the pool keeps, larger buffers are freed
+    static const int MAX_POOLED_FRAMES;
+    static const qint64 MAX_POOLED_BYTES;
+    static const qint64 MAX_FRAME_BYTES;
+};
+}
+}
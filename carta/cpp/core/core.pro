@@ -64,6 +64,13 @@ HEADERS += \
     Data/Image/Contour/GeneratorState.h \
     Data/Image/CoordinateSystems.h \
     Data/Image/DataSource.h \
+    Data/Image/MipmapCache.h \
+    Data/Image/ChannelPlaneCache.h \
+    Data/Image/ChannelStatsIndex.h \
+    Data/Image/SpectralCubeCache.h \
+    Data/Image/RegionShape.h \
+    Data/Image/RegionMaskCache.h \
+    Data/Image/RegionStatsCache.h \
     Data/Image/Draw/DrawGroupSynchronizer.h \
     Data/Image/Draw/DrawImageViewsSynchronizer.h \
     Data/Image/Draw/DrawSynchronizer.h \
@@ -129,6 +136,8 @@ HEADERS += \
     Data/FitsHeaderExtractor.h \
     GrayColormap.h \
     ImageRenderService.h \
+    FrameRenderCache.h \
+    SendBufferPool.h \
 #    Plot2D/Plot.h \
 #    Plot2D/Plot2DGenerator.h \
 #    Plot2D/Plot2DRangeMarker.h \
@@ -151,6 +160,14 @@ HEADERS += \
     ScriptedClient/ScriptFacade.h \
     Algorithms/percentileAlgorithms.h \
     Algorithms/percentileManku99.h \
+    Algorithms/downsampling.h \
+    Algorithms/parallel.h \
+    Algorithms/regionStatistics.h \
+    Algorithms/minMaxHistogram.h \
+    Algorithms/percentileSelect.h \
+    Algorithms/contourEncoding.h \
+    Algorithms/contourTiles.h \
+    Algorithms/smoothing.h \
     ScriptedClient/Listener.h \
     ScriptedClient/ScriptedCommandInterpreter.h \
     ScriptedClient/VarLengthMessage.h \
@@ -212,6 +229,13 @@ SOURCES += \
     Data/Image/Contour/GeneratorState.cpp \
     Data/Image/CoordinateSystems.cpp \
     Data/Image/DataSource.cpp \
+    Data/Image/MipmapCache.cpp \
+    Data/Image/ChannelPlaneCache.cpp \
+    Data/Image/ChannelStatsIndex.cpp \
+    Data/Image/SpectralCubeCache.cpp \
+    Data/Image/RegionShape.cpp \
+    Data/Image/RegionMaskCache.cpp \
+    Data/Image/RegionStatsCache.cpp \
     Data/Image/Grid/AxisMapper.cpp \
     Data/Image/Grid/DataGrid.cpp \
     Data/Image/Grid/Fonts.cpp \
@@ -306,7 +330,16 @@ SOURCES += \
     Shape/ShapePolygon.cpp \
     Shape/ShapeRectangle.cpp \
     ImageRenderService.cpp \
+    FrameRenderCache.cpp \
+    SendBufferPool.cpp \
     Algorithms/percentileAlgorithms.cpp \
+    Algorithms/downsampling.cpp \
+    Algorithms/parallel.cpp \
+    Algorithms/regionStatistics.cpp \
+    Algorithms/minMaxHistogram.cpp \
+    Algorithms/contourEncoding.cpp \
+    Algorithms/contourTiles.cpp \
+    Algorithms/smoothing.cpp \
     ScriptedClient/Listener.cpp \
     ScriptedClient/ScriptedCommandInterpreter.cpp \
     ScriptedClient/VarLengthMessage.cpp \
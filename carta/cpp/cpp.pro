@@ -11,7 +11,11 @@ SUBDIRS = \
     Tests \
 #    testCache \
 #    testRegion \
-#    testPercentile
+#    testPercentile \
+#    testDownsample \
+#    testContour \
+#    testRender \
+#    testSession
 
 # explicit dependencies, to make sure parallel make works (i.e. make -j4...)
 core.depends = CartaLib
@@ -21,6 +25,10 @@ plugins.depends = core
 testRegion.depends = core
 testCache.depends = core
 testPercentile.depends = core
+testDownsample.depends = core
+testContour.depends = core
+testRender.depends = core
+testSession.depends = core
 Tests.depends = core desktop plugins
 
 # ... or ...
@@ -0,0 +1,135 @@
+/**
+ *
+ **/
+
+#include "JobScheduler.h"
+
+#include <QDebug>
+#include <QReadLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QWriteLocker>
+#include <algorithm>
+
+namespace {
+
+/// one submitted job, the shared state keeps the lock alive even if the scheduler is
+/// gone by the time the job comes off the queue
+template <typename Shared>
+class JobRunnable : public QRunnable
+{
+public:
+    JobRunnable(std::shared_ptr<Shared> shared, const JobScheduler::Ticket& ticket, const JobScheduler::Job& job) :
+        m_shared(shared),
+        m_ticket(ticket),
+        m_job(job) {
+        setAutoDelete(true);
+    }
+
+    void run() override {
+        if (m_ticket.isCancelled()) {
+            m_shared->cancelledCount++;
+            return;
+        }
+        QReadLocker locker(&m_shared->stateLock);
+        // checked again under the lock, the scheduler sets the flag before it waits for the lock
+        if (m_shared->stopped->load() || m_ticket.isCancelled()) {
+            m_shared->cancelledCount++;
+            return;
+        }
+        m_job(m_ticket);
+        if (m_ticket.isCancelled()) {
+            m_shared->cancelledCount++;
+        }
+    }
+
+private:
+    std::shared_ptr<Shared> m_shared;
+    JobScheduler::Ticket m_ticket;
+    JobScheduler::Job m_job;
+};
+
+}
+
+bool JobScheduler::Ticket::isCancelled() const {
+    return m_cancelled->load() || m_stopped->load();
+}
+
+void JobScheduler::Ticket::yieldState() const {
+    // the lock prefers writers, so a waiting writer gets it before the job reads again
+    m_stateLock->unlock();
+    m_stateLock->lockForRead();
+}
+
+JobScheduler::JobScheduler() :
+    m_shared(new Shared()) {
+    m_shared->stopped.reset(new std::atomic<bool>(false));
+}
+
+JobScheduler::~JobScheduler() {
+    m_shared->stopped->store(true);
+    // wait for the running jobs, the queued ones see the flag and return
+    QWriteLocker locker(&m_shared->stateLock);
+}
+
+void JobScheduler::submit(Kind kind, int fileId, const Job& job, int regionId) {
+    Ticket ticket;
+    ticket.m_cancelled.reset(new std::atomic<bool>(false));
+    ticket.m_stopped = m_shared->stopped;
+    ticket.m_stateLock = std::shared_ptr<QReadWriteLock>(m_shared, &m_shared->stateLock);
+    {
+        QMutexLocker locker(&m_mutex);
+        std::shared_ptr<std::atomic<bool> >& newest = m_newest[std::make_tuple(int(kind), fileId, regionId)];
+        if (newest) {
+            newest->store(true);
+        }
+        newest = ticket.m_cancelled;
+    }
+
+    // QThreadPool runs higher numbers first
+    int priority = int(Kind::REGION) - int(kind);
+    _pool()->start(new JobRunnable<Shared>(m_shared, ticket, job), priority);
+}
+
+void JobScheduler::cancel(int fileId) {
+    QMutexLocker locker(&m_mutex);
+    for (auto iter = m_newest.begin(); iter != m_newest.end(); ) {
+        if (std::get<1>(iter->first) == fileId) {
+            iter->second->store(true);
+            iter = m_newest.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+}
+
+void JobScheduler::cancel(Kind kind, int fileId, int regionId) {
+    QMutexLocker locker(&m_mutex);
+    auto iter = m_newest.find(std::make_tuple(int(kind), fileId, regionId));
+    if (iter != m_newest.end()) {
+        iter->second->store(true);
+        m_newest.erase(iter);
+    }
+}
+
+QReadWriteLock& JobScheduler::stateLock() {
+    return m_shared->stateLock;
+}
+
+quint64 JobScheduler::getCancelledCount() const {
+    return m_shared->cancelledCount.load();
+}
+
+QThreadPool* JobScheduler::_pool() {
+    // shared by the sessions, so that the number of busy threads does not grow with the
+    // number of sessions; the jobs fan out on the global pool themselves
+    static QThreadPool* pool = nullptr;
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    if (!pool) {
+        pool = new QThreadPool();
+        pool->setMaxThreadCount(std::max(2, QThread::idealThreadCount()));
+    }
+    return pool;
+}
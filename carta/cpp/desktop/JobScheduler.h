@@ -0,0 +1,117 @@
+/**
+ * Runs the expensive requests of a session on a worker pool shared by all the sessions.
+ **/
+
+#ifndef JOB_SCHEDULER_H
+#define JOB_SCHEDULER_H
+
+#include <QMutex>
+#include <QReadWriteLock>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <tuple>
+
+class QThreadPool;
+
+class JobScheduler
+{
+public:
+
+    /// kinds of jobs, in the order of their priority; a newer job of one kind for a file
+    /// and region supersedes the older jobs of the same kind for that file and region
+    enum class Kind {
+        CURSOR,     ///< spatial profiles under the cursor
+        RASTER,     ///< raster image data and the channel histogram that goes with it
+        CONTOUR,    ///< contour lines of the current channel, streamed tile by tile
+        STATS,      ///< statistics of the regions in the current channel
+        PROFILE,    ///< spectral profile under the cursor
+        REGION      ///< spectral profiles of the regions, which run a chunk of channels at a time
+    };
+
+    /// handed to a job, which should check it between pieces of work and stop once it
+    /// has been superseded; results of a superseded job should not be sent
+    class Ticket
+    {
+    public:
+        bool isCancelled() const;
+
+        /**
+         * Lets the requests waiting to change the state go first; for jobs that run for a
+         * long time. Anything read from the state before may have changed afterwards, so
+         * the job should check whether it was cancelled.
+         */
+        void yieldState() const;
+
+    private:
+        friend class JobScheduler;
+        std::shared_ptr<std::atomic<bool> > m_cancelled;
+        std::shared_ptr<std::atomic<bool> > m_stopped;
+        std::shared_ptr<QReadWriteLock> m_stateLock;
+    };
+
+    typedef std::function<void(const Ticket& ticket)> Job;
+
+    JobScheduler();
+
+    /**
+     * Cancels the jobs that are still queued and waits for the running ones.
+     */
+    ~JobScheduler();
+
+    /**
+     * Queues a job, cancelling the jobs of the same kind for the same file and region that
+     * are queued or running.
+     * @param kind - the kind of the job, which also sets its priority.
+     * @param fileId - the file the job is for.
+     * @param job - the job; it runs on a worker thread, with the state lock held for reading.
+     * @param regionId - the region the job is for, if any.
+     */
+    void submit(Kind kind, int fileId, const Job& job, int regionId = 0);
+
+    /**
+     * Cancels all the jobs for a file.
+     * @param fileId - the file id.
+     */
+    void cancel(int fileId);
+
+    /**
+     * Cancels the jobs of one kind for a region.
+     * @param kind - the kind of the jobs.
+     * @param fileId - the file id.
+     * @param regionId - the region id.
+     */
+    void cancel(Kind kind, int fileId, int regionId);
+
+    /**
+     * Jobs hold this lock for reading while they run; requests that change the images or
+     * the settings the jobs read take it for writing, which waits for the running jobs.
+     */
+    QReadWriteLock& stateLock();
+
+    /**
+     * Returns the number of jobs that were superseded before they finished.
+     */
+    quint64 getCancelledCount() const;
+
+private:
+
+    JobScheduler(const JobScheduler& other) = delete;
+    JobScheduler& operator=(const JobScheduler& other) = delete;
+
+    static QThreadPool* _pool();
+
+    struct Shared {
+        QReadWriteLock stateLock;
+        std::shared_ptr<std::atomic<bool> > stopped;
+        std::atomic<quint64> cancelledCount { 0 };
+    };
+    std::shared_ptr<Shared> m_shared;
+
+    QMutex m_mutex;
+    // cancel flags of the newest job of every kind, file and region
+    std::map<std::tuple<int, int, int>, std::shared_ptr<std::atomic<bool> > > m_newest;
+};
+
+#endif // JOB_SCHEDULER_H
@@ -3,6 +3,9 @@
  **/
 
 #include "NewServerConnector.h"
+#include "core/Globals.h"
+#include "core/MainConfig.h"
+#include "CartaLib/Proto/set_image_channels.pb.h"
 
 #include <iostream>
 #include <QXmlInputSource>
@@ -14,6 +17,15 @@
 #include <QStringList>
 #include <QBuffer>
 #include <QThread>
+#include <QMutexLocker>
+#include <QWriteLocker>
+#include <QElapsedTimer>
+#include <algorithm>
+
+namespace {
+/// partial spectral profiles of a region are sent at most this often
+const qint64 REGION_PROGRESS_INTERVAL_MS = 250;
+}
 
 /// \brief internal class of NewServerConnector, containing extra information we like
 ///  to remember with each view
@@ -62,6 +74,17 @@ NewServerConnector::~NewServerConnector()
 {
 }
 
+quint64 NewServerConnector::getCancelledJobCount() const
+{
+    return m_scheduler.getCancelledCount();
+}
+
+quint64 NewServerConnector::getCoalescedCursorCount() const
+{
+    QMutexLocker locker(&m_cursorMutex);
+    return m_coalescedCursors;
+}
+
 void NewServerConnector::initialize(const InitializeCallback & cb)
 {
     m_initializeCallback = cb;
@@ -272,7 +295,11 @@ void NewServerConnector::onTextMessage(QString message){
     emit jsTextMessageResultSignal(result);
 }
 
-void NewServerConnector::onBinaryMessageSignalSlot(const char *message, size_t length){
+void NewServerConnector::onBinaryMessageSignalSlot(QByteArray qByteMessage){
+    // runs on the session thread, so the sessions parse their messages in parallel
+    const char* message = qByteMessage.constData();
+    size_t length = qByteMessage.size();
+
     if (length < EVENT_NAME_LENGTH + EVENT_ID_LENGTH){
         qWarning("Illegal message.");
         return;
@@ -299,12 +326,144 @@ void NewServerConnector::onBinaryMessageSignalSlot(const char *message, size_t l
         qWarning("Illegal request in NewServerConnector. Please handle it in SessionDispatcher.");
         return;
 
+    } else if (eventName == "FILE_LIST_REQUEST") {
+
+        CARTA::FileListRequest fileListRequest;
+        fileListRequest.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        emit fileListRequestSignal(eventId, fileListRequest);
+
+    } else if (eventName == "FILE_INFO_REQUEST") {
+
+        CARTA::FileInfoRequest fileInfoRequest;
+        fileInfoRequest.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        emit fileInfoRequestSignal(eventId, fileInfoRequest);
+
+    } else if (eventName == "OPEN_FILE") {
+
+        CARTA::OpenFile openFile;
+        openFile.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        QString fileDir = QString::fromStdString(openFile.directory());
+        QString fileName = QString::fromStdString(openFile.file());
+        int fileId = openFile.file_id();
+        // If the histograms correspond to the entire current 2D image, the region ID has a value of -1.
+        int regionId = -1;
+        qDebug() << "[NewServerConnector] Open the image file" << fileDir + "/" + fileName << "(fileId=" << fileId << ")";
+        emit openFileSignal(eventId, fileDir, fileName, fileId, regionId);
+
+    } else if (eventName == "SET_IMAGE_VIEW") {
+
+        CARTA::SetImageView viewSetting;
+        viewSetting.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        int fileId = viewSetting.file_id();
+        int mip = viewSetting.mip();
+        int xMin = viewSetting.image_bounds().x_min();
+        int xMax = viewSetting.image_bounds().x_max();
+        int yMin = viewSetting.image_bounds().y_min();
+        int yMax = viewSetting.image_bounds().y_max();
+        qDebug() << "[NewServerConnector] Set image bounds [x_min, x_max, y_min, y_max, mip]=["
+                 << xMin << "," << xMax << "," << yMin << "," << yMax << "," << mip << "], fileId=" << fileId;
+
+        int numSubsets = viewSetting.num_subsets();
+        int precision = lround(viewSetting.compression_quality());
+        bool isZFP = (viewSetting.compression_type() == CARTA::CompressionType::ZFP) ? true : false;
+
+        emit setImageViewSignal(eventId, fileId, xMin, xMax, yMin, yMax, mip, isZFP, precision, numSubsets);
+
+    } else if (eventName == "SET_IMAGE_CHANNELS") {
+
+        CARTA::SetImageChannels setImageChannels;
+        setImageChannels.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        int fileId = setImageChannels.file_id();
+        int channel = setImageChannels.channel();
+        int stoke = setImageChannels.stokes();
+        qDebug() << "[NewServerConnector] Set image channel=" << channel << ", fileId=" << fileId << ", stoke=" << stoke;
+        emit imageChannelUpdateSignal(eventId, fileId, channel, stoke);
+
+    } else if (eventName == "SET_CURSOR") {
+
+        CARTA::SetCursor setCursor;
+        setCursor.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        int fileId = setCursor.file_id();
+        CARTA::Point point = setCursor.point();
+        CARTA::SetSpatialRequirements spatialReqs = setCursor.spatial_requirements();
+        qDebug() << "[NewServerConnector] Set cursor fileId=" << fileId << ", point=(" << point.x() << ", " << point.y() << ")";
+        emit setCursorSignal(eventId, fileId, point, spatialReqs);
+
+    } else if (eventName == "SET_SPATIAL_REQUIREMENTS") {
+
+        CARTA::SetSpatialRequirements setSpatialRequirements;
+        setSpatialRequirements.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        int fileId = setSpatialRequirements.file_id();
+        int regionId = setSpatialRequirements.region_id();
+        google::protobuf::RepeatedPtrField<std::string> spatialProfiles = setSpatialRequirements.spatial_profiles();
+        qDebug() << "[NewServerConnector] Set Spatial Requirements fileId=" << fileId << ", regionId=" << regionId;
+        for(auto iter = spatialProfiles.begin(); iter != spatialProfiles.end(); iter++) {
+            qDebug() << "[NewServerConnector] Spatial profile="  << QString::fromStdString(*iter);
+        }
+        emit setSpatialRequirementsSignal(eventId, fileId, regionId, spatialProfiles);
+
+    } else if (eventName == "SET_SPECTRAL_REQUIREMENTS") {
+
+        CARTA::SetSpectralRequirements setSpectralRequirements;
+        setSpectralRequirements.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        int fileId = setSpectralRequirements.file_id();
+        int regionId = setSpectralRequirements.region_id();
+        google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig> spectralProfiles = setSpectralRequirements.spectral_profiles();
+        qDebug() << "[NewServerConnector] Set Spectral Requirements fileId=" << fileId << ", regionId=" << regionId;
+        for(auto iter = spectralProfiles.begin(); iter != spectralProfiles.end(); iter++) {
+            qDebug() << "[NewServerConnector] Spectral profile coordinate="  << QString::fromStdString(iter->coordinate());
+            auto stats_types = iter->stats_types();
+            for(auto statIter = stats_types.begin(); statIter != stats_types.end(); statIter++) {
+                qDebug() << "[NewServerConnector] Statistic types="  << QString(*statIter);
+            }
+        }
+        emit setSpectralRequirementsSignal(eventId, fileId, regionId, spectralProfiles);
+
+    } else if (eventName == "SET_REGION") {
+
+        CARTA::SetRegion setRegion;
+        setRegion.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        qDebug() << "[NewServerConnector] Set region fileId=" << setRegion.file_id() << ", regionId=" << setRegion.region_id()
+                 << ", type=" << setRegion.region_type() << ", control points=" << setRegion.control_points_size();
+        emit setRegionSignal(eventId, setRegion);
+
+    } else if (eventName == "REMOVE_REGION") {
+
+        CARTA::RemoveRegion removeRegion;
+        removeRegion.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        qDebug() << "[NewServerConnector] Remove region regionId=" << removeRegion.region_id();
+        emit removeRegionSignal(eventId, removeRegion.region_id());
+
+    } else if (eventName == "SET_STATS_REQUIREMENTS") {
+
+        CARTA::SetStatsRequirements setStatsRequirements;
+        setStatsRequirements.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        int fileId = setStatsRequirements.file_id();
+        int regionId = setStatsRequirements.region_id();
+        std::vector<int> statsTypes(setStatsRequirements.stats().begin(), setStatsRequirements.stats().end());
+        qDebug() << "[NewServerConnector] Set Stats Requirements fileId=" << fileId << ", regionId=" << regionId
+                 << ", statistics=" << statsTypes.size();
+        emit setStatsRequirementsSignal(eventId, fileId, regionId, statsTypes);
+
+    } else if (eventName == "SET_CONTOUR_PARAMETERS") {
+
+        CARTA::SetContourParameters setContourParameters;
+        setContourParameters.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
+        qDebug() << "[NewServerConnector] Set contour parameters fileId=" << setContourParameters.file_id()
+                 << ", levels=" << setContourParameters.levels_size();
+        emit setContourParametersSignal(eventId, setContourParameters);
+
     } else if (eventName == "CLOSE_FILE") {
 
         CARTA::CloseFile closeFile;
         closeFile.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
         int closeFileId = closeFile.file_id();
         qDebug() << "[NewServerConnector] Close the file id=" << closeFileId;
+        m_scheduler.cancel(closeFileId);
+        _resetCursorState(closeFileId);
+        _resetRasterState(closeFileId);
+        m_regions.erase(closeFileId);
+        m_contourSettings.erase(closeFileId);
 
     } else {
         // Insert non-global object id
@@ -366,9 +525,24 @@ void NewServerConnector::openFileSignalSlot(uint32_t eventId, QString fileDir, Q
 
     qDebug() << "[NewServerConnector] Open the file ID:" << fileId;
 
+    // the file may replace the one the jobs for this id are reading
+    m_scheduler.cancel(fileId);
+    _resetCursorState(fileId);
+    m_regions.erase(fileId);
+    m_contourSettings.erase(fileId);
+    QWriteLocker stateLocker(&m_scheduler.stateLock());
+
     bool success;
     controller->addData(fileDir + "/" + fileName, &success, fileId);
 
+    // compute the statistics of every channel in the background, so that changing channels
+    // does not have to scan the new channel for its min/max and histogram
+    if (success) {
+        controller->indexChannelStats(numberOfBins);
+        // spectral profiles read the cube spectral-major once it has been copied
+        controller->transposeSpectralCube();
+    }
+
     std::shared_ptr<Carta::Lib::Image::ImageInterface> image = controller->getImage();
 
     CARTA::FileInfo* fileInfo = new CARTA::FileInfo();
@@ -441,14 +615,12 @@ void NewServerConnector::openFileSignalSlot(uint32_t eventId, QString fileDir, Q
     //m_calHistRange[fileId] = {0, m_lastFrame[fileId], 0}; // {frameLow, frameHigh, stokeFrame}
     //m_calHistRange[fileId] = {0, 0, 0}; // {frameLow, frameHigh, stokeFrame}
 
-    // set image changed is true
-    m_changeFrame[fileId] = true;
+    // the client has no raster data of this file yet
+    _resetRasterState(fileId);
 }
 
 void NewServerConnector::setImageViewSignalSlot(uint32_t eventId, int fileId, int xMin, int xMax, int yMin, int yMax, int mip,
     bool isZFP, int precision, int numSubsets) {
-    QString respName = "RASTER_IMAGE_DATA";
-
     // check if the boundaries are valid
     if (xMin > xMax || yMin > yMax) {
         qWarning() << "[NewServerConnector] Invalid image bound [xMin, xMax, yMin, yMax]: [" << xMin << ", " << xMax << ", " << yMin << ", " << yMax << "]";
@@ -471,6 +643,66 @@ void NewServerConnector::setImageViewSignalSlot(uint32_t eventId, int fileId, in
         m_ZFPSet[fileId] = {precision, numSubsets};
     }
 
+    if (Globals::instance()->mainConfig()->isRasterTiled()) {
+        _sendRasterTiles(eventId, fileId);
+        return;
+    }
+
+    _sendRasterImage(eventId, fileId);
+}
+
+void NewServerConnector::imageChannelUpdateSignalSlot(uint32_t eventId, int fileId, int channel, int stoke) {
+    bool stokeChanged = m_currentChannel[fileId][1] != stoke;
+    if (m_currentChannel[fileId][0] != channel || m_currentChannel[fileId][1] != stoke) {
+        //qDebug() << "[NewServerConnector] Set image channel=" << channel << ", fileId=" << fileId << ", stoke=" << stoke;
+        // update the current channel and stoke
+        m_currentChannel[fileId] = {channel, stoke};
+    } else {
+        //qDebug() << "[NewServerConnector] Internal signal is repeated!! Don't know the reason yet, just ignore the signal!!";
+        return;
+    }
+
+    // set spectral and stoke frame ranges to calculate the pixel to histogram data
+    //m_calHistRange[fileId] = {0, m_lastFrame[fileId], 0};
+    //m_calHistRange[fileId] = {channel, channel, stoke};
+
+    // the raster data the client has belongs to the previous channel, and the new
+    // channel needs its histogram
+    _resetRasterState(fileId);
+
+    // the profiles of the regions are of the previous stokes, the new ones supersede
+    // those still being computed
+    if (stokeChanged) {
+        for (const auto& region : m_regions[fileId]) {
+            if (region.second.spectralProfiles.size() > 0) {
+                _sendRegionSpectralProfile(eventId, fileId, region.first);
+            }
+        }
+    }
+
+    // the statistics of the regions follow the channel
+    for (const auto& region : m_regions[fileId]) {
+        if (!region.second.statsTypes.empty()) {
+            _sendRegionStats(eventId, fileId, region.first);
+        }
+    }
+
+    // and so do the contours
+    if (m_contourSettings.count(fileId) > 0) {
+        _sendContours(eventId, fileId);
+    }
+
+    if (Globals::instance()->mainConfig()->isRasterTiled()) {
+        _sendRasterTiles(eventId, fileId);
+        return;
+    }
+
+    _sendRasterImage(eventId, fileId);
+}
+
+void NewServerConnector::_sendRasterImage(uint32_t eventId, int fileId) {
+    QString respName = "RASTER_IMAGE_DATA";
+
     // get the controller
     Carta::Data::Controller* controller = _getController();
 
@@ -482,48 +714,59 @@ void NewServerConnector::setImageViewSignalSlot(uint32_t eventId, int fileId, in
     int frameHigh = frameLow;
     int stokeFrame = m_currentChannel[fileId][1];
 
+    // get image viewer bounds with respect to the fileId
+    int xMin = m_imageBounds[fileId][0];
+    int xMax = m_imageBounds[fileId][1];
+    int yMin = m_imageBounds[fileId][2];
+    int yMax = m_imageBounds[fileId][3];
+    int mip = m_imageBounds[fileId][4];
+
+    bool isZFP = m_isZFP[fileId];
+    int precision = m_ZFPSet[fileId][0];
+    int numSubsets = m_ZFPSet[fileId][1];
+
     // If the histograms correspond to the entire current 2D image, the region ID has a value of -1.
     int regionId = -1;
 
     // do not include unit converter for pixel values
     Carta::Lib::IntensityUnitConverter::SharedPtr converter = nullptr;
 
-    // get the down sampling raster image raw data
-    PBMSharedPtr raster = controller->getRasterImageData(fileId, xMin, xMax, yMin, yMax, mip,
-                                                         frameLow, frameHigh, stokeFrame,
-                                                         isZFP, precision, numSubsets,
-                                                         m_changeFrame[fileId], regionId, numberOfBins, converter);
+    quint64 epoch = 0;
+    bool changeFrame = _getRasterState(fileId, epoch);
+
+    // a newer view or channel of the file supersedes this one
+    m_scheduler.submit(JobScheduler::Kind::RASTER, fileId, [=](const JobScheduler::Ticket& ticket) {
+        bool histogramPending = changeFrame;
+        PBMSharedPtr raster = controller->getRasterImageData(fileId, xMin, xMax, yMin, yMax, mip,
+                                                             frameLow, frameHigh, stokeFrame,
+                                                             isZFP, precision, numSubsets,
+                                                             histogramPending, regionId, numberOfBins, converter);
+        if (ticket.isCancelled()) {
+            return;
+        }
+        _setRasterSent(fileId, epoch, histogramPending, 0, {});
 
-    // send the serialized message to the frontend
-    sendSerializedMessage(respName, eventId, raster);
+        // send the serialized message to the frontend
+        sendSerializedMessage(respName, eventId, raster);
+    });
 }
 
-void NewServerConnector::imageChannelUpdateSignalSlot(uint32_t eventId, int fileId, int channel, int stoke) {
+void NewServerConnector::_sendRasterTiles(uint32_t eventId, int fileId) {
     QString respName = "RASTER_IMAGE_DATA";
-
-    if (m_currentChannel[fileId][0] != channel || m_currentChannel[fileId][1] != stoke) {
-        //qDebug() << "[NewServerConnector] Set image channel=" << channel << ", fileId=" << fileId << ", stoke=" << stoke;
-        // update the current channel and stoke
-        m_currentChannel[fileId] = {channel, stoke};
-    } else {
-        //qDebug() << "[NewServerConnector] Internal signal is repeated!! Don't know the reason yet, just ignore the signal!!";
+    std::vector<QPoint> tiles = _getTilesToSend(fileId);
+    if (tiles.empty()) {
         return;
     }
 
-    // set spectral and stoke frame ranges to calculate the pixel to histogram data
-    //m_calHistRange[fileId] = {0, m_lastFrame[fileId], 0};
-    //m_calHistRange[fileId] = {channel, channel, stoke};
-
-    // get the controller
     Carta::Data::Controller* controller = _getController();
-
-    // set the file id as the private parameter in the Stack object
     controller->setFileId(fileId);
 
-    // set the current channel
     int frameLow = m_currentChannel[fileId][0];
     int frameHigh = frameLow;
     int stokeFrame = m_currentChannel[fileId][1];
+    int mip = m_imageBounds[fileId][4];
+    bool isZFP = m_isZFP[fileId];
+    int precision = m_ZFPSet[fileId][0];
 
     // If the histograms correspond to the entire current 2D image, the region ID has a value of -1.
     int regionId = -1;
@@ -531,28 +774,123 @@ void NewServerConnector::imageChannelUpdateSignalSlot(uint32_t eventId, int file
     // do not include unit converter for pixel values
     Carta::Lib::IntensityUnitConverter::SharedPtr converter = nullptr;
 
-    // set image changed is true
-    m_changeFrame[fileId] = true;
+    quint64 epoch = 0;
+    bool changeFrame = _getRasterState(fileId, epoch);
+
+    // a newer view or channel of the file supersedes this one; the tiles it did not get
+    // to are not marked as sent, so the newer job picks them up if they are still needed
+    m_scheduler.submit(JobScheduler::Kind::RASTER, fileId, [=](const JobScheduler::Ticket& ticket) {
+        bool histogramPending = changeFrame;
+        const int tileExtent = Carta::Data::DataSource::RASTER_TILE_SIZE * mip;
+
+        // every tile goes out as soon as it is ready
+        int sent = controller->getRasterTiles(fileId, tiles, mip, frameLow, frameHigh, stokeFrame,
+                                              isZFP, precision, histogramPending, regionId, numberOfBins, converter,
+                                              [&](PBMSharedPtr tile) {
+            if (ticket.isCancelled()) {
+                return false;
+            }
+            sendSerializedMessage(respName, eventId, tile);
+            const CARTA::ImageBounds& bounds = static_cast<CARTA::RasterImageData*>(tile.get())->image_bounds();
+            QPoint index(bounds.x_min() / tileExtent, bounds.y_min() / tileExtent);
+            _setRasterSent(fileId, epoch, histogramPending, mip, {index});
+            return true;
+        });
+        if (ticket.isCancelled()) {
+            return;
+        }
+        // the tiles outside the image are never sent, they count as sent as well
+        _setRasterSent(fileId, epoch, histogramPending, mip, tiles);
+        qDebug() << "[NewServerConnector] Sent" << sent << "raster tiles, mip=" << mip << ", file id=" << fileId;
+    });
+}
 
-    // get image viewer bounds with respect to the fileId
-    int xMin = m_imageBounds[fileId][0];
-    int xMax = m_imageBounds[fileId][1];
-    int yMin = m_imageBounds[fileId][2];
-    int yMax = m_imageBounds[fileId][3];
-    int mip = m_imageBounds[fileId][4];
+bool NewServerConnector::_getRasterState(int fileId, quint64& epoch) const {
+    QMutexLocker locker(&m_rasterMutex);
+    auto iter = m_rasterState.find(fileId);
+    if (iter == m_rasterState.end()) {
+        epoch = 0;
+        return true;
+    }
+    epoch = iter->second.epoch;
+    return iter->second.changeFrame;
+}
 
-    bool isZFP = m_isZFP[fileId];
-    int precision = m_ZFPSet[fileId][0];
-    int numSubsets = m_ZFPSet[fileId][1];
+void NewServerConnector::_resetRasterState(int fileId) {
+    QMutexLocker locker(&m_rasterMutex);
+    RasterState& state = m_rasterState[fileId];
+    state.epoch++;
+    state.changeFrame = true;
+    state.tiles.clear();
+}
 
-    // use image bounds with respect to the fileID and get the down sampling raster image raw data
-    PBMSharedPtr raster = controller->getRasterImageData(fileId, xMin, xMax, yMin, yMax, mip,
-                                                         frameLow, frameHigh, stokeFrame,
-                                                         isZFP, precision, numSubsets,
-                                                         m_changeFrame[fileId], regionId, numberOfBins, converter);
+void NewServerConnector::_setRasterSent(int fileId, quint64 epoch, bool changeFrame, int mip,
+                                        const std::vector<QPoint>& tiles) {
+    QMutexLocker locker(&m_rasterMutex);
+    auto iter = m_rasterState.find(fileId);
+    // the job was for a channel the client has moved away from
+    if (iter == m_rasterState.end() || iter->second.epoch != epoch) {
+        return;
+    }
+    if (!changeFrame) {
+        iter->second.changeFrame = false;
+    }
+    for (const QPoint& tile : tiles) {
+        iter->second.tiles.insert(_getTileKey(mip, tile));
+    }
+}
 
-    // send the serialized message to the frontend
-    sendSerializedMessage(respName, eventId, raster);
+std::vector<QPoint> NewServerConnector::_getTilesToSend(int fileId) const {
+    std::vector<QPoint> tiles;
+    const std::vector<int>& bounds = m_imageBounds.at(fileId);
+    int xMin = bounds[0];
+    int xMax = bounds[1];
+    int yMin = bounds[2];
+    int yMax = bounds[3];
+    int mip = bounds[4];
+    if (mip <= 0 || xMax <= xMin || yMax <= yMin) {
+        return tiles;
+    }
+
+    // tile range of the view, plus a border of one tile which is sent after the view
+    const int tileExtent = Carta::Data::DataSource::RASTER_TILE_SIZE * mip;
+    int txMin = std::max(0, xMin / tileExtent);
+    int txMax = (xMax - 1) / tileExtent;
+    int tyMin = std::max(0, yMin / tileExtent);
+    int tyMax = (yMax - 1) / tileExtent;
+    double xCenter = 0.5 * (xMin + xMax) / tileExtent;
+    double yCenter = 0.5 * (yMin + yMax) / tileExtent;
+
+    QMutexLocker locker(&m_rasterMutex);
+    auto rasterState = m_rasterState.find(fileId);
+    std::vector<std::pair<double, QPoint> > ordered;
+    for (int ty = std::max(0, tyMin - 1); ty <= tyMax + 1; ty++) {
+        for (int tx = std::max(0, txMin - 1); tx <= txMax + 1; tx++) {
+            QPoint tile(tx, ty);
+            if (rasterState != m_rasterState.end() && rasterState->second.tiles.count(_getTileKey(mip, tile))) {
+                continue;
+            }
+            // tiles outside the image are dropped by the data source
+            double dx = tx + 0.5 - xCenter;
+            double dy = ty + 0.5 - yCenter;
+            bool visible = tx >= txMin && tx <= txMax && ty >= tyMin && ty <= tyMax;
+            // the border always comes after the visible tiles
+            double priority = dx * dx + dy * dy + (visible ? 0 : 1e9);
+            ordered.push_back(std::make_pair(priority, tile));
+        }
+    }
+    std::stable_sort(ordered.begin(), ordered.end(),
+                     [](const std::pair<double, QPoint>& a, const std::pair<double, QPoint>& b) {
+        return a.first < b.first;
+    });
+    for (const auto& entry : ordered) {
+        tiles.push_back(entry.second);
+    }
+    return tiles;
+}
+
+quint64 NewServerConnector::_getTileKey(int mip, const QPoint& tile) {
+    return (quint64(mip) << 48) | (quint64(quint32(tile.y()) & 0xffffff) << 24) | (quint64(quint32(tile.x()) & 0xffffff));
 }
 
 void NewServerConnector::setCursorSignalSlot(uint32_t eventId, int fileId, CARTA::Point point, CARTA::SetSpatialRequirements setSpatialReqs) {
@@ -567,19 +905,16 @@ void NewServerConnector::setCursorSignalSlot(uint32_t eventId, int fileId, CARTA
 
     // set the current channel
     int frameLow = m_currentChannel[fileId][0];
-    int frameHigh = frameLow;
     int stokeFrame = m_currentChannel[fileId][1];
 
-    // do not include unit converter for pixel values
-    Carta::Lib::IntensityUnitConverter::SharedPtr converter = nullptr;
-
     // get X/Y profile & fill in the response
-    int x = (int)round(point.x());
-    int y = (int)round(point.y());
-    PBMSharedPtr pbMsg = controller->getXYProfiles(fileId, x, y, frameLow, frameHigh, stokeFrame, converter);
-
-    // send the serialized message to the frontend
-    sendSerializedMessage("SPATIAL_PROFILE_DATA", eventId, pbMsg);
+    CursorRequest request;
+    request.eventId = eventId;
+    request.x = (int)round(point.x());
+    request.y = (int)round(point.y());
+    request.channel = frameLow;
+    request.stokes = stokeFrame;
+    _submitCursor(JobScheduler::Kind::CURSOR, fileId, request);
 
     // skip spectral profile if there is only single channel in the image
     // channel numbers = dims[spectralIndicator]
@@ -587,15 +922,94 @@ void NewServerConnector::setCursorSignalSlot(uint32_t eventId, int fileId, CARTA
     std::vector<int> dims = controller->getImageDimensions();
 
     if(0 <= spectralIndicator && 1 < dims[spectralIndicator]) {
-        // get spectral profile
-        pbMsg = controller->getSpectralProfile(fileId, x, y, stokeFrame);
+        // get spectral profile, it takes the longest and runs after the other requests
+        _submitCursor(JobScheduler::Kind::PROFILE, fileId, request);
+    }
+}
 
-        // send the serialized message to the frontend
-        sendSerializedMessage("SPECTRAL_PROFILE_DATA", eventId, pbMsg);
+void NewServerConnector::_submitCursor(JobScheduler::Kind kind, int fileId, const CursorRequest& request) {
+    std::shared_ptr<CursorState> state;
+    {
+        QMutexLocker locker(&m_cursorMutex);
+        std::shared_ptr<CursorState>& entry = m_cursorState[std::make_pair(int(kind), fileId)];
+        if (!entry) {
+            entry = std::make_shared<CursorState>();
+        }
+        if (entry->pending) {
+            m_coalescedCursors++;
+        }
+        entry->request = request;
+        entry->pending = true;
+        if (entry->running) {
+            // the running job picks it up when it is done
+            return;
+        }
+        entry->running = true;
+        state = entry;
+    }
+    _runCursor(kind, fileId, _getController(), state);
+}
+
+void NewServerConnector::_runCursor(JobScheduler::Kind kind, int fileId, Carta::Data::Controller* controller,
+                                    std::shared_ptr<CursorState> state) {
+    m_scheduler.submit(kind, fileId, [=](const JobScheduler::Ticket& ticket) {
+        CursorRequest request;
+        {
+            QMutexLocker locker(&m_cursorMutex);
+            if (!state->pending) {
+                state->running = false;
+                return;
+            }
+            request = state->request;
+            state->pending = false;
+        }
+
+        if (kind == JobScheduler::Kind::CURSOR) {
+            // do not include unit converter for pixel values
+            Carta::Lib::IntensityUnitConverter::SharedPtr converter = nullptr;
+            PBMSharedPtr pbMsg = controller->getXYProfiles(fileId, request.x, request.y,
+                    request.channel, request.channel, request.stokes, converter);
+            if (!ticket.isCancelled()) {
+                // send the serialized message to the frontend
+                sendSerializedMessage("SPATIAL_PROFILE_DATA", request.eventId, pbMsg);
+            }
+        } else {
+            PBMSharedPtr pbMsg = controller->getSpectralProfile(fileId, request.x, request.y, request.stokes);
+            if (!ticket.isCancelled()) {
+                // send the serialized message to the frontend
+                sendSerializedMessage("SPECTRAL_PROFILE_DATA", request.eventId, pbMsg);
+            }
+        }
+
+        {
+            QMutexLocker locker(&m_cursorMutex);
+            if (!state->pending) {
+                state->running = false;
+                return;
+            }
+        }
+        // a new job rather than a loop, so that the state lock is released in between
+        _runCursor(kind, fileId, controller, state);
+    });
+}
+
+void NewServerConnector::_resetCursorState(int fileId) {
+    QMutexLocker locker(&m_cursorMutex);
+    for (auto iter = m_cursorState.begin(); iter != m_cursorState.end(); ) {
+        if (iter->first.second == fileId) {
+            // a cancelled job never runs, so a new state is started for the next position
+            iter->second->pending = false;
+            iter = m_cursorState.erase(iter);
+        } else {
+            ++iter;
+        }
     }
 }
 
 void NewServerConnector::setSpatialRequirementsSignalSlot(uint32_t eventId, int fileId, int regionId, google::protobuf::RepeatedPtrField<std::string> spatialProfiles) {
+    // the requirements are read by the profile jobs
+    QWriteLocker stateLocker(&m_scheduler.stateLock());
+
     // get the controller
     Carta::Data::Controller* controller = _getController();
 
@@ -610,6 +1024,25 @@ void NewServerConnector::setSpatialRequirementsSignalSlot(uint32_t eventId, int
 }
 
 void NewServerConnector::setSpectralRequirementsSignalSlot(uint32_t eventId, int fileId, int regionId, google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig> spectralProfiles) {
+    // the profiles of a region other than the cursor are computed as soon as they are asked for
+    if (regionId > 0) {
+        auto region = m_regions[fileId].find(regionId);
+        if (region == m_regions[fileId].end()) {
+            qWarning() << "[NewServerConnector] Spectral requirements of an unknown region, fileId=" << fileId << ", regionId=" << regionId;
+            return;
+        }
+        region->second.spectralProfiles = spectralProfiles;
+        if (spectralProfiles.size() > 0) {
+            _sendRegionSpectralProfile(eventId, fileId, regionId);
+        } else {
+            m_scheduler.cancel(JobScheduler::Kind::REGION, fileId, regionId);
+        }
+        return;
+    }
+
+    // the requirements are read by the profile jobs
+    QWriteLocker stateLocker(&m_scheduler.stateLock());
+
     // get the controller
     Carta::Data::Controller* controller = _getController();
 
@@ -626,13 +1059,261 @@ void NewServerConnector::setSpectralRequirementsSignalSlot(uint32_t eventId, int
     }
 }
 
+void NewServerConnector::setStatsRequirementsSignalSlot(uint32_t eventId, int fileId, int regionId, std::vector<int> statsTypes) {
+    // region -1 is the whole image, which the client does not set
+    auto region = m_regions[fileId].find(regionId);
+    if (regionId == -1 && region == m_regions[fileId].end()) {
+        region = m_regions[fileId].insert(std::make_pair(regionId, RegionInfo())).first;
+    }
+    if (region == m_regions[fileId].end()) {
+        qWarning() << "[NewServerConnector] Stats requirements of an unknown region, fileId=" << fileId << ", regionId=" << regionId;
+        return;
+    }
+    region->second.statsTypes = statsTypes;
+    if (!statsTypes.empty()) {
+        _sendRegionStats(eventId, fileId, regionId);
+    } else {
+        m_scheduler.cancel(JobScheduler::Kind::STATS, fileId, regionId);
+    }
+}
+
+void NewServerConnector::setRegionSignalSlot(uint32_t eventId, CARTA::SetRegion setRegion) {
+    int fileId = setRegion.file_id();
+    int regionId = setRegion.region_id();
+
+    std::shared_ptr<CARTA::SetRegionAck> ack(new CARTA::SetRegionAck());
+    Carta::Data::RegionShape shape;
+    if (!_getRegionShape(setRegion, shape)) {
+        qWarning() << "[NewServerConnector] Unsupported region, type=" << setRegion.region_type()
+                   << ", control points=" << setRegion.control_points_size();
+        ack->set_success(false);
+        ack->set_message("Region type not supported or invalid control points");
+        ack->set_region_id(regionId);
+        sendSerializedMessage("SET_REGION_ACK", eventId, ack);
+        return;
+    }
+
+    // a new region gets its id from the server
+    if (regionId <= 0) {
+        regionId = m_nextRegionId;
+    }
+    m_nextRegionId = std::max(m_nextRegionId, regionId + 1);
+
+    RegionInfo& region = m_regions[fileId][regionId];
+    bool changed = region.shape != shape;
+    region.shape = shape;
+
+    ack->set_success(true);
+    ack->set_region_id(regionId);
+    sendSerializedMessage("SET_REGION_ACK", eventId, ack);
+
+    // moving or resizing the region supersedes the profiles of its previous shape
+    if (changed && region.spectralProfiles.size() > 0) {
+        _sendRegionSpectralProfile(eventId, fileId, regionId);
+    }
+    if (changed && !region.statsTypes.empty()) {
+        _sendRegionStats(eventId, fileId, regionId);
+    }
+}
+
+void NewServerConnector::removeRegionSignalSlot(uint32_t eventId, int regionId) {
+    for (auto& regions : m_regions) {
+        if (regions.second.erase(regionId) > 0) {
+            m_scheduler.cancel(JobScheduler::Kind::REGION, regions.first, regionId);
+            m_scheduler.cancel(JobScheduler::Kind::STATS, regions.first, regionId);
+            _getController()->removeRegionStats(regions.first, regionId);
+        }
+    }
+}
+
+void NewServerConnector::_sendRegionSpectralProfile(uint32_t eventId, int fileId, int regionId) {
+    const RegionInfo& region = m_regions[fileId][regionId];
+    Carta::Data::RegionShape shape = region.shape;
+    google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig> spectralProfiles = region.spectralProfiles;
+    int stokeFrame = m_currentChannel[fileId][1];
+    Carta::Data::Controller* controller = _getController();
+
+    m_scheduler.submit(JobScheduler::Kind::REGION, fileId, [=](const JobScheduler::Ticket& ticket) {
+        QElapsedTimer sinceSent;
+        bool sentAny = false;
+        bool computed = controller->getRegionSpectralProfile(fileId, regionId, shape, stokeFrame, spectralProfiles,
+                                                             [&](PBMSharedPtr msg) {
+            // requests that change the state wait for the running jobs, let them in
+            // between the chunks
+            ticket.yieldState();
+            if (ticket.isCancelled()) {
+                return false;
+            }
+            // the first chunk goes out at once so the client sees the profile start, then
+            // the partial profiles are thinned out; the complete one is always sent
+            const CARTA::SpectralProfileData* profile = static_cast<const CARTA::SpectralProfileData*>(msg.get());
+            if (profile->progress() < 1 && sentAny && sinceSent.elapsed() < REGION_PROGRESS_INTERVAL_MS) {
+                return true;
+            }
+            sendSerializedMessage("SPECTRAL_PROFILE_DATA", eventId, msg);
+            sentAny = true;
+            sinceSent.start();
+            return true;
+        });
+        if (!computed) {
+            qDebug() << "[NewServerConnector] No spectral profile for region" << regionId << "of file" << fileId;
+        }
+    }, regionId);
+}
+
+void NewServerConnector::_sendRegionStats(uint32_t eventId, int fileId, int regionId) {
+    const RegionInfo& region = m_regions[fileId][regionId];
+    Carta::Data::RegionShape shape = region.shape;
+    std::vector<int> statsTypes = region.statsTypes;
+    int channel = m_currentChannel[fileId][0];
+    int stokeFrame = m_currentChannel[fileId][1];
+    Carta::Data::Controller* controller = _getController();
+
+    m_scheduler.submit(JobScheduler::Kind::STATS, fileId, [=](const JobScheduler::Ticket& ticket) {
+        PBMSharedPtr msg = controller->getRegionStats(fileId, regionId, shape, channel, stokeFrame, statsTypes);
+        if (ticket.isCancelled()) {
+            return;
+        }
+        if (!msg) {
+            qDebug() << "[NewServerConnector] No statistics for region" << regionId << "of file" << fileId;
+            return;
+        }
+        sendSerializedMessage("REGION_STATS_DATA", eventId, msg);
+    }, regionId);
+}
+
+void NewServerConnector::setContourParametersSignalSlot(uint32_t eventId, CARTA::SetContourParameters setContourParameters) {
+    int fileId = setContourParameters.file_id();
+    if (m_currentChannel.find(fileId) == m_currentChannel.end()) {
+        qWarning() << "[NewServerConnector] Contour parameters of a file that is not open, fileId=" << fileId;
+        return;
+    }
+
+    // no levels turns the contours off
+    std::vector<double> levels(setContourParameters.levels().begin(), setContourParameters.levels().end());
+    if (levels.empty()) {
+        m_contourSettings.erase(fileId);
+        m_scheduler.cancel(JobScheduler::Kind::CONTOUR, fileId, 0);
+        return;
+    }
+    ContourSettings& settings = m_contourSettings[fileId];
+    settings.levels = levels;
+    settings.smoothingMode = setContourParameters.smoothing_mode();
+    settings.smoothingFactor = setContourParameters.smoothing_factor();
+    settings.decimation = setContourParameters.decimation_factor();
+    settings.compressionLevel = setContourParameters.compression_level();
+    _sendContours(eventId, fileId);
+}
+
+void NewServerConnector::_sendContours(uint32_t eventId, int fileId) {
+    ContourSettings settings = m_contourSettings[fileId];
+    int channel = m_currentChannel[fileId][0];
+    int stokeFrame = m_currentChannel[fileId][1];
+    Carta::Data::Controller* controller = _getController();
+
+    // every piece is needed, so none of them supersedes another one in the send queue;
+    // a newer channel or new contour settings cancel the job instead
+    m_scheduler.submit(JobScheduler::Kind::CONTOUR, fileId, [=](const JobScheduler::Ticket& ticket) {
+        int sent = controller->getContourImageData(fileId, channel, stokeFrame, settings.levels,
+            settings.smoothingMode, settings.smoothingFactor, settings.decimation, settings.compressionLevel,
+            [&](PBMSharedPtr contours) {
+            if (ticket.isCancelled()) {
+                return false;
+            }
+            sendSerializedMessage("CONTOUR_IMAGE_DATA", eventId, contours);
+            return true;
+        });
+        if (ticket.isCancelled()) {
+            return;
+        }
+        qDebug() << "[NewServerConnector] Sent" << sent << "contour messages, levels=" << settings.levels.size()
+                 << ", file id=" << fileId;
+    });
+}
+
+bool NewServerConnector::_getRegionShape(const CARTA::SetRegion& setRegion, Carta::Data::RegionShape& shape) {
+    Carta::Data::RegionShape::Type type;
+    switch (setRegion.region_type()) {
+    case CARTA::RegionType::POINT:
+        type = Carta::Data::RegionShape::Type::POINT;
+        break;
+    case CARTA::RegionType::RECTANGLE:
+        type = Carta::Data::RegionShape::Type::RECTANGLE;
+        break;
+    case CARTA::RegionType::ELLIPSE:
+        type = Carta::Data::RegionShape::Type::ELLIPSE;
+        break;
+    case CARTA::RegionType::POLYGON:
+        type = Carta::Data::RegionShape::Type::POLYGON;
+        break;
+    default:
+        return false;
+    }
+
+    std::vector<QPointF> points;
+    for (const CARTA::Point& point : setRegion.control_points()) {
+        points.push_back(QPointF(point.x(), point.y()));
+    }
+    shape = Carta::Data::RegionShape(type, points, setRegion.rotation());
+    return shape.isValid();
+}
+
+// may be called from the worker threads of the scheduler as well, the signal is queued
+// to the dispatcher then
 void NewServerConnector::sendSerializedMessage(QString respName, uint32_t eventId, PBMSharedPtr msg) {
     if (nullptr == msg) {
         qWarning() << "Respond message is nullptr. Respond: " << respName << ", eventId: " << eventId;
         return;
     }
 
-    emit jsBinaryMessageResultSignal(respName, eventId, msg);
+    // serialize here rather than on the dispatcher thread, which all the sessions share
+    Carta::Core::SendBufferPool::FramePtr frame = Carta::Core::SendBufferPool::instance().serialize(respName, eventId, msg);
+    emit jsBinaryMessageResultSignal(respName, eventId, frame, _getSupersedeKey(respName, msg), _isDroppable(respName, msg));
+}
+
+QString NewServerConnector::_getSupersedeKey(const QString& respName, const PBMSharedPtr& msg) {
+    if (respName == "RASTER_IMAGE_DATA") {
+        const CARTA::RasterImageData* raster = static_cast<const CARTA::RasterImageData*>(msg.get());
+        // the histogram of a new channel only goes with one of its rasters, a raster
+        // without it must not take its place
+        QString key = QString("%1/%2/%3").arg(respName).arg(raster->file_id())
+                .arg(raster->has_channel_histogram_data() ? "histogram" : "image");
+        if (Globals::instance()->mainConfig()->isRasterTiled()) {
+            // every tile is needed, only a newer version of the same tile replaces it
+            const CARTA::ImageBounds& bounds = raster->image_bounds();
+            key += QString("/%1/%2/%3").arg(raster->mip()).arg(bounds.x_min()).arg(bounds.y_min());
+        }
+        return key;
+    }
+    if (respName == "SPATIAL_PROFILE_DATA") {
+        const CARTA::SpatialProfileData* profile = static_cast<const CARTA::SpatialProfileData*>(msg.get());
+        return QString("%1/%2/%3").arg(respName).arg(profile->file_id()).arg(profile->region_id());
+    }
+    if (respName == "SPECTRAL_PROFILE_DATA") {
+        // a partial profile holds all the channels of the previous one; the complete
+        // profile is never replaced
+        const CARTA::SpectralProfileData* profile = static_cast<const CARTA::SpectralProfileData*>(msg.get());
+        if (profile->progress() < 1) {
+            return QString("%1/%2/%3/partial").arg(respName).arg(profile->file_id()).arg(profile->region_id());
+        }
+    }
+    if (respName == "REGION_STATS_DATA") {
+        const CARTA::RegionStatsData* stats = static_cast<const CARTA::RegionStatsData*>(msg.get());
+        return QString("%1/%2/%3").arg(respName).arg(stats->file_id()).arg(stats->region_id());
+    }
+    return QString();
+}
+
+bool NewServerConnector::_isDroppable(const QString& respName, const PBMSharedPtr& msg) {
+    if (respName == "RASTER_IMAGE_DATA") {
+        // the histogram is only sent with the first raster of a channel
+        return !static_cast<const CARTA::RasterImageData*>(msg.get())->has_channel_histogram_data();
+    }
+    if (respName == "SPECTRAL_PROFILE_DATA") {
+        // the complete profile follows a partial one
+        return static_cast<const CARTA::SpectralProfileData*>(msg.get())->progress() < 1;
+    }
+    return false;
 }
 
 Carta::Data::Controller* NewServerConnector::_getController() {
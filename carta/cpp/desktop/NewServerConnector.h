@@ -8,12 +8,18 @@
 #include <QObject>
 #include <QList>
 #include <QByteArray>
+#include <QPoint>
+#include <QMutex>
+#include <set>
+
+#include "JobScheduler.h"
 
 #include "CartaLib/IRemoteVGView.h"
 #include "CartaLib/IPercentileCalculator.h"
 #include "CartaLib/LinearMap.h"
 
 #include "core/IConnector.h"
+#include "core/SendBufferPool.h"
 #include "core/CallbackList.h"
 #include "core/Viewer.h"
 #include "core/MyQApp.h"
@@ -23,6 +29,7 @@
 #include "core/Data/ViewManager.h"
 #include "core/Data/Image/Controller.h"
 #include "core/Data/Image/DataSource.h"
+#include "core/Data/Image/RegionShape.h"
 
 #include "CartaLib/Proto/open_file.pb.h"
 #include "CartaLib/Proto/set_image_view.pb.h"
@@ -70,6 +77,17 @@ public:
 
      ~NewServerConnector();
 
+    /**
+     * Returns the number of jobs of this session that were superseded before they finished.
+     */
+    quint64 getCancelledJobCount() const;
+
+    /**
+     * Returns the number of cursor positions of this session that were replaced by a newer
+     * one before they were computed.
+     */
+    quint64 getCoalescedCursorCount() const;
+
     Viewer viewer;
     QThread *selfThread; //not really use now, may take effect later
 
@@ -77,7 +95,7 @@ public slots:
 
     void startViewerSlot(const QString & sessionID);
     void onTextMessage(QString message);
-    void onBinaryMessageSignalSlot(const char* message, size_t length);
+    void onBinaryMessageSignalSlot(QByteArray message);
     void sendSerializedMessage(QString respName, uint32_t eventId, PBMSharedPtr msg);
 
     void imageChannelUpdateSignalSlot(uint32_t eventId, int fileId, int channel, int stoke);
@@ -87,6 +105,10 @@ public slots:
     void setCursorSignalSlot(uint32_t eventId, int fileId, CARTA::Point point, CARTA::SetSpatialRequirements setSpatialReqs);
     void setSpatialRequirementsSignalSlot(uint32_t eventId, int fileId, int regionId, google::protobuf::RepeatedPtrField<std::string> spatialProfiles);
     void setSpectralRequirementsSignalSlot(uint32_t eventId, int fileId, int regionId, google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig> spectralProfiles);
+    void setRegionSignalSlot(uint32_t eventId, CARTA::SetRegion setRegion);
+    void removeRegionSignalSlot(uint32_t eventId, int regionId);
+    void setStatsRequirementsSignalSlot(uint32_t eventId, int fileId, int regionId, std::vector<int> statsTypes);
+    void setContourParametersSignalSlot(uint32_t eventId, CARTA::SetContourParameters setContourParameters);
 
     void fileListRequestSignalSlot(uint32_t eventId, CARTA::FileListRequest fileListRequest);
     void fileInfoRequestSignalSlot(uint32_t eventId, CARTA::FileInfoRequest fileInfoRequest);
@@ -98,10 +120,10 @@ signals:
     //new arch
     void startViewerSignal(const QString & sessionID);
     void onTextMessageSignal(QString message);
-    void onBinaryMessageSignal(const char* message, size_t length);
+    void onBinaryMessageSignal(QByteArray message);
 
     void jsTextMessageResultSignal(QString result);
-    void jsBinaryMessageResultSignal(QString respName, uint32_t eventId, PBMSharedPtr message);
+    void jsBinaryMessageResultSignal(QString respName, uint32_t eventId, Carta::Core::SendBufferPool::FramePtr frame, QString supersedeKey, bool droppable);
 
     void imageChannelUpdateSignal(uint32_t eventId, int fileId, int channel, int stoke);
     void setImageViewSignal(uint32_t eventId, int fileId, int xMin, int xMax, int yMin, int yMax, int mip,
@@ -110,6 +132,10 @@ signals:
     void setCursorSignal(uint32_t eventId, int fileId, CARTA::Point point, CARTA::SetSpatialRequirements setSpatialReqs);
     void setSpatialRequirementsSignal(uint32_t eventId, int fileId, int regionId, google::protobuf::RepeatedPtrField<std::string> spatialProfiles);
     void setSpectralRequirementsSignal(uint32_t eventId, int fileId, int regionId, google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig> spectralProfiles);
+    void setRegionSignal(uint32_t eventId, CARTA::SetRegion setRegion);
+    void removeRegionSignal(uint32_t eventId, int regionId);
+    void setStatsRequirementsSignal(uint32_t eventId, int fileId, int regionId, std::vector<int> statsTypes);
+    void setContourParametersSignal(uint32_t eventId, CARTA::SetContourParameters setContourParameters);
 
     void fileListRequestSignal(uint32_t eventId, CARTA::FileListRequest fileListRequest);
     void fileInfoRequestSignal(uint32_t eventId, CARTA::FileInfoRequest fileInfoRequest);
@@ -167,6 +193,136 @@ protected:
 
     Carta::Data::Controller* _getController();
 
+    /**
+     * Queues a job that sends the raster image data of the current view of a file.
+     * @param eventId - the id of the request.
+     * @param fileId - the file id.
+     */
+    void _sendRasterImage(uint32_t eventId, int fileId);
+
+    /**
+     * Queues a job that sends the raster image data of the current view of a file as
+     * tiles, visible tiles first, skipping the tiles the client already has.
+     * @param eventId - the id of the request.
+     * @param fileId - the file id.
+     */
+    void _sendRasterTiles(uint32_t eventId, int fileId);
+
+    /**
+     * Returns the tiles of the current view that the client does not have yet, the
+     * ones closest to the centre of the view first, followed by a border of one tile
+     * around the view so that small pans are already covered.
+     * @param fileId - the file id.
+     * @return - the (column, row) indices of the tiles at the current mip.
+     */
+    std::vector<QPoint> _getTilesToSend(int fileId) const;
+
+    /// key of a tile in m_rasterState
+    static quint64 _getTileKey(int mip, const QPoint& tile);
+
+    /**
+     * Returns the key under which a newer message replaces an older one that is still
+     * waiting to be sent to the client.
+     * @param respName - the event name.
+     * @param msg - the message.
+     * @return - the key or an empty string if the message must not be replaced.
+     */
+    static QString _getSupersedeKey(const QString& respName, const PBMSharedPtr& msg);
+
+    /**
+     * Returns whether a message may be dropped when the client is too slow to take it.
+     * @param respName - the event name.
+     * @param msg - the message.
+     * @return - true if the client gets the content again anyway: a raster without the
+     *      histogram of a new channel, or a partial spectral profile.
+     */
+    static bool _isDroppable(const QString& respName, const PBMSharedPtr& msg);
+
+    /**
+     * Returns whether the channel histogram still has to be sent with the raster data of a file.
+     * @param fileId - the file id.
+     * @param epoch - set to the current epoch of the raster data of the file.
+     * @return - true if the histogram has not been sent for the current channel yet.
+     */
+    bool _getRasterState(int fileId, quint64& epoch) const;
+
+    /**
+     * Forgets which raster data the client has for a file, because the channel changed
+     * or the file was opened or closed.
+     * @param fileId - the file id.
+     */
+    void _resetRasterState(int fileId);
+
+    /**
+     * Records raster data a job has sent; ignored if the state was reset since the job was queued.
+     * @param fileId - the file id.
+     * @param epoch - the epoch of the raster data when the job was queued.
+     * @param changeFrame - false if the channel histogram was sent.
+     * @param mip - the mip of the tiles.
+     * @param tiles - the (column, row) indices of the tiles sent.
+     */
+    void _setRasterSent(int fileId, quint64 epoch, bool changeFrame, int mip, const std::vector<QPoint>& tiles);
+
+    /// a cursor position for which profiles are requested
+    struct CursorRequest {
+        uint32_t eventId = 0;
+        int x = 0;
+        int y = 0;
+        int channel = 0;
+        int stokes = 0;
+    };
+
+    /**
+     * Queues the profiles of a cursor position. While the profiles of an earlier position
+     * are computed, newer positions replace each other and only the latest one is computed
+     * next, so the client gets answers at the rate they can be computed.
+     * @param kind - JobScheduler::Kind::CURSOR for the spatial profiles or
+     *      JobScheduler::Kind::PROFILE for the spectral profile.
+     * @param fileId - the file id.
+     * @param request - the cursor position.
+     */
+    void _submitCursor(JobScheduler::Kind kind, int fileId, const CursorRequest& request);
+
+    /**
+     * Forgets the cursor positions waiting for a file, whose jobs were cancelled.
+     * @param fileId - the file id.
+     */
+    void _resetCursorState(int fileId);
+
+    /**
+     * Queues a job that computes the spectral profiles of a region and sends them as the
+     * channels come in, superseding the job of an earlier shape or stokes of the region.
+     * @param eventId - the id of the request.
+     * @param fileId - the file id.
+     * @param regionId - the region id.
+     */
+    void _sendRegionSpectralProfile(uint32_t eventId, int fileId, int regionId);
+
+    /**
+     * Queues a job that computes the statistics of a region in the current channel and
+     * stokes, superseding the job of an earlier channel or shape of the region.
+     * @param eventId - the event id.
+     * @param fileId - the file id.
+     * @param regionId - the region id, -1 for the whole image.
+     */
+    void _sendRegionStats(uint32_t eventId, int fileId, int regionId);
+
+    /**
+     * Queues a job that computes the contours of the current channel of a file and streams
+     * them tile by tile, superseding the job of an earlier channel or of earlier contour settings.
+     * @param eventId - the event id.
+     * @param fileId - the file id.
+     */
+    void _sendContours(uint32_t eventId, int fileId);
+
+    /**
+     * Returns the geometry of a region the client has set.
+     * @param setRegion - the request.
+     * @param shape - set to the geometry, in pixel coordinates of the image.
+     * @return - false if the server does not support the kind of region or its control points are not valid.
+     */
+    static bool _getRegionShape(const CARTA::SetRegion& setRegion, Carta::Data::RegionShape& shape);
+
 private:
 
     std::map<int, std::vector<int> > m_imageBounds; // m_imageBounds[fileId] = {x_min, x_max, y_min, y_max, mip}
@@ -175,8 +331,52 @@ private:
     std::map<int, std::vector<int> > m_currentChannel; // m_currentChannel[fileId] = {spectralFrame, stokeFrame}
     //std::map<int, std::vector<int> > m_calHistRange; // m_calHistRange[fileId] = {frameLow, frameHigh, stokeFrame}
     std::map<int, int> m_lastFrame; // m_lastFrame[fileId] = lastFrame (for the spectral axis)
-    std::map<int, bool> m_changeFrame;
+
+    /// raster data the client has for the current channel of a file, updated by the raster jobs
+    struct RasterState {
+        quint64 epoch = 0; // bumped whenever the state is reset
+        bool changeFrame = true; // whether the channel histogram still has to be sent
+        std::set<quint64> tiles; // tiles the client has
+    };
+    std::map<int, RasterState> m_rasterState;
+    mutable QMutex m_rasterMutex;
+
+    /// cursor profiles of one kind for a file, shared with the job computing them
+    struct CursorState {
+        bool running = false; // a job is queued or computing
+        bool pending = false; // request has not been picked up by a job yet
+        CursorRequest request;
+    };
+    void _runCursor(JobScheduler::Kind kind, int fileId, Carta::Data::Controller* controller,
+                    std::shared_ptr<CursorState> state);
+    std::map<std::pair<int, int>, std::shared_ptr<CursorState> > m_cursorState; // key = {kind, fileId}
+    mutable QMutex m_cursorMutex;
+    quint64 m_coalescedCursors = 0; // positions replaced by a newer one before they were computed
+
+    /// a region the client has set, only used on the session thread
+    struct RegionInfo {
+        Carta::Data::RegionShape shape;
+        google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig> spectralProfiles;
+        std::vector<int> statsTypes;
+    };
+    std::map<int, std::map<int, RegionInfo> > m_regions; // m_regions[fileId][regionId], -1 is the whole image
+    int m_nextRegionId = 1; // id of the next region the client adds without one
+
+    /// what the client asked the contours of a file to be
+    struct ContourSettings {
+        std::vector<double> levels;
+        int smoothingMode = 0;
+        int smoothingFactor = 1;
+        int decimation = 0;
+        int compressionLevel = 0;
+    };
+    std::map<int, ContourSettings> m_contourSettings; // m_contourSettings[fileId], only files with contours
+
     const int numberOfBins = 10000; // define number of bins for calculating pixels to histogram data
+
+    /// runs the raster, cursor and profile requests off the session thread; declared
+    /// last so that it waits for the running jobs before anything they use goes away
+    JobScheduler m_scheduler;
 };
 
 
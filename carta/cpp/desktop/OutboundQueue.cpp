@@ -0,0 +1,123 @@
+/**
+ *
+ **/
+
+#include "OutboundQueue.h"
+
+#include <QDebug>
+#include <algorithm>
+
+const qint64 OutboundQueue::MAX_IN_FLIGHT_BYTES = 8LL * 1024 * 1024;
+const qint64 OutboundQueue::MAX_QUEUED_BYTES = 128LL * 1024 * 1024;
+const int OutboundQueue::MAX_QUEUED_FRAMES = 1024;
+const qint64 OutboundQueue::HARD_MAX_QUEUED_BYTES = 512LL * 1024 * 1024;
+const int OutboundQueue::HARD_MAX_QUEUED_FRAMES = 8192;
+
+OutboundQueue::OutboundQueue(const Writer& writer) :
+    m_writer(writer) {
+}
+
+bool OutboundQueue::push(const QString& respName, const Carta::Core::SendBufferPool::FramePtr& frame,
+                         const QString& supersedeKey, bool droppable) {
+    if (!frame) {
+        return !m_closed;
+    }
+    if (m_closed) {
+        m_stats.dropped++;
+        return false;
+    }
+    Entry entry;
+    entry.respName = respName;
+    entry.key = supersedeKey;
+    entry.frame = frame;
+    entry.droppable = droppable;
+
+    // the newer frame takes the place of the older one, so the order of the other
+    // frames does not change
+    bool replaced = false;
+    if (!supersedeKey.isEmpty()) {
+        for (Entry& waiting : m_entries) {
+            if (waiting.key == supersedeKey) {
+                m_stats.bytes += qint64(frame->size()) - qint64(waiting.frame->size());
+                waiting = entry;
+                m_stats.coalesced++;
+                replaced = true;
+                break;
+            }
+        }
+    }
+    if (!replaced) {
+        m_entries.push_back(entry);
+        m_stats.bytes += frame->size();
+        m_stats.depth++;
+    }
+
+    bool overLimit = m_stats.bytes > MAX_QUEUED_BYTES || m_stats.depth > MAX_QUEUED_FRAMES;
+    if (overLimit && !m_overLimit) {
+        qWarning() << "[OutboundQueue] Client is too slow," << m_stats.depth << "frames ("
+                   << m_stats.bytes << "bytes ) waiting, dropping rasters and partial profiles";
+    }
+    m_overLimit = overLimit;
+    while (m_stats.bytes > MAX_QUEUED_BYTES || m_stats.depth > MAX_QUEUED_FRAMES) {
+        if (!_dropOldest()) {
+            // nothing left that may be dropped
+            break;
+        }
+    }
+    _send();
+
+    // what is still waiting is needed, a client that cannot take it is given up on
+    if (m_stats.bytes > HARD_MAX_QUEUED_BYTES || m_stats.depth > HARD_MAX_QUEUED_FRAMES) {
+        _close(respName);
+        return false;
+    }
+    return true;
+}
+
+void OutboundQueue::written(qint64 bytes) {
+    // the count includes the websocket framing, so it can run slightly ahead of ours
+    m_stats.inFlight = std::max<qint64>(0, m_stats.inFlight - bytes);
+    _send();
+}
+
+OutboundQueue::Stats OutboundQueue::getStats() const {
+    return m_stats;
+}
+
+void OutboundQueue::_send() {
+    // a frame larger than the limit still goes out once the socket is idle
+    while (!m_entries.empty() && m_stats.inFlight < MAX_IN_FLIGHT_BYTES) {
+        Entry entry = m_entries.front();
+        m_entries.pop_front();
+        m_stats.depth--;
+        m_stats.bytes -= entry.frame->size();
+        m_stats.inFlight += entry.frame->size();
+        m_stats.sent++;
+        m_writer(entry.frame);
+    }
+}
+
+bool OutboundQueue::_dropOldest() {
+    for (auto iter = m_entries.begin(); iter != m_entries.end(); ++iter) {
+        if (!iter->droppable) {
+            continue;
+        }
+        m_stats.depth--;
+        m_stats.bytes -= iter->frame->size();
+        m_stats.dropped++;
+        m_entries.erase(iter);
+        return true;
+    }
+    return false;
+}
+
+void OutboundQueue::_close(const QString& respName) {
+    qWarning() << "[OutboundQueue] Client is too slow," << m_stats.depth << "frames ("
+               << m_stats.bytes << "bytes ) waiting, the last one" << respName << ", closing the session";
+    m_stats.dropped += m_stats.depth;
+    m_stats.depth = 0;
+    m_stats.bytes = 0;
+    m_stats.closed++;
+    m_entries.clear();
+    m_closed = true;
+}
@@ -0,0 +1,87 @@
+/**
+ * Frames waiting to be written to the socket of one session.
+ **/
+
+#ifndef OUTBOUND_QUEUE_H
+#define OUTBOUND_QUEUE_H
+
+#include "core/SendBufferPool.h"
+
+#include <QString>
+#include <deque>
+#include <functional>
+
+class OutboundQueue
+{
+public:
+
+    /// counters of one queue, or summed over all the queues
+    struct Stats {
+        int depth = 0;          ///< frames waiting
+        qint64 bytes = 0;       ///< bytes waiting
+        qint64 inFlight = 0;    ///< bytes handed to the socket and not written yet
+        quint64 sent = 0;       ///< frames handed to the socket
+        quint64 coalesced = 0;  ///< frames replaced by a newer frame with the same key
+        quint64 dropped = 0;    ///< frames dropped because the queue was full
+        quint64 closed = 0;     ///< sessions closed because the queue was past its hard limits
+    };
+
+    /// writes a frame to the socket
+    typedef std::function<void(const Carta::Core::SendBufferPool::FramePtr& frame)> Writer;
+
+    explicit OutboundQueue(const Writer& writer);
+
+    /**
+     * Queues a frame and writes as much as the socket can take.
+     * @param respName - the event name, for the log.
+     * @param frame - the frame.
+     * @param supersedeKey - a waiting frame with the same key is replaced by this one; an
+     *      empty key means the frame is never replaced.
+     * @param droppable - true if the client gets the content again anyway (a raster of the
+     *      current view, a partial profile); the oldest such frames are dropped while the
+     *      queue is over MAX_QUEUED_BYTES or MAX_QUEUED_FRAMES.
+     * @return - false if the queue is past HARD_MAX_QUEUED_BYTES or HARD_MAX_QUEUED_FRAMES;
+     *      it then drops all its frames and every later one, and the session has to be closed.
+     */
+    bool push(const QString& respName, const Carta::Core::SendBufferPool::FramePtr& frame,
+              const QString& supersedeKey, bool droppable);
+
+    /**
+     * Called when the socket has written bytes, writes the next frames.
+     * @param bytes - the number of bytes written.
+     */
+    void written(qint64 bytes);
+
+    Stats getStats() const;
+
+    /// limits on the frames handed to the socket and waiting in the queue
+    static const qint64 MAX_IN_FLIGHT_BYTES;
+    static const qint64 MAX_QUEUED_BYTES;
+    static const int MAX_QUEUED_FRAMES;
+
+    /// limits on the frames waiting in the queue that cannot be dropped, the client is
+    /// disconnected past them
+    static const qint64 HARD_MAX_QUEUED_BYTES;
+    static const int HARD_MAX_QUEUED_FRAMES;
+
+private:
+
+    struct Entry {
+        QString respName;
+        QString key;
+        Carta::Core::SendBufferPool::FramePtr frame;
+        bool droppable = false;
+    };
+
+    void _send();
+    bool _dropOldest();
+    void _close(const QString& respName);
+
+    Writer m_writer;
+    std::deque<Entry> m_entries;
+    Stats m_stats;
+    bool m_overLimit = false;
+    bool m_closed = false;
+};
+
+#endif // OUTBOUND_QUEUE_H
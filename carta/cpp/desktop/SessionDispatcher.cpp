@@ -27,11 +27,15 @@
 #include "NewServerConnector.h"
 
 #include "CartaLib/Proto/register_viewer.pb.h"
-#include "CartaLib/Proto/set_image_channels.pb.h"
-#include "CartaLib/Proto/set_image_view.pb.h"
 
 #include "Globals.h"
 #include "core/CmdLine.h"
+#include "CartaLib/UtilCASA.h"
+#include "core/FrameRenderCache.h"
+#include "PluginManager.h"
+#include "CartaLib/Hooks/GetPersistentCache.h"
+
+const int SessionDispatcher::STATS_INTERVAL_MS = 60 * 1000;
 
 void SessionDispatcher::startWebSocket(){
 
@@ -53,6 +57,9 @@ void SessionDispatcher::startWebSocket(){
     }
 
     connect(m_pWebSocketServer, &QWebSocketServer::newConnection, this, &SessionDispatcher::onNewConnection);
+
+    connect(&m_statsTimer, &QTimer::timeout, this, &SessionDispatcher::onStatsTimer);
+    m_statsTimer.start(STATS_INTERVAL_MS);
 }
 
 SessionDispatcher::SessionDispatcher() {
@@ -72,14 +79,48 @@ void SessionDispatcher::onNewConnection() {
     QWebSocket* ws = m_pWebSocketServer->nextPendingConnection();
     connect(ws, &QWebSocket::textMessageReceived, this, &SessionDispatcher::onTextMessage);
     connect(ws, &QWebSocket::binaryMessageReceived, this, &SessionDispatcher::onBinaryMessage);
+    connect(ws, &QWebSocket::bytesWritten, this, &SessionDispatcher::onBytesWritten);
+    connect(ws, &QWebSocket::disconnected, this, &SessionDispatcher::onDisconnected);
+}
+
+void SessionDispatcher::onBytesWritten(qint64 bytes) {
+    QWebSocket* ws = qobject_cast<QWebSocket*>(sender());
+    auto iter = queueList.find(ws);
+    if (iter != queueList.end()) {
+        iter->second->written(bytes);
+    }
+}
+
+void SessionDispatcher::onDisconnected() {
+    QWebSocket* ws = qobject_cast<QWebSocket*>(sender());
+    qDebug() << "[SessionDispatcher] A connection is closed";
+    // the connector stays in clientList so that the session can be resumed
+    auto session = sessionList.find(ws);
+    if (session != sessionList.end()) {
+        auto socket = socketList.find(session->second);
+        if (socket != socketList.end() && socket->second == ws) {
+            socketList.erase(socket);
+        }
+        sessionList.erase(session);
+    }
+    auto queue = queueList.find(ws);
+    if (queue != queueList.end()) {
+        OutboundQueue::Stats stats = queue->second->getStats();
+        m_closedQueueStats.sent += stats.sent;
+        m_closedQueueStats.coalesced += stats.coalesced;
+        m_closedQueueStats.dropped += stats.dropped + stats.depth;
+        m_closedQueueStats.closed += stats.closed;
+        queueList.erase(queue);
+    }
+    ws->deleteLater();
 }
 
 void SessionDispatcher::onTextMessage(QString message) {
     // get the source of websocket
     QWebSocket* ws = qobject_cast<QWebSocket*>(sender());
-    NewServerConnector* connector= sessionList[ws];
-    if (connector != nullptr) {
-        emit connector->onTextMessageSignal(message);
+    auto iter = sessionList.find(ws);
+    if (iter != sessionList.end() && iter->second != nullptr) {
+        emit iter->second->onTextMessageSignal(message);
     }
 }
 
@@ -136,25 +177,30 @@ void SessionDispatcher::onBinaryMessage(QByteArray qByteMessage) {
         }
 
         sessionList[ws] = connector;
+        socketList[connector] = ws;
 
         if (!sessionExisting) {
             qRegisterMetaType<size_t>("size_t");
             qRegisterMetaType<uint32_t>("uint32_t");
             qRegisterMetaType<PBMSharedPtr>("PBMSharedPtr");
+            qRegisterMetaType<Carta::Core::SendBufferPool::FramePtr>("Carta::Core::SendBufferPool::FramePtr");
             qRegisterMetaType<CARTA::Point>("CARTA::Point");
             qRegisterMetaType<CARTA::SetSpatialRequirements>("CARTA::SetSpatialRequirements");
             qRegisterMetaType<CARTA::FileListRequest>("CARTA::FileListRequest");
             qRegisterMetaType<CARTA::FileInfoRequest>("CARTA::FileInfoRequest");
             qRegisterMetaType<google::protobuf::RepeatedPtrField<std::string>>("google::protobuf::RepeatedPtrField<std::string>");
             qRegisterMetaType<google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>>("google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>");
+            qRegisterMetaType<CARTA::SetRegion>("CARTA::SetRegion");
+            qRegisterMetaType<CARTA::SetContourParameters>("CARTA::SetContourParameters");
+            qRegisterMetaType<std::vector<int>>("std::vector<int>");
 
             // start the image viewer
             connect(connector, SIGNAL(startViewerSignal(const QString &)),
                     connector, SLOT(startViewerSlot(const QString &)));
 
             // general commands
-            //connect(connector, SIGNAL(onBinaryMessageSignal(const char*, size_t)),
-            //        connector, SLOT(onBinaryMessageSignalSlot(const char*, size_t)));
+            connect(connector, SIGNAL(onBinaryMessageSignal(QByteArray)),
+                    connector, SLOT(onBinaryMessageSignalSlot(QByteArray)));
 
             // file list request
             connect(connector, SIGNAL(fileListRequestSignal(uint32_t, CARTA::FileListRequest)),
@@ -188,9 +234,25 @@ void SessionDispatcher::onBinaryMessage(QByteArray qByteMessage) {
             connect(connector, SIGNAL(setSpectralRequirementsSignal(uint32_t, int, int, google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>)),
                     connector, SLOT(setSpectralRequirementsSignalSlot(uint32_t, int, int, google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig>)));
 
+            // set region
+            connect(connector, SIGNAL(setRegionSignal(uint32_t, CARTA::SetRegion)),
+                    connector, SLOT(setRegionSignalSlot(uint32_t, CARTA::SetRegion)));
+
+            // remove region
+            connect(connector, SIGNAL(removeRegionSignal(uint32_t, int)),
+                    connector, SLOT(removeRegionSignalSlot(uint32_t, int)));
+
+            // set stats requirements
+            connect(connector, SIGNAL(setStatsRequirementsSignal(uint32_t, int, int, std::vector<int>)),
+                    connector, SLOT(setStatsRequirementsSignalSlot(uint32_t, int, int, std::vector<int>)));
+
+            // set contour parameters
+            connect(connector, SIGNAL(setContourParametersSignal(uint32_t, CARTA::SetContourParameters)),
+                    connector, SLOT(setContourParametersSignalSlot(uint32_t, CARTA::SetContourParameters)));
+
             // send binary signal to the frontend
-            connect(connector, SIGNAL(jsBinaryMessageResultSignal(QString, uint32_t, PBMSharedPtr)),
-                    this, SLOT(forwardBinaryMessageResult(QString, uint32_t, PBMSharedPtr)));
+            connect(connector, SIGNAL(jsBinaryMessageResultSignal(QString, uint32_t, Carta::Core::SendBufferPool::FramePtr, QString, bool)),
+                    this, SLOT(forwardBinaryMessageResult(QString, uint32_t, Carta::Core::SendBufferPool::FramePtr, QString, bool)));
 
             //connect(connector, SIGNAL(onTextMessageSignal(QString)), connector, SLOT(onTextMessage(QString)));
             //connect(connector, SIGNAL(jsTextMessageResultSignal(QString)), this, SLOT(forwardTextMessageResult(QString)) );
@@ -228,138 +290,28 @@ void SessionDispatcher::onBinaryMessage(QByteArray qByteMessage) {
         // serialize the message and send to the frontend
         QString respName = "REGISTER_VIEWER_ACK";
         PBMSharedPtr msg = ack;
-        bool success = false;
-        size_t requiredSize = 0;
-        std::vector<char> tmpResult = _serializeToArray(respName, eventId, msg, success, requiredSize);
-        if (success) {
-            // convert the std::vector<char> to QByteArray
-            char* tmpMessage = &tmpResult[0];
-            QByteArray result = QByteArray::fromRawData(tmpMessage, requiredSize);
-            ws->sendBinaryMessage(result);
-            qDebug() << "[SessionDispatcher] Send event:" << respName<< ", Id=" << eventId << ", length=" << requiredSize << QTime::currentTime().toString();
-        }
+        Carta::Core::SendBufferPool::FramePtr frame = Carta::Core::SendBufferPool::instance().serialize(respName, eventId, msg);
+        _getQueue(ws)->push(respName, frame, QString(), false);
+        qDebug() << "[SessionDispatcher] Send event:" << respName<< ", Id=" << eventId << ", length=" << frame->size() << QTime::currentTime().toString();
 
         return;
     } // end of "REGISTER_VIEWER" block
 
-    NewServerConnector* connector= sessionList[ws];
+    auto session = sessionList.find(ws);
+    NewServerConnector* connector = session != sessionList.end() ? session->second : nullptr;
 
     if (!connector) {
         qCritical("[SessionDispatcher] Cannot find the server connector");
         return;
     }
 
-    if (connector != nullptr) {
-        if (eventName == "FILE_LIST_REQUEST") {
-
-            CARTA::FileListRequest fileListRequest;
-            fileListRequest.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
-            emit connector->fileListRequestSignal(eventId, fileListRequest);
-
-        } else if (eventName == "FILE_INFO_REQUEST") {
-
-            CARTA::FileInfoRequest fileInfoRequest;
-            fileInfoRequest.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
-            emit connector->fileInfoRequestSignal(eventId, fileInfoRequest);
-
-        } else if (eventName == "OPEN_FILE") {
-
-            CARTA::OpenFile openFile;
-            openFile.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
-            QString fileDir = QString::fromStdString(openFile.directory());
-            QString fileName = QString::fromStdString(openFile.file());
-            int fileId = openFile.file_id();
-            // If the histograms correspond to the entire current 2D image, the region ID has a value of -1.
-            int regionId = -1;
-            qDebug() << "[SessionDispatcher] Open the image file" << fileDir + "/" + fileName << "(fileId=" << fileId << ")";
-            emit connector->openFileSignal(eventId, fileDir, fileName, fileId, regionId);
-
-        } else if (eventName == "SET_IMAGE_VIEW") {
-
-            CARTA::SetImageView viewSetting;
-            viewSetting.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
-            int fileId = viewSetting.file_id();
-            int mip = viewSetting.mip();
-            int xMin = viewSetting.image_bounds().x_min();
-            int xMax = viewSetting.image_bounds().x_max();
-            int yMin = viewSetting.image_bounds().y_min();
-            int yMax = viewSetting.image_bounds().y_max();
-            qDebug() << "[SessionDispatcher] Set image bounds [x_min, x_max, y_min, y_max, mip]=["
-                     << xMin << "," << xMax << "," << yMin << "," << yMax << "," << mip << "], fileId=" << fileId;
-
-            int numSubsets = viewSetting.num_subsets();
-            int precision = lround(viewSetting.compression_quality());
-            bool isZFP = (viewSetting.compression_type() == CARTA::CompressionType::ZFP) ? true : false;
-
-            emit connector->setImageViewSignal(eventId, fileId, xMin, xMax, yMin, yMax, mip, isZFP, precision, numSubsets);
-
-        } else if (eventName == "SET_IMAGE_CHANNELS") {
-
-            CARTA::SetImageChannels setImageChannels;
-            setImageChannels.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
-            int fileId = setImageChannels.file_id();
-            int channel = setImageChannels.channel();
-            int stoke = setImageChannels.stokes();
-            qDebug() << "[SessionDispatcher] Set image channel=" << channel << ", fileId=" << fileId << ", stoke=" << stoke;
-            emit connector->imageChannelUpdateSignal(eventId, fileId, channel, stoke);
-
-        } else if (eventName == "SET_CURSOR") {
-
-            CARTA::SetCursor setCursor;
-            setCursor.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
-            int fileId = setCursor.file_id();
-            CARTA::Point point = setCursor.point();
-            CARTA::SetSpatialRequirements spatialReqs = setCursor.spatial_requirements();
-            qDebug() << "[SessionDispatcher] Set cursor fileId=" << fileId << ", point=(" << point.x() << ", " << point.y() << ")";
-            emit connector->setCursorSignal(eventId, fileId, point, spatialReqs);
-
-        } else if (eventName == "SET_SPATIAL_REQUIREMENTS") {
-
-            CARTA::SetSpatialRequirements setSpatialRequirements;
-            setSpatialRequirements.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
-            int fileId = setSpatialRequirements.file_id();
-            int regionId = setSpatialRequirements.region_id();
-            google::protobuf::RepeatedPtrField<std::string> spatialProfiles = setSpatialRequirements.spatial_profiles();
-            qDebug() << "[SessionDispatcher] Set Spatial Requirements fileId=" << fileId << ", regionId=" << regionId;
-            for(auto iter = spatialProfiles.begin(); iter != spatialProfiles.end(); iter++) {
-                qDebug() << "[SessionDispatcher] Spatial profile="  << QString::fromStdString(*iter);
-            }
-            emit connector->setSpatialRequirementsSignal(eventId, fileId, regionId, spatialProfiles);
-
-        } else if (eventName == "SET_SPECTRAL_REQUIREMENTS") {
-
-            CARTA::SetSpectralRequirements setSpectralRequirements;
-            setSpectralRequirements.ParseFromArray(message + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, length - EVENT_NAME_LENGTH - EVENT_ID_LENGTH);
-            int fileId = setSpectralRequirements.file_id();
-            int regionId = setSpectralRequirements.region_id();
-            google::protobuf::RepeatedPtrField<CARTA::SetSpectralRequirements_SpectralConfig> spectralProfiles = setSpectralRequirements.spectral_profiles();
-            qDebug() << "[SessionDispatcher] Set Spectral Requirements fileId=" << fileId << ", regionId=" << regionId;
-            for(auto iter = spectralProfiles.begin(); iter != spectralProfiles.end(); iter++) {
-                qDebug() << "[SessionDispatcher] Spectral profile coordinate="  << QString::fromStdString(iter->coordinate());
-                auto stats_types = iter->stats_types();
-                for(auto statIter = stats_types.begin(); statIter != stats_types.end(); statIter++) {
-                    qDebug() << "[SessionDispatcher] Statistic types="  << QString(*statIter);
-                }
-            }
-            emit connector->setSpectralRequirementsSignal(eventId, fileId, regionId, spectralProfiles);
-
-        } else {
-            qCritical() << "[SessionDispatcher] There is no event handler:" << eventName;
-            //emit connector->onBinaryMessageSignal(message, length);
-        }
-    }
+    // the message is parsed on the thread of the session, the byte array is shared
+    // and not copied
+    emit connector->onBinaryMessageSignal(qByteMessage);
 }
 
 void SessionDispatcher::forwardTextMessageResult(QString result) {
-    QWebSocket* ws = nullptr;
-    NewServerConnector* connector = qobject_cast<NewServerConnector*>(sender());
-    std::map<QWebSocket*, NewServerConnector*>::iterator iter;
-    for (iter = sessionList.begin(); iter != sessionList.end(); ++iter) {
-        if (iter->second == connector) {
-            ws = iter->first;
-            break;
-        }
-    }
+    QWebSocket* ws = _getSocket(sender());
     if (ws) {
         ws->sendTextMessage(result);
     } else {
@@ -367,33 +319,104 @@ void SessionDispatcher::forwardTextMessageResult(QString result) {
     }
 }
 
-void SessionDispatcher::forwardBinaryMessageResult(QString respName, uint32_t eventId, PBMSharedPtr protoMsg) {
-    QWebSocket* ws = nullptr;
-    NewServerConnector* connector = qobject_cast<NewServerConnector*>(sender());
-    std::map<QWebSocket*, NewServerConnector*>::iterator iter;
-    for (iter = sessionList.begin(); iter != sessionList.end(); ++iter){
-        if (iter->second == connector){
-            ws = iter->first;
-            break;
-        }
-    }
+void SessionDispatcher::forwardBinaryMessageResult(QString respName, uint32_t eventId, Carta::Core::SendBufferPool::FramePtr frame, QString supersedeKey, bool droppable) {
+    QWebSocket* ws = _getSocket(sender());
     if (ws) {
-        // send serialized message to the frontend
-        bool success = false;
-        size_t requiredSize = 0;
-        std::vector<char> message = _serializeToArray(respName, eventId, protoMsg, success, requiredSize);
-        if (success) {
-            // convert the std::vector<char> to QByteArray
-            char* tmpMessage = &message[0];
-            QByteArray result = QByteArray::fromRawData(tmpMessage, requiredSize);
-            ws->sendBinaryMessage(result);
-            qDebug() << "[SessionDispatcher] Send event: Name=" << respName << ", Id=" << eventId << ", length=" << requiredSize << ", Time=" << QTime::currentTime().toString();
+        // the message was serialized by the session; the queue hands the frame to the
+        // socket as soon as the socket has room for it, replacing frames that are
+        // superseded while they wait
+        if (!_getQueue(ws)->push(respName, frame, supersedeKey, droppable)) {
+            // the client cannot keep up, the session can be resumed on a new connection
+            if (ws->state() == QAbstractSocket::ConnectedState) {
+                ws->close(QWebSocketProtocol::CloseCodePolicyViolated, "Client is too slow");
+            }
+            return;
         }
+        qDebug() << "[SessionDispatcher] Queue event: Name=" << respName << ", Id=" << eventId << ", length=" << frame->size() << ", Time=" << QTime::currentTime().toString();
     } else {
         qDebug() << "[SessionDispatcher] ERROR! Cannot find the corresponding websocket!";
     }
 }
 
+QWebSocket* SessionDispatcher::_getSocket(QObject* connector) const {
+    auto iter = socketList.find(qobject_cast<NewServerConnector*>(connector));
+    if (iter == socketList.end()) {
+        return nullptr;
+    }
+    return iter->second;
+}
+
+OutboundQueue* SessionDispatcher::_getQueue(QWebSocket* ws) {
+    std::unique_ptr<OutboundQueue>& queue = queueList[ws];
+    if (!queue) {
+        // the socket copies the frame into its own buffer, so the frame may go back to
+        // the pool right after
+        queue.reset(new OutboundQueue([ws](const Carta::Core::SendBufferPool::FramePtr& frame) {
+            ws->sendBinaryMessage(frame->bytes());
+        }));
+    }
+    return queue.get();
+}
+
+OutboundQueue::Stats SessionDispatcher::getOutboundStats() const {
+    OutboundQueue::Stats total = m_closedQueueStats;
+    for (const auto& entry : queueList) {
+        OutboundQueue::Stats stats = entry.second->getStats();
+        total.depth += stats.depth;
+        total.bytes += stats.bytes;
+        total.inFlight += stats.inFlight;
+        total.sent += stats.sent;
+        total.coalesced += stats.coalesced;
+        total.dropped += stats.dropped;
+        total.closed += stats.closed;
+    }
+    return total;
+}
+
+void SessionDispatcher::onStatsTimer() {
+    qDebug() << "[SessionDispatcher] Image reader locks:" << casa_lock_stats.acquisitions.load() << "acquired,"
+             << casa_lock_stats.contended.load() << "contended, waited"
+             << casa_lock_stats.waitNanoSeconds.load() / 1000000 << "ms";
+
+    quint64 cancelledJobs = 0;
+    quint64 coalescedCursors = 0;
+    mutex.lock();
+    for (const auto& client : clientList) {
+        NewServerConnector* connector = dynamic_cast<NewServerConnector*>(client.second);
+        if (connector) {
+            cancelledJobs += connector->getCancelledJobCount();
+            coalescedCursors += connector->getCoalescedCursorCount();
+        }
+    }
+    int sessions = clientList.size();
+    mutex.unlock();
+    qDebug() << "[SessionDispatcher] Jobs superseded before they finished:" << cancelledJobs
+             << "in" << sessions << "sessions";
+    qDebug() << "[SessionDispatcher] Cursor positions replaced by a newer one before they were computed:"
+             << coalescedCursors;
+
+    OutboundQueue::Stats outbound = getOutboundStats();
+    qDebug() << "[SessionDispatcher] Outbound frames:" << outbound.sent << "sent,"
+             << outbound.coalesced << "replaced by newer ones," << outbound.dropped << "dropped,"
+             << outbound.depth << "waiting (" << outbound.bytes << "bytes )," << outbound.inFlight
+             << "bytes in flight," << outbound.closed << "sessions closed for being too slow";
+
+    const Carta::Core::FrameRenderCache& frameCache = Carta::Core::FrameRenderCache::instance();
+    qDebug() << "[SessionDispatcher] Frame render cache:" << frameCache.getEntryCount() << "frames,"
+             << frameCache.getUsedBytes() / (1024 * 1024) << "of" << frameCache.getMaxBytes() / (1024 * 1024) << "MB,"
+             << frameCache.getHitCount() << "hits," << frameCache.getMissCount() << "misses,"
+             << frameCache.getEvictionCount() << "evictions";
+
+    auto res = Globals::instance()->pluginManager()
+               ->prepare<Carta::Lib::Hooks::GetPersistentCache>().first();
+    if (!res.isNull() && res.val()) {
+        std::shared_ptr<Carta::Lib::IPCache> diskCache = res.val();
+        qDebug() << "[SessionDispatcher] Persistent cache:" << diskCache->nEntries() << "entries,"
+                 << diskCache->usedStorage() / (1024 * 1024) << "of" << diskCache->maxStorage() / (1024 * 1024) << "MB,"
+                 << diskCache->nEvictions() << "evictions";
+    }
+}
+
 IConnector* SessionDispatcher::getConnectorInMap(const QString & sessionID) {
     mutex.lock();
     auto iter = clientList.find(sessionID);
@@ -414,26 +437,6 @@ void SessionDispatcher::setConnectorInMap(const QString & sessionID, IConnector
     mutex.unlock();
 }
 
-std::vector<char> SessionDispatcher::_serializeToArray(QString respName, uint32_t eventId, PBMSharedPtr msg, bool &success, size_t &requiredSize) {
-    success = false;
-    std::vector<char> result;
-    size_t messageLength = msg->ByteSize();
-    requiredSize = EVENT_NAME_LENGTH + EVENT_ID_LENGTH + messageLength;
-    if (result.size() < requiredSize) {
-        result.resize(requiredSize);
-    }
-    memset(result.data(), 0, EVENT_NAME_LENGTH);
-    memcpy(result.data(), respName.toStdString().c_str(), std::min<size_t>(respName.length(), EVENT_NAME_LENGTH));
-    memcpy(result.data() + EVENT_NAME_LENGTH, &eventId, EVENT_ID_LENGTH);
-    if (msg) {
-        msg->SerializeToArray(result.data() + EVENT_NAME_LENGTH + EVENT_ID_LENGTH, messageLength);
-        success = true;
-        //emit jsBinaryMessageResultSignal(result.data(), requiredSize);
-        //qDebug() << "Send event:" << respName << QTime::currentTime().toString();
-    }
-    return result;
-}
-
 // //TODO implement later
 // void SessionDispatcher::jsSendKeepAlive(){
 // //    qDebug() << "get keepalive packet !!!!";
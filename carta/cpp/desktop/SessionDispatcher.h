@@ -7,8 +7,12 @@
 #define SESSION_DISPATCHER_H
 
 #include <QObject>
+#include <QTimer>
 #include <qmutex.h>
+#include <memory>
+#include <unordered_map>
 #include "NewServerConnector.h"
+#include "OutboundQueue.h"
 
 #include "core/IConnector.h"
 #include "CartaLib/IRemoteVGView.h"
@@ -56,6 +60,11 @@ public:
     IConnector* getConnectorInMap(const QString & sessionID) override;
     void setConnectorInMap(const QString & sessionID, IConnector *connector) override;
 
+    /**
+     * Returns the counters of the outbound queues, summed over all the sessions.
+     */
+    OutboundQueue::Stats getOutboundStats() const;
+
 protected:
 
     std::map<QString, IConnector*> clientList;
@@ -65,9 +74,19 @@ private:
     QMutex mutex;
     QWebSocketServer *m_pWebSocketServer;
     // prevent being accessed by other to avoid thread-safety problem
-    std::map<QWebSocket*, NewServerConnector*> sessionList;
-
-    std::vector<char> _serializeToArray(QString respName, uint32_t eventId, PBMSharedPtr msg, bool &success, size_t &requiredSize);
+    std::unordered_map<QWebSocket*, NewServerConnector*> sessionList;
+    // reverse index of sessionList, to find the socket of a message
+    std::unordered_map<NewServerConnector*, QWebSocket*> socketList;
+    // frames waiting for each socket
+    std::unordered_map<QWebSocket*, std::unique_ptr<OutboundQueue> > queueList;
+    // counters of the queues of closed sockets
+    OutboundQueue::Stats m_closedQueueStats;
+    // logs the counters of the process once in a while
+    QTimer m_statsTimer;
+    static const int STATS_INTERVAL_MS;
+
+    QWebSocket* _getSocket(QObject* connector) const;
+    OutboundQueue* _getQueue(QWebSocket* ws);
 
 private slots:
 
@@ -75,7 +94,10 @@ private slots:
     void onTextMessage(QString);
     void onBinaryMessage(QByteArray qByteMessage);
     void forwardTextMessageResult(QString);
-    void forwardBinaryMessageResult(QString respName, uint32_t eventId, PBMSharedPtr protoMsg);
+    void forwardBinaryMessageResult(QString respName, uint32_t eventId, Carta::Core::SendBufferPool::FramePtr frame, QString supersedeKey, bool droppable);
+    void onBytesWritten(qint64 bytes);
+    void onDisconnected();
+    void onStatsTimer();
 };
 
 
@@ -9,13 +9,17 @@ HEADERS += \
     DesktopPlatform.h \
     NewServerConnector.h \
     SessionDispatcher.h \
-    NewServerConnector.h
+    NewServerConnector.h \
+    JobScheduler.h \
+    OutboundQueue.h
 
 SOURCES += \
     DesktopPlatform.cpp \
     desktopMain.cpp \
     NewServerConnector.cpp \
-    SessionDispatcher.cpp
+    SessionDispatcher.cpp \
+    JobScheduler.cpp \
+    OutboundQueue.cpp
 
 HEADERS += \
     websockettransport.h \
@@ -23,3 +23,13 @@ cartaII2casaII_float( std::shared_ptr < Carta::Lib::Image::ImageInterface > ii )
 //    qWarning() << "ciif" << ciif;
 //    return ciif;
 }
+
+QMutex *
+cartaII2storageMutex( std::shared_ptr < Carta::Lib::Image::ImageInterface > ii )
+{
+    CCImageBase * base = dynamic_cast<CCImageBase*>( ii.get());
+    if( ! base) {
+        return nullptr;
+    }
+    return & base-> storageMutex();
+}
@@ -8,6 +8,7 @@
 #include "CartaLib/IImage.h"
 #include "CartaLib/AxisInfo.h"
 #include "CCRawView.h"
+#include "CCReaderPool.h"
 #include "CCMetaDataInterface.h"
 #include "casacore/images/Images/ImageInterface.h"
 #include "casacore/images/Images/ImageUtilities.h"
@@ -44,6 +45,20 @@ public:
 
     virtual casacore::ImageInfo getImageInfo() const = 0;
 
+    /**
+     * Returns the lock guarding the storage behind getCasaImage(). Code reading pixels
+     * from getCasaImage() directly has to hold it (after casa_mutex), so that it does
+     * not race with the readers used by the raw views.
+     * @return the storage lock
+     */
+    virtual QMutex & storageMutex() = 0;
+
+    /**
+     * Returns how much the pixel readers of this image had to wait for each other.
+     * @return reader pool counters
+     */
+    virtual CCReaderStats readerStats() const = 0;
+
 //    virtual casacore::ImageInterface<casacore::Float> * getCasaIIfloat() = 0;
 
 
@@ -106,10 +121,11 @@ public:
 
         //Make a new image and copy the data into it.
         casacore::ImageInterface<PType>* newImage = new casacore::TempImage<PType>(casacore::TiledShape( newShape), coordSys);
-        casacore::Array<PType> dataCopy = m_casaII->get();
+        auto reader = m_readerPool->acquire();
+        casacore::Array<PType> dataCopy = reader->get();
         newImage->put( reorderArray( dataCopy, newOrder ));
-        if ( m_casaII->hasPixelMask()){
-            std::unique_ptr<casacore::Lattice<casacore::Bool> > maskLattice( m_casaII->pixelMask().clone());
+        if ( reader->hasPixelMask()){
+            std::unique_ptr<casacore::Lattice<casacore::Bool> > maskLattice( reader->pixelMask().clone());
             casacore::Array<casacore::Bool> maskCopy = maskLattice->get();
             dynamic_cast< casacore::TempImage<PType> *>(newImage)->attachMask( casacore::ArrayLattice<casacore::Bool>(reorderArray( maskCopy, newOrder )));
         }
@@ -193,42 +209,8 @@ public:
     static CCImage::SharedPtr
     create( casacore::ImageInterface < PType > * casaImage )
     {
-
-        // create an image interface instance and populate it with various
-        // values from casacore::ImageInterface
         CCImage::SharedPtr img = std::make_shared < CCImage < PType > > ();
-        casa_mutex.lock();
-
-        img-> m_pixelType = Carta::Lib::Image::CType2PixelType < PType >::type;
-        img-> m_dims      = casaImage-> shape().asStdVector();
-        img-> m_casaII    = casaImage;
-        img-> m_unit      = Carta::Lib::Unit( casaImage-> units().getName().c_str() );
-        img-> m_type      = casaImage->imageType().c_str();
-
-        // get title and escape html characters in case there are any
-        QString htmlTitle = casaImage->imageInfo().objectName().c_str();
-        htmlTitle = htmlTitle.toHtmlEscaped();
-
-        // make our own copy of the coordinate system using 'clone'
-        std::shared_ptr<casacore::CoordinateSystem> casaCS(
-                    static_cast<casacore::CoordinateSystem *> (casaImage->coordinates().clone()));
-        casa_mutex.unlock();
-
-        // construct a meta data instance
-        img-> m_meta = std::make_shared < CCMetaDataInterface > ( htmlTitle, casaCS );
-
-        /// \todo remove this test code
-       /* casacore::Record rec;
-        if( ! casaCS-> save( rec, "")) {
-            std::string err = casaCS-> errorMessage();
-            qWarning() << "Could not serialize coordinate system";
-        }
-        else {
-            rec.print( std::cerr);
-            casacore::AipsIO os("/tmp/file.name", casacore::ByteIO::New);
-            rec.putRecord( os);
-        }*/
-
+        img-> init( casaImage );
         return img;
     } // create
 
@@ -242,8 +224,31 @@ public:
                return m_casaII->imageInfo();
            }
 
+    virtual QMutex &
+    storageMutex() override
+    {
+        return m_readerPool-> storageMutex();
+    }
+
+    virtual CCReaderStats
+    readerStats() const override
+    {
+        return m_readerPool-> stats();
+    }
+
     virtual
     ~CCImage() {
+        if ( m_readerPool ) {
+            CCReaderStats stats = readerStats();
+            if ( stats.contended > 0 ) {
+                qDebug() << "<> Readers of" << CCReaderPool < PType >::storageName( m_casaII )
+                         << "waited" << stats.contended << "of" << stats.leases << "times,"
+                         << stats.waitNanoSeconds / 1000000 << "ms in total," << stats.readers << "readers";
+            }
+        }
+
+        // the readers are clones of m_casaII, release them first
+        m_readerPool.reset();
         if(m_casaII != nullptr)
         {
             delete m_casaII;
@@ -262,6 +267,46 @@ public:
     }
 
 protected:
+    /// populates the instance with various values from casacore::ImageInterface,
+    /// for create() and the factories of derived classes
+    void
+    init( casacore::ImageInterface < PType > * casaImage )
+    {
+        casa_mutex.lock();
+
+        m_pixelType = Carta::Lib::Image::CType2PixelType < PType >::type;
+        m_dims      = casaImage-> shape().asStdVector();
+        m_casaII    = casaImage;
+        m_unit      = Carta::Lib::Unit( casaImage-> units().getName().c_str() );
+        m_type      = casaImage->imageType().c_str();
+        m_readerPool.reset( new CCReaderPool < PType > ( casaImage ) );
+
+        // get title and escape html characters in case there are any
+        QString htmlTitle = casaImage->imageInfo().objectName().c_str();
+        htmlTitle = htmlTitle.toHtmlEscaped();
+
+        // make our own copy of the coordinate system using 'clone'
+        std::shared_ptr<casacore::CoordinateSystem> casaCS(
+                    static_cast<casacore::CoordinateSystem *> (casaImage->coordinates().clone()));
+        casa_mutex.unlock();
+
+        // construct a meta data instance
+        m_meta = std::make_shared < CCMetaDataInterface > ( htmlTitle, casaCS );
+
+        /// \todo remove this test code
+       /* casacore::Record rec;
+        if( ! casaCS-> save( rec, "")) {
+            std::string err = casaCS-> errorMessage();
+            qWarning() << "Could not serialize coordinate system";
+        }
+        else {
+            rec.print( std::cerr);
+            casacore::AipsIO os("/tmp/file.name", casacore::ByteIO::New);
+            rec.putRecord( os);
+        }*/
+
+    } // init
+
     /// type of the image data
     Carta::Lib::Image::PixelType m_pixelType;
 
@@ -279,6 +324,9 @@ protected:
 
     QString m_type;
 
+    /// readers used for pixel access from the raw views
+    std::unique_ptr < CCReaderPool < PType > > m_readerPool;
+
     /// we want CCRawView to access our internals...
     /// \todo maybe we just need a public accessor, no? I don't like friends :) (Pavol)
     friend class CCRawView < PType >;
@@ -287,3 +335,8 @@ protected:
 /// helper to convert carta's image to casacore image interface
 casacore::ImageInterface<casacore::Float> *
 cartaII2casaII_float( std::shared_ptr<Carta::Lib::Image::ImageInterface> ii) ;
+
+/// helper to find the storage lock of carta's image, returns nullptr if the image
+/// was not created by this plugin
+QMutex *
+cartaII2storageMutex( std::shared_ptr<Carta::Lib::Image::ImageInterface> ii) ;
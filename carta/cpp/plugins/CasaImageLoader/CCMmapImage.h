@@ -0,0 +1,63 @@
+/**
+ *
+ **/
+
+#pragma once
+
+#include "CCImage.h"
+#include "FitsMmapData.h"
+#include "FitsMmapRawView.h"
+
+/// A plain FITS image whose pixels are read from the memory mapped file.
+///
+/// casacore still opens the file, for the coordinate system and the rest of the
+/// meta data, and for the code that needs a casacore::ImageInterface (statistics,
+/// regions, getPermuted()). Only the raw views handed out by getDataSlice() bypass
+/// casacore's FITS reader.
+class CCMmapImage
+    : public CCImage < float >
+{
+    CLASS_BOILERPLATE( CCMmapImage );
+
+public:
+
+    /// call this to create an instance of this class, do not use constructor
+    /// \param casaImage the image as opened by casacore, the instance takes ownership
+    /// \param data the same file mapped into memory, has to have the shape of casaImage
+    static CCMmapImage::SharedPtr
+    create( casacore::ImageInterface < float > * casaImage, FitsMmapData::SharedPtr data )
+    {
+        CCMmapImage::SharedPtr img = std::make_shared < CCMmapImage > ();
+        img-> init( casaImage );
+        img-> m_mmap = data;
+        return img;
+    }
+
+    virtual Carta::Lib::NdArray::RawViewInterface *
+    getDataSlice( const SliceND & sliceInfo ) override
+    {
+        return new FitsMmapRawView( m_mmap, sliceInfo );
+    }
+
+    /// counters of the plane cache of the mapped file
+    FitsMmapStats
+    mmapStats() const
+    {
+        return m_mmap-> stats();
+    }
+
+    virtual
+    ~CCMmapImage()
+    {
+        if ( m_mmap ) {
+            FitsMmapStats stats = mmapStats();
+            qDebug() << "<> Mapped planes of" << m_mmap-> fileName() << ":" << stats.planeHits << "hits,"
+                     << stats.planeMisses << "misses," << stats.directValues << "values read directly,"
+                     << FitsMmapData::cacheBytes() / ( 1024 * 1024 ) << "MB cached for all the files";
+        }
+    }
+
+private:
+
+    FitsMmapData::SharedPtr m_mmap;
+};
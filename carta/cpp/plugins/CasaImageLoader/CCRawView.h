@@ -68,21 +68,23 @@ public:
         return new CCRawView( m_ccimage, newAr);
     }
 
+    /// reads the next buffSize bytes (rounded down to whole pixels) of the view
     virtual int64_t
     read( int64_t buffSize, char * buff,
           Traversal traversal = Traversal::Sequential ) override
     {
-        Q_UNUSED( buffSize);
-        Q_UNUSED( buff);
         Q_UNUSED( traversal);
-        qFatal( "not implemented");
+        int64_t count = readElements( m_readPos, buffSize / int64_t( sizeof( PType ) ),
+                                      reinterpret_cast < PType * > ( buff ) );
+        m_readPos += count;
+        return count * sizeof( PType );
     }
 
+    /// \param ind index of the element the next read() starts at
     virtual void
     seek(int64_t ind) override
     {
-        Q_UNUSED( ind);
-        qFatal( "not implemented");
+        m_readPos = ind;
     }
 
     /// another high performance accessor to data
@@ -92,11 +94,11 @@ public:
     read( int64_t chunk, int64_t buffSize, char * buff,
           Traversal traversal = Traversal::Sequential ) override
     {
-        Q_UNUSED( chunk );
-        Q_UNUSED( buffSize );
-        Q_UNUSED( buff );
         Q_UNUSED( traversal );
-        qFatal( "not implemented" );
+        int64_t chunkElements = buffSize / int64_t( sizeof( PType ) );
+        int64_t count = readElements( chunk * chunkElements, chunkElements,
+                                      reinterpret_cast < PType * > ( buff ) );
+        return count * sizeof( PType );
     }
 
     /// yet another high performance accessor... similar to forEach above,
@@ -107,17 +109,18 @@ public:
         int64_t buffSize,
         std::function < void (const char *, int64_t count) > func,
         char * buff = nullptr,
-        Traversal traversal = Traversal::Sequential ) override
-    {
-        Q_UNUSED( buffSize );
-        Q_UNUSED( func );
-        Q_UNUSED( buff );
-        Q_UNUSED( traversal );
-        qFatal( "not implemented" );
-    }
+        Traversal traversal = Traversal::Sequential ) override;
 
 protected:
 
+    /// read count elements starting at element start (in sequential order) into out
+    /// \return number of elements actually read
+    int64_t
+    readElements( int64_t start, int64_t count, PType * out );
+
+    /// position of the next stateful read()
+    int64_t m_readPos = 0;
+
     /// construct a view directly from applied slice
     CCRawView( CCImage < PType > * ccimage, const SliceND::ApplyResult & applyResult );
 
@@ -198,14 +201,12 @@ CCRawView < PType >::get( const Carta::Lib::NdArray::RawViewInterface::VI & pos
                        + p * m_appliedSlice.dims()[i].step;
     }
 
-    casa_mutex.lock();
+    auto reader = m_ccimage-> m_readerPool-> acquire();
 
     // casacore::ImageInterface::operator() returns the result by value
     // so in order to return reference (to satisfy our API) we need to store this
     // in a buffer first...
-    m_buff = m_ccimage-> m_casaII->
-                 operator() ( m_destPos );
-    casa_mutex.unlock();
+    m_buff = reader-> operator() ( m_destPos );
 
     return reinterpret_cast < const char * > ( & m_buff );
 } // get
@@ -251,8 +252,10 @@ CCRawView < PType >::forEach(
     }
     stepper.subSection( blc, trc, inc );
 
-    casa_mutex.lock();
-    casacore::RO_LatticeIterator < PType > iterator( * casaII, stepper );
+    // each thread iterates over its own reader, so views of the same image can be
+    // traversed in parallel
+    auto reader = m_ccimage-> m_readerPool-> acquire();
+    casacore::RO_LatticeIterator < PType > iterator( * reader, stepper );
 
     for ( iterator.reset() ; ! iterator.atEnd() ; iterator++ ) {
         const auto & cursor = iterator.cursor();
@@ -260,9 +263,158 @@ CCRawView < PType >::forEach(
             func( reinterpret_cast < const char * > ( & val ) );
         }
     }
-    casa_mutex.unlock();
 } // forEach
 
+template < typename PType >
+void
+CCRawView < PType >::forEach(
+    int64_t buffSize,
+    std::function < void (const char *, int64_t count) > func,
+    char * buff,
+    Carta::Lib::NdArray::RawViewInterface::Traversal traversal )
+{
+    if ( traversal != Carta::Lib::NdArray::RawViewInterface::Traversal::Sequential ) {
+        qFatal( "sorry, not implemented yet" );
+    }
+    const int64_t capacity = buffSize / int64_t( sizeof( PType ) );
+    if ( capacity <= 0 ) {
+        throw std::runtime_error( "buffer too small" );
+    }
+
+    auto casaII     = m_ccimage-> m_casaII;
+    int imgDims     = casaII-> ndim();
+    auto imageShape = casaII-> shape();
+
+    // same cursor shape as the per-element forEach(), so the order is identical
+    casacore::IPosition cursorShape( imgDims );
+    auto shapeVec = imageShape.asVector();
+    for ( int i = 0 ; i < imgDims ; i++ ) {
+        cursorShape( i ) = ( i == 0 || i == 1 ) ? shapeVec( i ) : std::min( shapeVec( i ), 16 );
+    }
+
+    casacore::LatticeStepper stepper( imageShape, cursorShape, casacore::LatticeStepper::RESIZE );
+    casacore::IPosition blc( imgDims, 0 );
+    auto trc = blc;
+    auto inc = blc;
+    for ( int i = 0 ; i < imgDims ; i++ ) {
+        const auto & slice1d = m_appliedSlice.dims()[i];
+        blc( i ) = slice1d.start;
+        trc( i ) = slice1d.end();
+        inc( i ) = slice1d.step;
+    }
+    stepper.subSection( blc, trc, inc );
+
+    // only allocate our own buffer if we need one (i.e. non-contiguous cursors)
+    std::vector < PType > ownBuffer;
+    PType * typedBuff = reinterpret_cast < PType * > ( buff );
+
+    auto reader = m_ccimage-> m_readerPool-> acquire();
+    casacore::RO_LatticeIterator < PType > iterator( * reader, stepper );
+
+    for ( iterator.reset() ; ! iterator.atEnd() ; iterator++ ) {
+        const casacore::Array < PType > & cursor = iterator.cursor();
+        const int64_t cursorSize = cursor.nelements();
+
+        // contiguous cursors are handed out directly in capacity sized pieces
+        if ( cursor.contiguousStorage() ) {
+            const PType * data = cursor.data();
+            for ( int64_t offset = 0 ; offset < cursorSize ; offset += capacity ) {
+                int64_t count = std::min( capacity, cursorSize - offset );
+                func( reinterpret_cast < const char * > ( data + offset ), count );
+            }
+            continue;
+        }
+
+        // otherwise copy through the buffer
+        if ( ! typedBuff ) {
+            ownBuffer.resize( capacity );
+            typedBuff = ownBuffer.data();
+        }
+        int64_t count = 0;
+        for ( const auto & val : cursor ) {
+            typedBuff[count++] = val;
+            if ( count == capacity ) {
+                func( reinterpret_cast < const char * > ( typedBuff ), count );
+                count = 0;
+            }
+        }
+        if ( count > 0 ) {
+            func( reinterpret_cast < const char * > ( typedBuff ), count );
+        }
+    }
+} // forEach
+
+template < typename PType >
+int64_t
+CCRawView < PType >::readElements( int64_t start, int64_t count, PType * out )
+{
+    const int nDims = m_viewDims.size();
+    int64_t total = 1;
+    for ( auto d : m_viewDims ) {
+        total *= d;
+    }
+    if ( start < 0 || start >= total || count <= 0 ) {
+        return 0;
+    }
+    count = std::min( count, total - start );
+
+    const int64_t width = m_viewDims[0];
+    const int64_t height = nDims > 1 ? m_viewDims[1] : 1;
+    const auto & sliceDims = m_appliedSlice.dims();
+
+    casacore::IPosition blc( nDims ), shape( nDims ), stride( nDims );
+    for ( int i = 0 ; i < nDims ; i++ ) {
+        stride( i ) = sliceDims[i].step;
+    }
+
+    auto reader = m_ccimage-> m_readerPool-> acquire();
+
+    // read the range as a sequence of boxes: a partial row, whole rows of
+    // one plane, another partial row...
+    int64_t done = 0;
+    while ( done < count ) {
+        // view coordinates of the next element
+        int64_t ind = start + done;
+        int64_t x = ind % width;
+        int64_t rest = ind / width;
+        int64_t y = rest % height;
+        rest /= height;
+        int64_t remaining = count - done;
+
+        int64_t boxWidth, boxRows;
+        if ( x == 0 && remaining >= width ) {
+            boxWidth = width;
+            boxRows = std::min( remaining / width, height - y );
+        }
+        else {
+            boxWidth = std::min( width - x, remaining );
+            boxRows = 1;
+        }
+
+        blc( 0 ) = sliceDims[0].start + x * sliceDims[0].step;
+        shape( 0 ) = boxWidth;
+        if ( nDims > 1 ) {
+            blc( 1 ) = sliceDims[1].start + y * sliceDims[1].step;
+            shape( 1 ) = boxRows;
+        }
+        for ( int i = 2 ; i < nDims ; i++ ) {
+            int64_t p = rest % m_viewDims[i];
+            rest /= m_viewDims[i];
+            blc( i ) = sliceDims[i].start + p * sliceDims[i].step;
+            shape( i ) = 1;
+        }
+
+        casacore::Array < PType > box = reader-> getSlice( blc, shape, stride );
+        bool deleteIt;
+        const PType * data = box.getStorage( deleteIt );
+        std::copy( data, data + box.nelements(), out + done );
+        box.freeStorage( data, deleteIt );
+
+        done += boxWidth * boxRows;
+    }
+    return done;
+} // readElements
+
 template < typename PType >
 const Carta::Lib::NdArray::RawViewInterface::VI &
 CCRawView < PType >::currentPos()
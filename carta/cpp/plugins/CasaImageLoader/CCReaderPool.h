@@ -0,0 +1,290 @@
+/**
+ *
+ **/
+
+#pragma once
+
+#include "casacore/images/Images/ImageInterface.h"
+#include "casacore/images/Images/FITSImage.h"
+#include "casacore/images/Images/MIRIADImage.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QString>
+#include <QDebug>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "CartaLib/UtilCASA.h"
+
+/// snapshot of the reader pool counters of one image
+struct CCReaderStats
+{
+    /// how many times a reader was handed out
+    uint64_t leases = 0;
+
+    /// how many of those had to wait for a reader (or the storage lock)
+    uint64_t contended = 0;
+
+    /// total time spent waiting, in nanoseconds
+    uint64_t waitNanoSeconds = 0;
+
+    /// number of independent readers created so far
+    int readers = 0;
+};
+
+/// Hands out casacore readers for one image, so that pixel access from different
+/// threads (sessions) does not have to go through the global casa_mutex.
+///
+/// There are two modes, depending on the storage behind the image:
+///   - FITS and MIRIAD images keep their own file handles, so every clone of the
+///     image is an independent reader. The pool lazily creates up to
+///     QThread::idealThreadCount() clones and leases them out, reads on different
+///     clones run fully in parallel.
+///   - everything else (PagedImage, HDF5, temporary and expression images) shares
+///     the underlying table between clones, so the primary lattice is leased out
+///     under a per-storage lock (see casa_storage_mutex()). Reads of different
+///     files still proceed in parallel.
+///
+/// Lock order: casa_mutex -> storage mutex -> pool mutex. Readers never take
+/// casa_mutex while holding the storage mutex.
+template < typename PType >
+class CCReaderPool
+{
+public:
+
+    /// RAII handle to a reader, returns it to the pool when destroyed
+    class Lease
+    {
+public:
+
+        Lease( Lease && other )
+            : m_pool( other.m_pool )
+              , m_lattice( other.m_lattice )
+              , m_slot( other.m_slot )
+        {
+            other.m_pool = nullptr;
+        }
+
+        ~Lease()
+        {
+            if ( m_pool ) {
+                m_pool-> release( m_slot );
+            }
+        }
+
+        casacore::ImageInterface < PType > *
+        operator-> () const
+        {
+            return m_lattice;
+        }
+
+        casacore::ImageInterface < PType > &
+        operator* () const
+        {
+            return * m_lattice;
+        }
+
+private:
+
+        friend class CCReaderPool;
+
+        Lease( CCReaderPool * pool, casacore::ImageInterface < PType > * lattice, int slot )
+            : m_pool( pool )
+              , m_lattice( lattice )
+              , m_slot( slot )
+        { }
+
+        Lease( const Lease & ) = delete;
+        Lease & operator= ( const Lease & ) = delete;
+
+        CCReaderPool * m_pool = nullptr;
+        casacore::ImageInterface < PType > * m_lattice = nullptr;
+
+        /// index of the leased clone, or -1 for the primary lattice
+        int m_slot = - 1;
+    };
+
+    /// \param primary the image we read from, we don't own it
+    explicit
+    CCReaderPool( casacore::ImageInterface < PType > * primary )
+        : m_primary( primary )
+    {
+        m_independent = dynamic_cast < casacore::FITSImage * > ( primary ) != nullptr
+                        || dynamic_cast < casacore::MIRIADImage * > ( primary ) != nullptr;
+        m_maxReaders = std::max( 1, QThread::idealThreadCount() );
+        m_storageMutex = & casa_storage_mutex( storageName( primary ) );
+    }
+
+    ~CCReaderPool()
+    {
+        for ( auto reader : m_readers ) {
+            delete reader;
+        }
+    }
+
+    /// lease a reader, blocks until one is available
+    Lease
+    acquire()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        bool contended = false;
+
+        if ( m_independent ) {
+            QMutexLocker locker( & m_mutex );
+
+            // m_independent only changes under m_mutex, when the first clone fails
+            while ( m_independent ) {
+                // reuse an idle reader if there is one
+                for ( size_t i = 0 ; i < m_readers.size() ; i++ ) {
+                    if ( ! m_busy[i] && m_readers[i] ) {
+                        m_busy[i] = true;
+                        locker.unlock();
+                        record( contended, timer.nsecsElapsed() );
+                        return Lease( this, m_readers[i], i );
+                    }
+                }
+
+                // otherwise create a new one if we are allowed to
+                if ( int ( m_readers.size() ) < m_maxReaders ) {
+                    int slot = m_readers.size();
+                    m_readers.push_back( nullptr );
+                    m_busy.push_back( true );
+                    locker.unlock();
+
+                    // cloning touches casacore's shared state, do it without holding
+                    // our own mutex to keep the lock order
+                    casacore::ImageInterface < PType > * clone = nullptr;
+                    casa_mutex.lock();
+                    try {
+                        clone = m_primary-> cloneII();
+                    }
+                    catch ( const casacore::AipsError & error ) {
+                        qWarning() << "Could not clone image reader:" << error.getMesg().c_str();
+                    }
+                    casa_mutex.unlock();
+
+                    locker.relock();
+                    if ( clone ) {
+                        m_readers[slot] = clone;
+                        locker.unlock();
+                        record( contended, timer.nsecsElapsed() );
+                        return Lease( this, clone, slot );
+                    }
+
+                    // cloning failed, leave the slot empty and stay with the readers
+                    // we already have, or with the primary lattice if there are none;
+                    // either way the threads waiting for a slot have to look again
+                    m_busy[slot] = false;
+                    m_maxReaders = 0;
+                    if ( slot == 0 ) {
+                        m_independent = false;
+                    }
+                    m_freeCond.wakeAll();
+                    continue;
+                }
+
+                contended = true;
+                m_freeCond.wait( & m_mutex );
+            }
+        }
+
+        // the primary lattice, the pool mutex is not held here to keep the lock order
+        if ( ! m_storageMutex-> tryLock() ) {
+            contended = true;
+            m_storageMutex-> lock();
+        }
+        record( contended, timer.nsecsElapsed() );
+        return Lease( this, m_primary, - 1 );
+    } // acquire
+
+    /// the lock that serializes access to the storage behind the primary lattice,
+    /// code that reads from the primary lattice directly needs to hold it
+    QMutex &
+    storageMutex() const
+    {
+        return * m_storageMutex;
+    }
+
+    CCReaderStats
+    stats() const
+    {
+        CCReaderStats result;
+        result.leases = m_leases;
+        result.contended = m_contended;
+        result.waitNanoSeconds = m_waitNanoSeconds;
+        QMutexLocker locker( & m_mutex );
+        for ( auto reader : m_readers ) {
+            if ( reader ) {
+                result.readers++;
+            }
+        }
+        return result;
+    }
+
+    /// key under which the storage of the lattice is locked, persistent images
+    /// are identified by their file name, everything else by its address
+    static QString
+    storageName( casacore::ImageInterface < PType > * lattice )
+    {
+        if ( lattice-> isPersistent() ) {
+            return QString( lattice-> name( false ).c_str() );
+        }
+        return QString( "memory:%1" ).arg( quintptr( lattice ), 0, 16 );
+    }
+
+private:
+
+    CCReaderPool( const CCReaderPool & ) = delete;
+    CCReaderPool & operator= ( const CCReaderPool & ) = delete;
+
+    void
+    release( int slot )
+    {
+        if ( slot < 0 ) {
+            m_storageMutex-> unlock();
+            return;
+        }
+        QMutexLocker locker( & m_mutex );
+        m_busy[slot] = false;
+        m_freeCond.wakeOne();
+    }
+
+    void
+    record( bool contended, qint64 waitNs )
+    {
+        m_leases++;
+        casa_lock_stats.acquisitions++;
+        if ( ! contended ) {
+            return;
+        }
+        m_contended++;
+        m_waitNanoSeconds += waitNs;
+        casa_lock_stats.contended++;
+        casa_lock_stats.waitNanoSeconds += waitNs;
+        if ( waitNs > 50 * 1000 * 1000 ) {
+            qDebug() << "<> Waited" << waitNs / 1000000 << "ms for an image reader of"
+                     << storageName( m_primary );
+        }
+    }
+
+    casacore::ImageInterface < PType > * m_primary = nullptr;
+    /// written under m_mutex, read without it on the way to the primary lattice
+    std::atomic < bool > m_independent { false };
+    int m_maxReaders = 1;
+    QMutex * m_storageMutex = nullptr;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_freeCond;
+    std::vector < casacore::ImageInterface < PType > * > m_readers;
+    std::vector < bool > m_busy;
+
+    std::atomic < uint64_t > m_leases { 0 };
+    std::atomic < uint64_t > m_contended { 0 };
+    std::atomic < uint64_t > m_waitNanoSeconds { 0 };
+};
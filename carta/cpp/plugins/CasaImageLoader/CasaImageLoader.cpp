@@ -1,5 +1,6 @@
 #include "CasaImageLoader.h"
 #include "CCImage.h"
+#include "CCMmapImage.h"
 #include "CartaLib/Hooks/Initialize.h"
 #include "CartaLib/Hooks/LoadAstroImage.h"
 #include <QDebug>
@@ -23,6 +24,15 @@ CasaImageLoader::CasaImageLoader(QObject *parent) :
 {
 }
 
+void CasaImageLoader::initialize(const InitInfo & initInfo)
+{
+    // memory for the converted planes of the memory mapped FITS files, all of them together
+    int sizeMB = initInfo.json.value( "mmapCacheSizeMB" ).toInt( -1 );
+    if ( sizeMB > 0 ) {
+        FitsMmapData::setMaxCacheBytes( int64_t( sizeMB ) * 1024 * 1024 );
+    }
+}
+
 bool CasaImageLoader::handleHook(BaseHook & hookData)
 {
     qDebug() << "CasaImageLoader plugin is handling hook #" << hookData.hookId();
@@ -66,6 +76,35 @@ static CCImageBase::SharedPtr tryCast( casacore::LatticeBase * lat)
     return res;
 }
 
+/// plain FITS images get their pixels from a memory map of the file, casacore is only
+/// used for the meta data; returns nullptr if the file cannot be mapped
+static CCImageBase::SharedPtr tryMmap( casacore::LatticeBase * lat, const QString & fname)
+{
+    typedef casacore::ImageInterface<float> CCIT;
+    CCIT * cii = dynamic_cast<CCIT *>(lat);
+    if( ! cii) {
+        return nullptr;
+    }
+    FitsMmapData::SharedPtr data = FitsMmapData::open( fname);
+    if( ! data) {
+        return nullptr;
+    }
+
+    // both have to see the same data unit
+    casacore::IPosition shape = cii->shape();
+    const std::vector<int> & dims = data->dims();
+    bool sameShape = shape.size() == dims.size();
+    for( size_t i = 0; sameShape && i < dims.size(); i++) {
+        sameShape = shape[i] == dims[i];
+    }
+    if( ! sameShape) {
+        qDebug() << "\t-memory map does not match casacore's shape, not used";
+        return nullptr;
+    }
+    qDebug() << "\t-pixels read through a memory map";
+    return CCMmapImage::create( cii, data);
+}
+
 ///
 /// \brief Attempts to load an image using casacore library, namely the very first
 /// frame of it. Then converts the frame to a QImage using 100% histogram clip values.
@@ -147,7 +186,10 @@ Carta::Lib::Image::ImageInterface::SharedPtr CasaImageLoader::loadImage(const QS
     qDebug() << "Float type is " << casacore::TpFloat;
 
     CCImageBase::SharedPtr res;
-    res = tryCast<float>(lat);
+    if (filetype == casacore::ImageOpener::ImageTypes::FITS) {
+        res = tryMmap(lat, fname);
+    }
+    if( ! res) res = tryCast<float>(lat);
     // Please note that the following code will not be reached
     // even if the FITS file is defined in 64 bit
     // and FitsHeaderExtractor::_CasaFitsConverter assumes that
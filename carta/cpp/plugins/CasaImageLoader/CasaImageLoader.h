@@ -16,6 +16,7 @@ class CasaImageLoader : public QObject, public IPlugin
 public:
 
     CasaImageLoader(QObject *parent = 0);
+    virtual void initialize(const InitInfo & initInfo) override;
     virtual bool handleHook(BaseHook & hookData) override;
     virtual std::vector<HookId> getInitialHookList() override;
     virtual ~CasaImageLoader();
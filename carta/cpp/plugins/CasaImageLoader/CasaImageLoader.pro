@@ -2,7 +2,7 @@
   error( "Could not find the common.pri file!" )
 }
 
-QT       += core
+QT       += core gui
 TARGET = plugin
 TEMPLATE = lib
 CONFIG += plugin
@@ -12,14 +12,22 @@ SOURCES += \
     CCImage.cpp \
     CCMetaDataInterface.cpp \
     CCRawView.cpp \
-    CCCoordinateFormatter.cpp
+    CCCoordinateFormatter.cpp \
+    FitsMmapData.cpp \
+    FitsMmapRawView.cpp \
+    ../WcsPlotter/SimpleFitsParser.cpp
 
 HEADERS += \
     CasaImageLoader.h \
     CCImage.h \
+    CCReaderPool.h \
     CCMetaDataInterface.h \
     CCRawView.h \
-    CCCoordinateFormatter.h
+    CCCoordinateFormatter.h \
+    CCMmapImage.h \
+    FitsMmapData.h \
+    FitsMmapRawView.h \
+    ../WcsPlotter/SimpleFitsParser.h
 
 casacoreLIBS += -L$${CASACOREDIR}/lib
 casacoreLIBS += -lcasa_lattices -lcasa_tables -lcasa_scimath -lcasa_scimath_f -lcasa_mirlib
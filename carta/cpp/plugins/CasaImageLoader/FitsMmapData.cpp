@@ -0,0 +1,387 @@
+/**
+ *
+ **/
+
+#include "FitsMmapData.h"
+#include "../WcsPlotter/SimpleFitsParser.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+#include <QtEndian>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+// the AVX2 byte swap is compiled for its own function only and taken if the CPU has
+// it, so that the plugin still runs on older machines
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define FITS_RUNTIME_AVX2 1
+#include <immintrin.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const int64_t FitsMmapData::DEFAULT_MAX_CACHE_BYTES = 256LL * 1024 * 1024;
+
+struct FitsMmapData::SharedCache
+{
+    QMutex mutex;
+
+    /// file and index of every cached plane
+    std::vector < std::pair < FitsMmapData *, int64_t > > planes;
+    int64_t usedBytes = 0;
+    int64_t maxBytes = DEFAULT_MAX_CACHE_BYTES;
+
+    /// ticks on every use of a plane
+    std::atomic < uint64_t > clock { 0 };
+};
+
+namespace
+{
+/// values converted at once through the stack buffer of the wider types
+const int64_t CONVERT_BLOCK = 1024;
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN && defined( FITS_RUNTIME_AVX2 )
+__attribute__( ( target( "avx2" ) ) ) void
+swap32Avx2( const uchar * src, int64_t count, uint32_t * dst )
+{
+    const __m256i order = _mm256_setr_epi8( 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 );
+    int64_t i = 0;
+    for ( ; i + 8 <= count ; i += 8 ) {
+        __m256i v = _mm256_loadu_si256( reinterpret_cast < const __m256i * > ( src + 4 * i ) );
+        _mm256_storeu_si256( reinterpret_cast < __m256i * > ( dst + i ), _mm256_shuffle_epi8( v, order ) );
+    }
+    for ( ; i < count ; i++ ) {
+        dst[i] = qFromBigEndian < quint32 > ( src + 4 * i );
+    }
+}
+
+bool
+haveAvx2()
+{
+    static const bool have = [] () {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports( "avx2" ) != 0;
+    } ();
+    return have;
+}
+#endif
+
+/// big endian 32 bit words to native order
+void
+swap32( const uchar * src, int64_t count, uint32_t * dst )
+{
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    std::memcpy( dst, src, count * 4 );
+#else
+#ifdef FITS_RUNTIME_AVX2
+    if ( haveAvx2() ) {
+        swap32Avx2( src, count, dst );
+        return;
+    }
+#endif
+    int64_t i = 0;
+#ifdef __SSE2__
+    // swap the bytes of the 16 bit halves, then the halves
+    for ( ; i + 4 <= count ; i += 4 ) {
+        __m128i v = _mm_loadu_si128( reinterpret_cast < const __m128i * > ( src + 4 * i ) );
+        v = _mm_or_si128( _mm_slli_epi16( v, 8 ), _mm_srli_epi16( v, 8 ) );
+        v = _mm_shufflehi_epi16( _mm_shufflelo_epi16( v, _MM_SHUFFLE( 2, 3, 0, 1 ) ), _MM_SHUFFLE( 2, 3, 0, 1 ) );
+        _mm_storeu_si128( reinterpret_cast < __m128i * > ( dst + i ), v );
+    }
+#endif
+    for ( ; i < count ; i++ ) {
+        dst[i] = qFromBigEndian < quint32 > ( src + 4 * i );
+    }
+#endif
+}
+
+/// a FITS keyword as a string without the quotes
+QString
+unquoted( const QString & value )
+{
+    QString res = value;
+    res.remove( '\'' );
+    return res.trimmed();
+}
+}
+
+FitsMmapData::FitsMmapData()
+    : m_planeHits( 0 )
+      , m_planeMisses( 0 )
+      , m_directValues( 0 )
+{ }
+
+FitsMmapData::~FitsMmapData()
+{
+    SharedCache & cache = sharedCache();
+    {
+        QMutexLocker locker( & cache.mutex );
+        auto mine = std::remove_if( cache.planes.begin(), cache.planes.end(),
+                                    [this] ( const std::pair < FitsMmapData *, int64_t > & plane ) {
+                                        return plane.first == this;
+                                    } );
+        cache.usedBytes -= int64_t( cache.planes.end() - mine ) * m_planeSize * int64_t( sizeof( float ) );
+        cache.planes.erase( mine, cache.planes.end() );
+    }
+    if ( m_data ) {
+        m_file.unmap( const_cast < uchar * > ( m_data ) );
+    }
+}
+
+FitsMmapData::SharedPtr
+FitsMmapData::open( const QString & fileName )
+{
+    // c++ does not allow make_shared with a private constructor
+    SharedPtr data( new FitsMmapData() );
+    QFile & file = data-> m_file;
+    file.setFileName( fileName );
+    if ( ! file.open( QFile::ReadOnly ) ) {
+        return nullptr;
+    }
+
+    // the header parser reads until it finds END, so we do not let it loose on files
+    // that are not FITS
+    char first[9];
+    if ( file.read( first, sizeof( first ) ) != qint64( sizeof( first ) ) ||
+         std::memcmp( first, "SIMPLE  =", sizeof( first ) ) != 0 ) {
+        return nullptr;
+    }
+    file.seek( 0 );
+
+    int64_t total = 1;
+    qint64 dataOffset = 0;
+    try {
+        WcsPlotterPluginNS::FitsHeader hdr = WcsPlotterPluginNS::FitsHeader::parse( file );
+        if ( ! hdr.isValid() || unquoted( hdr.stringValue( "SIMPLE", "F" ) ) != "T" ||
+             unquoted( hdr.stringValue( "GROUPS", "F" ) ) == "T" ) {
+            return nullptr;
+        }
+        data-> m_bitpix = hdr.intValue( "BITPIX" );
+        int bitpix = data-> m_bitpix;
+        if ( bitpix != 8 && bitpix != 16 && bitpix != 32 && bitpix != 64 && bitpix != - 32 && bitpix != - 64 ) {
+            return nullptr;
+        }
+        int naxis = hdr.intValue( "NAXIS" );
+        if ( naxis < 2 ) {
+            return nullptr;
+        }
+        for ( int i = 1 ; i <= naxis ; i++ ) {
+            int n = hdr.intValue( QString( "NAXIS%1" ).arg( i ) );
+            if ( n < 1 ) {
+                return nullptr;
+            }
+            data-> m_dims.push_back( n );
+            total *= n;
+        }
+        data-> m_bscale = hdr.doubleValue( "BSCALE", 1 );
+        data-> m_bzero = hdr.doubleValue( "BZERO", 0 );
+        data-> m_scaled = data-> m_bscale != 1 || data-> m_bzero != 0;
+        if ( bitpix > 0 && hdr.findLine( "BLANK" ) >= 0 ) {
+            data-> m_hasBlank = true;
+            data-> m_blank = hdr.intValue( "BLANK" );
+        }
+        dataOffset = hdr.dataOffset();
+    }
+    catch ( const QString & err ) {
+        qDebug() << "FitsMmapData: not a plain FITS image:" << err;
+        return nullptr;
+    }
+    catch ( ... ) {
+        return nullptr;
+    }
+
+    qint64 dataBytes = total * ( std::abs( data-> m_bitpix ) / 8 );
+    if ( dataOffset + dataBytes > file.size() ) {
+        qWarning() << "FitsMmapData: the data unit of" << fileName << "is truncated";
+        return nullptr;
+    }
+    data-> m_data = file.map( dataOffset, dataBytes );
+    if ( ! data-> m_data ) {
+        return nullptr;
+    }
+
+    data-> m_planeSize = int64_t( data-> m_dims[0] ) * data-> m_dims[1];
+    data-> m_planeCount = total / data-> m_planeSize;
+    data-> m_planes.resize( data-> m_planeCount );
+    data-> m_lastUse = std::vector < std::atomic < uint64_t > > ( data-> m_planeCount );
+    return data;
+} // open
+
+std::shared_ptr < const float >
+FitsMmapData::cachedPlane( int64_t index )
+{
+    std::shared_ptr < const float > plane = std::atomic_load( & m_planes[index] );
+    if ( plane ) {
+        m_planeHits++;
+        touch( index );
+    }
+    return plane;
+}
+
+std::shared_ptr < const float >
+FitsMmapData::plane( int64_t index )
+{
+    std::shared_ptr < const float > cached = cachedPlane( index );
+    if ( cached ) {
+        return cached;
+    }
+
+    // converted outside of the lock, concurrent readers of other planes go on
+    auto values = std::make_shared < std::vector < float > > ( m_planeSize );
+    convertValues( index * m_planeSize, m_planeSize, values-> data() );
+    std::shared_ptr < const float > converted( values, values-> data() );
+    m_planeMisses++;
+
+    SharedCache & cache = sharedCache();
+    QMutexLocker locker( & cache.mutex );
+    cached = std::atomic_load( & m_planes[index] );
+    if ( cached ) {
+        // another reader converted it meanwhile
+        return cached;
+    }
+    std::atomic_store( & m_planes[index], converted );
+    touch( index );
+    cache.planes.emplace_back( this, index );
+    cache.usedBytes += m_planeSize * int64_t( sizeof( float ) );
+    evict( cache );
+    return converted;
+} // plane
+
+void
+FitsMmapData::convert( int64_t start, int64_t count, float * out )
+{
+    m_directValues += count;
+    convertValues( start, count, out );
+}
+
+void
+FitsMmapData::convertValues( int64_t start, int64_t count, float * out ) const
+{
+    const float nan = std::numeric_limits < float >::quiet_NaN();
+    const uchar * src = m_data + start * ( std::abs( m_bitpix ) / 8 );
+    switch ( m_bitpix )
+    {
+    case - 32 :
+        static_assert( sizeof( float ) == 4, "floats have to be 32 bit" );
+        swap32( src, count, reinterpret_cast < uint32_t * > ( out ) );
+        if ( m_scaled ) {
+            for ( int64_t i = 0 ; i < count ; i++ ) {
+                out[i] = m_bzero + m_bscale * out[i];
+            }
+        }
+        break;
+
+    case 32 : {
+        uint32_t words[CONVERT_BLOCK];
+        for ( int64_t done = 0 ; done < count ; done += CONVERT_BLOCK ) {
+            int64_t n = std::min( CONVERT_BLOCK, count - done );
+            swap32( src + 4 * done, n, words );
+            for ( int64_t i = 0 ; i < n ; i++ ) {
+                int32_t value = int32_t( words[i] );
+                out[done + i] = ( m_hasBlank && value == m_blank ) ? nan : float ( m_bzero + m_bscale * value );
+            }
+        }
+        break;
+    }
+
+    case - 64 :
+        for ( int64_t i = 0 ; i < count ; i++ ) {
+            quint64 bits = qFromBigEndian < quint64 > ( src + 8 * i );
+            double value;
+            std::memcpy( & value, & bits, sizeof( value ) );
+            out[i] = m_scaled ? float ( m_bzero + m_bscale * value ) : float ( value );
+        }
+        break;
+
+    case 64 :
+        for ( int64_t i = 0 ; i < count ; i++ ) {
+            qint64 value = qFromBigEndian < qint64 > ( src + 8 * i );
+            out[i] = ( m_hasBlank && value == m_blank ) ? nan : float ( m_bzero + m_bscale * value );
+        }
+        break;
+
+    case 16 :
+        for ( int64_t i = 0 ; i < count ; i++ ) {
+            qint16 value = qFromBigEndian < qint16 > ( src + 2 * i );
+            out[i] = ( m_hasBlank && value == m_blank ) ? nan : float ( m_bzero + m_bscale * value );
+        }
+        break;
+
+    case 8 :
+        for ( int64_t i = 0 ; i < count ; i++ ) {
+            out[i] = ( m_hasBlank && src[i] == m_blank ) ? nan : float ( m_bzero + m_bscale * src[i] );
+        }
+        break;
+    } // switch
+} // convertValues
+
+FitsMmapData::SharedCache &
+FitsMmapData::sharedCache()
+{
+    static SharedCache cache;
+    return cache;
+}
+
+void
+FitsMmapData::setMaxCacheBytes( int64_t maxBytes )
+{
+    SharedCache & cache = sharedCache();
+    QMutexLocker locker( & cache.mutex );
+    cache.maxBytes = maxBytes;
+    evict( cache );
+}
+
+int64_t
+FitsMmapData::cacheBytes()
+{
+    SharedCache & cache = sharedCache();
+    QMutexLocker locker( & cache.mutex );
+    return cache.usedBytes;
+}
+
+void
+FitsMmapData::touch( int64_t index )
+{
+    m_lastUse[index].store( ++ sharedCache().clock, std::memory_order_relaxed );
+}
+
+void
+FitsMmapData::evict( SharedCache & cache )
+{
+    // there are only as many planes as fit into the budget, looking for the least
+    // recently used one costs nothing next to converting a plane
+    while ( cache.planes.size() > 1 && cache.usedBytes > cache.maxBytes ) {
+        size_t oldest = 0;
+        uint64_t oldestUse = std::numeric_limits < uint64_t >::max();
+        for ( size_t i = 0 ; i < cache.planes.size() ; i++ ) {
+            const std::pair < FitsMmapData *, int64_t > & plane = cache.planes[i];
+            uint64_t use = plane.first-> m_lastUse[plane.second].load( std::memory_order_relaxed );
+            if ( use < oldestUse ) {
+                oldest = i;
+                oldestUse = use;
+            }
+        }
+        FitsMmapData * data = cache.planes[oldest].first;
+        // readers still using the plane keep it alive
+        std::atomic_store( & data-> m_planes[cache.planes[oldest].second], std::shared_ptr < const float > () );
+        cache.usedBytes -= data-> m_planeSize * int64_t( sizeof( float ) );
+        cache.planes[oldest] = cache.planes.back();
+        cache.planes.pop_back();
+    }
+}
+
+FitsMmapStats
+FitsMmapData::stats() const
+{
+    FitsMmapStats stats;
+    stats.planeHits = m_planeHits;
+    stats.planeMisses = m_planeMisses;
+    stats.directValues = m_directValues;
+    return stats;
+}
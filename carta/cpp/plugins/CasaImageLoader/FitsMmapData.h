@@ -0,0 +1,158 @@
+/**
+ *
+ **/
+
+#pragma once
+
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/// snapshot of the plane cache counters of one file
+struct FitsMmapStats
+{
+    /// planes found converted in the cache
+    uint64_t planeHits = 0;
+
+    /// planes converted from the mapped file
+    uint64_t planeMisses = 0;
+
+    /// values converted straight from the mapped file, for reads that cover
+    /// only a small part of a plane
+    uint64_t directValues = 0;
+};
+
+/// The data unit of a plain FITS file, mapped into memory.
+///
+/// Only the primary HDU of uncompressed files is handled, anything else (gzip-ed
+/// files, random groups, tile compressed images in extensions) is left to casacore.
+/// Values are converted from big endian and scaled with BSCALE/BZERO on the fly,
+/// integer BLANK values become NaN, the same as casacore's FITSImage does.
+///
+/// Planes (the first two axes) that are read as a whole are converted once and kept
+/// in a cache shared by all the mapped files, with one memory budget; the least
+/// recently used planes are evicted first. Readers never lock: the cached planes are
+/// published with atomic shared pointer stores and a hit only stamps the plane, only
+/// the threads converting a plane take a lock to update the cache bookkeeping.
+class FitsMmapData
+{
+public:
+
+    typedef std::shared_ptr < FitsMmapData > SharedPtr;
+
+    /// maps the data unit of a FITS file
+    /// \param fileName the file
+    /// \return nullptr if the file is not a plain FITS image
+    static SharedPtr
+    open( const QString & fileName );
+
+    ~FitsMmapData();
+
+    /// the mapped file
+    QString
+    fileName() const
+    {
+        return m_file.fileName();
+    }
+
+    /// NAXIS1, NAXIS2, ...
+    const std::vector < int > &
+    dims() const
+    {
+        return m_dims;
+    }
+
+    /// number of values in a plane, NAXIS1 * NAXIS2
+    int64_t
+    planeSize() const
+    {
+        return m_planeSize;
+    }
+
+    /// returns a converted plane, from the cache if possible
+    /// \param index index of the plane, over the axes after the first two
+    std::shared_ptr < const float >
+    plane( int64_t index );
+
+    /// returns a converted plane if it is cached, nullptr otherwise
+    /// \param index index of the plane, over the axes after the first two
+    std::shared_ptr < const float >
+    cachedPlane( int64_t index );
+
+    /// converts values straight from the mapped file
+    /// \param start index of the first value, in file order
+    /// \param count number of values
+    /// \param out where the values go
+    void
+    convert( int64_t start, int64_t count, float * out );
+
+    /// sets the memory the cached planes of all the files may use, at least one plane
+    /// is kept
+    static void
+    setMaxCacheBytes( int64_t maxBytes );
+
+    /// memory used by the cached planes of all the files
+    static int64_t
+    cacheBytes();
+
+    FitsMmapStats
+    stats() const;
+
+private:
+
+    FitsMmapData();
+
+    FitsMmapData( const FitsMmapData & ) = delete;
+    FitsMmapData &
+    operator= ( const FitsMmapData & ) = delete;
+
+    /// converts without counting, see convert()
+    void
+    convertValues( int64_t start, int64_t count, float * out ) const;
+
+    /// the planes cached for all the files
+    struct SharedCache;
+
+    static SharedCache &
+    sharedCache();
+
+    /// drops the least recently used planes over the budget, the mutex of the shared
+    /// cache has to be held
+    static void
+    evict( SharedCache & cache );
+
+    /// marks a plane as the most recently used one
+    void
+    touch( int64_t index );
+
+    QFile m_file;
+
+    /// start of the data unit
+    const uchar * m_data = nullptr;
+
+    std::vector < int > m_dims;
+    int64_t m_planeSize = 0;
+    int64_t m_planeCount = 0;
+    int m_bitpix = - 32;
+    double m_bscale = 1;
+    double m_bzero = 0;
+    bool m_scaled = false;
+    bool m_hasBlank = false;
+    int64_t m_blank = 0;
+
+    /// one slot per plane, read and written with std::atomic_load/atomic_store
+    std::vector < std::shared_ptr < const float > > m_planes;
+
+    /// when each plane was last used, on the clock of the shared cache
+    std::vector < std::atomic < uint64_t > > m_lastUse;
+
+    std::atomic < uint64_t > m_planeHits;
+    std::atomic < uint64_t > m_planeMisses;
+    std::atomic < uint64_t > m_directValues;
+
+    static const int64_t DEFAULT_MAX_CACHE_BYTES;
+};
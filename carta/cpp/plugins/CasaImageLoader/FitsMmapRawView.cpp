@@ -0,0 +1,306 @@
+/**
+ *
+ **/
+
+#include "FitsMmapRawView.h"
+
+#include <QDebug>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+/// collects the values of a traversal: either hands them to a callback in pieces of
+/// at most capacity values, or, without a callback, just fills the buffer
+class FitsMmapRawView::Sink
+{
+public:
+
+    Sink( std::function < void (const char *, int64_t) > func, float * buffer, int64_t capacity )
+        : m_func( func )
+          , m_buffer( buffer )
+          , m_capacity( capacity )
+    { }
+
+    /// passes the buffered values on
+    void
+    flush()
+    {
+        if ( m_func && m_filled > 0 ) {
+            m_func( reinterpret_cast < const char * > ( m_buffer ), m_filled );
+            m_filled = 0;
+        }
+    }
+
+    /// values that stay valid for the duration of the call, passed on without a copy
+    void
+    direct( const float * values, int64_t n )
+    {
+        if ( ! m_func ) {
+            std::memcpy( m_buffer + m_filled, values, n * sizeof( float ) );
+            m_filled += n;
+            return;
+        }
+        flush();
+        for ( int64_t offset = 0 ; offset < n ; offset += m_capacity ) {
+            m_func( reinterpret_cast < const char * > ( values + offset ), std::min( m_capacity, n - offset ) );
+        }
+    }
+
+    void
+    push( float value )
+    {
+        m_buffer[m_filled++] = value;
+        if ( m_filled == m_capacity ) {
+            flush();
+        }
+    }
+
+    /// values converted from the file straight into the buffer
+    void
+    convert( FitsMmapData & data, int64_t start, int64_t n )
+    {
+        while ( n > 0 ) {
+            int64_t take = std::min( n, m_capacity - m_filled );
+            data.convert( start, take, m_buffer + m_filled );
+            m_filled += take;
+            start += take;
+            n -= take;
+            if ( m_filled == m_capacity ) {
+                flush();
+            }
+        }
+    }
+
+private:
+
+    std::function < void (const char *, int64_t) > m_func;
+    float * m_buffer;
+    int64_t m_capacity;
+    int64_t m_filled = 0;
+};
+
+FitsMmapRawView::FitsMmapRawView( FitsMmapData::SharedPtr data, const SliceND & sliceInfo )
+    : m_data( data )
+{
+    m_appliedSlice = sliceInfo.apply( m_data-> dims() );
+    init();
+}
+
+FitsMmapRawView::FitsMmapRawView( FitsMmapData::SharedPtr data, const SliceND::ApplyResult & applyResult )
+    : m_data( data )
+      , m_appliedSlice( applyResult )
+{
+    init();
+}
+
+void
+FitsMmapRawView::init()
+{
+    m_total = 1;
+    for ( auto & x : m_appliedSlice.dims() ) {
+        m_viewDims.push_back( x.count );
+        m_counts.push_back( x.isSingle() ? 1 : x.count );
+        m_total *= m_counts.back();
+    }
+
+    // converting whole planes pays off if a good part of them is used
+    int64_t perPlane = m_counts[0] * ( m_counts.size() > 1 ? m_counts[1] : 1 );
+    m_viaPlanes = perPlane * 4 >= m_data-> planeSize();
+}
+
+void
+FitsMmapRawView::locateRow( int64_t viewRow, int64_t & plane, int64_t & y ) const
+{
+    const auto & sliceDims = m_appliedSlice.dims();
+    const std::vector < int > & fileDims = m_data-> dims();
+    int64_t rows = m_counts.size() > 1 ? m_counts[1] : 1;
+    y = m_counts.size() > 1 ? sliceDims[1].start + ( viewRow % rows ) * sliceDims[1].step : 0;
+    int64_t rest = viewRow / rows;
+    plane = 0;
+    int64_t stride = 1;
+    for ( size_t i = 2 ; i < m_counts.size() ; i++ ) {
+        int64_t index = rest % m_counts[i];
+        rest /= m_counts[i];
+        plane += ( sliceDims[i].start + index * sliceDims[i].step ) * stride;
+        stride *= fileDims[i];
+    }
+}
+
+void
+FitsMmapRawView::copyRow( int64_t viewRow, int64_t x, int64_t n, Sink & sink, PlaneRef & planeRef )
+{
+    int64_t plane, y;
+    locateRow( viewRow, plane, y );
+    const int64_t width = m_data-> dims()[0];
+    const auto & xSlice = m_appliedSlice.dims()[0];
+    const int64_t fileX = xSlice.start + x * xSlice.step;
+
+    if ( planeRef.index != plane ) {
+        planeRef.index = plane;
+        planeRef.values = m_viaPlanes ? m_data-> plane( plane ) : m_data-> cachedPlane( plane );
+    }
+
+    if ( planeRef.values ) {
+        const float * row = planeRef.values.get() + y * width;
+        if ( xSlice.step == 1 ) {
+            sink.direct( row + fileX, n );
+        }
+        else {
+            for ( int64_t k = 0 ; k < n ; k++ ) {
+                sink.push( row[fileX + k * xSlice.step] );
+            }
+        }
+        return;
+    }
+
+    int64_t rowStart = plane * m_data-> planeSize() + y * width;
+    if ( xSlice.step == 1 ) {
+        sink.convert( * m_data, rowStart + fileX, n );
+    }
+    else {
+        for ( int64_t k = 0 ; k < n ; k++ ) {
+            sink.convert( * m_data, rowStart + fileX + k * xSlice.step, 1 );
+        }
+    }
+} // copyRow
+
+const char *
+FitsMmapRawView::get( const VI & pos )
+{
+    // preconditions
+    if ( CARTA_RUNTIME_CHECKS && pos.size() > dims().size() ) {
+        throw std::runtime_error( "invalid position" );
+    }
+
+    const auto & sliceDims = m_appliedSlice.dims();
+    const std::vector < int > & fileDims = m_data-> dims();
+    int64_t index = 0;
+    int64_t stride = 1;
+    for ( size_t i = 0 ; i < m_counts.size() ; i++ ) {
+        int64_t p = i < pos.size() ? pos[i] : 0;
+        index += ( sliceDims[i].start + p * sliceDims[i].step ) * stride;
+        stride *= fileDims[i];
+    }
+    m_data-> convert( index, 1, & m_buff );
+    return reinterpret_cast < const char * > ( & m_buff );
+}
+
+void
+FitsMmapRawView::forEach( std::function < void (const char *) > func, Traversal traversal )
+{
+    forEach( Carta::Lib::NdArray::Float::DefaultChunkSize * sizeof( float ),
+             [&func] ( const char * values, int64_t count ) {
+                 for ( int64_t i = 0 ; i < count ; i++ ) {
+                     func( values + i * sizeof( float ) );
+                 }
+             }, nullptr, traversal );
+}
+
+const Carta::Lib::NdArray::RawViewInterface::VI &
+FitsMmapRawView::currentPos()
+{
+    qFatal( "Not implemented yet" );
+    return m_currPosView;
+}
+
+Carta::Lib::NdArray::RawViewInterface *
+FitsMmapRawView::getView( const SliceND & sliceInfo )
+{
+    // apply the slice to dimensions of this view
+    SliceND::ApplyResult ar = sliceInfo.apply( dims() );
+
+    // create applied result that combines m_appliedSlice with ar
+    SliceND::ApplyResult newAr = SliceND::ApplyResult::combine( m_appliedSlice, ar );
+
+    // return a new view based on the new slice
+    return new FitsMmapRawView( m_data, newAr );
+}
+
+int64_t
+FitsMmapRawView::read( int64_t buffSize, char * buff, Traversal traversal )
+{
+    Q_UNUSED( traversal );
+    int64_t count = readElements( m_readPos, buffSize / int64_t( sizeof( float ) ),
+                                  reinterpret_cast < float * > ( buff ) );
+    m_readPos += count;
+    return count * sizeof( float );
+}
+
+int64_t
+FitsMmapRawView::read( int64_t chunk, int64_t buffSize, char * buff, Traversal traversal )
+{
+    Q_UNUSED( traversal );
+    int64_t chunkElements = buffSize / int64_t( sizeof( float ) );
+    int64_t count = readElements( chunk * chunkElements, chunkElements, reinterpret_cast < float * > ( buff ) );
+    return count * sizeof( float );
+}
+
+void
+FitsMmapRawView::forEach( int64_t buffSize,
+                          std::function < void (const char *, int64_t count) > func,
+                          char * buff,
+                          Traversal traversal )
+{
+    if ( traversal != Carta::Lib::NdArray::RawViewInterface::Traversal::Sequential ) {
+        qFatal( "sorry, not implemented yet" );
+    }
+    const int64_t capacity = buffSize / int64_t( sizeof( float ) );
+    if ( capacity <= 0 ) {
+        throw std::runtime_error( "buffer too small" );
+    }
+    if ( m_total == 0 ) {
+        return;
+    }
+    std::vector < float > ownBuffer;
+    float * floatBuff = reinterpret_cast < float * > ( buff );
+    if ( ! floatBuff ) {
+        ownBuffer.resize( capacity );
+        floatBuff = ownBuffer.data();
+    }
+    Sink sink( func, floatBuff, capacity );
+    PlaneRef planeRef;
+
+    const auto & sliceDims = m_appliedSlice.dims();
+    const int64_t width = m_data-> dims()[0];
+    const int64_t rows = m_counts.size() > 1 ? m_counts[1] : 1;
+    const int64_t totalRows = m_total / m_counts[0];
+
+    // whole planes of the cache are contiguous, they go out in as few calls as possible
+    bool wholePlanes = m_viaPlanes && sliceDims[0].start == 0 && sliceDims[0].step == 1 &&
+                       m_counts[0] == width && ( rows == 1 || sliceDims[1].step == 1 );
+    if ( wholePlanes ) {
+        for ( int64_t row = 0 ; row < totalRows ; row += rows ) {
+            int64_t plane, y;
+            locateRow( row, plane, y );
+            std::shared_ptr < const float > values = m_data-> plane( plane );
+            sink.direct( values.get() + y * width, rows * width );
+        }
+    }
+    else {
+        for ( int64_t row = 0 ; row < totalRows ; row++ ) {
+            copyRow( row, 0, m_counts[0], sink, planeRef );
+        }
+    }
+    sink.flush();
+} // forEach
+
+int64_t
+FitsMmapRawView::readElements( int64_t start, int64_t count, float * out )
+{
+    if ( start < 0 || start >= m_total || count <= 0 ) {
+        return 0;
+    }
+    count = std::min( count, m_total - start );
+
+    Sink sink( nullptr, out, count );
+    PlaneRef planeRef;
+    int64_t done = 0;
+    while ( done < count ) {
+        int64_t index = start + done;
+        int64_t x = index % m_counts[0];
+        int64_t n = std::min( m_counts[0] - x, count - done );
+        copyRow( index / m_counts[0], x, n, sink, planeRef );
+        done += n;
+    }
+    return done;
+}
@@ -0,0 +1,115 @@
+/**
+ *
+ **/
+
+#pragma once
+
+#include "CartaLib/IImage.h"
+#include "FitsMmapData.h"
+
+/// raw view on a memory mapped FITS file, see FitsMmapData
+///
+/// Views that cover a good part of each plane they touch read through the converted
+/// plane cache, and hand out pointers into the cached planes instead of copying
+/// (forEach() with contiguous rows). Smaller views, e.g. spectral profiles, convert
+/// just the values they need from the mapped file.
+class FitsMmapRawView
+    : public Carta::Lib::NdArray::RawViewInterface
+{
+public:
+
+    /// \param data the mapped file, the view keeps it alive
+    /// \param sliceInfo for which part of the file to create view
+    FitsMmapRawView( FitsMmapData::SharedPtr data, const SliceND & sliceInfo );
+
+    virtual PixelType
+    pixelType() override
+    {
+        return PixelType::Real32;
+    }
+
+    virtual const VI &
+    dims() override
+    {
+        return m_viewDims;
+    }
+
+    virtual const char *
+    get( const VI & pos ) override;
+
+    virtual void
+    forEach( std::function < void (const char *) > func, Traversal traversal ) override;
+
+    virtual const VI &
+    currentPos() override;
+
+    virtual RawViewInterface *
+    getView( const SliceND & sliceInfo ) override;
+
+    virtual int64_t
+    read( int64_t buffSize, char * buff, Traversal traversal = Traversal::Sequential ) override;
+
+    virtual void
+    seek( int64_t ind ) override
+    {
+        m_readPos = ind;
+    }
+
+    virtual int64_t
+    read( int64_t chunk, int64_t buffSize, char * buff,
+          Traversal traversal = Traversal::Sequential ) override;
+
+    virtual void
+    forEach( int64_t buffSize,
+             std::function < void (const char *, int64_t count) > func,
+             char * buff = nullptr,
+             Traversal traversal = Traversal::Sequential ) override;
+
+private:
+
+    class Sink;
+
+    /// the plane a view row is in, looked up only when the plane changes
+    struct PlaneRef
+    {
+        int64_t index = - 1;
+        std::shared_ptr < const float > values;
+    };
+
+    FitsMmapRawView( FitsMmapData::SharedPtr data, const SliceND::ApplyResult & applyResult );
+
+    void
+    init();
+
+    /// file plane and row of a row of the view (rows are counted over all the axes but the first)
+    void
+    locateRow( int64_t viewRow, int64_t & plane, int64_t & y ) const;
+
+    /// passes n values of a view row, from view column x on, to the sink
+    void
+    copyRow( int64_t viewRow, int64_t x, int64_t n, Sink & sink, PlaneRef & planeRef );
+
+    /// reads count values starting at value start (in view order) into out
+    /// \return number of values actually read
+    int64_t
+    readElements( int64_t start, int64_t count, float * out );
+
+    FitsMmapData::SharedPtr m_data;
+    SliceND::ApplyResult m_appliedSlice;
+
+    /// dimensions as reported, which are -1 for single index slices, like the casacore views
+    VI m_viewDims;
+
+    /// the number of values along each axis
+    std::vector < int64_t > m_counts;
+    int64_t m_total = 0;
+
+    /// whether the view goes through the plane cache
+    bool m_viaPlanes = false;
+
+    /// position of the next stateful read()
+    int64_t m_readPos = 0;
+
+    float m_buff = 0;
+    VI m_currPosView;
+};
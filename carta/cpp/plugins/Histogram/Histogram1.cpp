@@ -175,6 +175,8 @@ Histogram1::handleHook( BaseHook & hookData )
             casa_mutex.unlock();
             return false;
         }
+        // keep the raw view readers of this file out while we use the image
+        QMutexLocker storageLocker( cartaII2storageMutex( image ) );
         if ( !m_histogram ){
             m_histogram.reset(new ImageHistogram < casacore::Float >());
         }
@@ -218,6 +220,7 @@ Histogram1::handleHook( BaseHook & hookData )
         hook.result = _computeHistogram();
         hook.result.setFrequencyBounds( frequencyMin, frequencyMax );
 
+        storageLocker.unlock();
         casa_mutex.unlock();
 
         return true;
@@ -42,6 +42,8 @@ StatisticsCASA::handleHook( BaseHook & hookData ){
                 qWarning() << "Image statistics plugin: not an image created by casaimageloader...";
                 return false;
             }
+            // keep the raw view readers of this file out while we use the image
+            QMutexLocker storageLocker( cartaII2storageMutex( image ) );
 
             QList< QList< Carta::Lib::StatInfo > > statResults;
 
@@ -2,14 +2,26 @@
 #include "CartaLib/Hooks/GetPersistentCache.h"
 #include <QDebug>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QJsonDocument>
+#include <QMutex>
+#include <QMutexLocker>
+#include <map>
 #include "leveldb/db.h"
+#include "leveldb/write_batch.h"
 
 typedef Carta::Lib::Hooks::GetPersistentCache GetPersistentCacheHook;
 
 ///
 /// Implementation of IPCache using LevelDB
 ///
+/// LevelDB does not keep any metadata we could evict by, so the sizes and accesses of the
+/// entries are tracked in memory. The index is rebuilt from the keys when the database is
+/// opened, at which point all the entries count as equally old and unused. When the entries
+/// exceed the storage budget, the least recently used (or least frequently used) ones are
+/// deleted until 90% of the budget is left.
+///
 class LevelDBPCache : public Carta::Lib::IPCache
 {
 public:
@@ -17,19 +29,47 @@ public:
     virtual uint64_t
     maxStorage() override
     {
-        return 1;
+        QMutexLocker locker( & m_mutex );
+        return m_maxBytes;
     }
 
     virtual uint64_t
     usedStorage() override
     {
-        return 1;
+        QMutexLocker locker( & m_mutex );
+        return m_usedBytes;
     }
 
     virtual uint64_t
     nEntries() override
     {
-        return 1;
+        QMutexLocker locker( & m_mutex );
+        return m_usage.size();
+    }
+
+    virtual uint64_t
+    nEvictions() override
+    {
+        QMutexLocker locker( & m_mutex );
+        return m_evictions;
+    }
+
+    virtual void
+    setMaxStorage( uint64_t bytes ) override
+    {
+        QMutexLocker locker( & m_mutex );
+        m_maxBytes = bytes;
+        _evict();
+    }
+
+    virtual void
+    compact() override
+    {
+        if ( ! p_db ) {
+            return;
+        }
+        // rewrites the files without the deleted and overwritten values
+        p_db-> CompactRange( nullptr, nullptr );
     }
 
     virtual void
@@ -39,13 +79,21 @@ public:
             return;
         }
 
-        leveldb::Iterator* it = p_db->NewIterator(p_readOptions);
+        QMutexLocker locker( & m_mutex );
+        leveldb::WriteBatch batch;
+        std::unique_ptr < leveldb::Iterator > it( p_db->NewIterator(p_readOptions) );
         for (it->SeekToFirst(); it->Valid(); it->Next()) {
-            auto status = p_db->Delete(p_writeOptions, it->key());
-            if ( ! status.ok() ) {
-                qWarning() << "query delete failed:" << status.ToString().c_str();
-            }
+            batch.Delete( it->key() );
         }
+        auto status = p_db-> Write( p_writeOptions, & batch );
+        if ( ! status.ok() ) {
+            qWarning() << "query delete failed:" << status.ToString().c_str();
+        }
+        m_usage.clear();
+        m_order.clear();
+        m_usedBytes = 0;
+        locker.unlock();
+        compact();
     } // deleteAll
 
     virtual bool
@@ -57,41 +105,113 @@ public:
             return false;
         }
         std::string tmpVal;
-        auto status = p_db-> Get( p_readOptions, key.constData(), & tmpVal );
+        // keys may be binary, so do not let the slice stop at the first zero byte
+        auto status = p_db-> Get( p_readOptions, leveldb::Slice( key.constData(), key.size()), & tmpVal );
         if ( ! status.ok() ) {
             //qWarning() << "query read failed:" << status.ToString().c_str();
             return false;
         }
         val = QByteArray( tmpVal.data(), tmpVal.size());
+        QMutexLocker locker( & m_mutex );
+        _touch( key );
         return true;
     } // readEntry
 
+    virtual int
+    readEntries( std::vector < Entry > & entries ) override
+    {
+        if ( ! p_db ) {
+            return 0;
+        }
+
+        // read all of the entries from the same snapshot
+        leveldb::ReadOptions options = p_readOptions;
+        options.snapshot = p_db-> GetSnapshot();
+        int found = 0;
+        std::string tmpVal;
+        for ( Entry & entry : entries ) {
+            auto status = p_db-> Get( options, leveldb::Slice( entry.key.constData(), entry.key.size()), & tmpVal );
+            entry.found = status.ok();
+            if ( entry.found ) {
+                entry.val = QByteArray( tmpVal.data(), tmpVal.size());
+                found++;
+            }
+        }
+        p_db-> ReleaseSnapshot( options.snapshot );
+
+        QMutexLocker locker( & m_mutex );
+        for ( const Entry & entry : entries ) {
+            if ( entry.found ) {
+                _touch( entry.key );
+            }
+        }
+        return found;
+    } // readEntries
+
     virtual void
     setEntry( const QByteArray & key, const QByteArray & val, const QByteArray & error ) override
     {
         Q_UNUSED( error );
 
         if( ! p_db) return;
+        uint64_t size = key.size() + val.size();
+        QMutexLocker locker( & m_mutex );
+        if ( size > m_maxBytes ) {
+            return;
+        }
         auto status = p_db-> Put( p_writeOptions,
                     leveldb::Slice( key.constData(), key.size()),
                     leveldb::Slice( val.constData(), val.size()));
         if ( ! status.ok() ) {
             qWarning() << "query insert failed:" << status.ToString().c_str();
+            return;
         }
+        _add( key, size );
+        _evict();
 
         //Q_UNUSED( priority);
         // \todo we'll have to embed  priority into the value, e.g. first 8 bytes?
     } // setEntry
 
+    virtual void
+    setEntries( const std::vector < Entry > & entries ) override
+    {
+        if ( ! p_db || entries.empty() ) {
+            return;
+        }
+
+        // one atomic write instead of one per entry
+        QMutexLocker locker( & m_mutex );
+        leveldb::WriteBatch batch;
+        for ( const Entry & entry : entries ) {
+            if ( uint64_t( entry.key.size() + entry.val.size() ) <= m_maxBytes ) {
+                batch.Put( leveldb::Slice( entry.key.constData(), entry.key.size()),
+                           leveldb::Slice( entry.val.constData(), entry.val.size()));
+            }
+        }
+        auto status = p_db-> Write( p_writeOptions, & batch );
+        if ( ! status.ok() ) {
+            qWarning() << "batch insert failed:" << status.ToString().c_str();
+            return;
+        }
+        for ( const Entry & entry : entries ) {
+            uint64_t size = entry.key.size() + entry.val.size();
+            if ( size <= m_maxBytes ) {
+                _add( entry.key, size );
+            }
+        }
+        _evict();
+    } // setEntries
+
     static
     Carta::Lib::IPCache::SharedPtr
-    getCacheSingleton( QString dirPath)
+    getCacheSingleton( QString dirPath, uint64_t maxBytes, bool lfu )
     {
         if ( m_cachePtr ) {
             qCritical() << "PCacheLevelDBPlugin::Calling GetPersistentCacheHook multiple times!!!";
         }
         else {
-            m_cachePtr.reset( new LevelDBPCache( dirPath) );
+            m_cachePtr.reset( new LevelDBPCache( dirPath, maxBytes, lfu ) );
         }
         return m_cachePtr;
     }
@@ -105,7 +225,9 @@ public:
 
 private:
 
-    LevelDBPCache( QString dirPath)
+    LevelDBPCache( QString dirPath, uint64_t maxBytes, bool lfu ) :
+        m_maxBytes( maxBytes ),
+        m_lfu( lfu )
     {
         p_readOptions = leveldb::ReadOptions();
         p_writeOptions = leveldb::WriteOptions();
@@ -125,11 +247,113 @@ private:
         }
 
         p_db.reset( db );
+
+        // rebuild the index of the entries
+        QElapsedTimer timer;
+        timer.start();
+        leveldb::ReadOptions scanOptions = p_readOptions;
+        scanOptions.fill_cache = false;
+        std::unique_ptr < leveldb::Iterator > it( p_db->NewIterator( scanOptions ) );
+        for ( it->SeekToFirst(); it->Valid(); it->Next() ) {
+            _add( QByteArray( it->key().data(), it->key().size() ), it->key().size() + it->value().size() );
+        }
+        if ( CARTA_RUNTIME_CHECKS ) {
+            qCritical() << "<> Time to index" << m_usage.size() << "cache entries:" << timer.elapsed() << "ms";
+        }
+        _evict();
     }
 
+    /// position of an entry in the eviction order: least frequently used first if m_lfu is
+    /// set, then least recently used first (the access times are unique)
+    typedef std::pair < uint64_t, uint64_t > Rank;
+
+    struct Usage {
+        uint64_t size = 0;
+        uint64_t atime = 0;
+        uint64_t hits = 0;
+    };
+
+    Rank
+    _rank( const Usage & usage ) const
+    {
+        return Rank( m_lfu ? usage.hits : 0, usage.atime );
+    }
+
+    /// record an access to an entry
+    void
+    _touch( const QByteArray & key )
+    {
+        auto iter = m_usage.find( key );
+        if ( iter == m_usage.end() ) {
+            return;
+        }
+        m_order.erase( _rank( * iter ) );
+        iter->atime = m_clock++;
+        iter->hits++;
+        m_order[_rank( * iter )] = key;
+    }
+
+    /// record that an entry has been written
+    void
+    _add( const QByteArray & key, uint64_t size )
+    {
+        auto iter = m_usage.find( key );
+        if ( iter == m_usage.end() ) {
+            iter = m_usage.insert( key, Usage() );
+        }
+        else {
+            m_usedBytes -= iter->size;
+            m_order.erase( _rank( * iter ) );
+        }
+        iter->size = size;
+        iter->atime = m_clock++;
+        m_usedBytes += size;
+        m_order[_rank( * iter )] = key;
+    }
+
+    /// delete the least valuable entries until 90% of the budget is left
+    void
+    _evict()
+    {
+        if ( ! p_db || m_usedBytes <= m_maxBytes ) {
+            return;
+        }
+        const uint64_t target = m_maxBytes / 10 * 9;
+        leveldb::WriteBatch batch;
+        uint64_t evicted = 0;
+        while ( m_usedBytes > target && ! m_order.empty() ) {
+            const QByteArray key = m_order.begin()->second;
+            m_order.erase( m_order.begin() );
+            auto iter = m_usage.find( key );
+            if ( iter != m_usage.end() ) {
+                m_usedBytes -= iter->size;
+                m_usage.erase( iter );
+            }
+            batch.Delete( leveldb::Slice( key.constData(), key.size() ) );
+            evicted++;
+        }
+        auto status = p_db-> Write( p_writeOptions, & batch );
+        if ( ! status.ok() ) {
+            qWarning() << "eviction failed:" << status.ToString().c_str();
+        }
+        m_evictions += evicted;
+    } // _evict
+
     std::unique_ptr< leveldb::DB > p_db;
     leveldb::ReadOptions p_readOptions;
     leveldb::WriteOptions p_writeOptions;
+
+    // protects the index below
+    QMutex m_mutex;
+    uint64_t m_maxBytes;
+    bool m_lfu;
+    uint64_t m_usedBytes = 0;
+    uint64_t m_evictions = 0;
+    // logical time of the accesses
+    uint64_t m_clock = 1;
+    QHash < QByteArray, Usage > m_usage;
+    std::map < Rank, QByteArray > m_order;
+
     static Carta::Lib::IPCache::SharedPtr m_cachePtr; //  = nullptr;
 };
 
@@ -154,7 +378,7 @@ PCacheLevelDBPlugin::handleHook( BaseHook & hookData )
         }
 
         // try to create the database
-        hook.result = LevelDBPCache::getCacheSingleton( m_dbPath);
+        hook.result = LevelDBPCache::getCacheSingleton( m_dbPath, uint64_t( m_maxStorageMB * 1024 * 1024 ), m_lfu );
 
         // return true if result is not null
         return hook.result != nullptr;
@@ -180,6 +404,14 @@ PCacheLevelDBPlugin::initialize( const IPlugin::InitInfo & initInfo )
         // convert this to absolute path just in case
         m_dbPath = QDir(m_dbPath).absolutePath();
     }
+
+    // storage budget and which entries to evict when it is exceeded
+    m_maxStorageMB = initInfo.json.value( "maxStorageMB" ).toDouble( DEFAULT_MAX_STORAGE_MB );
+    if ( m_maxStorageMB <= 0 ) {
+        qWarning() << "Invalid maxStorageMB for PCacheLevelDB plugin, using" << DEFAULT_MAX_STORAGE_MB;
+        m_maxStorageMB = DEFAULT_MAX_STORAGE_MB;
+    }
+    m_lfu = initInfo.json.value( "evictionPolicy" ).toString( "LRU" ).toUpper() == "LFU";
 }
 
 std::vector < HookId >
@@ -18,6 +18,7 @@ HEADERS += \
     PCacheLevelDB.h
     
 LIBS += -lleveldb
+LIBS += -L$$OUT_PWD/../../CartaLib/ -lCartaLib
 
 OTHER_FILES += \
     plugin.json
@@ -6,6 +6,9 @@
 
 //class QMutex;
 #include <qmutex.h>
+#include <QElapsedTimer>
+#include <QHash>
+#include <algorithm>
 
 static QMutex sql_mutex;
 
@@ -14,115 +17,171 @@ typedef Carta::Lib::Hooks::GetPersistentCache GetPersistentCacheHook;
 ///
 /// Implementation of IPCache using sqlite
 ///
+/// Every entry is stored once (the key is the primary key) together with its size, the
+/// logical time of its last access and its number of hits. Accesses are recorded in memory
+/// and written back in batches, so that reads do not turn into writes. When the entries
+/// exceed the storage budget, the least recently used (or least frequently used) ones are
+/// deleted until 90% of the budget is left.
+///
 class SqLitePCache : public Carta::Lib::IPCache
 {
 public:
 
-
-
     virtual uint64_t
     maxStorage() override
     {
-        return 1;
+        QMutexLocker locker( & sql_mutex );
+        return m_maxBytes;
     }
 
     virtual uint64_t
     usedStorage() override
     {
-        return 1;
+        QMutexLocker locker( & sql_mutex );
+        return m_usedBytes;
     }
 
     virtual uint64_t
     nEntries() override
     {
-        return 1;
+        QMutexLocker locker( & sql_mutex );
+        return m_entryCount;
+    }
+
+    virtual uint64_t
+    nEvictions() override
+    {
+        QMutexLocker locker( & sql_mutex );
+        return m_evictions;
     }
 
+    virtual void
+    setMaxStorage( uint64_t bytes ) override
+    {
+        QMutexLocker locker( & sql_mutex );
+        m_maxBytes = bytes;
+        _evict();
+    }
+
+    virtual void
+    compact() override
+    {
+        QMutexLocker locker( & sql_mutex );
+        if ( ! m_db.isOpen() ) {
+            return;
+        }
+        _flushAccesses();
+        _evict();
+        QSqlQuery query( m_db );
+        if ( ! query.exec( "VACUUM" ) ) {
+            qWarning() << "Vacuum failed:" << query.lastError().text();
+        }
+    } // compact
+
     virtual void
     deleteAll() override
     {
+        QMutexLocker locker( & sql_mutex );
         if ( ! m_db.isOpen() ) {
             return;
         }
         QSqlQuery query( m_db );
-        query.prepare( "DELETE FROM db;" );
+        query.prepare( "DELETE FROM entries" );
 
         if ( ! query.exec() ) {
             qWarning() << "Delete query failed.";
+            return;
         }
+        m_accesses.clear();
+        m_usedBytes = 0;
+        m_entryCount = 0;
+        query.exec( "PRAGMA incremental_vacuum" );
     } // deleteAll
 
     virtual bool
     readEntry( const QByteArray & key, QByteArray & val, QByteArray & error ) override
     {
-        sql_mutex.lock();
+        QMutexLocker locker( & sql_mutex );
         if ( ! m_db.isOpen() ) {
-             sql_mutex.unlock();
             return false;
         }
         QSqlQuery query( m_db );
-        //query.prepare( "SELECT val FROM db WHERE key = :key" );
-
-        // choose "val" and "error" with the minimum "error" for the specific "key"
-        query.prepare( "SELECT val,error FROM db WHERE key = :key ORDER BY error ASC LIMIT 1" );
-        query.bindValue( ":key", key );
+        query.prepare( SELECT_SQL );
+        return _read( query, key, val, error );
+    } // readEntry
 
-        if ( ! query.exec() ) {
-            qWarning() << "Select query failed.";
-            sql_mutex.unlock();
-            return false;
-        }
-        if ( query.next() ) {
-            val = query.value( 0 ).toByteArray();
-            error = query.value( 1 ).toByteArray();
-            sql_mutex.unlock();
-            return true;
+    virtual int
+    readEntries( std::vector < Entry > & entries ) override
+    {
+        QMutexLocker locker( & sql_mutex );
+        if ( ! m_db.isOpen() || entries.empty() ) {
+            return 0;
         }
-        sql_mutex.unlock();
 
-        return false;
-    } // readEntry
+        // prepare the statement once and read everything in a single transaction
+        m_db.transaction();
+        QSqlQuery query( m_db );
+        query.prepare( SELECT_SQL );
+        int found = 0;
+        for ( Entry & entry : entries ) {
+            entry.found = _read( query, entry.key, entry.val, entry.error );
+            if ( entry.found ) {
+                found++;
+            }
+        }
+        m_db.commit();
+        return found;
+    } // readEntries
 
     virtual void
     setEntry( const QByteArray & key, const QByteArray & val, const QByteArray & error ) override
     {
-        sql_mutex.lock();
+        QMutexLocker locker( & sql_mutex );
 
         if ( ! m_db.isOpen() ) {
-            sql_mutex.unlock();
             return;
         }
 
-        //Q_UNUSED( priority );
-        QSqlQuery query( m_db );
-        //query.prepare( "INSERT OR REPLACE INTO db (key, val) VALUES ( :key, :val )" );
-
-        // add a new value "error" in the row
-        query.prepare( "INSERT INTO db (key, val, error) VALUES (:key, :val, :error)" );
-
-        query.bindValue( ":key", key );
-        query.bindValue( ":val", val );
-        query.bindValue( ":error", error );
+        QSqlQuery select( m_db ), insert( m_db );
+        _prepareWrite( select, insert );
+        _write( select, insert, key, val, error );
+        _evict();
+    } // setEntry
 
-        if ( ! query.exec() ) {
-            qWarning() << "Insert query failed:" << query.lastError().text();
+    virtual void
+    setEntries( const std::vector < Entry > & entries ) override
+    {
+        QMutexLocker locker( & sql_mutex );
+        if ( ! m_db.isOpen() || entries.empty() ) {
+            return;
         }
-        sql_mutex.unlock();
 
-    } // setEntry
+        // one transaction instead of one journal sync per entry
+        m_db.transaction();
+        QSqlQuery select( m_db ), insert( m_db );
+        _prepareWrite( select, insert );
+        for ( const Entry & entry : entries ) {
+            _write( select, insert, entry.key, entry.val, entry.error );
+        }
+        if ( ! m_db.commit() ) {
+            qWarning() << "Insert transaction failed:" << m_db.lastError().text();
+            m_db.rollback();
+            _loadTotals();
+        }
+        _evict();
+    } // setEntries
 
     static
     Carta::Lib::IPCache::SharedPtr
-    getCacheSingleton( QString dirPath)
+    getCacheSingleton( QString dirPath, uint64_t maxBytes, bool lfu )
     {
-        sql_mutex.lock();
+        QMutexLocker locker( & sql_mutex );
         if ( m_cachePtr ) {
             qCritical() << "PCacheSQlite3Plugin::Calling GetPersistentCacheHook multiple times!!!";
         }
         else {
-            m_cachePtr.reset( new SqLitePCache( dirPath) );
+            m_cachePtr.reset( new SqLitePCache( dirPath, maxBytes, lfu ) );
         }
-        sql_mutex.unlock();
         return m_cachePtr;
     }
 
@@ -133,12 +192,20 @@ public:
 
     ~SqLitePCache()
     {
+        {
+            QMutexLocker locker( & sql_mutex );
+            if ( m_db.isOpen() ) {
+                _flushAccesses();
+            }
+        }
         m_db.close();
     }
 
 private:
 
-    SqLitePCache( QString dirPath)
+    SqLitePCache( QString dirPath, uint64_t maxBytes, bool lfu ) :
+        m_maxBytes( maxBytes ),
+        m_lfu( lfu )
     {
         m_db = QSqlDatabase::addDatabase( "QSQLITE" );
 
@@ -146,27 +213,243 @@ private:
         bool ok = m_db.open();
         if ( ! ok ) {
             qCritical() << "Could not open sqlite database at location" << dirPath;
+            return;
         }
 
         QSqlQuery query( m_db );
 
-        //query.prepare( "CREATE TABLE IF NOT EXISTS db (key TEXT PRIMARY KEY, val BLOB)" );
+        // this is a cache: losing the last writes on a power failure is fine, waiting for
+        // the disk on every transaction is not
+        query.exec( "PRAGMA synchronous = NORMAL" );
 
-        // allow to insert rows with the same "key TEXT" but may have different errors
-        query.prepare( "CREATE TABLE IF NOT EXISTS db (key TEXT, val BLOB, error BLOB)" );
+        // free pages can be given back without rewriting the whole file; only takes effect
+        // on new databases and after a VACUUM
+        query.exec( "PRAGMA auto_vacuum = INCREMENTAL" );
 
-        if ( ! query.exec() ) {
+        // one row per key, with what the eviction needs
+        if ( ! query.exec( "CREATE TABLE IF NOT EXISTS entries ("
+                           "key BLOB PRIMARY KEY, val BLOB, error BLOB, "
+                           "size INTEGER NOT NULL, atime INTEGER NOT NULL, hits INTEGER NOT NULL DEFAULT 0)" ) ) {
             qCritical() << "Create table query failed:" << query.lastError().text();
         }
+        query.exec( "CREATE INDEX IF NOT EXISTS entries_atime ON entries (atime)" );
+        query.exec( "CREATE INDEX IF NOT EXISTS entries_hits ON entries (hits, atime)" );
+
+        _migrate();
+        _loadTotals();
+        _evict();
     }
 
-private:
+    /// move the entries of the old schema, db (key, val, error) with a row per write,
+    /// keeping the value with the smallest error of every key
+    void
+    _migrate()
+    {
+        QSqlQuery query( m_db );
+        query.exec( "SELECT name FROM sqlite_master WHERE type = 'table' AND name = 'db'" );
+        if ( ! query.next() ) {
+            return;
+        }
+        query.finish();
+        qDebug() << "Migrating the persistent cache to the indexed schema...";
+        m_db.transaction();
+        bool ok = query.exec( "INSERT OR IGNORE INTO entries (key, val, error, size, atime, hits) "
+                              "SELECT key, val, error, length(key) + length(val) + length(error), 0, 0 "
+                              "FROM db ORDER BY error ASC" ) &&
+                  query.exec( "DROP TABLE db" );
+        if ( ! ok ) {
+            qWarning() << "Migration failed:" << query.lastError().text();
+            m_db.rollback();
+            return;
+        }
+        m_db.commit();
+        // also switches the file to incremental vacuum
+        query.exec( "VACUUM" );
+    } // _migrate
+
+    void
+    _loadTotals()
+    {
+        QSqlQuery query( m_db );
+        if ( query.exec( "SELECT COUNT(*), COALESCE(SUM(size), 0), COALESCE(MAX(atime), 0) FROM entries" ) &&
+             query.next() ) {
+            m_entryCount = query.value( 0 ).toULongLong();
+            m_usedBytes = query.value( 1 ).toULongLong();
+            m_clock = std::max( m_clock, query.value( 2 ).toULongLong() + 1 );
+        }
+    }
+
+    /// query must have been prepared with SELECT_SQL
+    bool
+    _read( QSqlQuery & query, const QByteArray & key, QByteArray & val, QByteArray & error )
+    {
+        query.bindValue( ":key", key );
+
+        if ( ! query.exec() ) {
+            qWarning() << "Select query failed:" << query.lastError().text();
+            query.finish();
+            return false;
+        }
+        if ( ! query.next() ) {
+            query.finish();
+            return false;
+        }
+        val = query.value( 0 ).toByteArray();
+        error = query.value( 1 ).toByteArray();
+        query.finish();
+
+        Access & access = m_accesses[key];
+        access.atime = m_clock++;
+        access.hits++;
+        if ( m_accesses.size() >= MAX_PENDING_ACCESSES ) {
+            _flushAccesses();
+        }
+        return true;
+    } // _read
+
+    void
+    _prepareWrite( QSqlQuery & select, QSqlQuery & insert )
+    {
+        select.prepare( "SELECT size, hits FROM entries WHERE key = :key" );
+        insert.prepare( "INSERT OR REPLACE INTO entries (key, val, error, size, atime, hits) "
+                        "VALUES (:key, :val, :error, :size, :atime, :hits)" );
+    }
+
+    /// insert or replace an entry; callers only write values that are at least as good
+    /// as the cached ones, so the last write wins
+    void
+    _write( QSqlQuery & select, QSqlQuery & insert,
+            const QByteArray & key, const QByteArray & val, const QByteArray & error )
+    {
+        uint64_t size = key.size() + val.size() + error.size();
+        if ( size > m_maxBytes ) {
+            return;
+        }
+
+        uint64_t oldSize = 0;
+        uint64_t hits = 0;
+        bool replace = false;
+        select.bindValue( ":key", key );
+        if ( select.exec() && select.next() ) {
+            oldSize = select.value( 0 ).toULongLong();
+            hits = select.value( 1 ).toULongLong();
+            replace = true;
+        }
+        select.finish();
+
+        insert.bindValue( ":key", key );
+        insert.bindValue( ":val", val );
+        insert.bindValue( ":error", error );
+        insert.bindValue( ":size", qulonglong( size ) );
+        insert.bindValue( ":atime", qulonglong( m_clock++ ) );
+        insert.bindValue( ":hits", qulonglong( hits ) );
+
+        if ( ! insert.exec() ) {
+            qWarning() << "Insert query failed:" << insert.lastError().text();
+            return;
+        }
+        m_accesses.remove( key );
+        m_usedBytes += size - oldSize;
+        if ( ! replace ) {
+            m_entryCount++;
+        }
+    } // _write
+
+    /// write the recorded accesses back to the table
+    void
+    _flushAccesses()
+    {
+        if ( m_accesses.isEmpty() ) {
+            return;
+        }
+        bool own = m_db.transaction();
+        QSqlQuery query( m_db );
+        query.prepare( "UPDATE entries SET atime = :atime, hits = hits + :hits WHERE key = :key" );
+        for ( auto iter = m_accesses.begin() ; iter != m_accesses.end() ; ++iter ) {
+            query.bindValue( ":atime", qulonglong( iter->atime ) );
+            query.bindValue( ":hits", qulonglong( iter->hits ) );
+            query.bindValue( ":key", iter.key() );
+            if ( ! query.exec() ) {
+                qWarning() << "Access update failed:" << query.lastError().text();
+            }
+        }
+        if ( own ) {
+            m_db.commit();
+        }
+        m_accesses.clear();
+    } // _flushAccesses
+
+    /// delete the least valuable entries until 90% of the budget is left
+    void
+    _evict()
+    {
+        if ( m_usedBytes <= m_maxBytes ) {
+            return;
+        }
+        const uint64_t target = m_maxBytes / 10 * 9;
+        _flushAccesses();
+
+        QElapsedTimer timer;
+        timer.start();
+        uint64_t evicted = 0;
+        bool own = m_db.transaction();
+        QSqlQuery select( m_db );
+        QSqlQuery remove( m_db );
+        remove.prepare( "DELETE FROM entries WHERE key = :key" );
+        while ( m_usedBytes > target ) {
+            select.exec( m_lfu ?
+                         "SELECT key, size FROM entries ORDER BY hits ASC, atime ASC LIMIT 256" :
+                         "SELECT key, size FROM entries ORDER BY atime ASC LIMIT 256" );
+            std::vector < std::pair < QByteArray, uint64_t > > victims;
+            while ( select.next() && m_usedBytes > target ) {
+                victims.push_back( { select.value( 0 ).toByteArray(), select.value( 1 ).toULongLong() } );
+                m_usedBytes -= std::min( m_usedBytes, victims.back().second );
+            }
+            select.finish();
+            if ( victims.empty() ) {
+                break;
+            }
+            for ( auto & victim : victims ) {
+                remove.bindValue( ":key", victim.first );
+                if ( remove.exec() ) {
+                    m_entryCount--;
+                    evicted++;
+                }
+            }
+        }
+        if ( own ) {
+            m_db.commit();
+        }
+        m_evictions += evicted;
+        QSqlQuery vacuum( m_db );
+        vacuum.exec( "PRAGMA incremental_vacuum" );
+        if ( CARTA_RUNTIME_CHECKS ) {
+            qCritical() << "<> Time to evict" << evicted << "cache entries:" << timer.elapsed() << "ms";
+        }
+    } // _evict
+
+    struct Access {
+        uint64_t atime = 0;
+        uint64_t hits = 0;
+    };
 
     QSqlDatabase m_db;
+    uint64_t m_maxBytes;
+    bool m_lfu;
+    uint64_t m_usedBytes = 0;
+    uint64_t m_entryCount = 0;
+    uint64_t m_evictions = 0;
+    // logical time of the accesses
+    uint64_t m_clock = 1;
+    // accesses not written back yet
+    QHash < QByteArray, Access > m_accesses;
+    static const int MAX_PENDING_ACCESSES = 256;
+    static const char * const SELECT_SQL;
     static Carta::Lib::IPCache::SharedPtr m_cachePtr; //  = nullptr;
 };
 
 Carta::Lib::IPCache::SharedPtr SqLitePCache::m_cachePtr = nullptr;
+const char * const SqLitePCache::SELECT_SQL = "SELECT val, error FROM entries WHERE key = :key";
 
 PCacheSQlite3Plugin::PCacheSQlite3Plugin( QObject * parent ) :
     QObject( parent )
@@ -187,7 +470,7 @@ PCacheSQlite3Plugin::handleHook( BaseHook & hookData )
         }
 
         // try to create the database
-        hook.result = SqLitePCache::getCacheSingleton( m_dbPath);
+        hook.result = SqLitePCache::getCacheSingleton( m_dbPath, uint64_t( m_maxStorageMB * 1024 * 1024 ), m_lfu );
 
         // return true if result is not null
         return hook.result != nullptr;
@@ -216,6 +499,14 @@ PCacheSQlite3Plugin::initialize( const IPlugin::InitInfo & initInfo )
         m_dbPath.replace("$(APPDIR)", QCoreApplication::applicationDirPath()); // get the directory of CARTA Application
         m_dbPath = QDir(m_dbPath).absolutePath();
     }
+
+    // storage budget and which entries to evict when it is exceeded
+    m_maxStorageMB = initInfo.json.value( "maxStorageMB" ).toDouble( DEFAULT_MAX_STORAGE_MB );
+    if ( m_maxStorageMB <= 0 ) {
+        qWarning() << "Invalid maxStorageMB for PCacheSqlite3 plugin, using" << DEFAULT_MAX_STORAGE_MB;
+        m_maxStorageMB = DEFAULT_MAX_STORAGE_MB;
+    }
+    m_lfu = initInfo.json.value( "evictionPolicy" ).toString( "LRU" ).toUpper() == "LFU";
 }
 
 std::vector < HookId >
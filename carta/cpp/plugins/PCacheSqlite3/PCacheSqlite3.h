@@ -28,4 +28,7 @@ public :
 private:
 
     QString m_dbPath;
+    double m_maxStorageMB = DEFAULT_MAX_STORAGE_MB;
+    bool m_lfu = false;
+    static const int DEFAULT_MAX_STORAGE_MB = 4096;
 };
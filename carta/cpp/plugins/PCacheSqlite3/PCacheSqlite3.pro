@@ -17,6 +17,9 @@ SOURCES += \
 HEADERS += \
     PCacheSqlite3.h
 
+# the default batched accessors of IPCache live in CartaLib
+LIBS += -L$$OUT_PWD/../../CartaLib/ -lCartaLib
+
 OTHER_FILES += \
     plugin.json
 
@@ -92,20 +92,23 @@ std::map<double, Scalar> PercentileHistogram<Scalar>::percentile2pixels(
             Carta::Lib::NdArray::Double viewSlice = Carta::Lib::viewSliceForFrame(view, spectralIndex, f);
 
             // iterate over the frame
-            viewSlice.forEach([&bins, this, &pixelIndex, &minIntensity, &intensityRange, &converter, &hertzVal] (const Scalar &val) {
-                if (std::isfinite(val)) {
-                    pixelIndex = static_cast<unsigned int>(round(this->numberOfBins * (converter->_frameDependentConvert(val, hertzVal) - minIntensity) / intensityRange));
-                    bins[pixelIndex]++;
+            viewSlice.forEachChunk([&bins, this, &pixelIndex, &minIntensity, &intensityRange, &converter, &hertzVal] (const double * values, int64_t count) {
+                for (int64_t i = 0; i < count; i++) {
+                    if (std::isfinite(values[i])) {
+                        pixelIndex = static_cast<unsigned int>(round(this->numberOfBins * (converter->_frameDependentConvert(values[i], hertzVal) - minIntensity) / intensityRange));
+                        bins[pixelIndex]++;
+                    }
                 }
             });
         }
     } else {
         // we don't have to do any conversions in the loop
         // and we can loop over the flat image
-        view.forEach([&bins, this, &pixelIndex, &minIntensity, &intensityRange] (const Scalar &val) {
-            if (std::isfinite(val)) {
-                pixelIndex = static_cast<unsigned int>(round(this->numberOfBins * (val - minIntensity) / intensityRange));
-                bins[pixelIndex]++;
+        view.forEachChunk([&bins, this, &minIntensity, &intensityRange] (const Scalar * values, int64_t count) {
+            for (int64_t i = 0; i < count; i++) {
+                if (std::isfinite(values[i])) {
+                    bins[static_cast<unsigned int>(round(this->numberOfBins * (values[i] - minIntensity) / intensityRange))]++;
+                }
             }
         });
     }
@@ -427,12 +427,15 @@ bool ProfileCASA::handleHook(BaseHook & hookData){
             casa_mutex.unlock();
             return false;
         }
+        // keep the raw view readers of this file out while we use the image
+        QMutexLocker storageLocker( cartaII2storageMutex( imagePtr ) );
 
         std::shared_ptr<Carta::Lib::Regions::RegionBase> regionInfo = hook.paramsPtr->m_regionInfo;
         Carta::Lib::ProfileInfo profileInfo = hook.paramsPtr->m_profileInfo;
         int x = hook.paramsPtr->m_x;
         int y = hook.paramsPtr->m_y;
         hook.result = _generateProfile( casaImage, regionInfo, x, y, profileInfo );
+        storageLocker.unlock();
         casa_mutex.unlock();
         return true;
     }
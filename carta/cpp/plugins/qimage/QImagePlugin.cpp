@@ -5,6 +5,7 @@
 #include <memory>
 #include <algorithm>
 #include <vector>
+#include <stdexcept>
 
 typedef Carta::Lib::HtmlString HtmlString;
 typedef Carta::Lib::AxisInfo AxisInfo;
@@ -164,12 +165,41 @@ public:
              char * buff,
              Traversal traversal ) override
     {
-        Q_UNUSED( buffSize );
-        Q_UNUSED( func );
-        Q_UNUSED( buff );
-        Q_UNUSED( traversal );
-        qFatal( "not implemented" );
-    }
+        if ( traversal != Carta::Lib::NdArray::RawViewInterface::Traversal::Sequential ) {
+            qFatal( "sorry, not implemented yet" );
+        }
+        const int64_t capacity = buffSize / int64_t( sizeof( float ) );
+        if ( capacity <= 0 ) {
+            throw std::runtime_error( "buffer too small" );
+        }
+        std::vector < float > ownBuffer;
+        float * floatBuff = reinterpret_cast < float * > ( buff );
+        if ( ! floatBuff ) {
+            ownBuffer.resize( capacity );
+            floatBuff = ownBuffer.data();
+        }
+
+        const std::vector < Slice1D::ApplyResult > & dims = m_appliedSlice.dims();
+
+        int64_t count = 0;
+        int y = dims[1].start;
+        for ( int yc = 0 ; yc < dims[1].count ; ++yc ) {
+            unsigned char * row = & m_rawData[m_origDims[0] * y];
+            int x = dims[0].start;
+            for ( int xc = 0 ; xc < dims[0].count ; ++xc ) {
+                floatBuff[count++] = float (row[x]) / float (255.0);
+                if ( count == capacity ) {
+                    func( reinterpret_cast < const char * > ( floatBuff ), count );
+                    count = 0;
+                }
+                x += dims[0].step;
+            }
+            y += dims[1].step;
+        }
+        if ( count > 0 ) {
+            func( reinterpret_cast < const char * > ( floatBuff ), count );
+        }
+    } // forEach
 
 private:
 
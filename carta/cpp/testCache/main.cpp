@@ -7,8 +7,10 @@
 #include "CartaLib/Algorithms/cacheUtils.h"
 #include "CartaLib/IPCache.h"
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QTime>
 #include <QJsonArray>
+#include <random>
 
 namespace tCache
 {
@@ -140,6 +142,129 @@ testCache()
     pcache-> setEntry( key, "hola", 0 );
 } // testCache
 
+// benchmark parameters
+int benchEntries = 2000;
+int benchEntrySize = 64 * 1024;
+int benchBatchSize = 64;
+int benchAccesses = 20000;
+
+static QByteArray
+benchKey( int i )
+{
+    return QString( "bench/%1" ).arg( i ).toUtf8();
+}
+
+static QByteArray
+benchValue( int i )
+{
+    return QByteArray( benchEntrySize, char ( 'a' + i % 26 ) );
+}
+
+static void
+reportThroughput( const char * what, int count, qint64 ms )
+{
+    double seconds = std::max < qint64 > ( ms, 1 ) / 1000.0;
+    qDebug() << "  " << what << ":" << count / seconds << "entries/s,"
+             << count * double ( benchEntrySize ) / seconds / 1024 / 1024 << "MB/s";
+}
+
+static void
+reportStorage()
+{
+    qDebug() << "   storage:" << pcache-> usedStorage() << "of" << pcache-> maxStorage()
+             << "bytes in" << pcache-> nEntries() << "entries,"
+             << pcache-> nEvictions() << "evicted";
+}
+
+/// read/write throughput, one at a time and batched, and the hit rate with a skewed
+/// access pattern on a working set 4 times larger than the storage budget
+static void
+benchmarkCache()
+{
+    QElapsedTimer timer;
+    const uint64_t oldMax = pcache-> maxStorage();
+    qDebug() << "Benchmark:" << benchEntries << "entries of" << benchEntrySize << "bytes";
+
+    timer.start();
+    for ( int i = 0 ; i < benchEntries ; i++ ) {
+        pcache-> setEntry( benchKey( i ), benchValue( i ), QByteArray() );
+    }
+    reportThroughput( "single writes", benchEntries, timer.elapsed() );
+
+    timer.start();
+    for ( int i = 0 ; i < benchEntries ; i += benchBatchSize ) {
+        std::vector < Carta::Lib::IPCache::Entry > batch;
+        for ( int j = i ; j < std::min( i + benchBatchSize, benchEntries ) ; j++ ) {
+            Carta::Lib::IPCache::Entry entry;
+            entry.key = benchKey( j );
+            entry.val = benchValue( j );
+            batch.push_back( entry );
+        }
+        pcache-> setEntries( batch );
+    }
+    reportThroughput( "batched writes", benchEntries, timer.elapsed() );
+    reportStorage();
+
+    timer.start();
+    int found = 0;
+    for ( int i = 0 ; i < benchEntries ; i++ ) {
+        QByteArray val, error;
+        if ( pcache-> readEntry( benchKey( i ), val, error ) && val == benchValue( i ) ) {
+            found++;
+        }
+    }
+    reportThroughput( "single reads", benchEntries, timer.elapsed() );
+    if ( found != benchEntries ) {
+        qCritical() << "Only" << found << "of" << benchEntries << "entries read back";
+    }
+
+    timer.start();
+    found = 0;
+    for ( int i = 0 ; i < benchEntries ; i += benchBatchSize ) {
+        std::vector < Carta::Lib::IPCache::Entry > batch;
+        for ( int j = i ; j < std::min( i + benchBatchSize, benchEntries ) ; j++ ) {
+            Carta::Lib::IPCache::Entry entry;
+            entry.key = benchKey( j );
+            batch.push_back( entry );
+        }
+        found += pcache-> readEntries( batch );
+    }
+    reportThroughput( "batched reads", benchEntries, timer.elapsed() );
+    if ( found != benchEntries ) {
+        qCritical() << "Only" << found << "of" << benchEntries << "entries read back in batches";
+    }
+
+    // the cache can now only hold a quarter of the entries; we read with a skewed
+    // distribution and write the entry on every miss, like the viewer does
+    pcache-> setMaxStorage( uint64_t( benchEntries ) * benchEntrySize / 4 );
+    reportStorage();
+    std::mt19937 generator( 1 );
+    std::uniform_real_distribution < double > uniform( 0, 1 );
+    int hits = 0;
+    timer.start();
+    for ( int a = 0 ; a < benchAccesses ; a++ ) {
+        double u = uniform( generator );
+        int i = std::min( benchEntries - 1, int ( benchEntries * u * u * u ) );
+        QByteArray val, error;
+        if ( pcache-> readEntry( benchKey( i ), val, error ) ) {
+            hits++;
+        }
+        else {
+            pcache-> setEntry( benchKey( i ), benchValue( i ), QByteArray() );
+        }
+    }
+    qDebug() << "   hit rate:" << 100.0 * hits / benchAccesses << "% of" << benchAccesses
+             << "skewed accesses in" << timer.elapsed() << "ms";
+    reportStorage();
+
+    timer.start();
+    pcache-> compact();
+    qDebug() << "   compaction:" << timer.elapsed() << "ms";
+
+    pcache-> setMaxStorage( oldMax );
+    pcache-> deleteAll();
+} // benchmarkCache
+
 static int
 coreMainCPP( QString platformString, int argc, char * * argv )
 {
@@ -215,6 +340,7 @@ coreMainCPP( QString platformString, int argc, char * * argv )
         pcache = res;
         pcache->deleteAll();
         testCache();
+        benchmarkCache();
     };
     
     // call the lambda on every pcache plugin
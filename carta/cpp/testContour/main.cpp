@@ -0,0 +1,225 @@
+/*
+ * This is the benchmark for the contour generators
+ *
+ * Usage: $./testContour [plane size] [number of levels] [repeats]
+ *
+ * for example: $./testContour 8192 20 3
+ *
+ * It compares the tiled marching squares, single threaded and multithreaded, with
+ * the Conrec path of the old contour service on a synthetic plane. The tiled result
+ * is checked against the same computation done in a single tile, which has nothing
+ * to stitch. It also times the smoothing done before contouring, the gaussian and the
+ * box filter, for a few kernel sizes.
+ */
+
+#include "core/Algorithms/contourTiles.h"
+#include "core/Algorithms/smoothing.h"
+#include "CartaLib/Algorithms/ContourConrec.h"
+#include "CartaLib/IImage.h"
+#include "CartaLib/Slice.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QDebug>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace tContour {
+
+typedef Carta::Core::Algorithms::ContourLines ContourLines;
+
+/// synthetic plane: a few broad blobs with some noise and a NaN hole, so that every
+/// level has both long lines across many tiles and lots of small closed ones
+static std::shared_ptr<std::vector<float> > makePlane(int size) {
+    auto plane = std::make_shared<std::vector<float> >(int64_t(size) * size);
+    std::mt19937 gen(42);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+    int64_t r2 = int64_t(size / 16) * (size / 16);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            double u = double(x) / size, v = double(y) / size;
+            float val = std::sin(7 * u) * std::cos(5 * v) + 0.5 * std::sin(23 * u * v) + noise(gen);
+            int64_t dx = x - size / 3, dy = y - size / 3;
+            (*plane)[int64_t(y) * size + x] = dx * dx + dy * dy < r2 ? NAN : val;
+        }
+    }
+    return plane;
+}
+
+/// a band of rows of the plane in memory, as much of a raw view as Conrec needs
+class PlaneView : public Carta::Lib::NdArray::RawViewInterface {
+public:
+    PlaneView(std::shared_ptr<std::vector<float> > plane, int width, int y0, int rows)
+        : m_plane(plane), m_y0(y0) {
+        m_viewDims = {width, rows};
+        m_pixelType = Carta::Lib::Image::PixelType::Real32;
+    }
+
+    virtual PixelType pixelType() override {
+        return m_pixelType;
+    }
+
+    virtual const VI & dims() override {
+        return m_viewDims;
+    }
+
+    virtual const char * get(const VI & pos) override {
+        return reinterpret_cast<const char *>(&(*m_plane)[int64_t(m_y0 + pos[1]) * m_viewDims[0] + pos[0]]);
+    }
+
+    virtual void forEach(std::function<void (const char *)> func, Traversal traversal) override {
+        Q_UNUSED(traversal);
+        const float * first = m_plane->data() + int64_t(m_y0) * m_viewDims[0];
+        for (int64_t i = 0; i < int64_t(m_viewDims[0]) * m_viewDims[1]; i++) {
+            func(reinterpret_cast<const char *>(first + i));
+        }
+    }
+
+    virtual const VI & currentPos() override {
+        qFatal("not implemented");
+        return m_viewDims;
+    }
+
+    /// only whole rows are supported
+    virtual RawViewInterface * getView(const SliceND & sliceInfo) override {
+        SliceND::ApplyResult ar = sliceInfo.apply(m_viewDims);
+        const auto & rows = ar.dims()[1];
+        return new PlaneView(m_plane, m_viewDims[0], m_y0 + rows.start, rows.count);
+    }
+
+    virtual int64_t read(int64_t buffSize, char * buff, Traversal traversal) override {
+        Q_UNUSED(buffSize);
+        Q_UNUSED(buff);
+        Q_UNUSED(traversal);
+        qFatal("not implemented");
+        return 0;
+    }
+
+    virtual void seek(int64_t ind) override {
+        Q_UNUSED(ind);
+        qFatal("not implemented");
+    }
+
+    virtual int64_t read(int64_t chunk, int64_t buffSize, char * buff, Traversal traversal) override {
+        Q_UNUSED(chunk);
+        Q_UNUSED(buffSize);
+        Q_UNUSED(buff);
+        Q_UNUSED(traversal);
+        qFatal("not implemented");
+        return 0;
+    }
+
+    virtual void forEach(int64_t buffSize, std::function<void (const char *, int64_t count)> func,
+                         char * buff, Traversal traversal) override {
+        Q_UNUSED(buffSize);
+        Q_UNUSED(buff);
+        Q_UNUSED(traversal);
+        const float * first = m_plane->data() + int64_t(m_y0) * m_viewDims[0];
+        func(reinterpret_cast<const char *>(first), int64_t(m_viewDims[0]) * m_viewDims[1]);
+    }
+
+private:
+    std::shared_ptr<std::vector<float> > m_plane;
+    int m_y0;
+    VI m_viewDims;
+    PixelType m_pixelType;
+};
+
+/// what the sink received
+struct Totals {
+    int messages = 0;
+    int64_t lines = 0;
+    int64_t vertices = 0;
+};
+
+static Totals runTiled(const std::vector<float> & plane, int size, const std::vector<double> & levels,
+                       int tileSize, int nThreads, qint64 & best, int repeats) {
+    Totals totals;
+    best = -1;
+    for (int i = 0; i < repeats; i++) {
+        totals = Totals();
+        QElapsedTimer timer;
+        timer.start();
+        Carta::Core::Algorithms::tiledContours(plane.data(), size, size, levels,
+            [&totals](int, const std::vector<ContourLines> & lines, double) {
+                totals.messages++;
+                for (const ContourLines & level : lines) {
+                    totals.lines += level.startIndices.size();
+                    totals.vertices += level.coordinates.size() / 2;
+                }
+                return true;
+            }, tileSize, nThreads);
+        qint64 elapsed = timer.nsecsElapsed();
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return totals;
+}
+
+} // namespace tContour
+
+int main(int argc, char **argv) {
+    QCoreApplication app(argc, argv);
+    int size = argc > 1 ? atoi(argv[1]) : 8192;
+    int nLevels = argc > 2 ? atoi(argv[2]) : 20;
+    int repeats = argc > 3 ? atoi(argv[3]) : 3;
+
+    qCritical() << "Generating a synthetic" << size << "x" << size << "plane...";
+    std::shared_ptr<std::vector<float> > plane = tContour::makePlane(size);
+    std::vector<double> levels;
+    for (int i = 0; i < nLevels; i++) {
+        levels.push_back(-1.4 + 2.8 * (i + 0.5) / nLevels);
+    }
+
+    // reference: one tile covering the whole plane
+    qint64 elapsed;
+    tContour::Totals reference = tContour::runTiled(*plane, size, levels, size, 1, elapsed, 1);
+    qCritical() << "single tile: " << elapsed / 1e6 << "ms," << reference.lines << "lines,"
+                << reference.vertices << "vertices";
+
+    int threads = QThread::idealThreadCount();
+    for (int nThreads : {1, threads}) {
+        tContour::Totals totals = tContour::runTiled(*plane, size, levels, 256, nThreads, elapsed, repeats);
+        bool pass = totals.lines == reference.lines && totals.vertices == reference.vertices;
+        qCritical() << "tiled, threads" << nThreads << ":" << elapsed / 1e6 << "ms,"
+                    << totals.messages << "messages," << totals.lines << "lines,"
+                    << totals.vertices << "vertices" << (pass ? "PASS" : "FAIL");
+    }
+
+    // smoothing: the gaussian costs grow with the kernel, the box filter's do not
+    std::vector<float> smoothed(plane->size());
+    for (int factor : {3, 7, 15, 31}) {
+        QElapsedTimer timer;
+        timer.start();
+        Carta::Core::Algorithms::smoothSeparable(plane->data(), size, size,
+            Carta::Core::Algorithms::gaussianKernel(factor / 2.3548), smoothed.data());
+        qint64 gaussian = timer.nsecsElapsed();
+        timer.restart();
+        Carta::Core::Algorithms::smoothBox(plane->data(), size, size, factor, smoothed.data());
+        qint64 box = timer.nsecsElapsed();
+        qCritical() << "smoothing" << factor << "pixels: gaussian" << gaussian / 1e6 << "ms, box"
+                    << box / 1e6 << "ms";
+    }
+
+    // the old path: Conrec reads the rows through the raw view and returns unjoined segments
+    tContour::PlaneView view(plane, size, 0, size);
+    Carta::Lib::Algorithms::ContourConrec conrec;
+    conrec.setLevels(levels);
+    QElapsedTimer timer;
+    timer.start();
+    Carta::Lib::Algorithms::ContourConrec::Result result = conrec.compute(&view, "");
+    elapsed = timer.nsecsElapsed();
+    int64_t polygons = 0, vertices = 0;
+    for (const auto & level : result) {
+        polygons += level.size();
+        for (const QPolygonF & polygon : level) {
+            vertices += polygon.size();
+        }
+    }
+    qCritical() << "conrec: " << elapsed / 1e6 << "ms," << polygons << "polylines," << vertices << "vertices";
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * This is the benchmark for the raster image downsampling kernel
+ *
+ * Usage: $./testDownsample [plane size] [repeats]
+ *
+ * for example: $./testDownsample 8192 3
+ *
+ * It reports the throughput (in input MPix/s) of the NaN-aware block average for
+ * mip = 1, 2, 4, 8 and 16 on a synthetic plane, single threaded and multithreaded.
+ */
+
+#include "core/Algorithms/downsampling.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QDebug>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace tDownsample {
+
+const std::vector<int> mips = {1, 2, 4, 8, 16};
+
+/// synthetic plane: noise with a few NaN holes, like a real image with a mask
+static std::vector<float> makePlane(int size) {
+    std::vector<float> plane(int64_t(size) * size);
+    std::mt19937 gen(42);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    for (auto & val : plane) {
+        val = noise(gen);
+    }
+    // blank out a disk in the middle and every 97th pixel
+    int64_t r2 = int64_t(size / 8) * (size / 8);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int64_t dx = x - size / 2, dy = y - size / 2;
+            if (dx * dx + dy * dy < r2 || (int64_t(y) * size + x) % 97 == 0) {
+                plane[int64_t(y) * size + x] = NAN;
+            }
+        }
+    }
+    return plane;
+}
+
+/// straightforward version of the old algorithm, used to check the results
+static float referenceBlock(const std::vector<float> & plane, int size, int bx, int by, int mip) {
+    float sum = 0;
+    float denominator = mip * mip;
+    for (int e = 0; e < mip * mip; e++) {
+        float val = plane[int64_t(by * mip + e / mip) * size + bx * mip + e % mip];
+        if (std::isfinite(val)) {
+            sum += val;
+        } else {
+            denominator -= 1;
+        }
+    }
+    return denominator < 1 ? NAN : sum / denominator;
+}
+
+static bool check(const std::vector<float> & plane, int size, int mip, const std::vector<float> & out) {
+    int nx = size / mip;
+    int ny = size / mip;
+    for (int by = 0; by < ny; by += 97) {
+        for (int bx = 0; bx < nx; bx += 13) {
+            float expected = referenceBlock(plane, size, bx, by, mip);
+            float actual = out[int64_t(by) * nx + bx];
+            if (std::isnan(expected) != std::isnan(actual) ||
+                (!std::isnan(expected) && std::abs(expected - actual) > 1e-4f * (1 + std::abs(expected)))) {
+                qCritical() << "Mismatch at" << bx << by << "mip" << mip << ":" << actual << "!=" << expected;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void benchmark(const std::vector<float> & plane, int size, int mip, int nThreads, int repeats) {
+    int nx = size / mip;
+    int ny = size / mip;
+    std::vector<float> out(int64_t(nx) * ny);
+
+    // the reader copies the rows from memory, like a cached plane would
+    auto readRows = [&plane, size, nx, mip](int yStart, int nRows, float * dst) {
+        int64_t width = int64_t(nx) * mip;
+        for (int r = 0; r < nRows; r++) {
+            std::memcpy(dst + r * width, plane.data() + int64_t(yStart + r) * size, width * sizeof(float));
+        }
+    };
+
+    qint64 best = -1;
+    for (int i = 0; i < repeats; i++) {
+        QElapsedTimer timer;
+        timer.start();
+        Carta::Core::Algorithms::downsample(readRows, nx, ny, mip, out.data(), nThreads);
+        qint64 elapsed = timer.nsecsElapsed();
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    double mpix = double(nx) * mip * ny * mip / 1e6;
+    qCritical() << "mip" << mip << "threads" << nThreads << ":"
+                << best / 1e6 << "ms," << mpix / (best / 1e9) << "MPix/s"
+                << (check(plane, size, mip, out) ? "PASS" : "FAIL");
+}
+
+} // namespace tDownsample
+
+int main(int argc, char **argv) {
+    QCoreApplication app(argc, argv);
+    int size = argc > 1 ? atoi(argv[1]) : 8192;
+    int repeats = argc > 2 ? atoi(argv[2]) : 3;
+
+    qCritical() << "Generating a synthetic" << size << "x" << size << "plane...";
+    std::vector<float> plane = tDownsample::makePlane(size);
+
+    int threads = QThread::idealThreadCount();
+    for (int mip : tDownsample::mips) {
+        tDownsample::benchmark(plane, size, mip, 1, repeats);
+        tDownsample::benchmark(plane, size, mip, threads, repeats);
+    }
+    return 0;
+}
@@ -20,6 +20,7 @@
 
 // we want to check percentile functions from this code
 #include "core/Algorithms/percentileAlgorithms.h"
+#include "core/Algorithms/minMaxHistogram.h"
 
 #include "CartaLib/Hooks/LoadAstroImage.h"
 #include "CartaLib/Hooks/Initialize.h"
@@ -37,6 +38,7 @@
 #include <QDebug>
 #include <cmath>
 #include <QJsonObject>
+#include <QElapsedTimer>
 
 const std::vector<double> percentile = {0.0005, 0.0025, 0.005, 0.01, 0.015,
                                         0.02, 0.025, 0.0375, 0.05, 0.95,
@@ -337,6 +339,69 @@ static void testPercentileManku99(std::shared_ptr<Carta::Lib::Image::ImageInterf
 
 }
 
+/// the min/max and histogram loops of MinMaxPercentiles before they went to the kernels
+static std::vector<uint32_t> referenceHistogram(const std::vector<float>& values, int numberOfBins,
+                                                double& minPixel, double& maxPixel) {
+    minPixel = std::numeric_limits<double>::max();
+    maxPixel = std::numeric_limits<double>::lowest();
+    for (const float& val : values) {
+        if (std::isfinite(val)) {
+            minPixel = std::min<double>(minPixel, val);
+            maxPixel = std::max<double>(maxPixel, val);
+        }
+    }
+    std::vector<uint32_t> bins(numberOfBins + 1, 0);
+    double intensityRange = fabs(maxPixel - minPixel);
+    for (const float& val : values) {
+        if (std::isfinite(val)) {
+            bins[static_cast<unsigned int>(round(numberOfBins * (val - minPixel) / intensityRange))]++;
+        }
+    }
+    return bins;
+}
+
+/// times the min/max and histogram of stoke I in memory: the scalar loops against the
+/// kernels on one thread and on all of them, best of a few runs
+static void benchmarkMinMaxHistogram(std::shared_ptr<Carta::Lib::Image::ImageInterface> astroImage, int numberOfBins) {
+    const int repeats = 5;
+
+    Carta::Lib::NdArray::RawViewInterface* rawData = getRawData(astroImage, -1, -1, 0);
+    std::shared_ptr<Carta::Lib::NdArray::RawViewInterface> view(rawData);
+    Carta::Lib::NdArray::Float floatView(view.get(), false);
+    std::vector<float> values;
+    floatView.forEachChunk([&values] (const float * chunk, int64_t count) {
+        values.insert(values.end(), chunk, chunk + count);
+    });
+
+    double minRef = 0, maxRef = 0;
+    std::vector<uint32_t> binsRef;
+    QElapsedTimer timer;
+    qint64 referenceTime = std::numeric_limits<qint64>::max();
+    for (int r = 0; r < repeats; r++) {
+        timer.start();
+        binsRef = referenceHistogram(values, numberOfBins, minRef, maxRef);
+        referenceTime = std::min(referenceTime, timer.nsecsElapsed());
+    }
+
+    qCritical() << "MIN/MAX + HISTOGRAM KERNELS (" << Carta::Core::Algorithms::minMaxHistogramIsa() << ")";
+    qCritical() << "--------------------------------------------------------------------------------";
+    qCritical() << values.size() << "values," << numberOfBins + 1 << "bins, scalar loops:" << referenceTime / 1.0e6 << "ms";
+    for (int nThreads : {1, 0}) {
+        Carta::Core::Algorithms::MinMaxCount minMax;
+        std::vector<uint32_t> bins;
+        qint64 kernelTime = std::numeric_limits<qint64>::max();
+        for (int r = 0; r < repeats; r++) {
+            timer.start();
+            bins = Carta::Core::Algorithms::histogram(values.data(), values.size(), numberOfBins, minMax, nThreads);
+            kernelTime = std::min(kernelTime, timer.nsecsElapsed());
+        }
+        bool same = bins == binsRef && minMax.min == minRef && minMax.max == maxRef;
+        qCritical() << (same ? "[PASS]" : "[FAIL !!]") << "kernels on" << (nThreads == 1 ? "one thread:" : "all threads:")
+                    << kernelTime / 1.0e6 << "ms, speedup" << double(referenceTime) / std::max<qint64>(kernelTime, 1)
+                    << "NaN count" << minMax.nonFiniteCount;
+    }
+}
+
 static int coreMainCPP(QString platformString, int argc, char **argv) {
     MyQApp qapp(argc, argv);
 
@@ -411,6 +476,9 @@ static int coreMainCPP(QString platformString, int argc, char **argv) {
         // Compare old and new min/max algorithms
         testMinMax(astroImage);
 
+        // Time the min/max and histogram kernels against the scalar loops
+        benchmarkMinMaxHistogram(astroImage, bin_number[0]);
+
         // make a lambda to set the value of calculator and call the tests
         auto lam = [=] ( const Carta::Lib::Hooks::PercentileToPixelHook<double>::ResultType &res ) {
             Carta::Lib::IPercentilesToPixels<double>::SharedPtr calculator = res;
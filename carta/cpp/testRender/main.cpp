@@ -0,0 +1,144 @@
+/*
+ * This is the benchmark for rendering an image plane through the pixel pipeline
+ *
+ * Usage: $./testRender [plane size] [repeats]
+ *
+ * for example: $./testRender 4096 3
+ *
+ * It compares the per-pixel paths of the image render service (the full pipeline and
+ * the cached one) with the table driven batch conversion, single threaded and
+ * parallel over rows, on a synthetic plane with a log scale and gamma. The colors are
+ * checked against the full pipeline.
+ */
+
+#include "CartaLib/PixelPipeline/CustomizablePixelPipeline.h"
+#include "CartaLib/PixelPipeline/LutPipeline.h"
+#include "core/Algorithms/parallel.h"
+#include "core/GrayColormap.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QDebug>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <vector>
+
+namespace tRender {
+
+namespace PP = Carta::Lib::PixelPipeline;
+
+/// synthetic plane: noise on a slope, with a few NaN holes
+static std::vector<float> makePlane(int size) {
+    std::vector<float> plane(int64_t(size) * size);
+    std::mt19937 gen(42);
+    std::normal_distribution<float> noise(0.0f, 0.1f);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int64_t i = int64_t(y) * size + x;
+            plane[i] = i % 101 == 0 ? NAN : float(x) / size + noise(gen);
+        }
+    }
+    return plane;
+}
+
+/// best time of repeats runs of func, in ns
+static qint64 best(int repeats, const std::function<void()> & func) {
+    qint64 best = -1;
+    for (int i = 0; i < repeats; i++) {
+        QElapsedTimer timer;
+        timer.start();
+        func();
+        qint64 elapsed = timer.nsecsElapsed();
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+/// the loop of the render service before the batch conversion
+template <class Pipeline>
+static void perPixel(const std::vector<float> & plane, Pipeline & pipe, QRgb nanColor, std::vector<QRgb> & out) {
+    for (size_t i = 0; i < plane.size(); i++) {
+        double val = plane[i];
+        if (!std::isnan(val)) {
+            pipe.convertq(val, out[i]);
+        } else {
+            out[i] = nanColor;
+        }
+    }
+}
+
+/// pixels whose colors differ from the reference by more than one step in any channel
+static int64_t mismatches(const std::vector<QRgb> & reference, const std::vector<QRgb> & out) {
+    int64_t count = 0;
+    for (size_t i = 0; i < out.size(); i++) {
+        if (std::abs(qRed(out[i]) - qRed(reference[i])) > 1 ||
+            std::abs(qGreen(out[i]) - qGreen(reference[i])) > 1 ||
+            std::abs(qBlue(out[i]) - qBlue(reference[i])) > 1) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void report(const char * name, qint64 elapsed, int size, int64_t bad) {
+    double mpix = double(size) * size / 1e6;
+    qCritical() << name << ":" << elapsed / 1e6 << "ms," << mpix / (elapsed / 1e9) << "MPix/s,"
+                << bad << "pixels off by more than one step";
+}
+
+} // namespace tRender
+
+int main(int argc, char **argv) {
+    QCoreApplication app(argc, argv);
+    int size = argc > 1 ? atoi(argv[1]) : 4096;
+    int repeats = argc > 2 ? atoi(argv[2]) : 3;
+
+    qCritical() << "Generating a synthetic" << size << "x" << size << "plane...";
+    std::vector<float> plane = tRender::makePlane(size);
+
+    tRender::PP::CustomizablePixelPipeline pipe;
+    pipe.setColormap(std::make_shared<Carta::Core::GrayColormap>());
+    pipe.setScale(tRender::PP::ScaleType::Log);
+    pipe.setGamma(0.8);
+    double clipMin = 0.05, clipMax = 0.95;
+    pipe.setMinMax(clipMin, clipMax);
+    QRgb nanColor = qRgb(255, 0, 0);
+
+    std::vector<QRgb> reference(plane.size()), out(plane.size());
+    qint64 elapsed = tRender::best(repeats, [&]() {
+        tRender::perPixel(plane, pipe, nanColor, reference);
+    });
+    tRender::report("pipeline, per pixel", elapsed, size, 0);
+
+    tRender::PP::CachedPipeline<true> cached;
+    cached.cache(pipe, 1000, clipMin, clipMax);
+    elapsed = tRender::best(repeats, [&]() {
+        tRender::perPixel(plane, cached, nanColor, out);
+    });
+    tRender::report("cached 1000, interpolated, per pixel", elapsed, size, tRender::mismatches(reference, out));
+
+    tRender::PP::LutPipeline lut;
+    elapsed = tRender::best(1, [&]() {
+        lut.cache(pipe, tRender::PP::LutPipeline::DefaultSize, clipMin, clipMax, nanColor);
+    });
+    qCritical() << "sampling" << tRender::PP::LutPipeline::DefaultSize << "entries:" << elapsed / 1e6 << "ms";
+
+    elapsed = tRender::best(repeats, [&]() {
+        lut.convert(plane.data(), plane.size(), out.data());
+    });
+    tRender::report("table, batch, 1 thread", elapsed, size, tRender::mismatches(reference, out));
+
+    int threads = QThread::idealThreadCount();
+    elapsed = tRender::best(repeats, [&]() {
+        Carta::Core::Algorithms::parallelFor(size, [&](int row, int) {
+            lut.convert(plane.data() + int64_t(row) * size, size, out.data() + int64_t(row) * size);
+        }, threads);
+    });
+    QString name = QString("table, batch, %1 threads").arg(threads);
+    tRender::report(name.toLatin1().constData(), elapsed, size, tRender::mismatches(reference, out));
+    return 0;
+}
@@ -0,0 +1,221 @@
+/**
+ * Throughput of the outgoing messages of many sessions through the one dispatcher thread.
+ *
+ * Every session produces raster messages on its own thread, the dispatcher thread hands
+ * them to the sockets. We compare serializing on the dispatcher thread (the way it used to
+ * be done) with serializing on the session threads into pooled buffers, where the dispatcher
+ * only copies the finished frame into the socket buffer.
+ *
+ * usage: testSession [sessions] [messages per session] [kilobytes per message]
+ **/
+
+#include "core/SendBufferPool.h"
+#include "CartaLib/Proto/raster_image.pb.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QtConcurrent>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace tSession
+{
+typedef std::shared_ptr < google::protobuf::MessageLite > PBMSharedPtr;
+
+int nSessions = 8;
+int nMessages = 200;
+int messageKB = 1024;
+
+/// what travels from a session to the dispatcher: a message to serialize or a finished frame
+struct Item {
+    PBMSharedPtr msg;
+    Carta::Core::SendBufferPool::FramePtr frame;
+};
+
+/// the queue of the dispatcher thread, like the event queue of the main thread
+class Queue
+{
+public:
+    void
+    push( Item item )
+    {
+        QMutexLocker locker( & m_mutex );
+        m_items.push_back( std::move( item ) );
+        m_cond.wakeOne();
+    }
+
+    bool
+    pop( Item & item )
+    {
+        QMutexLocker locker( & m_mutex );
+        while ( m_items.empty() && m_producers > 0 ) {
+            m_cond.wait( & m_mutex );
+        }
+        if ( m_items.empty() ) {
+            return false;
+        }
+        item = std::move( m_items.front() );
+        m_items.pop_front();
+        return true;
+    }
+
+    void
+    setProducers( int producers )
+    {
+        QMutexLocker locker( & m_mutex );
+        m_producers = producers;
+    }
+
+    void
+    producerDone()
+    {
+        QMutexLocker locker( & m_mutex );
+        m_producers--;
+        m_cond.wakeAll();
+    }
+
+private:
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    std::deque < Item > m_items;
+    int m_producers = 0;
+};
+
+static PBMSharedPtr
+makeRaster( int session, int index )
+{
+    std::shared_ptr < CARTA::RasterImageData > raster( new CARTA::RasterImageData() );
+    raster-> set_file_id( session );
+    raster-> set_channel( index );
+    raster-> set_stokes( 0 );
+    raster-> set_mip( 1 );
+    raster-> set_compression_type( CARTA::CompressionType::NONE );
+    std::vector < float > data( messageKB * 1024 / sizeof( float ), float ( index ) );
+    raster-> add_image_data( data.data(), data.size() * sizeof( float ) );
+    return raster;
+}
+
+/// the way SessionDispatcher used to serialize: a new vector for every message
+static std::vector < char >
+serializeToArray( const QString & respName, uint32_t eventId, PBMSharedPtr msg )
+{
+    const size_t headerSize = Carta::Core::SendBufferPool::EVENT_NAME_LENGTH +
+                              Carta::Core::SendBufferPool::EVENT_ID_LENGTH;
+    size_t messageLength = msg-> ByteSize();
+    std::vector < char > result( headerSize + messageLength );
+    QByteArray name = respName.toLatin1();
+    memcpy( result.data(), name.constData(), name.size() );
+    memcpy( result.data() + Carta::Core::SendBufferPool::EVENT_NAME_LENGTH, & eventId, sizeof( eventId ) );
+    msg-> SerializeToArray( result.data() + headerSize, messageLength );
+    return result;
+}
+
+/// runs the sessions and the dispatcher, returns the wall time and the time the dispatcher
+/// was busy
+static void
+runSessions( bool serializeInSession, qint64 & wallMs, qint64 & dispatcherMs )
+{
+    Queue queue;
+    queue.setProducers( nSessions );
+    QThreadPool pool;
+    pool.setMaxThreadCount( nSessions );
+
+    QElapsedTimer wall;
+    wall.start();
+    std::vector < QFuture < void > > sessions;
+    for ( int s = 0 ; s < nSessions ; s++ ) {
+        sessions.push_back( QtConcurrent::run( & pool, [&queue, s, serializeInSession] () {
+                                                   for ( int i = 0 ; i < nMessages ; i++ ) {
+                                                       Item item;
+                                                       item.msg = makeRaster( s, i );
+                                                       if ( serializeInSession ) {
+                                                           item.frame = Carta::Core::SendBufferPool::instance().serialize(
+                                                               "RASTER_IMAGE_DATA", i, item.msg );
+                                                           item.msg.reset();
+                                                       }
+                                                       queue.push( std::move( item ) );
+                                                   }
+                                                   queue.producerDone();
+                                               } ) );
+    }
+
+    // the dispatcher: the socket copies every frame into its write buffer
+    QByteArray socketBuffer;
+    qint64 busyNs = 0;
+    QElapsedTimer busy;
+    Item item;
+    while ( queue.pop( item ) ) {
+        busy.start();
+        if ( item.frame ) {
+            QByteArray bytes = item.frame-> bytes();
+            socketBuffer.resize( bytes.size() );
+            memcpy( socketBuffer.data(), bytes.constData(), bytes.size() );
+        }
+        else {
+            std::vector < char > message = serializeToArray( "RASTER_IMAGE_DATA", 0, item.msg );
+            QByteArray bytes = QByteArray::fromRawData( message.data(), message.size() );
+            socketBuffer.resize( bytes.size() );
+            memcpy( socketBuffer.data(), bytes.constData(), bytes.size() );
+        }
+        item = Item();
+        busyNs += busy.nsecsElapsed();
+    }
+    for ( auto & session : sessions ) {
+        session.waitForFinished();
+    }
+    wallMs = wall.elapsed();
+    dispatcherMs = busyNs / 1000000;
+} // runSessions
+
+static void
+report( const char * what, qint64 wallMs, qint64 dispatcherMs )
+{
+    double megabytes = double ( nSessions ) * nMessages * messageKB / 1024;
+    double seconds = std::max < qint64 > ( wallMs, 1 ) / 1000.0;
+    qDebug() << "  " << what << ":" << megabytes / seconds << "MB/s," << nSessions * nMessages / seconds
+             << "messages/s, dispatcher busy" << dispatcherMs << "of" << wallMs << "ms";
+}
+
+static void
+benchmarkSessions()
+{
+    qDebug() << "Benchmark:" << nSessions << "sessions," << nMessages << "messages of" << messageKB << "kB each";
+    qint64 wallMs = 0, dispatcherMs = 0;
+
+    runSessions( false, wallMs, dispatcherMs );
+    report( "serialized by the dispatcher", wallMs, dispatcherMs );
+
+    runSessions( true, wallMs, dispatcherMs );
+    report( "serialized by the sessions", wallMs, dispatcherMs );
+
+    Carta::Core::SendBufferPool & pool = Carta::Core::SendBufferPool::instance();
+    qDebug() << "   send buffers allocated:" << pool.getAllocationCount() << ", reused:" << pool.getReuseCount()
+             << ", pooled:" << pool.getPooledBytes() << "bytes";
+} // benchmarkSessions
+}
+
+int
+main( int argc, char * * argv )
+{
+    QCoreApplication qapp( argc, argv );
+    QStringList args = QCoreApplication::arguments();
+    if ( args.size() > 1 ) {
+        tSession::nSessions = std::max( 1, args[1].toInt() );
+    }
+    if ( args.size() > 2 ) {
+        tSession::nMessages = std::max( 1, args[2].toInt() );
+    }
+    if ( args.size() > 3 ) {
+        tSession::messageKB = std::max( 1, args[3].toInt() );
+    }
+    tSession::benchmarkSessions();
+    return 0;
+} // main
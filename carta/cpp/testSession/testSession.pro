@@ -0,0 +1,29 @@
+! include(../common.pri) {
+  error( "Could not find the common.pri file!" )
+}
+
+QT      +=  network xml concurrent
+
+HEADERS +=
+
+SOURCES += \
+    main.cpp
+
+RESOURCES =
+
+INCLUDEPATH += ../../../ThirdParty/protobuf/include
+LIBS += -L../../../ThirdParty/protobuf/lib -lprotobuf
+
+unix: LIBS += -L$$OUT_PWD/../core/ -lcore
+unix: LIBS += -L$$OUT_PWD/../CartaLib/ -lCartaLib
+DEPENDPATH += $$PROJECT_ROOT/core
+DEPENDPATH += $$PROJECT_ROOT/CartaLib
+
+QMAKE_LFLAGS += '-Wl,-rpath,\'\$$ORIGIN/../CartaLib:\$$ORIGIN/../core\''
+
+unix:macx {
+    PRE_TARGETDEPS += $$OUT_PWD/../core/libcore.dylib
+}
+else{
+    PRE_TARGETDEPS += $$OUT_PWD/../core/libcore.so
+}